@@ -0,0 +1,477 @@
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include "file_manager.hpp"
+
+// Allocations of everything measured, through the replaced operator new
+static atomic<size_t> allocations{0};
+static atomic<size_t> allocated_bytes{0};
+
+static void *count_allocation(size_t size)
+{
+    allocations.fetch_add(1, memory_order_relaxed);
+    allocated_bytes.fetch_add(size, memory_order_relaxed);
+    return malloc(size == 0 ? 1 : size);
+}
+
+void *operator new(size_t size)
+{
+    if (void *memory = count_allocation(size)) {
+        return memory;
+    }
+    throw bad_alloc();
+}
+
+void *operator new[](size_t size) { return operator new(size); }
+
+void *operator new(size_t size, const nothrow_t &) noexcept
+{
+    return count_allocation(size);
+}
+
+void *operator new[](size_t size, const nothrow_t &) noexcept
+{
+    return count_allocation(size);
+}
+
+void operator delete(void *memory) noexcept { free(memory); }
+void operator delete[](void *memory) noexcept { free(memory); }
+void operator delete(void *memory, size_t) noexcept { free(memory); }
+void operator delete[](void *memory, size_t) noexcept { free(memory); }
+void operator delete(void *memory, const nothrow_t &) noexcept
+{
+    free(memory);
+}
+void operator delete[](void *memory, const nothrow_t &) noexcept
+{
+    free(memory);
+}
+
+class BenchOptions {
+  public:
+    string root;            // where the trees' folder is made
+    size_t iterations = 20;
+    bool large = false;     // adds the 1M entries folder
+    bool keep = false;      // leaves the trees behind
+    string filter;          // only the operations with this in their name
+};
+
+class BenchResult {
+  public:
+    string name;
+    vector<double> micros;
+    size_t allocations = 0;
+    size_t allocated_bytes = 0;
+};
+
+static vector<BenchResult> results;
+
+// Runs operation iterations times (once more unmeasured to warm up), prepare
+// runs before each sample and isn't counted
+static void measure(const BenchOptions &options, const string &name,
+                    size_t iterations, const function<void()> &operation,
+                    const function<void()> &prepare = nullptr)
+{
+    if (!options.filter.empty() && name.find(options.filter) == string::npos) {
+        return;
+    }
+
+    BenchResult result;
+    result.name = name;
+
+    for (size_t i = 0; i <= iterations; i++) {
+        if (prepare) {
+            prepare();
+        }
+        size_t allocations_before = allocations;
+        size_t bytes_before = allocated_bytes;
+        auto start = chrono::steady_clock::now();
+        operation();
+        auto end = chrono::steady_clock::now();
+        if (i == 0) {
+            continue;
+        }
+        result.micros.push_back(
+            chrono::duration<double, micro>(end - start).count());
+        result.allocations += allocations - allocations_before;
+        result.allocated_bytes += allocated_bytes - bytes_before;
+    }
+    results.push_back(move(result));
+    fprintf(stderr, ".");
+}
+
+static double percentile(vector<double> sorted, double fraction)
+{
+    sort(sorted.begin(), sorted.end());
+    size_t index = min(sorted.size() - 1,
+                       static_cast<size_t>(fraction * sorted.size()));
+    return sorted[index];
+}
+
+static void print_results()
+{
+    fprintf(stderr, "\n");
+    printf("%-40s %7s %11s %11s %11s %11s %10s %10s\n", "operation", "runs",
+           "p50 us", "p90 us", "p99 us", "max us", "allocs", "alloc KB");
+    for (const BenchResult &result : results) {
+        size_t runs = result.micros.size();
+        printf("%-40s %7zu %11.1f %11.1f %11.1f %11.1f %10zu %10.1f\n",
+               result.name.c_str(), runs, percentile(result.micros, 0.5),
+               percentile(result.micros, 0.9), percentile(result.micros, 0.99),
+               percentile(result.micros, 1), result.allocations / runs,
+               result.allocated_bytes / runs / 1024.0);
+    }
+}
+
+static void create_file(const string &path, off_t size, mode_t mode = 0644)
+{
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, mode);
+
+    if (fd == -1) {
+        perror(path.c_str());
+        exit(1);
+    }
+    if (size != 0 && ftruncate(fd, size) != 0) {
+        perror(path.c_str());
+    }
+    close(fd);
+}
+
+// One folder holding entries of every kind: files of all sizes (sparse),
+// folders, dotfiles, links, dangling links and files nobody can read
+static void make_wide_tree(const string &folder, size_t entries)
+{
+    mt19937_64 random(entries);
+
+    fs::create_directories(folder);
+    for (size_t i = 0; i < entries; i++) {
+        char name[64];
+        const char *prefixes[] = {"file", "Report", "data_", "IMG", "log"};
+        snprintf(name, sizeof(name), "%s%s%zu%s", i % 30 == 0 ? "." : "",
+                 prefixes[i % 5], random() % (entries * 10),
+                 i % 3 == 0 ? ".txt" : "");
+        string path = folder + '/' + name + '_' + to_string(i);
+
+        if (i % 10 == 0) {
+            mkdir(path.c_str(), 0755);
+            for (int child = 0; child < 3; child++) {
+                create_file(path + "/child" + to_string(child), 0);
+            }
+        } else if (i % 200 == 1) {
+            symlink("missing_target", path.c_str());
+        } else if (i % 50 == 2) {
+            symlink(folder.c_str(), path.c_str());
+        } else if (i % 100 == 3) {
+            create_file(path, 4096, 0);
+        } else {
+            create_file(path, random() % (1ULL << (random() % 40)));
+        }
+    }
+}
+
+// depth levels of fanout folders, a few files in each
+static void make_deep_tree(const string &folder, size_t depth, size_t fanout)
+{
+    fs::create_directories(folder);
+    for (int i = 0; i < 4; i++) {
+        create_file(folder + "/file" + to_string(i) + ".c", 1000 * i);
+    }
+    if (depth == 0) {
+        return;
+    }
+    for (size_t i = 0; i < fanout; i++) {
+        make_deep_tree(folder + "/dir" + to_string(i), depth - 1, fanout);
+    }
+}
+
+static void make_preview_files(const string &folder)
+{
+    fs::create_directories(folder);
+
+    string text;
+    for (int line = 0; line < 200000; line++) {
+        text += "2024-01-01 12:00:00 INFO request " + to_string(line) +
+                " served in " + to_string(line % 97) + " ms\n";
+    }
+    ofstream(folder + "/big.log") << text;
+    ofstream(folder + "/small.txt") << text.substr(0, 2000);
+
+    string binary(1 << 20, '\0');
+    mt19937 random(1);
+    for (char &byte : binary) {
+        byte = random();
+    }
+    memcpy(binary.data(), "\x7F" "ELF", 4);
+    ofstream(folder + "/program.bin") << binary;
+}
+
+// Entries nobody can read have to be made writable again to be removed
+static void remove_tree(const string &root)
+{
+    error_code error;
+
+    for (auto entry = fs::recursive_directory_iterator(
+             root, fs::directory_options::skip_permission_denied, error);
+         entry != fs::recursive_directory_iterator(); entry.increment(error)) {
+        if (!entry->is_symlink()) {
+            chmod(entry->path().c_str(), entry->is_directory() ? 0755 : 0644);
+        }
+    }
+    fs::remove_all(root, error);
+}
+
+static void setup_file_manager(FileManager *file_manager, const string &cwd)
+{
+    file_manager->cwd = cwd;
+    file_manager->file_position = 0;
+    file_manager->directory_change = false;
+    file_manager->sort_type = ALPHABETICAL_INCREASING;
+    file_manager->hidden_files = false;
+    file_manager->preview = true;
+    file_manager->in_shell = false;
+    file_manager->in_search = false;
+    file_manager->recursive_search = false;
+    file_manager->search_contents = false;
+    file_manager->search_git_ignore = false;
+    file_manager->search_depth = 32;
+    file_manager->help_menu = false;
+    setup_folders_cache(file_manager);
+    setup_preview_cache(file_manager);
+    setup_sorting(file_manager);
+}
+
+static void bench_folder(const BenchOptions &options, const string &label,
+                         const string &folder, size_t iterations)
+{
+    FileManager file_manager;
+    setup_file_manager(&file_manager, folder);
+    // the size sort counts folders through it, like the file manager does
+    start_child_counts(&file_manager);
+
+    measure(options, label + " read folder", iterations,
+            [&] { get_files_in_folder(folder); });
+
+    shared_ptr<EntryTable> table = get_files_in_folder(folder);
+    cache_folder(&file_manager, folder, table);
+
+    measure(options, label + " load_folder (cached)", iterations, [&] {
+        file_manager.files = load_folder(&file_manager, folder, false, true);
+    });
+    file_manager.files = load_folder(&file_manager, folder, false, true);
+
+    const pair<int, const char *> sorts[] = {
+        {ALPHABETICAL_INCREASING, "name"},
+        {FILE_SIZE_DECREASING, "size"},
+        {LAST_MODIFIED, "mtime"},
+        {NATURAL_INCREASING, "natural"},
+        {LOCALE_INCREASING, "locale"},
+    };
+    FileList unsorted = file_manager.files;
+    FileList files;
+    for (auto [sort_type, sort_name] : sorts) {
+        file_manager.sort_type = sort_type;
+        measure(
+            options, label + " sort_files " + sort_name, iterations,
+            [&] { sort_files(&file_manager, &files); },
+            [&] { files = unsorted; });
+    }
+    file_manager.sort_type = ALPHABETICAL_INCREASING;
+
+    for (const char *needle : {"f", "rep12", "zzz"}) {
+        measure(
+            options, label + " search_files \"" + needle + '"', iterations,
+            [&] { search_files(&files, 0, needle); },
+            [&] { files = unsorted; });
+    }
+    stop_child_counts(&file_manager);
+}
+
+static void bench_deep_tree(const BenchOptions &options, const string &root)
+{
+    vector<string> folders;
+    for (const auto &entry : fs::recursive_directory_iterator(root)) {
+        if (entry.is_directory()) {
+            folders.push_back(entry.path().string());
+        }
+    }
+
+    measure(options, "deep read all " + to_string(folders.size()) +
+                         " folders",
+            max<size_t>(options.iterations / 4, 3), [&] {
+                for (const string &folder : folders) {
+                    get_files_in_folder(folder);
+                }
+            });
+}
+
+static void bench_format_bytes(const BenchOptions &options)
+{
+    vector<uint64_t> sizes(1000);
+    mt19937_64 random(1);
+    for (uint64_t &size : sizes) {
+        size = random() >> (random() % 64);
+    }
+
+    measure(options, "format_bytes x1000", options.iterations * 10, [&] {
+        for (uint64_t size : sizes) {
+            format_bytes(size);
+        }
+    });
+}
+
+// Draws into a curses screen writing to /dev/null, the whole frame or one
+// cursor move at a time
+static void bench_display(const BenchOptions &options, const string &folder,
+                          const string &previews_folder)
+{
+    FILE *output = fopen("/dev/null", "w");
+    FILE *input = fopen("/dev/null", "r");
+    setenv("LINES", "50", 1);
+    setenv("COLUMNS", "160", 1);
+    SCREEN *screen = newterm("xterm-256color", output, input);
+    if (screen == nullptr) {
+        screen = newterm("xterm", output, input);
+    }
+    if (screen == nullptr) {
+        fprintf(stderr, "no terminfo for xterm, skipping the display\n");
+        return;
+    }
+    set_term(screen);
+    start_color();
+    setup_colors();
+
+    WINDOW *list = newwin(LINES - 3, COLS / 2, 0, 0);
+    WINDOW *preview = newwin(LINES, COLS / 2, 0, COLS / 2);
+
+    FileManager file_manager;
+    setup_file_manager(&file_manager, folder);
+    start_child_counts(&file_manager);
+    file_manager.files = load_folder(&file_manager, folder, false, true);
+
+    // folder counts come from a worker, let it count the first screen
+    display_files(list, &file_manager);
+    for (int i = 0; i < 500 && !poll_child_counts(file_manager.child_counts
+                                                      .get());
+         i++) {
+        this_thread::sleep_for(chrono::milliseconds(2));
+    }
+
+    measure(
+        options, "display_files full frame", options.iterations * 5,
+        [&] {
+            display_files(list, &file_manager);
+            doupdate();
+        },
+        [&] {
+            invalidate_screen(&file_manager);
+            clearok(curscr, TRUE);
+        });
+
+    measure(options, "display_files cursor move", options.iterations * 5,
+            [&] {
+                file_manager.file_position =
+                    (file_manager.file_position + 1) %
+                    file_manager.files.size();
+                display_files(list, &file_manager);
+                doupdate();
+            });
+
+    FileManager preview_manager;
+    setup_file_manager(&preview_manager, previews_folder);
+    preview_manager.files =
+        load_folder(&preview_manager, previews_folder, false, true);
+    for (size_t i = 0; i < preview_manager.files.size(); i++) {
+        FileEntry file = preview_manager.files[i];
+        measure(
+            options, "preview_file " + string(file.name()), options.iterations,
+            [&] {
+                preview_file(file, preview, &preview_manager);
+                doupdate();
+            },
+            [&] {
+                preview_manager.previews_cache.clear();
+                invalidate_screen(&preview_manager);
+            });
+    }
+
+    stop_child_counts(&file_manager);
+    delwin(list);
+    delwin(preview);
+    endwin();
+    delscreen(screen);
+    fclose(output);
+    fclose(input);
+}
+
+static void usage()
+{
+    printf("usage: bench [--large] [--iterations N] [--dir PATH] [--keep] "
+           "[--filter TEXT]\n"
+           "  --large       also bench a folder of 1M entries\n"
+           "  --iterations  samples per operation (default 20)\n"
+           "  --dir         where the trees' folder is made (default $TMPDIR)\n"
+           "  --keep        leave the trees behind\n"
+           "  --filter      only the operations with TEXT in their name\n");
+}
+
+int main(int argc, char **argv)
+{
+    BenchOptions options;
+
+    for (int i = 1; i < argc; i++) {
+        string argument = argv[i];
+        if (argument == "--large") {
+            options.large = true;
+        } else if (argument == "--keep") {
+            options.keep = true;
+        } else if (argument == "--iterations" && i + 1 < argc) {
+            options.iterations = max(1, atoi(argv[++i]));
+        } else if (argument == "--dir" && i + 1 < argc) {
+            options.root = argv[++i];
+        } else if (argument == "--filter" && i + 1 < argc) {
+            options.filter = argv[++i];
+        } else {
+            usage();
+            return argument == "--help" ? 0 : 1;
+        }
+    }
+
+    // always a folder of its own, it's removed with everything in it
+    if (options.root.empty()) {
+        const char *temp = getenv("TMPDIR");
+        options.root = temp != nullptr ? temp : "/tmp";
+    }
+    string pattern = options.root + "/file_manager_bench.XXXXXX";
+    if (mkdtemp(pattern.data()) == nullptr) {
+        perror(options.root.c_str());
+        return 1;
+    }
+    string root = fs::absolute(pattern).string();
+
+    fprintf(stderr, "making trees in %s\n", root.c_str());
+    make_wide_tree(root + "/wide_10k", 10000);
+    make_deep_tree(root + "/deep", 6, 4);
+    make_preview_files(root + "/previews");
+    if (options.large) {
+        make_wide_tree(root + "/wide_1m", 1000000);
+    }
+
+    bench_folder(options, "10k", root + "/wide_10k", options.iterations);
+    if (options.large) {
+        bench_folder(options, "1M", root + "/wide_1m",
+                     max<size_t>(options.iterations / 10, 3));
+    }
+    bench_deep_tree(options, root + "/deep");
+    bench_format_bytes(options);
+    bench_display(options, root + "/wide_10k", root + "/previews");
+
+    print_results();
+
+    if (!options.keep) {
+        remove_tree(root);
+    }
+    return 0;
+}
@@ -3,21 +3,36 @@
 
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <cctype>
+#include <chrono>
 #include <cmath>
+#include <condition_variable>
 #include <csignal>
 #include <cstdio>
+#include <deque>
 #include <filesystem>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <list>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <set>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 using namespace std;
 
 namespace fs = filesystem;
 
+#include <dirent.h>
 #include <ncurses.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #ifndef CTRL  // ncurses specific macro
 #define CTRL(c) ((c) & 037)
@@ -26,12 +41,6 @@ namespace fs = filesystem;
 #define ERROR_ATTRON(wd) (wattron(wd, A_UNDERLINE | COLOR_PAIR(1)))
 #define ERROR_ATTROFF(wd) (wattroff(wd, A_UNDERLINE | COLOR_PAIR(1)))
 
-#define FILE_PATH(file) (file).path().string()
-// #define FILE_PATH(file) (file).path().filename().string()
-#define FILE_NAME(file) (file).path().filename().string()
-
-const array<unsigned char, 16> ELF_MAGIC_NUMBER = {0x7F, 'E', 'L', 'F', 0};
-
 using sort_types_t = enum sort_types_e {
     ALPHABETICAL_INCREASING,
     ALPHABETICAL_DECREASING,
@@ -41,9 +50,16 @@ using sort_types_t = enum sort_types_e {
     FILE_SIZE_DECREASING,
     LAST_MODIFIED,
     FIRST_MODIFIED,
+    NATURAL_INCREASING,  // "file2" before "file10"
+    NATURAL_DECREASING,
+    LOCALE_INCREASING,  // LC_COLLATE order
+    LOCALE_DECREASING,
+    TREE_SIZE_INCREASING,  // disk usage of folders, files and folders mixed
+    TREE_SIZE_DECREASING,
 };
 
 using file_color_t = enum file_color_e {
+    RED = 1,  // files that can't be read
     WHITE = 2,
     CYAN = 20,
     GREEN,
@@ -51,59 +67,1122 @@ using file_color_t = enum file_color_e {
     MAGENTA
 };
 
+using entry_type_t = enum entry_type_e : uint8_t {
+    ENTRY_UNKNOWN,  // dangling symlinks or entries that couldn't be stat'ed
+    ENTRY_REGULAR,
+    ENTRY_DIRECTORY,
+    ENTRY_CHARACTER,
+    ENTRY_BLOCK,
+    ENTRY_FIFO,
+    ENTRY_SOCKET,
+};
+
+using entry_flag_t = enum entry_flag_e : uint8_t {
+    ENTRY_SYMLINK = 1 << 0,
+    ENTRY_READABLE = 1 << 1,  // open(O_RDONLY) would succeed, checked at load
+};
+
+// Listing of a folder stored as a structure of arrays, one row per entry.
+// Symlinks are resolved (type, mode, size and mtime are the target's) and
+// flagged with ENTRY_SYMLINK. Names are packed in a single arena.
+class EntryTable {
+  public:
+    string folder;
+    vector<uint8_t> types;
+    vector<uint8_t> flags;
+    vector<mode_t> modes;
+    vector<uint64_t> sizes;
+    vector<uint64_t> allocated;  // bytes on disk (st_blocks)
+    vector<int64_t> mtimes;  // nanoseconds
+    vector<ino_t> inodes;
+    vector<uint32_t> name_offsets;
+    vector<uint16_t> name_sizes;
+    string names;
+    size_t garbage_bytes = 0;  // names of removed rows still in the arena
+    uint64_t version = 0;      // bumped on every change to the rows
+    // bumped when rows move, appending keeps the names of existing rows put
+    uint64_t names_version = 0;
+    // the folder itself when it was read, a saved listing is only used
+    // while these still match. folder_mtime is 0 once the rows were patched.
+    int64_t folder_mtime = 0;
+    ino_t folder_inode = 0;
+    bool persisted = false;  // from the disk cache, not read again yet
+    bool unwatched = false;  // lost its watch, changes since may be missed
+
+    size_t size() const { return types.size(); }
+    string_view name(uint32_t row) const
+    {
+        return string_view(names.data() + name_offsets[row], name_sizes[row]);
+    }
+    string path(uint32_t row) const;
+    void add_entry(string_view name, const struct stat &file_stat,
+                   uint8_t type, uint8_t entry_flags);
+    void set_entry(uint32_t row, const struct stat &file_stat, uint8_t type,
+                   uint8_t entry_flags);
+    void remove_row(uint32_t row);
+    void append(const EntryTable &other);
+    size_t memory_usage() const;
+};
+
+// Lightweight handle to a row of an EntryTable
+class FileEntry {
+  public:
+    const EntryTable *table;
+    uint32_t row;
+
+    string_view name() const { return table->name(row); }
+    string path() const { return table->path(row); }
+    uint8_t type() const { return table->types[row]; }
+    bool is_directory() const { return type() == ENTRY_DIRECTORY; }
+    bool is_regular_file() const { return type() == ENTRY_REGULAR; }
+    bool is_character_file() const { return type() == ENTRY_CHARACTER; }
+    bool is_fifo() const { return type() == ENTRY_FIFO; }
+    bool is_other() const { return type() > ENTRY_DIRECTORY; }
+    bool is_symlink() const { return table->flags[row] & ENTRY_SYMLINK; }
+    bool is_readable() const { return table->flags[row] & ENTRY_READABLE; }
+    uint64_t file_size() const { return table->sizes[row]; }
+    uint64_t allocated_size() const { return table->allocated[row]; }
+    int64_t last_write_time() const { return table->mtimes[row]; }
+};
+
+// Filtered and sorted view over an EntryTable, rows index into the table
+class FileList {
+  public:
+    shared_ptr<EntryTable> table;
+    vector<uint32_t> rows;
+
+    size_t size() const { return rows.size(); }
+    bool empty() const { return rows.empty(); }
+    void clear()
+    {
+        rows.clear();
+        table.reset();
+    }
+    FileEntry operator[](size_t i) const { return {table.get(), rows[i]}; }
+};
+
+// Rows of the list matching needle, in list order
+class SearchStep {
+  public:
+    string needle;
+    vector<uint32_t> rows;
+};
+
+// Results of the search being typed. Each step narrows the one before, so a
+// new character only looks at the rows that still matched and backspace goes
+// back to a step already computed. Rebuilt when the list it was made from
+// changes.
+class SearchState {
+  public:
+    shared_ptr<EntryTable> table;
+    uint64_t table_version = 0;
+    int sort_type = -1;
+    bool hidden_files = false;
+    vector<SearchStep> steps;  // steps[0] is the list without the search
+};
+
+// State shared between the main loop and a background folder reader, the
+// worker only ever touches it through the atomics and chunk_lock
+class FolderLoad {
+  public:
+    string folder;
+    atomic<bool> cancelled{false};
+    atomic<bool> finished{false};
+    atomic<size_t> loaded{0};
+    mutex chunk_lock;
+    EntryTable chunk;
+    int64_t folder_mtime = 0;  // set before finished
+    ino_t folder_inode = 0;
+    // main thread only, keeps the old list on screen until the first chunk
+    bool replace_files = false;
+    // the list on screen came from the disk cache, it's swapped for the
+    // new read once that's done
+    bool revalidate = false;
+};
+
+// Least recently used cache bounded by the total size of its values instead
+// of their number. Lookups and evictions are O(1), pinned keys are skipped
+// by the eviction and so is the most recent insertion.
+template <typename Key, typename Value>
+class LruCache {
+  public:
+    class Item {
+      public:
+        Key key;
+        Value value;
+        size_t size;
+    };
+
+    size_t budget = 0;
+    size_t used = 0;
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t evictions = 0;
+    function<size_t(const Value &)> measure;
+    function<bool(const Key &)> pinned;
+    function<void(const Key &)> on_evict;
+    list<Item> items;  // most recently used first
+    unordered_map<Key, typename list<Item>::iterator> index;
+
+    size_t size() const { return items.size(); }
+    bool contains(const Key &key) const { return index.count(key) != 0; }
+
+    // Counts as a hit or a miss and marks the item as most recently used
+    Value *find(const Key &key)
+    {
+        auto item = index.find(key);
+        if (item == index.end()) {
+            misses++;
+            return nullptr;
+        }
+        hits++;
+        items.splice(items.begin(), items, item->second);
+        return &item->second->value;
+    }
+
+    // Lookup that doesn't touch the order or the counters
+    Value *peek(const Key &key)
+    {
+        auto item = index.find(key);
+        return item == index.end() ? nullptr : &item->second->value;
+    }
+
+    void insert(const Key &key, Value value)
+    {
+        erase(key);
+        size_t value_size = measure ? measure(value) : 1;
+        items.push_front({key, move(value), value_size});
+        index[key] = items.begin();
+        used += value_size;
+        evict();
+    }
+
+    void erase(const Key &key)
+    {
+        auto item = index.find(key);
+        if (item == index.end()) {
+            return;
+        }
+        used -= item->second->size;
+        items.erase(item->second);
+        index.erase(item);
+    }
+
+    // To be called after a cached value was modified in place
+    void update_size(const Key &key)
+    {
+        auto item = index.find(key);
+        if (item == index.end() || !measure) {
+            return;
+        }
+        used -= item->second->size;
+        item->second->size = measure(item->second->value);
+        used += item->second->size;
+        evict();
+    }
+
+    void evict()
+    {
+        auto item = items.end();
+        while (used > budget && item != items.begin() &&
+               prev(item) != items.begin()) {
+            --item;
+            if (pinned && pinned(item->key)) {
+                continue;
+            }
+            Key key = item->key;
+            used -= item->size;
+            index.erase(key);
+            item = items.erase(item);
+            evictions++;
+            if (on_evict) {
+                on_evict(key);
+            }
+        }
+    }
+
+    void clear()
+    {
+        items.clear();
+        index.clear();
+        used = 0;
+    }
+};
+
+class GitIgnoreRule {
+  public:
+    string pattern;
+    string base;  // folder of the .gitignore relative to the repository root
+    bool negated = false;
+    bool folder_only = false;
+    bool anchored = false;
+};
+
+// Rules of .gitignore and .git/info/exclude files
+class GitIgnore {
+  public:
+    vector<GitIgnoreRule> rules;
+
+    void load(const string &file_path, const string &base);
+    void load_for_folder(const string &root, const string &git_dir,
+                         const string &prefix);
+    bool matches(const string &path, bool is_folder) const;
+    bool is_ignored(const string &path, bool is_folder) const;
+};
+
+// A folder left to walk by a recursive search, relative to where the search
+// started ("" or "src/lib/")
+class SearchFolder {
+  public:
+    string folder;
+    int depth = 0;
+    shared_ptr<const GitIgnore> git_ignore;  // rules inside it, or null
+};
+
+class SearchQueue {
+  public:
+    mutex lock;
+    deque<SearchFolder> folders;
+};
+
+// Lines found by a content search, one per row of the results table (the
+// row names the file)
+class ContentMatches {
+  public:
+    vector<uint32_t> lines;    // 1 based
+    vector<uint16_t> columns;  // of the match in the snippet
+    vector<string> snippets;
+
+    void add_match(uint32_t line, uint16_t column, string snippet)
+    {
+        lines.push_back(line);
+        columns.push_back(column);
+        snippets.push_back(move(snippet));
+    }
+    void append(ContentMatches &other)
+    {
+        lines.insert(lines.end(), other.lines.begin(), other.lines.end());
+        columns.insert(columns.end(), other.columns.begin(),
+                       other.columns.end());
+        move(other.snippets.begin(), other.snippets.end(),
+             back_inserter(snippets));
+    }
+    void clear()
+    {
+        lines.clear();
+        columns.clear();
+        snippets.clear();
+    }
+};
+
+// State shared between the main loop and the walkers of a recursive search.
+// Each walker has its own queue of folders and steals from the others when
+// it runs out. Matches are named by their path relative to root.
+class RecursiveSearch {
+  public:
+    string root;
+    string needle;
+    string repo_prefix;  // root relative to the repository, for .gitignore
+    bool hidden_files = false;
+    bool contents = false;  // grep the files instead of matching names
+    int max_depth = 0;
+    atomic<bool> cancelled{false};
+    atomic<bool> finished{false};
+    atomic<size_t> pending_folders{0};  // queued or being walked
+    atomic<size_t> running_walkers{0};
+    atomic<size_t> walked_folders{0};
+    vector<unique_ptr<SearchQueue>> queues;
+    // walkers with nothing to take sleep on idle_wake until a folder is
+    // queued (queued is bumped) or the walk is over
+    mutex idle_lock;
+    condition_variable idle_wake;
+    uint64_t queued = 0;  // behind idle_lock
+    mutex chunk_lock;
+    EntryTable chunk;
+    ContentMatches content_chunk;
+};
+
+// Read only mapping of a whole file, unmapped when it goes out of scope. If
+// the file is truncated meanwhile, what's past its new end reads as zeros
+// instead of raising SIGBUS.
+class MappedFile {
+  public:
+    const unsigned char *data = nullptr;
+    size_t size = 0;
+    size_t guard = SIZE_MAX;  // its slot in the SIGBUS handler's list
+
+    MappedFile(int folder_fd, const char *name);
+    ~MappedFile();
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+};
+
+// Listings saved by the previous sessions (FILE_MANAGER_DISK_CACHE_MB),
+// mapped read only. Only the index is searched at startup, a folder's rows
+// are copied out the first time it's shown.
+class ListingStore {
+  public:
+    string path;
+    size_t budget = 0;  // 0 when the disk cache is off
+    unique_ptr<MappedFile> file;
+    uint32_t folder_count = 0;
+    size_t loaded = 0;  // folders shown from it this session
+};
+
+// Where the parts of a hex dump row go for a given width
+class HexLayout {
+  public:
+    size_t row_bytes = 16;
+    int offset_digits = 8;
+    size_t ascii_column = 0;
+};
+
+// Where the lines of a paged file start, filled by a background thread. Only
+// every LINE_INDEX_STEP-th line start is kept, the lines in between are found
+// again with memchr.
+class LineIndex {
+  public:
+    shared_ptr<MappedFile> file;
+    atomic<bool> cancelled{false};
+    atomic<bool> finished{false};
+    atomic<size_t> indexed{0};  // bytes scanned
+    atomic<size_t> lines{0};    // newlines in those bytes
+    mutex lock;
+    vector<size_t> checkpoints;  // start of line (i + 1) * LINE_INDEX_STEP + 1
+};
+
+// Full screen view of a file. Long lines are cut into rows of the window's
+// width, top is the offset of the first row shown.
+class FilePager {
+  public:
+    string path;
+    shared_ptr<MappedFile> file;
+    shared_ptr<LineIndex> index;
+    size_t top = 0;
+    size_t width = 0;  // of a row, in bytes
+    size_t rows = 0;
+    bool hex = false;  // binary files are shown as a hex dump
+    HexLayout hex_layout;
+    const char *file_type = nullptr;
+    size_t pending_line = 0;  // jump waiting for the index to get there
+    // in-file search, run a block at a time from the main loop
+    string needle;
+    bool search_forward = true;  // '/' or '?', n goes the same way
+    int search_direction = 0;    // 1 or -1 while a search runs
+    size_t search_position = 0;
+    size_t match_offset = string::npos;
+    // prompt being typed (':', '/' or '?'), or a message for the status line
+    char prompt = 0;
+    string input;
+    string message;
+};
+
+using git_mark_t = enum git_mark_e : uint8_t {
+    GIT_CLEAN,
+    GIT_MODIFIED,
+    GIT_UNTRACKED,
+    GIT_IGNORED,
+};
+
+using sha1_t = array<uint8_t, 20>;
+
+// Incremental SHA-1, what git names its objects with
+class Sha1 {
+  public:
+    array<uint32_t, 5> state = {0x67452301, 0xEFCDAB89, 0x98BADCFE,
+                                0x10325476, 0xC3D2E1F0};
+    array<uint8_t, 64> block = {};
+    size_t block_size = 0;
+    uint64_t total_size = 0;
+
+    void update(const uint8_t *data, size_t size);
+    sha1_t digest();
+
+  private:
+    void process_block();
+};
+
+// An entry of .git/index
+class GitIndexEntry {
+  public:
+    string path;
+    uint32_t mtime_seconds;
+    uint32_t mtime_nanoseconds;
+    uint32_t mode;
+    uint32_t size;
+    sha1_t hash;
+    bool skip_check;  // assume-unchanged or skip-worktree
+    bool changed;     // merge conflicts and intent-to-add entries
+};
+
+class GitRepo {
+  public:
+    string root;     // top of the worktree
+    string git_dir;  // usually root/.git
+    // config and info/ of a linked worktree, git_dir everywhere else
+    string common_dir;
+    string description;
+};
+
+// Shared with the git status worker, which turns one request at a time into
+// the markers of a folder's entries
+class GitStatusWork {
+  public:
+    mutex lock;
+    condition_variable wake;
+    bool stopped = false;
+    bool requested = false;
+    bool busy = false;
+    uint64_t request_id = 0;
+    shared_ptr<GitRepo> repo;
+    string folder;
+    uint64_t result_id = 0;
+    unordered_map<string, uint8_t> result;
+};
+
+// Main thread side of the git integration
+class GitState {
+  public:
+    unordered_map<string, shared_ptr<GitRepo>> repos;  // folder -> repo
+    unordered_set<string> git_dirs;  // watched .git folders
+    uint64_t generation = 0;  // bumped when anything under .git changes
+    shared_ptr<GitStatusWork> work;
+    uint64_t next_request_id = 0;
+    // what the markers were computed for, and what is being computed
+    tuple<const EntryTable *, uint64_t, uint64_t> marks_key;
+    tuple<const EntryTable *, uint64_t, uint64_t> requested_key;
+    uint64_t pending_request_id = 0;
+    vector<uint8_t> marks;  // indexed by table row
+};
+
+// Entry counts of folders, walked by a background worker and keyed by the
+// folder's mtime so a count is dropped as soon as the folder changes
+class ChildCounts {
+  public:
+    mutex lock;
+    condition_variable wake;
+    // mtime, count, the folders seen last only
+    LruCache<string, pair<int64_t, size_t>> counts;
+    deque<pair<string, int64_t>> queue;
+    unordered_set<string> queued;
+    bool stopped = false;
+    bool busy = false;
+    bool updated = false;
+};
+
+// A folder being measured by the disk usage workers. Its bytes grow as the
+// folders under it are read, the total is final once none of them is pending.
+class UsageNode {
+  public:
+    string path;
+    shared_ptr<UsageNode> parent;
+    dev_t device = 0;  // the walk stays on the filesystem it started on
+    int64_t mtime = 0;
+    uint64_t generation = 0;
+    uint64_t epoch = 0;  // of the usage when it was queued
+    uint64_t bytes = 0;  // allocated under it so far (st_blocks)
+    size_t pending = 1;  // itself and the subfolders not finished yet
+    // files with several links counted, shared by the nodes of one walk
+    shared_ptr<set<pair<dev_t, ino_t>>> linked;
+};
+
+class TreeSize {
+  public:
+    int64_t mtime;  // of the folder itself, a change in it drops the total
+    uint64_t bytes;
+    uint64_t epoch;  // of the walk that measured it
+};
+
+// Shared with the disk usage workers, all of it behind lock. The totals of
+// the folders measured are kept so going into one of them shows a size right
+// away, but a file deep below can grow without touching the folder's mtime:
+// a total from before the last directory change is only provisional until
+// it's walked again.
+class DiskUsage {
+  public:
+    mutex lock;
+    condition_variable wake;
+    vector<shared_ptr<UsageNode>> queue;
+    unordered_map<string, shared_ptr<UsageNode>> running;
+    LruCache<string, TreeSize> totals;
+    uint64_t generation = 0;  // bumped to drop the walks in progress
+    uint64_t epoch = 0;       // bumped on directory changes
+    size_t busy = 0;
+    size_t measured = 0;  // folders read since the workers were last idle
+    bool stopped = false;
+    bool updated = false;
+    chrono::steady_clock::time_point last_wake;
+};
+
+// inotify watches on the cwd and the most recently cached folders. Changed
+// names are gathered per folder and patched into the cached tables in
+// batches instead of re-reading the folders.
+class FolderWatcher {
+  public:
+    int inotify_fd = -1;
+    unordered_map<int, string> folders;  // watch descriptor -> folder
+    unordered_map<string, int> watches;
+    deque<string> watch_order;  // oldest first
+    unordered_map<string, unordered_set<string>> changes;
+    unordered_set<string> stale_folders;  // need a full re-read
+    chrono::steady_clock::time_point first_change;
+};
+
+// The last bytes a job wrote, older ones are written over
+class OutputRing {
+  public:
+    vector<char> buffer;
+    uint64_t written = 0;  // since the job started
+
+    void append(const char *data, size_t size);
+    string text() const;
+};
+
+// A shell command running in the background (posix_spawn), shared with the
+// thread that reads its output and waits for it
+class Job {
+  public:
+    int id = 0;
+    string command;
+    string folder;  // cwd when it was started
+    // what it names, resolved against folder. Their cached listings are
+    // dropped when it's done.
+    vector<string> paths;
+    pid_t pid = -1;
+    chrono::steady_clock::time_point started;
+    mutex lock;
+    OutputRing output;  // stdout and stderr, behind lock
+    // behind lock, its process group id may belong to others once it's set
+    bool reaped = false;
+    atomic<bool> finished{false};
+    int status = 0;  // from waitpid(), set before finished
+    chrono::steady_clock::duration elapsed{0};
+    // main thread only, the folders it touched were refreshed
+    bool collected = false;
+};
+
+class JobList {
+  public:
+    deque<shared_ptr<Job>> jobs;  // oldest first
+    int next_id = 1;
+    int shown = 0;         // id of the job in the preview pane
+    bool visible = false;  // j
+};
+
+// Entries picked with SPACE, one bit per row of the table they're in. They
+// stay marked while going to other folders, to be copied or moved there.
+class Marks {
+  public:
+    shared_ptr<EntryTable> table;
+    uint64_t names_version = 0;  // of table when the rows were marked
+    vector<uint64_t> bits;
+    size_t count = 0;
+
+    bool is_marked(const EntryTable *of, uint32_t row) const
+    {
+        return of == table.get() && row / 64 < bits.size() &&
+               (bits[row / 64] >> (row % 64) & 1) != 0;
+    }
+    bool operator==(const Marks &other) const
+    {
+        return table == other.table && names_version == other.names_version &&
+               bits == other.bits;
+    }
+    void toggle(const shared_ptr<EntryTable> &of, uint32_t row);
+    void clear();
+};
+
+using operation_type_t = enum operation_type_e {
+    OPERATION_COPY,
+    OPERATION_MOVE,
+    OPERATION_DELETE,
+    OPERATION_CHMOD,
+};
+
+// A folder being copied or deleted. It's finished (mode and times set on
+// the copy, or removed) once nothing under it is pending.
+class OperationFolder {
+  public:
+    string source;
+    string destination;
+    string name;  // in the folder above
+    struct stat source_stat;
+    shared_ptr<OperationFolder> parent;
+    // deletes go through fds so a folder swapped for a symlink midway isn't
+    // followed: fd is open until the folder is removed, parent_fd is the
+    // folder the top one is in
+    int fd = -1;
+    int parent_fd = -1;
+    size_t pending = 1;   // its own read, then one per entry queued
+    bool failed = false;  // the copy couldn't be made, what's there is kept
+
+    ~OperationFolder();
+};
+
+class OperationTask {
+  public:
+    int type;  // the operation's, or OPERATION_DELETE once a move copied
+    string source;
+    string destination;
+    bool is_folder = false;
+    // the folder the task reads for folders, the one the entry is in
+    // otherwise (null at the top)
+    shared_ptr<OperationFolder> folder;
+};
+
+// Copy, move, delete or chmod of the marked entries, shared with the
+// operation's workers. The queue and the errors are behind lock, the
+// counters are read by the interface while they run.
+class FileOperation {
+  public:
+    int type;
+    vector<string> sources;
+    string destination;  // folder copied or moved into
+    mode_t mode = 0;     // for chmod
+    mutex lock;
+    condition_variable wake;
+    vector<OperationTask> queue;  // a stack, walks go deep first
+    size_t busy = 0;
+    bool stopped = false;
+    // moved across filesystems, deleted once they're copied
+    vector<string> copied_sources;
+    vector<string> errors;  // the first few
+    size_t error_count = 0;
+    atomic<bool> cancelled{false};
+    atomic<bool> finished{false};
+    atomic<uint64_t> found_files{0};  // walked so far
+    atomic<uint64_t> found_bytes{0};
+    atomic<uint64_t> done_files{0};
+    atomic<uint64_t> done_bytes{0};
+    atomic<uint64_t> cloned_files{0};  // shared extents, nothing copied
+    chrono::steady_clock::time_point started;
+    chrono::steady_clock::duration elapsed{0};  // set before finished
+};
+
+// Main thread side of the operations. The last one done stays in the
+// status line until the next starts.
+class FileOperations {
+  public:
+    vector<shared_ptr<FileOperation>> running;
+    shared_ptr<FileOperation> last;
+    size_t threads = 4;  // per operation
+    int prompt = -1;     // OPERATION_DELETE or OPERATION_CHMOD being asked
+    string prompt_input;
+    // what the prompt asks about, taken when it opened. It gives up if the
+    // marks they came from change before the answer.
+    vector<string> prompt_sources;
+    Marks prompt_marks;
+};
+
+// A line of a preview as drawn in the pane
+class PreviewLine {
+  public:
+    string text;
+    attr_t attributes = A_NORMAL;
+    short color = 0;
+};
+
+// What the preview pane shows for a file at a given pane size, cached so
+// going back to a file draws it again without reading anything
+class PreviewFrame {
+  public:
+    string title;
+    vector<PreviewLine> lines;
+
+    size_t memory_usage() const;
+};
+
+// A preview to make off the main thread, with a copy of what it needs from
+// the entry since the table can change under it. Files get their frame
+// built, folders only get read (the main thread filters and sorts them).
+class PreviewJob {
+  public:
+    string key;
+    string path;
+    uint8_t type = ENTRY_REGULAR;
+    uint8_t flags = 0;
+    uint64_t size = 0;
+    size_t width = 0;
+    size_t height = 0;
+    size_t target_line = 0;
+    atomic<bool> cancelled{false};
+    shared_ptr<const PreviewFrame> frame;
+    shared_ptr<EntryTable> folder;
+};
+
+// Shared with the preview worker. The job of the selected entry goes first,
+// its neighbours are queued after it in case the cursor moves on to them.
+class PreviewWork {
+  public:
+    mutex lock;
+    condition_variable wake;
+    bool stopped = false;
+    deque<shared_ptr<PreviewJob>> queue;
+    shared_ptr<PreviewJob> running;
+    vector<shared_ptr<PreviewJob>> done;
+    // main thread only, the cursor has to rest on an entry for delay_ms
+    // before its preview is asked for
+    int delay_ms = 0;
+    string selected_key;
+    chrono::steady_clock::time_point selected_since;
+};
+
+// Columns of a list row that only change with the entry or the width
+class RowColumns {
+  public:
+    string name;            // name and link target, cut to the width
+    size_t name_width = 0;  // visible part of name, without the '+'
+    string size;            // "125 B" for files, empty otherwise
+};
+
+class ListColumns {
+  public:
+    const EntryTable *table = nullptr;
+    uint64_t version = 0;
+    size_t name_space = 0;
+    unordered_map<uint32_t, RowColumns> rows;  // table row -> columns
+};
+
+// What the last frames drew, so only what changed gets drawn again. The
+// bytes doupdate() writes to the terminal are counted from the main thread's
+// I/O stats.
+class ScreenState {
+  public:
+    size_t list_top = 0;        // entry on the first row of the list
+    vector<string> list_rows;   // what each row of the list shows
+    string preview_key;         // frame in the preview pane, empty if none
+    ListColumns columns;        // formatted rows of the list
+    int io_stats_fd = -1;
+    uint64_t tty_bytes = 0;
+    uint64_t frame_bytes = 0;  // written by the last doupdate()
+    uint64_t frames = 0;
+};
+
+class EventLoop {
+  public:
+    deque<int> keys;  // read from the terminal, not handled yet
+    chrono::milliseconds frame_interval{0};
+    chrono::steady_clock::time_point last_frame;
+};
+
+using perf_scope_t = enum perf_scope_e {
+    PERF_FRAME,  // display_panes
+    PERF_INPUT,  // the keys handled between two frames
+    PERF_READ_FOLDER,
+    PERF_LOAD_FOLDER,  // filters and sorts of a listing, cached or read
+    PERF_SORT_FILES,
+    PERF_COUNT_FILES,
+    PERF_DISK_USAGE,
+    PERF_GIT_REPO,
+    PERF_GIT_STATUS,
+    PERF_SEARCH,
+    PERF_DISPLAY_FILES,
+    PERF_PREVIEW_FILE,
+    PERF_BUILD_PREVIEW,  // preview worker
+    PERF_TERMINAL,       // doupdate()
+    PERF_SCOPES,
+};
+
+using perf_counter_t = enum perf_counter_e {
+    PERF_OPENS,  // open() and opendir()
+    PERF_STATS,  // stat() and friends
+    PERF_COUNTERS,
+};
+
+// What the timed scopes and counters added up to between two frames, on
+// every thread
+class PerfFrame {
+  public:
+    array<uint64_t, PERF_SCOPES> scope_ns{};
+    array<uint32_t, PERF_SCOPES> scope_calls{};
+    array<uint64_t, PERF_COUNTERS> counts{};
+    uint64_t frame_ns = 0;  // since the frame before
+    int64_t heap_bytes = 0;   // in use by malloc after the frame
+    int64_t heap_change = 0;
+    uint64_t folder_hits = 0;
+    uint64_t folder_misses = 0;
+    uint64_t preview_hits = 0;
+    uint64_t preview_misses = 0;
+};
+
+class PerfState {
+  public:
+    bool overlay = false;  // Ctrl-P
+    PerfFrame last;        // what the overlay shows
+    int64_t frame_start = 0;
+    // cache totals at the last frame
+    uint64_t folder_hits = 0;
+    uint64_t folder_misses = 0;
+    uint64_t preview_hits = 0;
+    uint64_t preview_misses = 0;
+};
+
 class FileManager {
   public:
     string cwd;
-    map<string, vector<fs::directory_entry>> folders_cache;
-    vector<fs::directory_entry> files;
+    LruCache<string, shared_ptr<EntryTable>> folders_cache;
+    LruCache<string, shared_ptr<const PreviewFrame>> previews_cache;
+    shared_ptr<PreviewWork> preview_work;
+    FileList files;
+    shared_ptr<FolderLoad> folder_load;
+    shared_ptr<EntryTable> loading_table;
+    shared_ptr<ChildCounts> child_counts;
+    shared_ptr<DiskUsage> disk_usage;
+    ListingStore listing_store;
+    FolderWatcher watcher;
+    GitState git;
+    SearchState search;
+    shared_ptr<RecursiveSearch> recursive_walk;
+    shared_ptr<FilePager> pager;
+    JobList jobs;
+    Marks marks;
+    FileOperations operations;
+    ScreenState screen;
+    EventLoop events;
+    PerfState perf;
+    ContentMatches content_matches;  // rows of files when searching contents
     size_t file_position;
     string current_search;
+    string shell_command;
     int sort_type;
+    size_t parallel_sort_threshold;  // lists this long are sorted by threads
     bool directory_change;
     bool hidden_files;
     bool preview;
     bool in_shell;
     bool in_search;
+    bool recursive_search;   // the list holds results from the subfolders
+    bool search_contents;    // ... of a content search
+    bool search_git_ignore;  // recursive searches skip ignored entries
+    int search_depth;
     bool help_menu;
 };
 
 // ncurses_setup.cpp
+void setup_colors();
 int start_ncurses();
 void close_ncurses();
 void handle_signals();
+void invalidate_screen(FileManager *file_manager);
+void update_screen(FileManager *file_manager);
+
+// event_loop.cpp
+void start_event_loop(FileManager *file_manager);
+void wake_event_loop();
+void wait_for_events(FileManager *file_manager, int timeout_ms);
+int frame_delay(FileManager *file_manager);
 
 // sort_functions.cpp
-void sort_files(vector<fs::directory_entry> *files, int sort_type);
+void setup_sorting(FileManager *file_manager);
+void sort_files(FileManager *file_manager, FileList *files);
+void merge_sorted_files(FileManager *file_manager, FileList *files,
+                        size_t middle);
 void display_sort_info(WINDOW *window, int sort_type);
 
+// entry_table.cpp
+bool stat_folder_entry(int folder_fd, const char *name, unsigned char d_type,
+                       struct stat *file_stat, uint8_t *type,
+                       uint8_t *entry_flags);
+bool add_folder_entry(EntryTable *table, int folder_fd,
+                      const struct dirent *entry);
+bool add_folder_name(EntryTable *table, int folder_fd,
+                     const struct dirent *entry);
+void get_folder_version(int folder_fd, int64_t *mtime, ino_t *inode);
+
 // files_list.cpp
-vector<fs::directory_entry> get_files_in_folder(const string &folder);
+shared_ptr<EntryTable> get_files_in_folder(const string &folder);
 void display_files(WINDOW *window, FileManager *file_manager);
 string format_bytes(uint64_t bytes);
-bool can_read_file(const string &file_path);
 size_t count_files_in_folder(const string &folder);
-int find_file_color(const fs::directory_entry &file);
-vector<fs::directory_entry> load_folder(FileManager *file_manager,
-                                        const std::string &folder,
-                                        bool force_update, bool search);
+int find_file_color(const FileEntry &file);
+void setup_folders_cache(FileManager *file_manager);
+void cache_folder(FileManager *file_manager, const string &folder,
+                  const shared_ptr<EntryTable> &table);
+void refresh_touched_folders(FileManager *file_manager, const string &folder,
+                             const vector<string> &paths);
+void filter_files(FileManager *file_manager, FileList *files, size_t from,
+                  bool search);
+FileList load_folder(FileManager *file_manager, const std::string &folder,
+                     bool force_update, bool search);
+void refresh_files(FileManager *file_manager);
+void resort_files(FileManager *file_manager);
+void select_file(FileManager *file_manager, string_view name);
+
+// child_counts.cpp
+void start_child_counts(FileManager *file_manager);
+void stop_child_counts(FileManager *file_manager);
+bool find_child_count(ChildCounts *child_counts, const string &folder,
+                      int64_t mtime, size_t *count);
+bool poll_child_counts(ChildCounts *child_counts);
+
+// disk_usage.cpp
+void start_disk_usage(FileManager *file_manager);
+void stop_disk_usage(FileManager *file_manager);
+void cancel_disk_usage(FileManager *file_manager);
+bool find_tree_size(DiskUsage *usage, const string &folder, int64_t mtime,
+                    uint64_t *bytes, bool *complete);
+void forget_tree_size(FileManager *file_manager, const string &folder);
+void recheck_tree_sizes(DiskUsage *usage);
+bool poll_disk_usage(DiskUsage *usage);
+size_t measured_folders(DiskUsage *usage);
+bool is_tree_size_sort(int sort_type);
+
+// listing_store.cpp
+void open_listing_store(FileManager *file_manager);
+bool load_stored_listing(FileManager *file_manager, const string &folder);
+void save_listing_store(FileManager *file_manager);
+
+// folder_watcher.cpp
+void start_folder_watcher(FileManager *file_manager);
+void stop_folder_watcher(FileManager *file_manager);
+void watch_folder(FileManager *file_manager, const string &folder);
+void unwatch_folder(FileManager *file_manager, const string &folder);
+bool is_folder_watched(FileManager *file_manager, const string &folder);
+void read_folder_events(FileManager *file_manager);
+bool apply_folder_changes(FileManager *file_manager, bool force);
+int folder_watcher_timeout(FileManager *file_manager);
+
+// git_status.cpp
+void start_git_status(FileManager *file_manager);
+void stop_git_status(FileManager *file_manager);
+const GitRepo *find_git_repo(FileManager *file_manager, const string &folder);
+void git_folder_changed(FileManager *file_manager);
+void update_git_status(FileManager *file_manager);
+uint8_t get_git_mark(FileManager *file_manager, uint32_t row);
+bool hash_git_blob(const string &file_path, const struct stat &file_stat,
+                   sha1_t *hash);
+bool read_git_index(const string &index_path, vector<GitIndexEntry> *entries);
+
+// recursive_search.cpp
+void setup_recursive_search(FileManager *file_manager);
+void start_recursive_search(FileManager *file_manager);
+void cancel_recursive_search(FileManager *file_manager);
+void stop_recursive_search(FileManager *file_manager);
+bool poll_recursive_search(FileManager *file_manager);
+
+// folder_loader.cpp
+void start_folder_load(FileManager *file_manager, const string &folder,
+                       bool force_update);
+void cancel_folder_load(FileManager *file_manager);
+bool poll_folder_load(FileManager *file_manager);
 
 // file_preview.cpp
-void preview_file(const fs::directory_entry &file, WINDOW *window,
+void setup_preview_cache(FileManager *file_manager);
+void start_preview_work(FileManager *file_manager);
+void stop_preview_work(FileManager *file_manager);
+bool poll_preview_work(FileManager *file_manager);
+int preview_work_timeout(FileManager *file_manager);
+void preview_file(const FileEntry &file, WINDOW *window,
                   FileManager *file_manager);
 
+// file_types.cpp
+const char *detect_file_type(const unsigned char *data, size_t size);
+bool is_binary_data(const unsigned char *data, size_t size);
+HexLayout get_hex_layout(size_t width, uint64_t file_size);
+string format_hex_row(const HexLayout &layout, const unsigned char *data,
+                      size_t size, uint64_t offset);
+
+// content_search.cpp
+size_t search_file_contents(int folder_fd, const char *name,
+                            const string &needle,
+                            const atomic<bool> &cancelled,
+                            ContentMatches *matches);
+size_t find_literal(string_view text, const string &needle,
+                    bool case_sensitive);
+
+// file_pager.cpp
+bool open_pager(FileManager *file_manager, const FileEntry &file);
+void close_pager(FileManager *file_manager);
+void display_pager(WINDOW *window, FileManager *file_manager);
+int handle_pager_input(FileManager *file_manager, int input);
+void poll_pager(FileManager *file_manager);
+bool pager_pending(FileManager *file_manager);
+
+// list_mode.cpp
+int run_list_mode(int argc, char **argv);
+void append_json_escaped(string *buffer, string_view text);
+
+// perf_trace.cpp
+extern atomic<bool> perf_enabled;
+int64_t perf_clock();
+void end_perf_scope(int scope, int64_t start, string_view detail);
+void add_perf_count(int counter, uint64_t count);
+bool start_perf_trace(const string &path);
+void stop_perf_trace();
+void name_perf_thread(const char *name);
+void toggle_perf_overlay(FileManager *file_manager);
+void end_perf_frame(FileManager *file_manager);
+WINDOW *create_perf_overlay();
+void display_perf_overlay(WINDOW *window, FileManager *file_manager);
+
+// Times the block it's declared in. Costs a relaxed load when neither the
+// overlay nor a trace is on.
+class PerfScope {
+  public:
+    explicit PerfScope(int scope, string_view detail = {})
+        : scope(scope), detail(detail),
+          start(perf_enabled.load(memory_order_relaxed) ? perf_clock() : 0)
+    {
+    }
+    ~PerfScope()
+    {
+        if (start != 0) {
+            end_perf_scope(scope, start, detail);
+        }
+    }
+    PerfScope(const PerfScope &) = delete;
+    PerfScope &operator=(const PerfScope &) = delete;
+
+    int scope;
+    string_view detail;  // shown in the trace, has to outlive the scope
+    int64_t start;
+};
+
+inline void perf_count(int counter, uint64_t count = 1)
+{
+    if (perf_enabled.load(memory_order_relaxed)) {
+        add_perf_count(counter, count);
+    }
+}
+
 // handle_shell.cpp
-int run_command(string command, string current_file);
-void display_shell(WINDOW *window, bool in_shell);
-int handle_shell_input(WINDOW *window, FileManager *file_manager);
-void handle_shell_return(int return_value, FileManager *file_manager);
+void display_shell(WINDOW *window, FileManager *file_manager);
+int handle_shell_input(FileManager *file_manager, int input);
+
+// job_runner.cpp
+void start_job(FileManager *file_manager, const string &command);
+bool poll_jobs(FileManager *file_manager);
+void stop_job(FileManager *file_manager, int id);
+void stop_jobs(FileManager *file_manager);
+size_t running_jobs(FileManager *file_manager);
+void show_next_job(FileManager *file_manager);
+void display_jobs(WINDOW *window, FileManager *file_manager);
+
+// file_operations.cpp
+void setup_file_operations(FileManager *file_manager);
+void toggle_mark(FileManager *file_manager);
+void toggle_all_marks(FileManager *file_manager);
+void sync_marks(FileManager *file_manager);
+void start_file_operation(FileManager *file_manager, int type);
+void open_operation_prompt(FileManager *file_manager, int type);
+void cancel_file_operations(FileManager *file_manager);
+bool poll_file_operations(FileManager *file_manager);
+int handle_operation_prompt(FileManager *file_manager, int input);
+void display_operations(WINDOW *window, FileManager *file_manager);
 
 // help_widget.cpp
-void display_help(WINDOW *window);
+int get_help_height();
+void display_help(WINDOW *window, FileManager *file_manager);
 
 // search_files.cpp
-int handle_search_input(FileManager *file_manager);
-vector<fs::directory_entry> search_files(
-    const vector<fs::directory_entry> &files, const string &needle);
+int handle_search_input(FileManager *file_manager, int input);
+void search_files(FileList *files, size_t from, const string &needle);
+bool match_search(string_view name, const string &needle,
+                  vector<size_t> *positions);
+bool is_case_sensitive(const string &needle);
+size_t find_character(string_view text, size_t from, unsigned char character,
+                      bool fold_case);
+void update_search(FileManager *file_manager);
 void display_search(WINDOW *window, FileManager *file_manager);
 
 #endif /* FILE_MANAGER_H_ */
@@ -0,0 +1,122 @@
+#include "file_manager.hpp"
+
+// requests for rows that scrolled out of view long ago aren't worth walking
+static const size_t MAX_QUEUED_COUNTS = 1024;
+// counts kept, a walk through a huge tree doesn't keep them all
+static const size_t MAX_CHILD_COUNTS = 65536;
+
+// counts are sent to the interface at most this often while more are queued,
+// the size sort is redone for each batch
+static const int WAKE_INTERVAL_MS = 100;
+
+// Detached like the folder loader, a walk stuck on a slow mount must not hold
+// up the UI or the exit
+static void child_counts_worker(shared_ptr<ChildCounts> child_counts)
+{
+    name_perf_thread("child counts");
+    unique_lock<mutex> guard(child_counts->lock);
+    auto last_wake = chrono::steady_clock::now();
+
+    while (true) {
+        child_counts->wake.wait(guard, [&child_counts] {
+            return child_counts->stopped || !child_counts->queue.empty();
+        });
+        if (child_counts->stopped) {
+            return;
+        }
+
+        // newest requests first, they are the rows on screen right now
+        auto [folder, mtime] = child_counts->queue.back();
+        child_counts->queue.pop_back();
+        child_counts->queued.erase(folder);
+
+        auto *cached = child_counts->counts.peek(folder);
+        if (cached != nullptr && cached->first == mtime) {
+            continue;
+        }
+
+        child_counts->busy = true;
+        guard.unlock();
+        size_t count = count_files_in_folder(folder);
+        guard.lock();
+
+        child_counts->counts.insert(folder, {mtime, count});
+        child_counts->busy = false;
+        child_counts->updated = true;
+        auto now = chrono::steady_clock::now();
+        if (child_counts->queue.empty() ||
+            now - last_wake >= chrono::milliseconds(WAKE_INTERVAL_MS)) {
+            last_wake = now;
+            wake_event_loop();
+        }
+    }
+}
+
+void start_child_counts(FileManager *file_manager)
+{
+    file_manager->child_counts = make_shared<ChildCounts>();
+    file_manager->child_counts->counts.budget = MAX_CHILD_COUNTS;
+
+    thread(child_counts_worker, file_manager->child_counts).detach();
+}
+
+void stop_child_counts(FileManager *file_manager)
+{
+    ChildCounts *child_counts = file_manager->child_counts.get();
+
+    if (child_counts == nullptr) {
+        return;
+    }
+    {
+        lock_guard<mutex> guard(child_counts->lock);
+        child_counts->stopped = true;
+    }
+    child_counts->wake.notify_one();
+    file_manager->child_counts.reset();
+}
+
+// Non blocking lookup for the render path, queues the folder for the worker
+// when its count is missing or stale
+bool find_child_count(ChildCounts *child_counts, const string &folder,
+                      int64_t mtime, size_t *count)
+{
+    if (child_counts == nullptr) {
+        *count = count_files_in_folder(folder);
+        return true;
+    }
+
+    {
+        lock_guard<mutex> guard(child_counts->lock);
+
+        auto *cached = child_counts->counts.find(folder);
+        if (cached != nullptr && cached->first == mtime) {
+            *count = cached->second;
+            return true;
+        }
+
+        if (child_counts->queued.count(folder) != 0) {
+            return false;
+        }
+        if (child_counts->queue.size() >= MAX_QUEUED_COUNTS) {
+            child_counts->queued.erase(child_counts->queue.front().first);
+            child_counts->queue.pop_front();
+        }
+        child_counts->queue.emplace_back(folder, mtime);
+        child_counts->queued.insert(folder);
+    }
+    child_counts->wake.notify_one();
+    return false;
+}
+
+// Returns true if counts arrived since the last call
+bool poll_child_counts(ChildCounts *child_counts)
+{
+    if (child_counts == nullptr) {
+        return false;
+    }
+
+    lock_guard<mutex> guard(child_counts->lock);
+    bool updated = child_counts->updated;
+    child_counts->updated = false;
+    return updated;
+}
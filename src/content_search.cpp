@@ -0,0 +1,233 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <csignal>
+#include <cstring>
+#include "file_manager.hpp"
+
+// the beginning of a file that decides if it's binary
+static const size_t BINARY_CHECK_SIZE = 4096;
+// files are scanned by blocks so a cancelled search doesn't finish a huge one
+static const size_t SCAN_BLOCK_SIZE = 4 << 20;
+static const size_t MAX_MATCHES_PER_FILE = 100;
+static const size_t MAX_SNIPPET_SIZE = 200;
+// bytes of the line kept before the match when it has to be cut
+static const size_t SNIPPET_LEAD = 40;
+
+// mappings the SIGBUS handler knows, more are left unguarded
+static const size_t MAX_GUARDED_MAPPINGS = 1024;
+
+// [start, end) of the live mappings, 0 for a free slot. Lock free, they're
+// read from the signal handler.
+static atomic<uintptr_t> guarded_starts[MAX_GUARDED_MAPPINGS];
+static atomic<uintptr_t> guarded_ends[MAX_GUARDED_MAPPINGS];
+static uintptr_t page_size;
+
+// A read past the end of a file truncated while it was mapped. The rest of
+// the mapping becomes zeros and the read goes on, anything else is fatal.
+static void handle_mapping_error(int, siginfo_t *info, void *)
+{
+    uintptr_t address = reinterpret_cast<uintptr_t>(info->si_addr);
+
+    for (size_t i = 0; i < MAX_GUARDED_MAPPINGS; i++) {
+        uintptr_t start = guarded_starts[i];
+        uintptr_t end = guarded_ends[i];
+        if (start == 0 || address < start || address >= end) {
+            continue;
+        }
+        uintptr_t page = address & ~(page_size - 1);
+        if (mmap(reinterpret_cast<void *>(page), end - page, PROT_READ,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1,
+                 0) != MAP_FAILED) {
+            return;
+        }
+        break;
+    }
+    signal(SIGBUS, SIG_DFL);
+}
+
+static bool guard_mappings()
+{
+    page_size = sysconf(_SC_PAGESIZE);
+
+    struct sigaction action = {};
+    action.sa_sigaction = handle_mapping_error;
+    action.sa_flags = SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+    return sigaction(SIGBUS, &action, nullptr) == 0;
+}
+
+static size_t guard_mapping(const unsigned char *data, size_t size)
+{
+    static const bool guarded = guard_mappings();
+    uintptr_t start = reinterpret_cast<uintptr_t>(data);
+
+    if (!guarded) {
+        return SIZE_MAX;
+    }
+    for (size_t i = 0; i < MAX_GUARDED_MAPPINGS; i++) {
+        uintptr_t free_slot = 0;
+        if (guarded_starts[i].compare_exchange_strong(free_slot, start)) {
+            guarded_ends[i] = start + size;
+            return i;
+        }
+    }
+    return SIZE_MAX;
+}
+
+MappedFile::MappedFile(int folder_fd, const char *name)
+{
+    int fd = openat(folder_fd, name, O_RDONLY | O_CLOEXEC | O_NOCTTY);
+    perf_count(PERF_OPENS);
+    if (fd == -1) {
+        return;
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) == 0 && S_ISREG(file_stat.st_mode) &&
+        file_stat.st_size > 0) {
+        void *mapping =
+            mmap(nullptr, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED) {
+            data = static_cast<const unsigned char *>(mapping);
+            size = file_stat.st_size;
+            madvise(mapping, size, MADV_SEQUENTIAL);
+            guard = guard_mapping(data, size);
+        }
+    }
+    close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+    if (guard != SIZE_MAX) {
+        guarded_ends[guard] = 0;
+        guarded_starts[guard] = 0;
+    }
+    if (data != nullptr) {
+        munmap(const_cast<unsigned char *>(data), size);
+    }
+}
+
+// Literal needle in text, memmem when the case matters. Otherwise candidates
+// for the first character are found with the SSE2 scan of the name search
+// and checked with the case folded.
+size_t find_literal(string_view text, const string &needle,
+                    bool case_sensitive)
+{
+    if (needle.size() > text.size()) {
+        return string_view::npos;
+    }
+
+    if (case_sensitive) {
+        const void *found = memmem(text.data(), text.size(), needle.data(),
+                                   needle.size());
+        return found == nullptr
+                   ? string_view::npos
+                   : static_cast<const char *>(found) - text.data();
+    }
+
+    unsigned char first = needle[0];
+    bool fold_case = isalpha(first);
+    if (fold_case) {
+        first = tolower(first);
+    }
+    size_t last_start = text.size() - needle.size();
+
+    for (size_t position = find_character(text, 0, first, fold_case);
+         position != string_view::npos && position <= last_start;
+         position = find_character(text, position + 1, first, fold_case)) {
+        size_t i = 1;
+        while (i < needle.size() &&
+               tolower(static_cast<unsigned char>(text[position + i])) ==
+                   tolower(static_cast<unsigned char>(needle[i]))) {
+            i++;
+        }
+        if (i == needle.size()) {
+            return position;
+        }
+    }
+    return string_view::npos;
+}
+
+// The matched line without its control characters, cut around the match when
+// it's too long
+static string make_snippet(string_view line, size_t match_column,
+                          uint16_t *column)
+{
+    size_t start = 0;
+
+    if (line.size() > MAX_SNIPPET_SIZE && match_column > SNIPPET_LEAD) {
+        start = min(match_column - SNIPPET_LEAD,
+                    line.size() - MAX_SNIPPET_SIZE);
+    }
+    string snippet(line.substr(start, MAX_SNIPPET_SIZE));
+    for (char &character : snippet) {
+        if (iscntrl(static_cast<unsigned char>(character))) {
+            character = ' ';
+        }
+    }
+    *column = match_column - start;
+    return snippet;
+}
+
+// Looks for needle (smart case like the name search) in a regular file of
+// folder_fd, one match per line at most. Returns the number of matches added.
+size_t search_file_contents(int folder_fd, const char *name,
+                            const string &needle,
+                            const atomic<bool> &cancelled,
+                            ContentMatches *matches)
+{
+    MappedFile file(folder_fd, name);
+
+    if (file.data == nullptr || needle.empty() ||
+        is_binary_data(file.data, min(file.size, BINARY_CHECK_SIZE))) {
+        return 0;
+    }
+
+    string_view text(reinterpret_cast<const char *>(file.data), file.size);
+    bool case_sensitive = is_case_sensitive(needle);
+    size_t found = 0;
+    size_t line = 1;
+    size_t counted_up_to = 0;  // newlines before this are in line
+    size_t position = 0;
+    size_t block_end = min(text.size(), SCAN_BLOCK_SIZE);
+
+    while (position < text.size() && found < MAX_MATCHES_PER_FILE &&
+           !cancelled) {
+        // matches starting in this block may run into the next one
+        size_t scan_end = min(text.size(), block_end + needle.size() - 1);
+        size_t match = find_literal(
+            text.substr(position, scan_end - position), needle,
+            case_sensitive);
+
+        if (match == string_view::npos) {
+            position = block_end;
+            block_end = min(text.size(), block_end + SCAN_BLOCK_SIZE);
+            continue;
+        }
+        match += position;
+
+        line += count(text.begin() + counted_up_to, text.begin() + match,
+                      '\n');
+        size_t line_start = text.rfind('\n', match);
+        line_start = line_start == string_view::npos ? 0 : line_start + 1;
+        size_t line_end = text.find('\n', match);
+        if (line_end == string_view::npos) {
+            line_end = text.size();
+        }
+
+        uint16_t column;
+        string snippet =
+            make_snippet(text.substr(line_start, line_end - line_start),
+                         match - line_start, &column);
+        matches->add_match(line, column, move(snippet));
+        found++;
+
+        // on to the next line, the newline ending this one is counted there
+        counted_up_to = line_end;
+        position = line_end + 1;
+        if (position > block_end) {
+            block_end = min(text.size(), position + SCAN_BLOCK_SIZE);
+        }
+    }
+    return found;
+}
@@ -0,0 +1,381 @@
+#include <fcntl.h>
+#include "file_manager.hpp"
+
+// partial totals are sent to the interface at most this often
+static const int WAKE_INTERVAL_MS = 100;
+
+// folders whose total is kept, ~100 bytes each
+static const size_t MAX_TREE_SIZES = 65536;
+
+// What reading one folder found, added to the tree by the worker
+class UsageFolder {
+  public:
+    uint64_t bytes = 0;  // the folder and the files in it with a single link
+    vector<pair<pair<dev_t, ino_t>, uint64_t>> links;  // the other files
+    vector<pair<string, int64_t>> subfolders;          // path, mtime
+};
+
+bool is_tree_size_sort(int sort_type)
+{
+    return sort_type == TREE_SIZE_INCREASING ||
+           sort_type == TREE_SIZE_DECREASING;
+}
+
+static uint64_t get_allocated_bytes(const struct stat &file_stat)
+{
+    return static_cast<uint64_t>(file_stat.st_blocks) * 512;
+}
+
+// Allocated bytes of folder and of the files in it, sparse files only count
+// what's on disk. device is the filesystem of the walk, 0 for the folder's
+// own; subfolders on other filesystems are left out like with du -x.
+static bool read_usage_folder(const string &folder, dev_t *device,
+                              UsageFolder *result)
+{
+    DIR *dir = opendir(folder.c_str());
+    perf_count(PERF_OPENS);
+
+    if (dir == nullptr) {
+        return false;
+    }
+
+    int folder_fd = dirfd(dir);
+    struct stat folder_stat;
+    perf_count(PERF_STATS);
+    if (fstat(folder_fd, &folder_stat) == 0) {
+        if (*device == 0) {
+            *device = folder_stat.st_dev;
+        }
+        result->bytes += get_allocated_bytes(folder_stat);
+    }
+
+    string prefix = folder.back() == '/' ? folder : folder + '/';
+    while (const struct dirent *entry = readdir(dir)) {
+        const char *name = entry->d_name;
+        if (name[0] == '.' &&
+            (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+            continue;
+        }
+
+        struct stat file_stat;
+        perf_count(PERF_STATS);
+        if (fstatat(folder_fd, name, &file_stat, AT_SYMLINK_NOFOLLOW) != 0) {
+            continue;
+        }
+        if (S_ISDIR(file_stat.st_mode)) {
+            if (file_stat.st_dev == *device) {
+                result->subfolders.emplace_back(
+                    prefix + name, file_stat.st_mtim.tv_sec * 1000000000LL +
+                                       file_stat.st_mtim.tv_nsec);
+            }
+        } else if (file_stat.st_nlink > 1) {
+            result->links.push_back({{file_stat.st_dev, file_stat.st_ino},
+                                     get_allocated_bytes(file_stat)});
+        } else {
+            result->bytes += get_allocated_bytes(file_stat);
+        }
+    }
+
+    closedir(dir);
+    return true;
+}
+
+static void add_usage_bytes(UsageNode *node, uint64_t bytes)
+{
+    for (; node != nullptr; node = node->parent.get()) {
+        node->bytes += bytes;
+    }
+}
+
+// One less folder pending under node, the folders it completes get their
+// total stored. Called with the lock held.
+static void finish_usage_node(DiskUsage *usage, UsageNode *node)
+{
+    while (node != nullptr && --node->pending == 0) {
+        usage->totals.insert(node->path,
+                             {node->mtime, node->bytes, node->epoch});
+        auto running = usage->running.find(node->path);
+        if (running != usage->running.end() && running->second.get() == node) {
+            usage->running.erase(running);
+        }
+        node = node->parent.get();
+    }
+}
+
+// Adds what was read in node's folder to it and its parents, and queues the
+// subfolders that don't have a total yet. Called with the lock held.
+static void add_usage_folder(DiskUsage *usage,
+                             const shared_ptr<UsageNode> &node,
+                             const UsageFolder &folder)
+{
+    uint64_t bytes = folder.bytes;
+    for (const auto &[file, file_bytes] : folder.links) {
+        if (node->linked->insert(file).second) {
+            bytes += file_bytes;
+        }
+    }
+    add_usage_bytes(node.get(), bytes);
+
+    for (const auto &[path, mtime] : folder.subfolders) {
+        // only a total this walk can vouch for is reused
+        const TreeSize *total = usage->totals.peek(path);
+        if (total != nullptr && total->mtime == mtime &&
+            total->epoch == node->epoch) {
+            add_usage_bytes(node.get(), total->bytes);
+            continue;
+        }
+
+        auto subfolder = make_shared<UsageNode>();
+        subfolder->path = path;
+        subfolder->parent = node;
+        subfolder->device = node->device;
+        subfolder->mtime = mtime;
+        subfolder->generation = node->generation;
+        subfolder->epoch = node->epoch;
+        subfolder->linked = node->linked;
+        node->pending++;
+        usage->queue.push_back(subfolder);
+        usage->running[path] = subfolder;
+    }
+    if (!folder.subfolders.empty()) {
+        usage->wake.notify_all();
+    }
+}
+
+// Detached like the other workers. The queue is a stack so a walk goes deep
+// first and only keeps the folders left next to the current path.
+static void disk_usage_worker(shared_ptr<DiskUsage> usage)
+{
+    name_perf_thread("disk usage");
+    unique_lock<mutex> guard(usage->lock);
+
+    while (true) {
+        usage->wake.wait(guard, [&usage] {
+            return usage->stopped || !usage->queue.empty();
+        });
+        if (usage->stopped) {
+            return;
+        }
+
+        shared_ptr<UsageNode> node = usage->queue.back();
+        usage->queue.pop_back();
+        usage->busy++;
+        guard.unlock();
+
+        UsageFolder folder;
+        dev_t device = node->device;
+        {
+            PerfScope perf_scope(PERF_DISK_USAGE, node->path);
+            read_usage_folder(node->path, &device, &folder);
+        }
+
+        guard.lock();
+        usage->busy--;
+        usage->measured++;
+        // dropped by cancel_disk_usage() while it was read
+        if (node->generation == usage->generation) {
+            node->device = device;
+            add_usage_folder(usage.get(), node, folder);
+            finish_usage_node(usage.get(), node.get());
+        }
+
+        bool idle = usage->queue.empty() && usage->busy == 0;
+        usage->updated = true;
+        auto now = chrono::steady_clock::now();
+        if (idle || now - usage->last_wake >=
+                        chrono::milliseconds(WAKE_INTERVAL_MS)) {
+            usage->last_wake = now;
+            wake_event_loop();
+        }
+    }
+}
+
+// Total of folder walked right away, for when there are no workers (--list)
+static uint64_t measure_tree_size(const string &folder)
+{
+    set<pair<dev_t, ino_t>> linked;
+    vector<string> pending = {folder};
+    dev_t device = 0;
+    uint64_t bytes = 0;
+
+    while (!pending.empty()) {
+        string path = move(pending.back());
+        pending.pop_back();
+
+        UsageFolder result;
+        if (!read_usage_folder(path, &device, &result)) {
+            continue;
+        }
+        bytes += result.bytes;
+        for (const auto &[file, file_bytes] : result.links) {
+            if (linked.insert(file).second) {
+                bytes += file_bytes;
+            }
+        }
+        for (auto &[subfolder, mtime] : result.subfolders) {
+            pending.push_back(move(subfolder));
+        }
+    }
+    return bytes;
+}
+
+// FILE_MANAGER_DU_THREADS workers, one per core and at least 4 since they
+// mostly wait on the disk. They sleep until a tree size is asked for.
+void start_disk_usage(FileManager *file_manager)
+{
+    size_t threads = max(thread::hardware_concurrency(), 4U);
+    if (const char *env_threads = getenv("FILE_MANAGER_DU_THREADS")) {
+        threads = max(atoi(env_threads), 1);
+    }
+
+    file_manager->disk_usage = make_shared<DiskUsage>();
+    file_manager->disk_usage->totals.budget = MAX_TREE_SIZES;
+    for (size_t i = 0; i < threads; i++) {
+        thread(disk_usage_worker, file_manager->disk_usage).detach();
+    }
+}
+
+void stop_disk_usage(FileManager *file_manager)
+{
+    DiskUsage *usage = file_manager->disk_usage.get();
+
+    if (usage == nullptr) {
+        return;
+    }
+    {
+        lock_guard<mutex> guard(usage->lock);
+        usage->stopped = true;
+    }
+    usage->wake.notify_all();
+    file_manager->disk_usage.reset();
+}
+
+// Drops the walks in progress, the totals already known are kept
+void cancel_disk_usage(FileManager *file_manager)
+{
+    DiskUsage *usage = file_manager->disk_usage.get();
+
+    if (usage == nullptr) {
+        return;
+    }
+    lock_guard<mutex> guard(usage->lock);
+    usage->generation++;
+    usage->queue.clear();
+    usage->running.clear();
+}
+
+// Non blocking lookup for the render path and the tree size sorts. A folder
+// being measured gives its bytes so far (or its provisional total) with
+// complete false, one that isn't known yet is queued and false returned.
+bool find_tree_size(DiskUsage *usage, const string &folder, int64_t mtime,
+                    uint64_t *bytes, bool *complete)
+{
+    if (usage == nullptr) {
+        *bytes = measure_tree_size(folder);
+        *complete = true;
+        return true;
+    }
+
+    lock_guard<mutex> guard(usage->lock);
+
+    TreeSize *total = usage->totals.find(folder);
+    if (total != nullptr && total->mtime != mtime) {
+        usage->totals.erase(folder);
+        total = nullptr;
+    }
+    if (total != nullptr && total->epoch == usage->epoch) {
+        *bytes = total->bytes;
+        *complete = true;
+        return true;
+    }
+
+    if (auto running = usage->running.find(folder);
+        running != usage->running.end()) {
+        *bytes = total != nullptr ? total->bytes : running->second->bytes;
+        *complete = false;
+        return true;
+    }
+
+    if (usage->queue.empty() && usage->busy == 0) {
+        usage->measured = 0;
+    }
+
+    auto node = make_shared<UsageNode>();
+    node->path = folder;
+    node->mtime = mtime;
+    node->generation = usage->generation;
+    node->epoch = usage->epoch;
+    // hard links are counted once per walk, like du
+    node->linked = make_shared<set<pair<dev_t, ino_t>>>();
+    usage->queue.push_back(node);
+    usage->running[folder] = node;
+    usage->wake.notify_one();
+
+    // shown while it's checked
+    if (total != nullptr) {
+        *bytes = total->bytes;
+        *complete = false;
+        return true;
+    }
+    return false;
+}
+
+// folder changed, its total and the ones of the folders above it are wrong
+void forget_tree_size(FileManager *file_manager, const string &folder)
+{
+    DiskUsage *usage = file_manager->disk_usage.get();
+
+    if (usage == nullptr) {
+        return;
+    }
+
+    lock_guard<mutex> guard(usage->lock);
+    string path = folder;
+    while (true) {
+        usage->totals.erase(path.empty() ? "/" : path);
+        size_t slash = path.find_last_of('/');
+        if (slash == string::npos || path.empty()) {
+            break;
+        }
+        path.erase(slash);
+    }
+}
+
+// The totals known so far become provisional, the next lookups walk their
+// folders again
+void recheck_tree_sizes(DiskUsage *usage)
+{
+    if (usage == nullptr) {
+        return;
+    }
+
+    lock_guard<mutex> guard(usage->lock);
+    usage->epoch++;
+}
+
+// Returns true if totals changed since the last call
+bool poll_disk_usage(DiskUsage *usage)
+{
+    if (usage == nullptr) {
+        return false;
+    }
+
+    lock_guard<mutex> guard(usage->lock);
+    bool updated = usage->updated;
+    usage->updated = false;
+    return updated;
+}
+
+// Folders read by the current walks, 0 when there are none
+size_t measured_folders(DiskUsage *usage)
+{
+    if (usage == nullptr) {
+        return 0;
+    }
+
+    lock_guard<mutex> guard(usage->lock);
+    if (usage->queue.empty() && usage->busy == 0) {
+        return 0;
+    }
+    return usage->measured;
+}
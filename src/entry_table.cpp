@@ -0,0 +1,323 @@
+#include <fcntl.h>
+#include <cerrno>
+#include "file_manager.hpp"
+
+static uint8_t type_from_mode(mode_t mode)
+{
+    switch (mode & S_IFMT) {
+        case S_IFREG:
+            return ENTRY_REGULAR;
+        case S_IFDIR:
+            return ENTRY_DIRECTORY;
+        case S_IFCHR:
+            return ENTRY_CHARACTER;
+        case S_IFBLK:
+            return ENTRY_BLOCK;
+        case S_IFIFO:
+            return ENTRY_FIFO;
+        case S_IFSOCK:
+            return ENTRY_SOCKET;
+        default:
+            return ENTRY_UNKNOWN;
+    }
+}
+
+static uint8_t type_from_dirent(unsigned char d_type)
+{
+    switch (d_type) {
+        case DT_REG:
+            return ENTRY_REGULAR;
+        case DT_DIR:
+            return ENTRY_DIRECTORY;
+        case DT_CHR:
+            return ENTRY_CHARACTER;
+        case DT_BLK:
+            return ENTRY_BLOCK;
+        case DT_FIFO:
+            return ENTRY_FIFO;
+        case DT_SOCK:
+            return ENTRY_SOCKET;
+        default:
+            return ENTRY_UNKNOWN;
+    }
+}
+
+string EntryTable::path(uint32_t row) const
+{
+    string file_path = folder;
+
+    if (file_path.empty() || file_path.back() != '/') {
+        file_path += '/';
+    }
+    file_path.append(name(row));
+    return file_path;
+}
+
+void EntryTable::add_entry(string_view name, const struct stat &file_stat,
+                           uint8_t type, uint8_t entry_flags)
+{
+    version++;
+    types.push_back(type);
+    flags.push_back(entry_flags);
+    modes.push_back(file_stat.st_mode);
+    sizes.push_back(file_stat.st_size);
+    allocated.push_back(static_cast<uint64_t>(file_stat.st_blocks) * 512);
+    mtimes.push_back(file_stat.st_mtim.tv_sec * 1000000000LL +
+                     file_stat.st_mtim.tv_nsec);
+    inodes.push_back(file_stat.st_ino);
+    name_offsets.push_back(names.size());
+    name_sizes.push_back(name.size());
+    names.append(name);
+}
+
+void EntryTable::set_entry(uint32_t row, const struct stat &file_stat,
+                           uint8_t type, uint8_t entry_flags)
+{
+    version++;
+    types[row] = type;
+    flags[row] = entry_flags;
+    modes[row] = file_stat.st_mode;
+    sizes[row] = file_stat.st_size;
+    allocated[row] = static_cast<uint64_t>(file_stat.st_blocks) * 512;
+    mtimes[row] = file_stat.st_mtim.tv_sec * 1000000000LL +
+                  file_stat.st_mtim.tv_nsec;
+    inodes[row] = file_stat.st_ino;
+}
+
+// Moves the last row into the removed one, so any row index held elsewhere
+// must be rebuilt afterwards. The name stays in the arena until enough of it
+// is garbage to be worth compacting.
+void EntryTable::remove_row(uint32_t row)
+{
+    uint32_t last = size() - 1;
+
+    version++;
+    names_version++;
+    garbage_bytes += name_sizes[row];
+
+    types[row] = types[last];
+    flags[row] = flags[last];
+    modes[row] = modes[last];
+    sizes[row] = sizes[last];
+    allocated[row] = allocated[last];
+    mtimes[row] = mtimes[last];
+    inodes[row] = inodes[last];
+    name_offsets[row] = name_offsets[last];
+    name_sizes[row] = name_sizes[last];
+
+    types.pop_back();
+    flags.pop_back();
+    modes.pop_back();
+    sizes.pop_back();
+    allocated.pop_back();
+    mtimes.pop_back();
+    inodes.pop_back();
+    name_offsets.pop_back();
+    name_sizes.pop_back();
+
+    if (garbage_bytes > names.size() / 2) {
+        string packed_names;
+        packed_names.reserve(names.size() - garbage_bytes);
+        for (uint32_t i = 0; i < size(); i++) {
+            string_view entry_name = name(i);
+            name_offsets[i] = packed_names.size();
+            packed_names.append(entry_name);
+        }
+        names.swap(packed_names);
+        garbage_bytes = 0;
+    }
+}
+
+void EntryTable::append(const EntryTable &other)
+{
+    size_t names_offset = names.size();
+
+    version++;
+    types.insert(types.end(), other.types.begin(), other.types.end());
+    flags.insert(flags.end(), other.flags.begin(), other.flags.end());
+    modes.insert(modes.end(), other.modes.begin(), other.modes.end());
+    sizes.insert(sizes.end(), other.sizes.begin(), other.sizes.end());
+    allocated.insert(allocated.end(), other.allocated.begin(),
+                     other.allocated.end());
+    mtimes.insert(mtimes.end(), other.mtimes.begin(), other.mtimes.end());
+    inodes.insert(inodes.end(), other.inodes.begin(), other.inodes.end());
+    name_sizes.insert(name_sizes.end(), other.name_sizes.begin(),
+                      other.name_sizes.end());
+    for (uint32_t offset : other.name_offsets) {
+        name_offsets.push_back(names_offset + offset);
+    }
+    names.append(other.names);
+}
+
+size_t EntryTable::memory_usage() const
+{
+    return sizeof(EntryTable) + folder.capacity() + types.capacity() +
+           flags.capacity() + modes.capacity() * sizeof(mode_t) +
+           sizes.capacity() * sizeof(uint64_t) +
+           allocated.capacity() * sizeof(uint64_t) +
+           mtimes.capacity() * sizeof(int64_t) +
+           inodes.capacity() * sizeof(ino_t) +
+           name_offsets.capacity() * sizeof(uint32_t) +
+           name_sizes.capacity() * sizeof(uint16_t) + names.capacity();
+}
+
+class ProcessCredentials {
+  public:
+    uid_t uid;
+    gid_t gid;
+    vector<gid_t> groups;
+};
+
+static const ProcessCredentials &get_process_credentials()
+{
+    static const ProcessCredentials credentials = [] {
+        ProcessCredentials process;
+        process.uid = geteuid();
+        process.gid = getegid();
+        int group_count = getgroups(0, nullptr);
+        if (group_count > 0) {
+            process.groups.resize(group_count);
+            group_count = getgroups(group_count, process.groups.data());
+            process.groups.resize(max(group_count, 0));
+        }
+        return process;
+    }();
+    return credentials;
+}
+
+// Same answer as an open(O_RDONLY) without opening anything, worked out from
+// the mode bits and the process credentials
+static bool is_entry_readable(int folder_fd, const char *name,
+                              const struct stat &file_stat)
+{
+    const ProcessCredentials &credentials = get_process_credentials();
+
+    if (credentials.uid == 0) {
+        return true;
+    }
+
+    mode_t mode = file_stat.st_mode;
+
+    if (file_stat.st_uid == credentials.uid) {
+        return mode & S_IRUSR;
+    }
+
+    bool in_group =
+        file_stat.st_gid == credentials.gid ||
+        find(credentials.groups.begin(), credentials.groups.end(),
+             file_stat.st_gid) != credentials.groups.end();
+    if (in_group ? mode & S_IRGRP : mode & S_IROTH) {
+        return true;
+    }
+
+    // with ACLs the group bits are the mask, a named entry can still grant
+    // read access so only the kernel knows
+    if (mode & S_IRGRP) {
+        return faccessat(folder_fd, name, R_OK, AT_EACCESS) == 0;
+    }
+    return false;
+}
+
+// lstat (plus one stat to resolve symlinks) of a folder entry, d_type is kept
+// as the type when stat isn't allowed. Returns false if the entry is gone.
+bool stat_folder_entry(int folder_fd, const char *name, unsigned char d_type,
+                       struct stat *file_stat, uint8_t *type,
+                       uint8_t *entry_flags)
+{
+    *file_stat = {};
+    *type = type_from_dirent(d_type);
+    *entry_flags = d_type == DT_LNK ? ENTRY_SYMLINK : 0;
+
+    perf_count(PERF_STATS);
+    if (fstatat(folder_fd, name, file_stat, AT_SYMLINK_NOFOLLOW) == 0) {
+        *type = type_from_mode(file_stat->st_mode);
+        if (S_ISLNK(file_stat->st_mode)) {
+            *entry_flags |= ENTRY_SYMLINK;
+        }
+    } else if (errno == ENOENT) {
+        return false;
+    }
+
+    if (*entry_flags & ENTRY_SYMLINK) {
+        struct stat target_stat;
+        perf_count(PERF_STATS);
+        if (fstatat(folder_fd, name, &target_stat, 0) == 0) {
+            *file_stat = target_stat;
+            *type = type_from_mode(target_stat.st_mode);
+        } else {
+            *type = ENTRY_UNKNOWN;
+        }
+    }
+
+    // a failed stat leaves st_mode at 0 (not readable either way), dangling
+    // symlinks can't be opened
+    if (file_stat->st_mode != 0 && *type != ENTRY_UNKNOWN &&
+        is_entry_readable(folder_fd, name, *file_stat)) {
+        *entry_flags |= ENTRY_READABLE;
+    }
+    return true;
+}
+
+// Adds a readdir() result to the table
+bool add_folder_entry(EntryTable *table, int folder_fd,
+                      const struct dirent *entry)
+{
+    const char *name = entry->d_name;
+
+    if (name[0] == '.' &&
+        (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+        return false;
+    }
+
+    struct stat file_stat;
+    uint8_t type;
+    uint8_t entry_flags;
+
+    // removed between readdir() and the stat
+    if (!stat_folder_entry(folder_fd, name, entry->d_type, &file_stat, &type,
+                           &entry_flags)) {
+        return false;
+    }
+    table->add_entry(name, file_stat, type, entry_flags);
+    return true;
+}
+
+// Same as add_folder_entry without the stat, for listings that only need
+// names and types. Only entries the filesystem doesn't give a type for are
+// stat'ed.
+bool add_folder_name(EntryTable *table, int folder_fd,
+                     const struct dirent *entry)
+{
+    const char *name = entry->d_name;
+
+    if (entry->d_type == DT_UNKNOWN) {
+        return add_folder_entry(table, folder_fd, entry);
+    }
+    if (name[0] == '.' &&
+        (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+        return false;
+    }
+
+    struct stat file_stat = {};
+    uint8_t type = type_from_dirent(entry->d_type);
+    table->add_entry(name, file_stat, type,
+                     entry->d_type == DT_LNK ? ENTRY_SYMLINK : 0);
+    return true;
+}
+
+// What a saved listing of the folder is checked against, 0s if the folder
+// can't be stat'ed
+void get_folder_version(int folder_fd, int64_t *mtime, ino_t *inode)
+{
+    struct stat folder_stat;
+
+    perf_count(PERF_STATS);
+    if (fstat(folder_fd, &folder_stat) != 0) {
+        *mtime = 0;
+        *inode = 0;
+        return;
+    }
+    *mtime = folder_stat.st_mtim.tv_sec * 1000000000LL +
+             folder_stat.st_mtim.tv_nsec;
+    *inode = folder_stat.st_ino;
+}
@@ -0,0 +1,86 @@
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include "file_manager.hpp"
+
+static const int DEFAULT_MAX_FPS = 60;
+
+// Written by the workers when they have something for the main loop. Never
+// closed, detached workers may still write to it on the way out.
+static int wake_fd = -1;
+
+// FILE_MANAGER_FPS caps how many frames are drawn per second, 0 for no cap
+void start_event_loop(FileManager *file_manager)
+{
+    EventLoop &events = file_manager->events;
+
+    if (wake_fd == -1) {
+        wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    }
+
+    int max_fps = DEFAULT_MAX_FPS;
+    if (const char *env_fps = getenv("FILE_MANAGER_FPS")) {
+        max_fps = atoi(env_fps);
+    }
+    events.frame_interval = chrono::milliseconds(max_fps > 0 ? 1000 / max_fps
+                                                             : 0);
+}
+
+// Safe from any thread
+void wake_event_loop()
+{
+    uint64_t one = 1;
+
+    if (wake_fd != -1) {
+        [[maybe_unused]] ssize_t written = write(wake_fd, &one, sizeof(one));
+    }
+}
+
+// Blocks until a key comes in, a worker wakes the loop, the watched folders
+// change or timeout_ms (-1 for none) runs out. Keys already read and not
+// handled yet don't wait.
+void wait_for_events(FileManager *file_manager, int timeout_ms)
+{
+    EventLoop &events = file_manager->events;
+    array<pollfd, 3> fds = {{{STDIN_FILENO, POLLIN, 0},
+                             {wake_fd, POLLIN, 0},
+                             {file_manager->watcher.inotify_fd, POLLIN, 0}}};
+
+    if (!events.keys.empty()) {
+        timeout_ms = 0;
+    }
+
+    // the watcher's fd is -1 when it isn't running, poll() skips those
+    if (poll(fds.data(), fds.size(), timeout_ms) <= 0) {
+        return;
+    }
+
+    if (fds[1].revents & POLLIN) {
+        uint64_t wakes;
+        [[maybe_unused]] ssize_t size = read(wake_fd, &wakes, sizeof(wakes));
+    }
+
+    // everything typed so far, a held key queues plenty of them
+    if (fds[0].revents & POLLIN) {
+        timeout(0);
+        for (int key = getch(); key != ERR; key = getch()) {
+            events.keys.push_back(key);
+        }
+    }
+}
+
+// Frames are at least frame_interval apart, 0 if one can be drawn now or
+// the milliseconds to wait otherwise
+int frame_delay(FileManager *file_manager)
+{
+    const EventLoop &events = file_manager->events;
+    auto elapsed = chrono::steady_clock::now() - events.last_frame;
+
+    if (elapsed >= events.frame_interval) {
+        return 0;
+    }
+    return chrono::duration_cast<chrono::milliseconds>(events.frame_interval -
+                                                       elapsed)
+               .count() +
+           1;
+}
@@ -1,7 +1,15 @@
+#include <cstring>
 #include <ctime>
 
 #include "file_manager.hpp"
 
+// how often the lists are refreshed while a folder is being read
+static const int LOADING_REFRESH_MS = 30;
+// and the jobs' running times while they're shown
+static const int JOBS_REFRESH_MS = 500;
+// and the progress of the file operations
+static const int OPERATIONS_REFRESH_MS = 250;
+
 void change_folder(FileManager *file_manager, const string &folder)
 {
     if (chdir(folder.c_str()) == -1) {
@@ -11,21 +19,36 @@ void change_folder(FileManager *file_manager, const string &folder)
     file_manager->file_position = 0;
     file_manager->directory_change = true;
     file_manager->files.clear();
+    cancel_folder_load(file_manager);
+    stop_recursive_search(file_manager);
+    // the watcher keeps the git cache fresh, without it start over
+    if (file_manager->watcher.inotify_fd == -1) {
+        git_folder_changed(file_manager);
+    }
 }
 
 void handle_enter_key(FileManager *file_manager)
 {
-    fs::directory_entry selected_entry =
-        file_manager->files[file_manager->file_position];
+    FileEntry selected_entry = file_manager->files[file_manager->file_position];
 
     bool is_valid_directory = false;
 
-    if (fs::is_directory(selected_entry) && !fs::is_symlink(selected_entry)) {
+    if (selected_entry.is_directory() && !selected_entry.is_symlink()) {
         is_valid_directory = true;
     }
 
-    else if (fs::is_symlink(selected_entry)) {
-        fs::path symlink_target = fs::read_symlink(selected_entry);
+    // files open in the pager
+    else if (selected_entry.is_regular_file()) {
+        if (selected_entry.is_readable() && selected_entry.file_size() != 0) {
+            open_pager(file_manager, selected_entry);
+        }
+        return;
+    }
+
+    else if (selected_entry.is_symlink()) {
+        error_code error;
+        fs::path symlink_target =
+            fs::read_symlink(selected_entry.path(), error);
         // an example of this bullshit is /usr/bin/X11 which just links to .
         if (symlink_target.string() != ".") {
             is_valid_directory = true;
@@ -33,7 +56,7 @@ void handle_enter_key(FileManager *file_manager)
     }
 
     if (is_valid_directory) {
-        string folder_name = selected_entry.path().filename().string();
+        string folder_name(selected_entry.name());
         change_folder(file_manager, folder_name);
     }
 }
@@ -44,20 +67,20 @@ void handle_preview_toggle(WINDOW *file_preview_wd, WINDOW *files_list_wd,
     file_manager->preview = !file_manager->preview;
     if (!file_manager->preview) {
         werase(file_preview_wd);
-        wrefresh(file_preview_wd);
+        wnoutrefresh(file_preview_wd);
         wresize(files_list_wd, LINES - 3, COLS);
         wresize(shell_wd, 3, COLS);
     } else {
         wresize(files_list_wd, LINES - 3, COLS / 2);
         wresize(shell_wd, 3, COLS / 2);
     }
+    invalidate_screen(file_manager);
 }
 
-int get_user_input(FileManager *file_manager, WINDOW *file_preview_wd,
-                   WINDOW *files_list_wd, WINDOW *shell_wd)
+int get_user_input(FileManager *file_manager, int input,
+                   WINDOW *file_preview_wd, WINDOW *files_list_wd,
+                   WINDOW *shell_wd)
 {
-    int input = getch();
-
     if (input == 'h') {
         file_manager->help_menu = !file_manager->help_menu;
     }
@@ -79,15 +102,32 @@ int get_user_input(FileManager *file_manager, WINDOW *file_preview_wd,
 
     if (input == 'f') {
         file_manager->in_search = true;
+        stop_recursive_search(file_manager);
+    }
+
+    // search the subfolders too, by name or by content
+    if (input == 'F' || input == 'g') {
+        file_manager->in_search = true;
+        file_manager->search_contents = input == 'g';
+        start_recursive_search(file_manager);
     }
 
     // loop through sorts
     if (input == 's') {
         file_manager->sort_type++;
-        if (file_manager->sort_type > FIRST_MODIFIED) {
+        if (file_manager->sort_type > TREE_SIZE_DECREASING) {
             file_manager->sort_type = 0;
         }
-        file_manager->directory_change = true;
+        // nothing is measured any more, whatever is done stays known
+        if (!is_tree_size_sort(file_manager->sort_type)) {
+            cancel_disk_usage(file_manager);
+        }
+        // search results are only sorted again, not searched again
+        if (file_manager->recursive_search) {
+            sort_files(file_manager, &file_manager->files);
+        } else {
+            file_manager->directory_change = true;
+        }
     }
 
     // move through files
@@ -124,6 +164,44 @@ int get_user_input(FileManager *file_manager, WINDOW *file_preview_wd,
         file_manager->in_shell = true;
     }
 
+    // the jobs started from the shell, over the preview pane
+    if (input == 'j') {
+        file_manager->jobs.visible = !file_manager->jobs.visible;
+        if (file_manager->jobs.visible && !file_manager->preview) {
+            handle_preview_toggle(file_preview_wd, files_list_wd, shell_wd,
+                                  file_manager);
+        }
+        invalidate_screen(file_manager);
+    }
+    if (input == 'J') {
+        show_next_job(file_manager);
+    }
+    if (input == 'K') {
+        stop_job(file_manager, file_manager->jobs.shown);
+    }
+
+    // marked entries, copied or moved into the cwd, deleted, chmoded
+    if (input == ' ') {
+        toggle_mark(file_manager);
+    }
+    if (input == 'M') {
+        toggle_all_marks(file_manager);
+    }
+    if (input == 'c') {
+        start_file_operation(file_manager, OPERATION_COPY);
+    }
+    if (input == 'v') {
+        start_file_operation(file_manager, OPERATION_MOVE);
+    }
+    if (input == 'D' || input == 'C') {
+        open_operation_prompt(file_manager,
+                              input == 'D' ? OPERATION_DELETE
+                                           : OPERATION_CHMOD);
+    }
+    if (input == 'X') {
+        cancel_file_operations(file_manager);
+    }
+
     if (input == 'q') {
         return -1;
     }
@@ -131,20 +209,138 @@ int get_user_input(FileManager *file_manager, WINDOW *file_preview_wd,
 }
 
 void display_panes(WINDOW *files_list_wd, WINDOW *file_preview_wd,
-                   WINDOW *shell_wd, WINDOW *help_wd, FileManager *file_manager)
+                   WINDOW *shell_wd, WINDOW *help_wd, WINDOW *pager_wd,
+                   WINDOW *perf_wd, FileManager *file_manager)
 {
-    if (file_manager->help_menu) {
-        display_help(help_wd);
+    PerfScope perf_scope(PERF_FRAME);
+
+    if (file_manager->pager) {
+        display_pager(pager_wd, file_manager);
+        invalidate_screen(file_manager);
+    } else if (file_manager->help_menu) {
+        display_help(help_wd, file_manager);
+        invalidate_screen(file_manager);
     } else {
+        // coming back from the pager or the help menu, every pane is drawn
+        // over them again
+        if (file_manager->screen.list_rows.empty()) {
+            touchwin(shell_wd);
+        }
         display_files(files_list_wd, file_manager);
-        if (file_manager->files.size() != 0 && file_manager->preview) {
+        if (file_manager->jobs.visible && file_manager->preview) {
+            display_jobs(file_preview_wd, file_manager);
+        } else if (file_manager->files.size() != 0 && file_manager->preview) {
             preview_file(file_manager->files[file_manager->file_position],
                          file_preview_wd, file_manager);
         }
-        display_shell(shell_wd, file_manager->in_shell);
+        display_shell(shell_wd, file_manager);
         display_search(shell_wd, file_manager);
+        display_operations(shell_wd, file_manager);
+    }
+    // on top of everything, numbers change every frame anyway
+    if (file_manager->perf.overlay) {
+        display_perf_overlay(perf_wd, file_manager);
+    }
+    update_screen(file_manager);
+}
+
+// How long the loop may wait for input before something in the background
+// needs it, -1 to wait for input only. Workers that finish wake the loop
+// themselves, this is for progress shown while they run.
+static int get_input_timeout(FileManager *file_manager)
+{
+    if (file_manager->recursive_walk || pager_pending(file_manager)) {
+        return LOADING_REFRESH_MS;
+    }
+
+    int watcher_timeout = folder_watcher_timeout(file_manager);
+    int preview_timeout = preview_work_timeout(file_manager);
+    if (file_manager->jobs.visible && running_jobs(file_manager) != 0) {
+        preview_timeout = preview_timeout == -1
+                              ? JOBS_REFRESH_MS
+                              : min(preview_timeout, JOBS_REFRESH_MS);
+    }
+    if (!file_manager->operations.running.empty()) {
+        preview_timeout = preview_timeout == -1
+                              ? OPERATIONS_REFRESH_MS
+                              : min(preview_timeout, OPERATIONS_REFRESH_MS);
+    }
+    if (watcher_timeout == -1 || preview_timeout == -1) {
+        return max(watcher_timeout, preview_timeout);
     }
-    doupdate();
+    return min(watcher_timeout, preview_timeout);
+}
+
+// Keys that only move through the list or the pager, a run of them is drawn
+// once
+static bool is_cursor_key(FileManager *file_manager, int input)
+{
+    if (file_manager->pager) {
+        return file_manager->pager->prompt == 0 &&
+               (input == KEY_UP || input == KEY_DOWN || input == 'j' ||
+                input == 'k' || input == KEY_NPAGE || input == KEY_PPAGE ||
+                input == ' ' || input == 'b');
+    }
+    if (file_manager->in_shell || file_manager->in_search ||
+        file_manager->help_menu) {
+        return false;
+    }
+    return input == KEY_UP || input == KEY_DOWN || input == 534 ||
+           input == 575;
+}
+
+static int handle_key(FileManager *file_manager, int input,
+                      WINDOW *file_preview_wd, WINDOW *files_list_wd,
+                      WINDOW *shell_wd)
+{
+    // works over anything, the shell doesn't take control keys
+    if (input == CTRL('p')) {
+        toggle_perf_overlay(file_manager);
+        return 0;
+    }
+
+    if (file_manager->pager) {
+        handle_pager_input(file_manager, input);
+    } else if (file_manager->in_shell) {
+        handle_shell_input(file_manager, input);
+    } else if (file_manager->in_search) {
+        handle_search_input(file_manager, input);
+    } else if (file_manager->operations.prompt != -1) {
+        handle_operation_prompt(file_manager, input);
+    } else {
+        return get_user_input(file_manager, input, file_preview_wd,
+                              files_list_wd, shell_wd);
+    }
+    return 0;
+}
+
+// Handles the keys read so far. A run of cursor moves only changes the
+// position and is drawn in one frame; any other key is handled alone so the
+// loop can load what it asks for first.
+static int handle_keys(FileManager *file_manager, WINDOW *file_preview_wd,
+                       WINDOW *files_list_wd, WINDOW *shell_wd)
+{
+    deque<int> &keys = file_manager->events.keys;
+
+    if (keys.empty()) {
+        return 0;
+    }
+
+    PerfScope perf_scope(PERF_INPUT);
+    int input = keys.front();
+    keys.pop_front();
+    bool cursor_key = is_cursor_key(file_manager, input);
+    int user_return = handle_key(file_manager, input, file_preview_wd,
+                                 files_list_wd, shell_wd);
+
+    while (user_return == 0 && cursor_key && !keys.empty() &&
+           is_cursor_key(file_manager, keys.front())) {
+        input = keys.front();
+        keys.pop_front();
+        user_return = handle_key(file_manager, input, file_preview_wd,
+                                 files_list_wd, shell_wd);
+    }
+    return user_return;
 }
 
 int main_app_loop(FileManager *file_manager)
@@ -160,43 +356,148 @@ int main_app_loop(FileManager *file_manager)
     file_manager->in_search = false;
     int user_return = 0;
 
+    start_event_loop(file_manager);
+    setup_folders_cache(file_manager);
+    open_listing_store(file_manager);
+    setup_preview_cache(file_manager);
+    start_preview_work(file_manager);
+    setup_sorting(file_manager);
+    setup_recursive_search(file_manager);
+    setup_file_operations(file_manager);
+    start_child_counts(file_manager);
+    start_disk_usage(file_manager);
+    start_folder_watcher(file_manager);
+    start_git_status(file_manager);
+
     WINDOW *files_list_wd = subwin(stdscr, LINES - 3, COLS / 2, 0, 0);
 
     WINDOW *file_preview_wd = subwin(stdscr, LINES, COLS / 2, 0, COLS / 2);
 
     WINDOW *shell_wd = subwin(stdscr, 3, COLS / 2, LINES - 3, 0);
 
-    WINDOW *help_wd = subwin(stdscr, LINES / 2, COLS / 2, LINES / 4, COLS / 4);
+    int help_height = min(LINES, max(LINES / 2, get_help_height()));
+    WINDOW *help_wd = subwin(stdscr, help_height, COLS / 2,
+                             (LINES - help_height) / 2, COLS / 4);
+
+    WINDOW *pager_wd = subwin(stdscr, LINES, COLS, 0, 0);
+
+    WINDOW *perf_wd = create_perf_overlay();
 
     while (user_return == 0) {
         if (file_manager->directory_change) {
-            file_manager->files =
-                load_folder(file_manager, file_manager->cwd, false, true);
+            recheck_tree_sizes(file_manager->disk_usage.get());
+            if (file_manager->recursive_search) {
+                start_recursive_search(file_manager);
+            } else {
+                start_folder_load(file_manager, file_manager->cwd, false);
+            }
             file_manager->directory_change = false;
         }
-        display_panes(files_list_wd, file_preview_wd, shell_wd, help_wd,
-                      file_manager);
-        if (file_manager->in_shell) {
-            int return_value = handle_shell_input(shell_wd, file_manager);
-            handle_shell_return(return_value, file_manager);
-        } else if (file_manager->in_search) {
-            int search_return = handle_search_input(file_manager);
-            handle_shell_return(search_return, file_manager);
-        } else {
-            user_return = get_user_input(file_manager, file_preview_wd,
-                                         files_list_wd, shell_wd);
+        poll_folder_load(file_manager);
+        poll_recursive_search(file_manager);
+        // counts coming in move the folders still uncounted (put last) in the
+        // size sorts
+        if (poll_child_counts(file_manager->child_counts.get()) &&
+            (file_manager->sort_type == FILE_SIZE_INCREASING ||
+             file_manager->sort_type == FILE_SIZE_DECREASING)) {
+            resort_files(file_manager);
         }
+        // totals coming in move the folders around in the tree size sorts
+        if (poll_disk_usage(file_manager->disk_usage.get()) &&
+            is_tree_size_sort(file_manager->sort_type)) {
+            resort_files(file_manager);
+        }
+        read_folder_events(file_manager);
+        apply_folder_changes(file_manager, false);
+        update_git_status(file_manager);
+        poll_pager(file_manager);
+        poll_preview_work(file_manager);
+        poll_jobs(file_manager);
+        poll_file_operations(file_manager);
+        sync_marks(file_manager);
+
+        // at most one frame per frame_interval, the keys typed meanwhile
+        // are drawn together
+        int timeout_ms = get_input_timeout(file_manager);
+        int delay_ms = frame_delay(file_manager);
+        if (delay_ms == 0) {
+            display_panes(files_list_wd, file_preview_wd, shell_wd, help_wd,
+                          pager_wd, perf_wd, file_manager);
+            file_manager->events.last_frame = chrono::steady_clock::now();
+            if (perf_enabled) {
+                end_perf_frame(file_manager);
+            }
+        } else if (timeout_ms == -1 || delay_ms < timeout_ms) {
+            timeout_ms = delay_ms;
+        }
+
+        wait_for_events(file_manager, timeout_ms);
+        user_return = handle_keys(file_manager, file_preview_wd,
+                                  files_list_wd, shell_wd);
     }
+    cancel_folder_load(file_manager);
+    cancel_recursive_search(file_manager);
+    close_pager(file_manager);
+    stop_jobs(file_manager);
+    cancel_file_operations(file_manager);
+    stop_preview_work(file_manager);
+    stop_child_counts(file_manager);
+    stop_disk_usage(file_manager);
+    stop_folder_watcher(file_manager);
+    stop_git_status(file_manager);
+    save_listing_store(file_manager);
     return 0;
 }
 
-int main()
+int main(int argc, char **argv)
 {
-    if (start_ncurses() == 1) {
-        return 1;
+    // --trace works with and without the interface, it's taken out before
+    // the rest goes to --list
+    vector<char *> arguments = {argv[0]};
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--trace") != 0) {
+            arguments.push_back(argv[i]);
+        } else if (i + 1 == argc) {
+            fprintf(stderr, "file_manager: --trace needs a file\n");
+            return 2;
+        } else if (!start_perf_trace(argv[++i])) {
+            return 1;
+        }
+    }
+    name_perf_thread("main");
+
+    bool list = any_of(arguments.begin() + 1, arguments.end(),
+                       [](const char *argument) {
+                           return strcmp(argument, "--list") == 0;
+                       });
+    // the interface takes no other option
+    if (!list && arguments.size() > 1) {
+        bool help = strcmp(arguments[1], "--help") == 0 ||
+                    strcmp(arguments[1], "-h") == 0;
+        if (!help) {
+            fprintf(stderr, "file_manager: unknown option '%s'\n",
+                    arguments[1]);
+        }
+        fprintf(help ? stdout : stderr,
+                "usage: file_manager [--trace FILE]\n"
+                "       file_manager --list [DIR] [OPTIONS] (--list --help "
+                "for them)\n");
+        stop_perf_trace();
+        return help ? 0 : 2;
+    }
+
+    int status = 0;
+    // scripts get the listing on stdout, without the interface
+    if (list) {
+        status = run_list_mode(arguments.size(), arguments.data());
+    } else if (start_ncurses() == 1) {
+        status = 1;
+    } else {
+        handle_signals();
+        FileManager file_manager;
+        main_app_loop(&file_manager);
+        close_ncurses();
     }
-    handle_signals();
-    FileManager file_manager;
-    main_app_loop(&file_manager);
-    close_ncurses();
+    stop_perf_trace();
+    return status;
 }
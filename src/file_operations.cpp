@@ -0,0 +1,904 @@
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <cerrno>
+#include <cstring>
+#include "file_manager.hpp"
+
+// errors listed per operation, the others are only counted
+static const size_t MAX_OPERATION_ERRORS = 16;
+// bytes per copy_file_range(), the progress moves this often on big files
+static const size_t COPY_CHUNK_SIZE = 8 * 1024 * 1024;
+// for the read/write copy when the kernel can't do it
+static const size_t COPY_BUFFER_SIZE = 1024 * 1024;
+// entries a folder read hands to the other workers at once
+static const size_t TASK_BATCH_SIZE = 256;
+
+static const char *const RUNNING_VERBS[] = {"Copying", "Moving", "Deleting",
+                                            "Changing the mode of"};
+static const char *const DONE_VERBS[] = {"Copied", "Moved", "Deleted",
+                                         "Changed the mode of"};
+
+OperationFolder::~OperationFolder()
+{
+    if (fd != -1) {
+        close(fd);
+    }
+    if (parent_fd != -1) {
+        close(parent_fd);
+    }
+}
+
+// Marking in another folder drops the marks of the last one
+void Marks::toggle(const shared_ptr<EntryTable> &of, uint32_t row)
+{
+    if (table != of) {
+        clear();
+        table = of;
+        names_version = of->names_version;
+    }
+    if (bits.size() <= row / 64) {
+        bits.resize(row / 64 + 1);
+    }
+
+    uint64_t bit = uint64_t(1) << (row % 64);
+    bits[row / 64] ^= bit;
+    if (bits[row / 64] & bit) {
+        count++;
+    } else {
+        count--;
+    }
+}
+
+void Marks::clear()
+{
+    table.reset();
+    names_version = 0;
+    bits.clear();
+    count = 0;
+}
+
+// FILE_MANAGER_OPS_THREADS files at once per operation, one per core and at
+// least 4 since they mostly wait on the disk
+void setup_file_operations(FileManager *file_manager)
+{
+    size_t threads = max(thread::hardware_concurrency(), 4U);
+    if (const char *env_threads = getenv("FILE_MANAGER_OPS_THREADS")) {
+        threads = max(atoi(env_threads), 1);
+    }
+    file_manager->operations.threads = threads;
+}
+
+// SPACE, marks the selected entry and moves on to the next one
+void toggle_mark(FileManager *file_manager)
+{
+    FileList &files = file_manager->files;
+
+    if (files.empty()) {
+        return;
+    }
+    file_manager->marks.toggle(files.table,
+                               files.rows[file_manager->file_position]);
+    if (file_manager->file_position + 1 < files.size()) {
+        file_manager->file_position++;
+    }
+}
+
+// M, every entry of the list or none of them
+void toggle_all_marks(FileManager *file_manager)
+{
+    Marks &marks = file_manager->marks;
+    FileList &files = file_manager->files;
+
+    bool marked = marks.count != 0 && marks.table == files.table;
+    marks.clear();
+    if (marked) {
+        return;
+    }
+    for (uint32_t row : files.rows) {
+        marks.toggle(files.table, row);
+    }
+}
+
+// Follows the marked folder when its listing is read again, by name. Rows
+// moved in place (the watcher removed entries) can't be told apart anymore,
+// the marks are dropped then. Search results aren't a listing of their
+// folder and are left alone.
+void sync_marks(FileManager *file_manager)
+{
+    Marks &marks = file_manager->marks;
+
+    if (marks.count == 0) {
+        return;
+    }
+    if (marks.table->names_version != marks.names_version) {
+        marks.clear();
+        return;
+    }
+
+    shared_ptr<EntryTable> *cached =
+        file_manager->folders_cache.peek(marks.table->folder);
+    if (cached == nullptr || *cached == marks.table ||
+        marks.table->folder_inode == 0) {
+        return;
+    }
+
+    const EntryTable &table = **cached;
+    unordered_map<string_view, uint32_t> rows;
+    for (uint32_t row = 0; row < table.size(); row++) {
+        rows.emplace(table.name(row), row);
+    }
+
+    Marks moved;
+    for (uint32_t row = 0; row < marks.table->size(); row++) {
+        if (!marks.is_marked(marks.table.get(), row)) {
+            continue;
+        }
+        auto found = rows.find(marks.table->name(row));
+        if (found != rows.end()) {
+            moved.toggle(*cached, found->second);
+        }
+    }
+    marks = move(moved);
+}
+
+// The sources removed after a move across filesystems were already counted
+// once copied
+static bool is_counted(const FileOperation *operation, int type)
+{
+    return operation->type != OPERATION_MOVE || type != OPERATION_DELETE;
+}
+
+static void add_operation_error(FileOperation *operation, const string &path,
+                                int error)
+{
+    lock_guard<mutex> guard(operation->lock);
+    operation->error_count++;
+    if (operation->errors.size() < MAX_OPERATION_ERRORS) {
+        operation->errors.push_back(path + ": " + strerror(error));
+    }
+}
+
+// Hands tasks to the workers, their folder waits for them
+static void queue_tasks(FileOperation *operation,
+                        vector<OperationTask> *tasks)
+{
+    if (tasks->empty()) {
+        return;
+    }
+    {
+        lock_guard<mutex> guard(operation->lock);
+        for (OperationTask &task : *tasks) {
+            if (task.is_folder) {
+                if (task.folder->parent) {
+                    task.folder->parent->pending++;
+                }
+            } else if (task.folder) {
+                task.folder->pending++;
+            }
+            operation->queue.push_back(move(task));
+        }
+    }
+    tasks->clear();
+    operation->wake.notify_all();
+}
+
+// One less task pending under folder. The copies of the folders it
+// completes get their mode and times, deleted ones are removed, deepest
+// first: a folder is done with before its parent is counted down, so the
+// parent can't complete in another worker while it's still there.
+static void finish_folder(FileOperation *operation, int type,
+                          OperationFolder *folder)
+{
+    for (; folder != nullptr; folder = folder->parent.get()) {
+        {
+            lock_guard<mutex> guard(operation->lock);
+            if (--folder->pending != 0) {
+                return;
+            }
+        }
+
+        if (type == OPERATION_DELETE) {
+            if (folder->fd != -1) {
+                close(folder->fd);
+                folder->fd = -1;
+            }
+            int parent_fd =
+                folder->parent ? folder->parent->fd : folder->parent_fd;
+            if (unlinkat(parent_fd, folder->name.c_str(), AT_REMOVEDIR) ==
+                0) {
+                operation->done_files += is_counted(operation, type);
+            } else if (!operation->cancelled) {
+                add_operation_error(operation, folder->source, errno);
+            }
+            continue;
+        }
+        if (folder->failed) {
+            continue;
+        }
+        const struct stat &source_stat = folder->source_stat;
+        struct timespec times[2] = {source_stat.st_atim, source_stat.st_mtim};
+        fchmodat(AT_FDCWD, folder->destination.c_str(),
+                 source_stat.st_mode & 07777, 0);
+        utimensat(AT_FDCWD, folder->destination.c_str(), times, 0);
+        operation->done_files++;
+    }
+}
+
+// Clone of the extents when the filesystem shares them (btrfs, xfs), else
+// copy_file_range() which stays in the kernel (and on the server for NFS),
+// else read and write
+static bool copy_file_data(FileOperation *operation, int input, int output,
+                           uint64_t size)
+{
+    if (ioctl(output, FICLONE, input) == 0) {
+        operation->cloned_files++;
+        operation->done_bytes += size;
+        return true;
+    }
+
+    bool in_kernel = true;
+    vector<char> buffer;
+
+    while (!operation->cancelled) {
+        ssize_t copied;
+        if (in_kernel) {
+            copied = copy_file_range(input, nullptr, output, nullptr,
+                                     COPY_CHUNK_SIZE, 0);
+            if (copied == -1 && (errno == EXDEV || errno == ENOSYS ||
+                                 errno == EINVAL || errno == EOPNOTSUPP)) {
+                in_kernel = false;
+                buffer.resize(COPY_BUFFER_SIZE);
+                continue;
+            }
+        } else {
+            copied = read(input, buffer.data(), buffer.size());
+            for (ssize_t written = 0; copied > 0 && written < copied;) {
+                ssize_t size = write(output, buffer.data() + written,
+                                     copied - written);
+                if (size == -1 && errno != EINTR) {
+                    return false;
+                }
+                written += max<ssize_t>(size, 0);
+            }
+        }
+
+        if (copied == 0) {
+            return true;
+        }
+        if (copied == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        operation->done_bytes += copied;
+    }
+    errno = ECANCELED;
+    return false;
+}
+
+// A half written copy is removed
+static void copy_file(FileOperation *operation, const string &source,
+                      const string &destination)
+{
+    int input = open(source.c_str(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    perf_count(PERF_OPENS);
+    if (input == -1) {
+        add_operation_error(operation, source, errno);
+        return;
+    }
+
+    struct stat source_stat;
+    fstat(input, &source_stat);
+    int output = open(destination.c_str(),
+                      O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    perf_count(PERF_OPENS);
+    if (output == -1) {
+        add_operation_error(operation, destination, errno);
+        close(input);
+        return;
+    }
+
+    bool copied = copy_file_data(operation, input, output, source_stat.st_size);
+    int error = errno;
+    if (copied) {
+        struct timespec times[2] = {source_stat.st_atim, source_stat.st_mtim};
+        fchmod(output, source_stat.st_mode & 07777);
+        futimens(output, times);
+    }
+    if (close(output) != 0 && copied) {
+        copied = false;
+        error = errno;
+    }
+    close(input);
+
+    if (!copied) {
+        unlink(destination.c_str());
+        if (error != ECANCELED) {
+            add_operation_error(operation, source, error);
+        }
+        return;
+    }
+    operation->done_files++;
+}
+
+static void copy_symlink(FileOperation *operation, const string &source,
+                         const string &destination)
+{
+    char target[PATH_MAX];
+    ssize_t size = readlink(source.c_str(), target, sizeof(target) - 1);
+
+    if (size == -1) {
+        add_operation_error(operation, source, errno);
+        return;
+    }
+    target[size] = '\0';
+    if (symlink(target, destination.c_str()) != 0) {
+        add_operation_error(operation, destination, errno);
+        return;
+    }
+    operation->done_files++;
+}
+
+// Creates the copy of the task's folder and queues what's in it, the files
+// are copied by whichever workers are free
+static void copy_folder(FileOperation *operation, const OperationTask &task)
+{
+    OperationFolder *folder = task.folder.get();
+    DIR *dir = nullptr;
+
+    if (mkdir(folder->destination.c_str(), 0700) != 0) {
+        folder->failed = true;
+        add_operation_error(operation, folder->destination, errno);
+    } else if ((dir = opendir(folder->source.c_str())) == nullptr) {
+        add_operation_error(operation, folder->source, errno);
+    }
+    perf_count(PERF_OPENS);
+
+    vector<OperationTask> tasks;
+    while (dir != nullptr && !operation->cancelled) {
+        const struct dirent *entry = readdir(dir);
+        if (entry == nullptr) {
+            break;
+        }
+        const char *name = entry->d_name;
+        if (name[0] == '.' &&
+            (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+            continue;
+        }
+
+        string source = folder->source + '/' + name;
+        string destination = folder->destination + '/' + name;
+        struct stat file_stat;
+        perf_count(PERF_STATS);
+        if (fstatat(dirfd(dir), name, &file_stat, AT_SYMLINK_NOFOLLOW) != 0) {
+            add_operation_error(operation, source, errno);
+            continue;
+        }
+        operation->found_files++;
+
+        if (S_ISDIR(file_stat.st_mode)) {
+            auto subfolder = make_shared<OperationFolder>();
+            subfolder->source = source;
+            subfolder->destination = destination;
+            subfolder->source_stat = file_stat;
+            subfolder->parent = task.folder;
+            tasks.push_back({OPERATION_COPY, source, destination, true,
+                             subfolder});
+        } else if (S_ISREG(file_stat.st_mode)) {
+            operation->found_bytes += file_stat.st_size;
+            tasks.push_back({OPERATION_COPY, move(source), move(destination),
+                             false, task.folder});
+        } else if (S_ISLNK(file_stat.st_mode)) {
+            copy_symlink(operation, source, destination);
+        } else {
+            add_operation_error(operation, source, ENOTSUP);
+        }
+
+        if (tasks.size() >= TASK_BATCH_SIZE) {
+            queue_tasks(operation, &tasks);
+        }
+    }
+    if (dir != nullptr) {
+        closedir(dir);
+    }
+
+    queue_tasks(operation, &tasks);
+    finish_folder(operation, OPERATION_COPY, folder);
+}
+
+// Unlinks the files of the task's folder through its fd and queues the
+// subfolders, the folder itself goes once they're all gone
+static void delete_folder(FileOperation *operation, const OperationTask &task)
+{
+    OperationFolder *folder = task.folder.get();
+    int parent_fd = folder->parent ? folder->parent->fd : folder->parent_fd;
+    folder->fd = openat(parent_fd, folder->name.c_str(),
+                        O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    perf_count(PERF_OPENS);
+    // the read gets a copy, folder->fd stays open for the removal
+    int read_fd = folder->fd == -1 ? -1 : fcntl(folder->fd, F_DUPFD_CLOEXEC, 0);
+    DIR *dir = read_fd == -1 ? nullptr : fdopendir(read_fd);
+    int folder_fd = folder->fd;
+
+    if (dir == nullptr) {
+        add_operation_error(operation, folder->source, errno);
+        if (read_fd != -1) {
+            close(read_fd);
+        }
+    }
+
+    vector<OperationTask> tasks;
+    while (dir != nullptr && !operation->cancelled) {
+        const struct dirent *entry = readdir(dir);
+        if (entry == nullptr) {
+            break;
+        }
+        const char *name = entry->d_name;
+        if (name[0] == '.' &&
+            (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+            continue;
+        }
+        operation->found_files += is_counted(operation, OPERATION_DELETE);
+
+        bool is_folder = entry->d_type == DT_DIR;
+        struct stat file_stat;
+        if (entry->d_type == DT_UNKNOWN &&
+            fstatat(folder_fd, name, &file_stat, AT_SYMLINK_NOFOLLOW) == 0) {
+            is_folder = S_ISDIR(file_stat.st_mode);
+        }
+
+        if (is_folder) {
+            auto subfolder = make_shared<OperationFolder>();
+            subfolder->source = folder->source + '/' + name;
+            subfolder->name = name;
+            subfolder->parent = task.folder;
+            tasks.push_back({OPERATION_DELETE, subfolder->source, "", true,
+                             subfolder});
+        } else if (unlinkat(folder_fd, name, 0) == 0) {
+            operation->done_files += is_counted(operation, OPERATION_DELETE);
+        } else {
+            add_operation_error(operation, folder->source + '/' + name, errno);
+        }
+
+        if (tasks.size() >= TASK_BATCH_SIZE) {
+            queue_tasks(operation, &tasks);
+        }
+    }
+    if (dir != nullptr) {
+        closedir(dir);
+    }
+
+    queue_tasks(operation, &tasks);
+    finish_folder(operation, OPERATION_DELETE, folder);
+}
+
+// rename() that doesn't replace what's already there
+static bool rename_entry(const string &source, const string &destination)
+{
+    if (renameat2(AT_FDCWD, source.c_str(), AT_FDCWD, destination.c_str(),
+                  RENAME_NOREPLACE) == 0) {
+        return true;
+    }
+    // the filesystem can't do it in one go. link() fails if destination
+    // exists, with no window for it to be created in; folders can't be
+    // linked and are refused.
+    if (errno != EINVAL && errno != ENOSYS) {
+        return false;
+    }
+    if (link(source.c_str(), destination.c_str()) != 0) {
+        return false;
+    }
+    if (unlink(source.c_str()) != 0) {
+        int error = errno;
+        unlink(destination.c_str());
+        errno = error;
+        return false;
+    }
+    return true;
+}
+
+// One of the marked entries
+static void run_top_task(FileOperation *operation, OperationTask task)
+{
+    struct stat source_stat;
+
+    if (lstat(task.source.c_str(), &source_stat) != 0) {
+        add_operation_error(operation, task.source, errno);
+        return;
+    }
+    operation->found_files += is_counted(operation, task.type);
+
+    if (task.type == OPERATION_CHMOD) {
+        if (fchmodat(AT_FDCWD, task.source.c_str(), operation->mode, 0) == 0) {
+            operation->done_files++;
+        } else {
+            add_operation_error(operation, task.source, errno);
+        }
+        return;
+    }
+
+    if (task.type == OPERATION_MOVE) {
+        if (rename_entry(task.source, task.destination)) {
+            operation->done_files++;
+            return;
+        }
+        if (errno != EXDEV) {
+            add_operation_error(operation, task.source, errno);
+            return;
+        }
+        // another filesystem, copied and then deleted
+        lock_guard<mutex> guard(operation->lock);
+        operation->copied_sources.push_back(task.source);
+    }
+
+    bool is_folder = S_ISDIR(source_stat.st_mode);
+    if (task.type != OPERATION_DELETE && task.destination == task.source) {
+        add_operation_error(operation, task.destination, EEXIST);
+        return;
+    }
+    if (task.type != OPERATION_DELETE && is_folder &&
+        (task.destination + '/').compare(0, task.source.size() + 1,
+                                         task.source + '/') == 0) {
+        add_operation_error(operation, task.destination, EINVAL);
+        return;
+    }
+
+    if (is_folder) {
+        task.folder = make_shared<OperationFolder>();
+        task.folder->source = task.source;
+        task.folder->destination = task.destination;
+        task.folder->source_stat = source_stat;
+        task.is_folder = true;
+        if (task.type == OPERATION_DELETE) {
+            fs::path source(task.source);
+            task.folder->name = source.filename().string();
+            task.folder->parent_fd =
+                open(source.parent_path().c_str(),
+                     O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            perf_count(PERF_OPENS);
+            if (task.folder->parent_fd == -1) {
+                add_operation_error(operation, task.source, errno);
+                return;
+            }
+            delete_folder(operation, task);
+        } else {
+            copy_folder(operation, task);
+        }
+    } else if (task.type == OPERATION_DELETE) {
+        if (unlink(task.source.c_str()) == 0) {
+            operation->done_files += is_counted(operation, task.type);
+        } else {
+            add_operation_error(operation, task.source, errno);
+        }
+    } else if (S_ISREG(source_stat.st_mode)) {
+        operation->found_bytes += source_stat.st_size;
+        copy_file(operation, task.source, task.destination);
+    } else if (S_ISLNK(source_stat.st_mode)) {
+        copy_symlink(operation, task.source, task.destination);
+    } else {
+        add_operation_error(operation, task.source, ENOTSUP);
+    }
+}
+
+static void run_task(FileOperation *operation, const OperationTask &task)
+{
+    if (operation->cancelled) {
+        // the folders above it never complete, nothing is left half done
+        return;
+    }
+    if (!task.is_folder && !task.folder) {
+        run_top_task(operation, task);
+    } else if (!task.is_folder) {
+        copy_file(operation, task.source, task.destination);
+        finish_folder(operation, OPERATION_COPY, task.folder.get());
+    } else if (task.type == OPERATION_DELETE) {
+        delete_folder(operation, task);
+    } else {
+        copy_folder(operation, task);
+    }
+}
+
+// Called with the lock held once nothing is queued or running. Sources
+// moved across filesystems are deleted after a copy without errors.
+static bool finish_operation(FileOperation *operation)
+{
+    if (!operation->copied_sources.empty() && operation->error_count == 0 &&
+        !operation->cancelled) {
+        for (string &source : operation->copied_sources) {
+            operation->queue.push_back(
+                {OPERATION_DELETE, move(source), "", false, nullptr});
+        }
+        operation->copied_sources.clear();
+        operation->wake.notify_all();
+        return false;
+    }
+
+    operation->stopped = true;
+    operation->elapsed = chrono::steady_clock::now() - operation->started;
+    operation->finished = true;
+    operation->wake.notify_all();
+    wake_event_loop();
+    return true;
+}
+
+// Detached like the other workers, the queue is a stack so walks go deep
+// first and a folder's copies finish early
+static void operation_worker(shared_ptr<FileOperation> operation)
+{
+    name_perf_thread("file operation");
+    unique_lock<mutex> guard(operation->lock);
+
+    while (true) {
+        operation->wake.wait(guard, [&operation] {
+            return operation->stopped || !operation->queue.empty();
+        });
+        if (operation->stopped) {
+            return;
+        }
+
+        OperationTask task = move(operation->queue.back());
+        operation->queue.pop_back();
+        operation->busy++;
+        guard.unlock();
+
+        run_task(operation.get(), task);
+
+        guard.lock();
+        operation->busy--;
+        if (operation->queue.empty() && operation->busy == 0 &&
+            finish_operation(operation.get())) {
+            return;
+        }
+    }
+}
+
+// The marked entries, or the selected one when nothing is marked and the
+// operation doesn't need another folder
+static vector<string> get_operation_sources(FileManager *file_manager,
+                                            int type)
+{
+    const Marks &marks = file_manager->marks;
+    vector<string> sources;
+
+    if (marks.count != 0) {
+        for (uint32_t row = 0; row < marks.table->size(); row++) {
+            if (marks.is_marked(marks.table.get(), row)) {
+                sources.push_back(marks.table->path(row));
+            }
+        }
+    } else if ((type == OPERATION_DELETE || type == OPERATION_CHMOD) &&
+               !file_manager->files.empty()) {
+        sources.push_back(
+            file_manager->files[file_manager->file_position].path());
+    }
+    return sources;
+}
+
+// Copies or moves sources into the cwd, or deletes them or changes their
+// mode, in the background. The marks are used up.
+static void start_operation(FileManager *file_manager, int type,
+                            vector<string> sources)
+{
+    FileOperations &operations = file_manager->operations;
+    auto operation = make_shared<FileOperation>();
+
+    operation->type = type;
+    operation->sources = move(sources);
+    operation->destination = file_manager->cwd;
+    operation->mode = strtoul(operations.prompt_input.c_str(), nullptr, 8);
+    operation->started = chrono::steady_clock::now();
+    if (operation->sources.empty()) {
+        return;
+    }
+    file_manager->marks.clear();
+
+    string folder = operation->destination == "/" ? ""
+                                                  : operation->destination;
+    for (const string &source : operation->sources) {
+        string destination =
+            folder + '/' + fs::path(source).filename().string();
+        operation->queue.push_back({type, source, destination, false, nullptr});
+    }
+
+    // chmod doesn't go under the marked entries
+    size_t threads = operations.threads;
+    if (type == OPERATION_CHMOD) {
+        threads = min(threads, operation->sources.size());
+    }
+    for (size_t i = 0; i < threads; i++) {
+        thread(operation_worker, operation).detach();
+    }
+    operations.running.push_back(operation);
+    operations.last.reset();
+}
+
+// c and v, the marked entries
+void start_file_operation(FileManager *file_manager, int type)
+{
+    start_operation(file_manager, type,
+                    get_operation_sources(file_manager, type));
+}
+
+// D and C, asked about first
+void open_operation_prompt(FileManager *file_manager, int type)
+{
+    FileOperations &operations = file_manager->operations;
+
+    operations.prompt_sources = get_operation_sources(file_manager, type);
+    if (operations.prompt_sources.empty()) {
+        return;
+    }
+    operations.prompt = type;
+    operations.prompt_input.clear();
+    operations.prompt_marks = file_manager->marks;
+}
+
+// X, the files being copied are removed, the folders already done stay
+void cancel_file_operations(FileManager *file_manager)
+{
+    for (const shared_ptr<FileOperation> &operation :
+         file_manager->operations.running) {
+        lock_guard<mutex> guard(operation->lock);
+        operation->cancelled = true;
+        operation->queue.clear();
+        operation->copied_sources.clear();
+        if (operation->busy == 0 && !operation->finished) {
+            finish_operation(operation.get());
+        }
+    }
+}
+
+// Refreshes the folders the operations that finished since the last call
+// changed, returns true if one did
+bool poll_file_operations(FileManager *file_manager)
+{
+    FileOperations &operations = file_manager->operations;
+    bool finished = false;
+
+    for (auto operation = operations.running.begin();
+         operation != operations.running.end();) {
+        if (!(*operation)->finished) {
+            ++operation;
+            continue;
+        }
+        refresh_touched_folders(file_manager, (*operation)->destination,
+                                (*operation)->sources);
+        operations.last = *operation;
+        operation = operations.running.erase(operation);
+        finished = true;
+    }
+    return finished;
+}
+
+// y deletes, digits and ENTER change the mode, anything else gives up. So
+// does a change to the marks meanwhile (the watcher removed some), rather
+// than acting on something else than what was asked.
+int handle_operation_prompt(FileManager *file_manager, int input)
+{
+    FileOperations &operations = file_manager->operations;
+    string &mode = operations.prompt_input;
+    bool confirmed = false;
+
+    if (operations.prompt == OPERATION_CHMOD) {
+        if (input >= '0' && input <= '7' && mode.size() < 4) {
+            mode += input;
+            return 0;
+        }
+        if ((input == 263 || input == 127) && !mode.empty()) {
+            mode.pop_back();
+            return 0;
+        }
+        confirmed = input == 10 && !mode.empty();
+    } else {
+        confirmed = input == 'y';
+    }
+
+    if (confirmed && operations.prompt_marks == file_manager->marks) {
+        start_operation(file_manager, operations.prompt,
+                        move(operations.prompt_sources));
+    }
+    operations.prompt = -1;
+    operations.prompt_sources.clear();
+    operations.prompt_marks.clear();
+    mode.clear();
+    return 0;
+}
+
+// "1.2 GB/s"
+static string format_rate(uint64_t bytes, chrono::steady_clock::duration time)
+{
+    double seconds = chrono::duration<double>(time).count();
+
+    if (seconds <= 0) {
+        return "-";
+    }
+    return format_bytes(bytes / seconds) + "/s";
+}
+
+static string format_operation(const FileOperation &operation)
+{
+    bool finished = operation.finished;
+    auto elapsed = finished ? operation.elapsed
+                            : chrono::steady_clock::now() - operation.started;
+    string text = operation.cancelled && finished ? "Stopped: " : "";
+    bool copies = operation.type == OPERATION_COPY ||
+                  operation.found_bytes != 0;
+
+    text += (finished ? DONE_VERBS : RUNNING_VERBS)[operation.type];
+    text += ' ' + to_string(operation.done_files.load());
+    if (!finished) {
+        text += '/' + to_string(operation.found_files.load());
+    }
+    text += operation.done_files == 1 && finished ? " entry" : " entries";
+
+    if (copies) {
+        text += ", " + format_bytes(operation.done_bytes);
+        if (!finished) {
+            text += '/' + format_bytes(operation.found_bytes);
+        }
+        text += " at " + format_rate(operation.done_bytes, elapsed);
+    }
+    if (operation.cloned_files != 0) {
+        text += ", " + to_string(operation.cloned_files.load()) + " cloned";
+    }
+
+    char seconds[32];
+    snprintf(seconds, sizeof(seconds), ", %.1fs",
+             chrono::duration<double>(elapsed).count());
+    text += seconds;
+    return text;
+}
+
+// The question asked over the search line, the progress of the running
+// operations (or how the last one went) on the box's bottom border
+void display_operations(WINDOW *window, FileManager *file_manager)
+{
+    FileOperations &operations = file_manager->operations;
+    size_t width = getmaxx(window);
+
+    if (width < 8 || file_manager->in_shell) {
+        return;
+    }
+
+    if (operations.prompt != -1) {
+        size_t count = operations.prompt_sources.size();
+        wmove(window, 1, 1);
+        wclrtoeol(window);
+        if (operations.prompt == OPERATION_DELETE) {
+            wprintw(window, "Delete %ld entr%s? (y/n)", count,
+                    count == 1 ? "y" : "ies");
+        } else {
+            wprintw(window, "Mode of %ld entr%s (octal): %s_", count,
+                    count == 1 ? "y" : "ies", operations.prompt_input.c_str());
+        }
+        box(window, ACS_VLINE, ACS_HLINE);
+    }
+
+    string status;
+    if (!operations.running.empty()) {
+        const FileOperation &operation = *operations.running.front();
+        status = format_operation(operation);
+        if (operations.running.size() > 1) {
+            status += " (+" + to_string(operations.running.size() - 1) + ")";
+        }
+    } else if (operations.last) {
+        const FileOperation &operation = *operations.last;
+        lock_guard<mutex> guard(operations.last->lock);
+        status = format_operation(operation);
+        if (operation.error_count != 0) {
+            status += ", " + to_string(operation.error_count) + " failed: " +
+                      operation.errors.front();
+        }
+    } else if (file_manager->marks.count != 0) {
+        status = to_string(file_manager->marks.count) +
+                 " marked, c/v copies/moves them here";
+    }
+
+    if (!status.empty()) {
+        status = ' ' + status + ' ';
+        mvwaddnstr(window, 2, 2, status.c_str(), width - 4);
+    }
+    wnoutrefresh(window);
+}
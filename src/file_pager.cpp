@@ -0,0 +1,651 @@
+#include <fcntl.h>
+#include <cstring>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "file_manager.hpp"
+
+static const size_t LINE_INDEX_STEP = 4096;
+// the indexer publishes what it found every block
+static const size_t INDEX_BLOCK_SIZE = 1 << 20;
+// how far back the start of a line is looked for before giving up on it
+static const size_t LINE_LOOKBACK = 1 << 20;
+// bytes searched per turn of the main loop
+static const size_t SEARCH_BLOCK_SIZE = 64 << 20;
+// the beginning of a file that decides if it opens as a hex dump
+static const size_t BINARY_CHECK_SIZE = 4096;
+
+static size_t count_newlines(const unsigned char *data, size_t size)
+{
+    size_t count = 0;
+    size_t i = 0;
+
+#ifdef __SSE2__
+    const __m128i newline = _mm_set1_epi8('\n');
+    for (; i + 16 <= size; i += 16) {
+        __m128i chunk =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        count += __builtin_popcount(
+            _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newline)));
+    }
+#endif
+    for (; i < size; i++) {
+        count += data[i] == '\n';
+    }
+    return count;
+}
+
+// Counts the newlines of a block, the start of every LINE_INDEX_STEP-th line
+// goes into checkpoints. 16 bytes at a time, the newlines of a chunk are only
+// looked at one by one when a checkpoint falls in it.
+static size_t index_block(const unsigned char *data, size_t from, size_t to,
+                          size_t lines, vector<size_t> *checkpoints)
+{
+    size_t i = from;
+
+#ifdef __SSE2__
+    const __m128i newline = _mm_set1_epi8('\n');
+    for (; i + 16 <= to; i += 16) {
+        __m128i chunk =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        unsigned found = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newline));
+        size_t count = __builtin_popcount(found);
+        if (lines % LINE_INDEX_STEP + count < LINE_INDEX_STEP) {
+            lines += count;
+            continue;
+        }
+        for (; found != 0; found &= found - 1) {
+            if (++lines % LINE_INDEX_STEP == 0) {
+                checkpoints->push_back(i + __builtin_ctz(found) + 1);
+            }
+        }
+    }
+#endif
+    for (; i < to; i++) {
+        if (data[i] == '\n' && ++lines % LINE_INDEX_STEP == 0) {
+            checkpoints->push_back(i + 1);
+        }
+    }
+    return lines;
+}
+
+// Runs detached, holds the mapping until it's done
+static void build_line_index(shared_ptr<LineIndex> index)
+{
+    name_perf_thread("pager index");
+    const MappedFile &file = *index->file;
+    size_t lines = 0;
+    vector<size_t> checkpoints;
+
+    for (size_t offset = 0; offset < file.size && !index->cancelled;
+         offset += INDEX_BLOCK_SIZE) {
+        size_t end = min(file.size, offset + INDEX_BLOCK_SIZE);
+        checkpoints.clear();
+        lines = index_block(file.data, offset, end, lines, &checkpoints);
+        {
+            lock_guard<mutex> guard(index->lock);
+            index->checkpoints.insert(index->checkpoints.end(),
+                                      checkpoints.begin(), checkpoints.end());
+        }
+        index->lines = lines;
+        index->indexed = end;
+    }
+    index->finished = true;
+    wake_event_loop();
+}
+
+bool open_pager(FileManager *file_manager, const FileEntry &file)
+{
+    auto mapping = make_shared<MappedFile>(AT_FDCWD, file.path().c_str());
+
+    if (mapping->data == nullptr) {
+        return false;
+    }
+
+    close_pager(file_manager);
+    auto pager = make_shared<FilePager>();
+    pager->path = file.path();
+    pager->file = mapping;
+    pager->width = COLS - 2;
+    pager->rows = LINES - 2;
+    pager->hex = is_binary_data(mapping->data,
+                                min(mapping->size, BINARY_CHECK_SIZE));
+    pager->hex_layout = get_hex_layout(pager->width, mapping->size);
+    pager->file_type = detect_file_type(mapping->data, mapping->size);
+    pager->index = make_shared<LineIndex>();
+    pager->index->file = mapping;
+    thread(build_line_index, pager->index).detach();
+
+    file_manager->pager = pager;
+    return true;
+}
+
+void close_pager(FileManager *file_manager)
+{
+    if (file_manager->pager) {
+        file_manager->pager->index->cancelled = true;
+        file_manager->pager.reset();
+    }
+}
+
+bool pager_pending(FileManager *file_manager)
+{
+    const FilePager *pager = file_manager->pager.get();
+
+    return pager != nullptr &&
+           (pager->search_direction != 0 || !pager->index->finished);
+}
+
+// Offset of the row after the one starting at offset
+static size_t next_row(const FilePager &pager, size_t offset)
+{
+    const MappedFile &file = *pager.file;
+
+    if (pager.hex) {
+        return min(file.size, offset + pager.hex_layout.row_bytes);
+    }
+
+    size_t limit = min(file.size - offset, pager.width);
+    const void *newline = memchr(file.data + offset, '\n', limit);
+
+    if (newline != nullptr) {
+        return static_cast<const unsigned char *>(newline) - file.data + 1;
+    }
+    // a line as long as the row ends on it
+    if (offset + limit < file.size && file.data[offset + limit] == '\n') {
+        return offset + limit + 1;
+    }
+    return offset + limit;
+}
+
+// Start of the line holding offset, false when it's further back than the
+// lookback
+static bool find_line_start(const FilePager &pager, size_t offset,
+                            size_t *line_start)
+{
+    const MappedFile &file = *pager.file;
+    size_t lookback = offset > LINE_LOOKBACK ? offset - LINE_LOOKBACK : 0;
+    const void *newline =
+        memrchr(file.data + lookback, '\n', offset - lookback);
+
+    if (newline != nullptr) {
+        *line_start =
+            static_cast<const unsigned char *>(newline) - file.data + 1;
+        return true;
+    }
+    *line_start = 0;
+    return lookback == 0;
+}
+
+// Start of the row holding offset. In a line too long to find its start the
+// rows are counted from the start of the file instead.
+static size_t row_start(const FilePager &pager, size_t offset)
+{
+    size_t line_start;
+
+    if (pager.hex) {
+        return offset - offset % pager.hex_layout.row_bytes;
+    }
+    if (!find_line_start(pager, offset, &line_start)) {
+        return offset - offset % pager.width;
+    }
+    size_t row = (offset - line_start) / pager.width;
+    // the newline ending a full row belongs to it
+    if (row != 0 && row * pager.width == offset - line_start &&
+        pager.file->data[offset] == '\n') {
+        row--;
+    }
+    return line_start + row * pager.width;
+}
+
+static size_t previous_row(const FilePager &pager, size_t offset)
+{
+    size_t line_start;
+
+    if (offset == 0) {
+        return 0;
+    }
+    if (pager.hex) {
+        return offset - pager.hex_layout.row_bytes;
+    }
+    // rows of a line are width apart, so in a long one it's just that
+    if (!find_line_start(pager, offset - 1, &line_start)) {
+        return offset - pager.width;
+    }
+    return row_start(pager, offset - 1);
+}
+
+static void scroll_pager(FilePager *pager, long rows)
+{
+    for (; rows > 0 && next_row(*pager, pager->top) < pager->file->size;
+         rows--) {
+        pager->top = next_row(*pager, pager->top);
+    }
+    for (; rows < 0 && pager->top != 0; rows++) {
+        pager->top = previous_row(*pager, pager->top);
+    }
+    pager->match_offset = string::npos;
+}
+
+static void scroll_to_end(FilePager *pager)
+{
+    pager->top = row_start(*pager, pager->file->size - 1);
+    scroll_pager(pager, 1 - static_cast<long>(pager->rows));
+}
+
+// Line number of offset, 0 if the index doesn't go that far yet
+static size_t line_at(FilePager *pager, size_t offset)
+{
+    LineIndex &index = *pager->index;
+
+    if (index.indexed < offset) {
+        return 0;
+    }
+    size_t checkpoint;
+    size_t from = 0;
+    {
+        lock_guard<mutex> guard(index.lock);
+        auto next = upper_bound(index.checkpoints.begin(),
+                                index.checkpoints.end(), offset);
+        checkpoint = next - index.checkpoints.begin();
+        if (checkpoint != 0) {
+            from = *(next - 1);
+        }
+    }
+    return checkpoint * LINE_INDEX_STEP + 1 +
+           count_newlines(pager->file->data + from, offset - from);
+}
+
+// Start of line (from 1), false while the index hasn't reached it. Past the
+// end of the file it's the last line.
+static bool find_line(FilePager *pager, size_t line, size_t *offset)
+{
+    LineIndex &index = *pager->index;
+    const MappedFile &file = *pager->file;
+    bool finished = index.finished;
+    size_t newlines = line - 1;
+
+    if (!finished && newlines > index.lines) {
+        return false;
+    }
+    if (finished) {
+        newlines = min(newlines, index.lines.load());
+    }
+
+    size_t checkpoint = newlines / LINE_INDEX_STEP;
+    *offset = 0;
+    if (checkpoint != 0) {
+        lock_guard<mutex> guard(index.lock);
+        *offset = index.checkpoints[checkpoint - 1];
+    }
+    for (size_t i = checkpoint * LINE_INDEX_STEP; i < newlines; i++) {
+        const void *newline =
+            memchr(file.data + *offset, '\n', file.size - *offset);
+        if (newline == nullptr) {
+            break;
+        }
+        *offset = static_cast<const unsigned char *>(newline) - file.data + 1;
+    }
+    // a file ending with a newline has no line after it
+    if (*offset == file.size && file.size != 0) {
+        *offset = row_start(*pager, file.size - 1);
+    }
+    return true;
+}
+
+static void jump_to_line(FilePager *pager, size_t line)
+{
+    size_t offset;
+
+    if (!find_line(pager, max<size_t>(line, 1), &offset)) {
+        pager->pending_line = line;
+        pager->message = "Indexing to line " + to_string(line) + "...";
+        return;
+    }
+    pager->pending_line = 0;
+    pager->message.clear();
+    pager->top = offset;
+    pager->match_offset = string::npos;
+}
+
+// ':' prompt, a line number or a percentage of the file
+static void run_jump_prompt(FilePager *pager)
+{
+    const string &input = pager->input;
+    char *end;
+    unsigned long value = strtoul(input.c_str(), &end, 10);
+
+    if (end == input.c_str()) {
+        pager->message = "Not a line number";
+        return;
+    }
+    if (*end == '%' && end[1] == '\0') {
+        size_t size = pager->file->size;
+        pager->top = row_start(*pager, min<size_t>(size * value / 100,
+                                                   size - 1));
+        pager->match_offset = string::npos;
+        return;
+    }
+    if (*end != '\0') {
+        pager->message = "Not a line number";
+        return;
+    }
+    jump_to_line(pager, value);
+}
+
+static void start_pager_search(FilePager *pager, bool forward)
+{
+    if (pager->needle.empty()) {
+        return;
+    }
+    bool from_match = pager->match_offset != string::npos;
+
+    pager->search_direction = forward ? 1 : -1;
+    pager->message.clear();
+    if (forward) {
+        pager->search_position =
+            from_match ? pager->match_offset + 1 : pager->top;
+    } else {
+        pager->search_position = from_match ? pager->match_offset : pager->top;
+    }
+}
+
+// Shows the match a third of the way down
+static void show_pager_match(FilePager *pager, size_t match)
+{
+    pager->search_direction = 0;
+    pager->match_offset = match;
+    pager->top = row_start(*pager, match);
+    for (size_t i = 0; i < pager->rows / 3 && pager->top != 0; i++) {
+        pager->top = previous_row(*pager, pager->top);
+    }
+}
+
+// One block of the search, forward from search_position or backward from it
+// (the match has to start before it then)
+static void step_pager_search(FilePager *pager)
+{
+    const MappedFile &file = *pager->file;
+    string_view text(reinterpret_cast<const char *>(file.data), file.size);
+    bool case_sensitive = is_case_sensitive(pager->needle);
+    size_t overlap = pager->needle.size() - 1;
+    size_t position = pager->search_position;
+
+    if (pager->search_direction > 0) {
+        size_t end = min(file.size, position + SEARCH_BLOCK_SIZE);
+        if (position < file.size) {
+            size_t match = find_literal(
+                text.substr(position, min(file.size, end + overlap) - position),
+                pager->needle, case_sensitive);
+            if (match != string_view::npos) {
+                show_pager_match(pager, position + match);
+                return;
+            }
+        }
+        pager->search_position = end;
+        if (end < file.size) {
+            return;
+        }
+    } else {
+        size_t start =
+            position > SEARCH_BLOCK_SIZE ? position - SEARCH_BLOCK_SIZE : 0;
+        string_view block = text.substr(
+            start, min(file.size, position + overlap) - start);
+        // the last match starting before position
+        size_t last = string_view::npos;
+        for (size_t from = 0;; from = last + 1) {
+            size_t match = find_literal(block.substr(from), pager->needle,
+                                        case_sensitive);
+            if (match == string_view::npos || start + from + match >= position) {
+                break;
+            }
+            last = from + match;
+        }
+        if (last != string_view::npos) {
+            show_pager_match(pager, start + last);
+            return;
+        }
+        pager->search_position = start;
+        if (start != 0) {
+            return;
+        }
+    }
+    pager->search_direction = 0;
+    pager->message = "Pattern not found";
+}
+
+void poll_pager(FileManager *file_manager)
+{
+    FilePager *pager = file_manager->pager.get();
+
+    if (pager == nullptr) {
+        return;
+    }
+    if (pager->search_direction != 0) {
+        step_pager_search(pager);
+    }
+    if (pager->pending_line != 0) {
+        jump_to_line(pager, pager->pending_line);
+    }
+}
+
+static void handle_pager_prompt(FilePager *pager, int input)
+{
+    if (input == 27) {
+        pager->prompt = 0;
+        return;
+    }
+    if (input == 263 || input == KEY_BACKSPACE) {
+        if (pager->input.empty()) {
+            pager->prompt = 0;
+        } else {
+            pager->input.pop_back();
+        }
+        return;
+    }
+    if (input != 10 && input != KEY_ENTER) {
+        if (isprint(input)) {
+            pager->input += input;
+        }
+        return;
+    }
+
+    char prompt = pager->prompt;
+    pager->prompt = 0;
+    if (prompt == ':') {
+        run_jump_prompt(pager);
+        return;
+    }
+    // an empty search repeats the last one
+    if (!pager->input.empty()) {
+        pager->needle = pager->input;
+        pager->match_offset = string::npos;
+    }
+    pager->search_forward = prompt == '/';
+    start_pager_search(pager, pager->search_forward);
+}
+
+int handle_pager_input(FileManager *file_manager, int input)
+{
+    FilePager *pager = file_manager->pager.get();
+
+    if (pager->prompt != 0) {
+        handle_pager_prompt(pager, input);
+        return 0;
+    }
+
+    pager->message.clear();
+    switch (input) {
+        case 'q':
+        case 27:
+        case KEY_LEFT:
+            close_pager(file_manager);
+            break;
+        case KEY_DOWN:
+        case 'j':
+            scroll_pager(pager, 1);
+            break;
+        case KEY_UP:
+        case 'k':
+            scroll_pager(pager, -1);
+            break;
+        case KEY_NPAGE:
+        case ' ':
+            scroll_pager(pager, pager->rows);
+            break;
+        case KEY_PPAGE:
+        case 'b':
+            scroll_pager(pager, -static_cast<long>(pager->rows));
+            break;
+        case KEY_HOME:
+        case 'g':
+            pager->top = 0;
+            pager->match_offset = string::npos;
+            break;
+        case KEY_END:
+        case 'G':
+            scroll_to_end(pager);
+            break;
+        case ':':
+        case '/':
+        case '?':
+            pager->prompt = input;
+            pager->input.clear();
+            pager->search_direction = 0;
+            pager->pending_line = 0;
+            break;
+        case 'x':
+            pager->hex = !pager->hex;
+            pager->top = row_start(*pager, pager->top);
+            break;
+        case 'n':
+        case 'N':
+            start_pager_search(pager, (input == 'n') == pager->search_forward);
+            break;
+        default:
+            break;
+    }
+    return 0;
+}
+
+// Bytes of a row as drawn, one column each so rows stay width bytes long
+static string format_pager_row(const unsigned char *data, size_t size)
+{
+    string row(reinterpret_cast<const char *>(data), size);
+
+    for (char &character : row) {
+        if (character == '\t') {
+            character = ' ';
+        } else if (!isprint(static_cast<unsigned char>(character))) {
+            character = '.';
+        }
+    }
+    return row;
+}
+
+static void display_pager_status(WINDOW *window, FilePager *pager)
+{
+    size_t height = getmaxy(window);
+    size_t width = getmaxx(window);
+    const MappedFile &file = *pager->file;
+    LineIndex &index = *pager->index;
+    string status;
+
+    if (pager->prompt != 0) {
+        status = string(1, pager->prompt) + pager->input + "_";
+    } else if (pager->hex) {
+        char offset[32];
+        snprintf(offset, sizeof(offset), "offset 0x%lx", pager->top);
+        status = offset;
+    } else {
+        size_t line = line_at(pager, pager->top);
+        status = "line " + (line == 0 ? string("?") : to_string(line));
+        if (index.finished) {
+            status += "/" + to_string(index.lines +
+                                      (file.data[file.size - 1] != '\n'));
+        }
+    }
+
+    if (pager->prompt == 0) {
+        status += " (" + to_string(pager->top * 100 / file.size) + "%)";
+        if (!index.finished && !pager->hex) {
+            status += " indexing " +
+                      to_string(index.indexed * 100 / file.size) + "%";
+        }
+        if (pager->search_direction != 0) {
+            status += " searching...";
+        }
+        if (!pager->message.empty()) {
+            status += " - " + pager->message;
+        }
+    }
+    status = " " + status + " ";
+    if (status.size() > width - 4) {
+        status.erase(width - 4);
+    }
+    mvwprintw(window, height - 1, 2, "%s", status.c_str());
+}
+
+void display_pager(WINDOW *window, FileManager *file_manager)
+{
+    FilePager *pager = file_manager->pager.get();
+    const MappedFile &file = *pager->file;
+
+    werase(window);
+
+    box(window, ACS_VLINE, ACS_HLINE);
+
+    // a resized window cuts the rows again from the one on top
+    size_t width = getmaxx(window) - 2;
+    if (width != pager->width) {
+        pager->width = width;
+        pager->hex_layout = get_hex_layout(width, file.size);
+        pager->top = row_start(*pager, pager->top);
+    }
+    pager->rows = getmaxy(window) - 2;
+
+    string title = " " + pager->path + " - ";
+    if (pager->file_type != nullptr) {
+        title += string(pager->file_type) + " - ";
+    }
+    title += format_bytes(file.size) + " ";
+    if (title.size() > width - 2) {
+        title.erase(width - 2);
+    }
+    mvwprintw(window, 0, 2, "%s", title.c_str());
+
+    size_t match_end = pager->match_offset + pager->needle.size();
+    size_t offset = pager->top;
+    for (size_t i = 0; i < pager->rows && offset < file.size; i++) {
+        size_t next = next_row(*pager, offset);
+        size_t end = next;
+        // where the bytes of the row start on screen
+        size_t column = 1;
+        string row;
+        if (pager->hex) {
+            row = format_hex_row(pager->hex_layout, file.data + offset,
+                                 next - offset, offset);
+            column += pager->hex_layout.ascii_column + 1;
+        } else {
+            if (end > offset && file.data[end - 1] == '\n') {
+                end--;
+            }
+            row = format_pager_row(file.data + offset, end - offset);
+        }
+        mvwprintw(window, i + 1, 1, "%s", row.c_str());
+
+        if (pager->match_offset != string::npos &&
+            pager->match_offset < next && match_end > offset) {
+            size_t from = max(pager->match_offset, offset);
+            size_t to = min(match_end, end);
+            if (to > from) {
+                mvwchgat(window, i + 1, column + from - offset, to - from,
+                         A_REVERSE, 0, nullptr);
+            }
+        }
+        offset = next;
+    }
+
+    display_pager_status(window, pager);
+    wnoutrefresh(window);
+}
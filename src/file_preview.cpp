@@ -1,61 +1,112 @@
+#include <fcntl.h>
 #include <ncurses.h>
 #include <cctype>
 #include <cstddef>
+#include <cstring>
 #include "file_manager.hpp"
 
+static const int DEFAULT_PREVIEW_DELAY_MS = 50;
+// the beginning of a file that decides if it's binary
+static const size_t BINARY_CHECK_SIZE = 4096;
+// how much of a line the text preview reads looking for its end
+static const size_t PREVIEW_LINE_LIMIT = 64 << 10;
+
 static bool is_line_ascii(const string &line)
 {
     return all_of(line.begin(), line.end(), isascii);
 }
 
-// read all file (or at least a big chunk) to be able to scroll without
-// re-reading everything
-static bool preview_text_file(const string &file_path, WINDOW *window,
-                              size_t file_size)
+size_t PreviewFrame::memory_usage() const
+{
+    size_t usage = sizeof(PreviewFrame) + title.capacity() +
+                   lines.capacity() * sizeof(PreviewLine);
+
+    for (const PreviewLine &line : lines) {
+        usage += line.text.capacity();
+    }
+    return usage;
+}
+
+// Frame with only an error message under the title
+static void set_error_frame(PreviewFrame *frame, const string &title,
+                            const string &message)
 {
-    ifstream file(file_path, ios::binary);
+    frame->title = title;
+    frame->lines.assign(1, {message, A_UNDERLINE, 1});
+}
 
-    if (!file) {
+// The file is mapped and only the start of each shown line is looked at, so
+// a huge single line file costs one row. With a target_line (content search
+// results) the preview starts a few lines above it and the line is
+// highlighted.
+static bool preview_text_file(const string &file_path, size_t width,
+                              size_t height, size_t file_size,
+                              size_t target_line,
+                              const atomic<bool> &cancelled,
+                              PreviewFrame *frame)
+{
+    MappedFile file(AT_FDCWD, file_path.c_str());
+
+    if (file.data == nullptr ||
+        is_binary_data(file.data, min(file.size, BINARY_CHECK_SIZE))) {
         return false;
     }
 
-    size_t height = getmaxy(window);
-    size_t width = getmaxx(window);
+    const char *text = reinterpret_cast<const char *>(file.data);
+    size_t offset = 0;
 
-    string line;
+    size_t first_line = 1;
+    if (target_line > (height - 2) / 3) {
+        first_line = target_line - (height - 2) / 3;
+    }
+    for (size_t i = 1; i < first_line && offset < file.size && !cancelled;
+         i++) {
+        const char *newline = static_cast<const char *>(
+            memchr(text + offset, '\n', file.size - offset));
+        offset = newline == nullptr ? file.size : newline - text + 1;
+    }
 
-    for (size_t i = 0; i < height - 2 && getline(file, line); i++) {
-        if (line.size() == 0) {
-            continue;
-        }
-        if (line.size() > width - 2) {
-            line.erase(width - 2);
-        }
+    for (size_t i = 0; i < height - 2 && offset < file.size; i++) {
+        size_t limit = min(file.size - offset, PREVIEW_LINE_LIMIT);
+        const char *newline =
+            static_cast<const char *>(memchr(text + offset, '\n', limit));
+        size_t line_size = newline == nullptr ? limit : newline - text - offset;
+
+        string line(text + offset, min(line_size, width - 2));
         if (!is_line_ascii(line)) {
-            werase(window);
-            box(window, ACS_VLINE, ACS_HLINE);
-            file.close();
+            frame->lines.clear();
             return false;
         }
-        mvwprintw(window, i + 1, 1, "%s", line.c_str());
+        attr_t attributes = first_line + i == target_line ? A_REVERSE
+                                                          : A_NORMAL;
+        frame->lines.push_back({line, attributes, 0});
+        // the last line, or one too long to look for its end
+        if (newline == nullptr) {
+            break;
+        }
+        offset += line_size + 1;
     }
 
-    mvwprintw(window, 0, 2, " Text file [%s] - %s ", file_path.c_str(),
-              format_bytes(file_size).c_str());
-
-    file.close();
+    char title[PATH_MAX + 64];
+    if (target_line != 0) {
+        snprintf(title, sizeof(title), " Text file [%s:%ld] - %s ",
+                 file_path.c_str(), target_line,
+                 format_bytes(file_size).c_str());
+    } else {
+        snprintf(title, sizeof(title), " Text file [%s] - %s ",
+                 file_path.c_str(), format_bytes(file_size).c_str());
+    }
+    frame->title = title;
     return true;
 }
 
-static void preview_folder(const fs::directory_entry &folder, WINDOW *window,
-                           FileManager *file_manager)
+static void preview_folder(string folder_path, size_t width, size_t height,
+                           FileManager *file_manager, PreviewFrame *frame)
 {
-    string folder_path = FILE_PATH(folder);
-    vector<fs::directory_entry> files;
-
-    files = load_folder(file_manager, folder_path, false, false);
-
-    size_t width = getmaxx(window);
+    shared_ptr<EntryTable> *cached =
+        file_manager->folders_cache.peek(folder_path);
+    bool stale = cached != nullptr && (*cached)->unwatched;
+    FileList files = load_folder(file_manager, folder_path, stale, false);
 
     if (width < 28) {
         return;
@@ -68,173 +119,473 @@ static void preview_folder(const fs::directory_entry &folder, WINDOW *window,
         folder_path.append("+");
     }
 
-    if (files.size() != 0) {
-        mvwprintw(window, 0, 2, " Folder [%s] - %ld %s ", folder_path.c_str(),
-                  files.size(), files.size() > 1 ? "files" : "file");
-    }
-
     if (files.size() == 0) {
-        mvwprintw(window, 0, 2, " Folder [%s] - Empty ", folder_path.c_str());
-        ERROR_ATTRON(window);
-        mvwprintw(window, 1, 1, "Directory is empty");
-        ERROR_ATTROFF(window);
+        set_error_frame(frame, " Folder [" + folder_path + "] - Empty ",
+                        "Directory is empty");
         return;
     }
 
-    size_t height = getmaxy(window);
+    frame->title = " Folder [" + folder_path + "] - " +
+                   to_string(files.size()) +
+                   (files.size() > 1 ? " files " : " file ");
 
     for (size_t i = 0; i < files.size() && i < height - 2; i++) {
-        if (files[i].is_character_file()) {
-            mvwprintw(window, i + 1, 1, "%s", FILE_NAME(files[i]).c_str());
-            wattrset(window, A_NORMAL);
+        FileEntry file = files[i];
+        string name(file.name());
+
+        if (file.is_character_file()) {
+            frame->lines.push_back({name, A_NORMAL, 0});
             continue;
         }
 
-        if (files[i].is_symlink()) {
-            mvwprintw(window, i + 1, 1, "Link");
-            wattrset(window, A_NORMAL);
+        if (file.is_symlink()) {
+            frame->lines.push_back({"Link", A_NORMAL, 0});
             continue;
         }
 
-        if (files[i].is_fifo()) {
-            mvwprintw(window, i + 1, 1, "Fifo");
-            wattrset(window, A_NORMAL);
+        if (file.is_fifo()) {
+            frame->lines.push_back({"Fifo", A_NORMAL, 0});
             continue;
         }
 
-        if (files[i].is_other()) {
-            mvwprintw(window, i + 1, 1, "Other");
-            wattrset(window, A_NORMAL);
+        if (file.is_other()) {
+            frame->lines.push_back({"Other", A_NORMAL, 0});
             continue;
         }
-        if (!can_read_file(files[i].path().string())) {
-            wattron(window, COLOR_PAIR(1));
-        } else {
-            wattron(window, COLOR_PAIR(find_file_color(files[i])));
+
+        bool too_long = name.size() > width - 3;
+        if (too_long) {
+            name.erase(width - 3);
         }
+        name += too_long ? '+' : ' ';
+        frame->lines.push_back(
+            {name, A_NORMAL, static_cast<short>(find_file_color(file))});
+    }
+}
 
-        mvwprintw(window, i + 1, 1, "%.*s%c", static_cast<int>(width - 3),
-                  FILE_NAME(files[i]).c_str(),
-                  FILE_NAME(files[i]).size() > width - 3 ? '+' : ' ');
-        wattrset(window, A_NORMAL);
+// Named after its magic number, the body is a hex dump of the first rows
+static bool preview_binary_file(const PreviewJob &job, PreviewFrame *frame)
+{
+    MappedFile file(AT_FDCWD, job.path.c_str());
+
+    if (file.data == nullptr) {
+        return false;
     }
+
+    const char *file_type = detect_file_type(file.data, file.size);
+    frame->title = " " + string(file_type ? file_type : "Binary file") +
+                   " - " + format_bytes(file.size) + " ";
+
+    HexLayout layout = get_hex_layout(job.width - 2, file.size);
+    size_t offset = 0;
+    for (size_t i = 0; i < job.height - 2 && offset < file.size; i++) {
+        size_t size = min<size_t>(layout.row_bytes, file.size - offset);
+        frame->lines.push_back(
+            {format_hex_row(layout, file.data + offset, size, offset),
+             A_NORMAL, 0});
+        offset += size;
+    }
+    return true;
 }
 
-static bool check_magic_number(const array<unsigned char, 16> buffer,
-                               const array<unsigned char, 16> magic_number)
+// The entries that can't be previewed, decided from the entry alone
+static bool preview_entry_error(const PreviewJob &job, PreviewFrame *frame)
 {
-    for (int i = 0; i < 16 && magic_number.at(i) != 0; i++) {
-        if (buffer.at(i) != magic_number.at(i)) {
-            return false;
+    string display_name = job.path;
+    size_t width = job.width;
+
+    if (!(job.flags & ENTRY_READABLE)) {
+        if (display_name.size() > width - 17) {
+            display_name.erase(width - 17);
+            display_name.append("+");
         }
+        set_error_frame(frame, " Unknown [" + display_name + "] ",
+                        "Missing permissions");
+        return true;
     }
-    return true;
+
+    if (job.type == ENTRY_REGULAR && job.size == 0) {
+        if (display_name.size() > width - 20) {
+            display_name.erase(width - 20);
+            display_name.append("+");
+        }
+        set_error_frame(frame, " Empty file [" + display_name + "] ",
+                        "Empty file");
+        return true;
+    }
+
+    if (job.type == ENTRY_CHARACTER) {
+        set_error_frame(frame, " Character device [" + display_name + "] ",
+                        "Nothing to display");
+        return true;
+    }
+
+    if (job.type > ENTRY_DIRECTORY) {
+        set_error_frame(frame, " Unknown file type [" + display_name + "] ",
+                        "Nothing to display");
+        return true;
+    }
+    return false;
 }
 
-static bool preview_binary_file(const fs::directory_entry &file, WINDOW *window)
+// What the worker does for a file, this is the part that reads the disk
+static void build_file_frame(const PreviewJob &job, PreviewFrame *frame)
 {
-    FILE *fstream = fopen(FILE_PATH(file).c_str(), "rb");
+    PerfScope perf_scope(PERF_BUILD_PREVIEW, job.path);
+    bool previewed = false;
 
-    array<unsigned char, 16> buffer = {0};
+    if (job.type == ENTRY_REGULAR) {
+        previewed =
+            preview_text_file(job.path, job.width, job.height, job.size,
+                              job.target_line, job.cancelled, frame);
+    }
 
-    if (fread(buffer.data(), 1, 16, fstream) == 0) {
-        return false;
+    if (!previewed && !job.cancelled) {
+        previewed = preview_binary_file(job, frame);
+    }
+
+    if (!previewed) {
+        frame->lines.assign(1, {"Couldn't preview file", A_UNDERLINE, 1});
     }
+}
 
-    string file_type = "Unknown";
+// Everything the frame of an entry depends on, known without touching the
+// disk: the entry's metadata, the pane size, and for folders the cached
+// listing and how it's filtered and sorted
+static string get_preview_key(const FileEntry &file, size_t width,
+                              size_t height, size_t target_line,
+                              FileManager *file_manager)
+{
+    string key = file.path();
 
-    if (check_magic_number(buffer, ELF_MAGIC_NUMBER)) {
-        file_type = "ELF";
+    key += '\0';
+    key += to_string(file.last_write_time()) + ' ' +
+           to_string(file.file_size()) + ' ' + to_string(file.type()) + ' ' +
+           to_string(file.table->flags[file.row]) + ' ' + to_string(width) +
+           'x' + to_string(height) + ' ' + to_string(target_line);
+
+    if (file.is_directory()) {
+        key += ' ' + to_string(file_manager->hidden_files) + ' ' +
+               to_string(file_manager->sort_type);
+        // the watcher patches cached listings, their version tells
+        if (shared_ptr<EntryTable> *table =
+                file_manager->folders_cache.peek(file.path())) {
+            key += ' ' + to_string(reinterpret_cast<uintptr_t>(table->get())) +
+                   ':' + to_string((*table)->version);
+        }
     }
+    return key;
+}
 
-    mvwprintw(window, 0, 2, " %s file - %s ", file_type.c_str(),
-              format_bytes(file.file_size()).c_str());
+static shared_ptr<PreviewJob> make_preview_job(const FileEntry &file,
+                                               const string &key, size_t width,
+                                               size_t height,
+                                               size_t target_line)
+{
+    auto job = make_shared<PreviewJob>();
+
+    job->key = key;
+    job->path = file.path();
+    job->type = file.type();
+    job->flags = file.table->flags[file.row];
+    job->size = file.file_size();
+    job->width = width;
+    job->height = height;
+    job->target_line = target_line;
+    return job;
+}
 
-    fclose(fstream);
+static void draw_preview_frame(WINDOW *window, const PreviewFrame &frame)
+{
+    if (!frame.title.empty()) {
+        mvwprintw(window, 0, 2, "%s", frame.title.c_str());
+    }
 
-    return true;
+    for (size_t i = 0; i < frame.lines.size(); i++) {
+        const PreviewLine &line = frame.lines[i];
+        if (line.text.empty()) {
+            continue;
+        }
+        wattrset(window, line.attributes | COLOR_PAIR(line.color));
+        mvwprintw(window, i + 1, 1, "%s", line.text.c_str());
+        wattrset(window, A_NORMAL);
+    }
 }
 
-void preview_file(const fs::directory_entry &file, WINDOW *window,
-                  FileManager *file_manager)
+// Rendered previews are cached up to FILE_MANAGER_PREVIEW_CACHE_MB
+void setup_preview_cache(FileManager *file_manager)
 {
-    werase(window);
+    size_t budget_mb = 8;
+    if (const char *env_budget = getenv("FILE_MANAGER_PREVIEW_CACHE_MB")) {
+        budget_mb = strtoul(env_budget, nullptr, 10);
+    }
 
-    box(window, ACS_VLINE, ACS_HLINE);
+    auto &cache = file_manager->previews_cache;
+    cache.budget = budget_mb * 1024 * 1024;
+    cache.measure = [](const shared_ptr<const PreviewFrame> &frame) {
+        return frame->memory_usage();
+    };
+}
 
-    int width = getmaxx(window);
+// Detached, a preview stuck on a slow mount only holds up the previews
+static void preview_worker(shared_ptr<PreviewWork> work)
+{
+    name_perf_thread("preview");
+    unique_lock<mutex> guard(work->lock);
+
+    while (true) {
+        work->wake.wait(guard,
+                        [&work] { return work->stopped || !work->queue.empty(); });
+        if (work->stopped) {
+            return;
+        }
 
-    string display_name = FILE_PATH(file);
+        shared_ptr<PreviewJob> job = work->queue.front();
+        work->queue.pop_front();
+        work->running = job;
+        guard.unlock();
 
-    if (!can_read_file(FILE_PATH(file))) {
-        if (display_name.size() > (size_t)width - 17) {
-            display_name.erase(width - 17);
-            display_name.append("+");
+        if (job->type == ENTRY_DIRECTORY) {
+            job->folder = get_files_in_folder(job->path);
+        } else {
+            auto frame = make_shared<PreviewFrame>();
+            build_file_frame(*job, frame.get());
+            job->frame = frame;
         }
-        mvwprintw(window, 0, 2, " Unknown [%s] ", display_name.c_str());
-        ERROR_ATTRON(window);
-        mvwprintw(window, 1, 1, "Missing permissions");
-        ERROR_ATTROFF(window);
-        wrefresh(window);
+
+        guard.lock();
+        work->running.reset();
+        if (!job->cancelled) {
+            work->done.push_back(job);
+            wake_event_loop();
+        }
+    }
+}
+
+// The delay the cursor has to rest on an entry comes from
+// FILE_MANAGER_PREVIEW_DELAY_MS
+void start_preview_work(FileManager *file_manager)
+{
+    auto work = make_shared<PreviewWork>();
+
+    work->delay_ms = DEFAULT_PREVIEW_DELAY_MS;
+    if (const char *env_delay = getenv("FILE_MANAGER_PREVIEW_DELAY_MS")) {
+        work->delay_ms = atoi(env_delay);
+    }
+    file_manager->preview_work = work;
+    thread(preview_worker, work).detach();
+}
+
+void stop_preview_work(FileManager *file_manager)
+{
+    PreviewWork *work = file_manager->preview_work.get();
+
+    if (work == nullptr) {
         return;
     }
+    {
+        lock_guard<mutex> guard(work->lock);
+        work->stopped = true;
+        if (work->running) {
+            work->running->cancelled = true;
+        }
+    }
+    work->wake.notify_one();
+    file_manager->preview_work.reset();
+}
 
-    if (file.is_regular_file() && file.file_size() == 0) {
-        if (display_name.size() > (size_t)width - 20) {
-            display_name.erase(width - 20);
-            display_name.append("+");
+// Moves finished previews into the caches, returns true if there were some
+bool poll_preview_work(FileManager *file_manager)
+{
+    PreviewWork *work = file_manager->preview_work.get();
+    vector<shared_ptr<PreviewJob>> done;
+
+    if (work == nullptr) {
+        return false;
+    }
+    {
+        lock_guard<mutex> guard(work->lock);
+        swap(done, work->done);
+    }
+
+    for (const shared_ptr<PreviewJob> &job : done) {
+        if (job->frame) {
+            file_manager->previews_cache.insert(job->key, job->frame);
+        } else if (!file_manager->folders_cache.contains(job->path)) {
+            cache_folder(file_manager, job->path, job->folder);
         }
-        mvwprintw(window, 0, 2, " Empty file [%s] ", display_name.c_str());
-        ERROR_ATTRON(window);
-        mvwprintw(window, 1, 1, "Empty file");
-        ERROR_ATTROFF(window);
-        wrefresh(window);
-        return;
     }
+    return !done.empty();
+}
 
-    if (file.is_character_file()) {
-        mvwprintw(window, 0, 2, " Character device [%s] ",
-                  display_name.c_str());
-        ERROR_ATTRON(window);
-        mvwprintw(window, 1, 1, "Nothing to display");
-        ERROR_ATTROFF(window);
-        wrefresh(window);
-        return;
+// -1 when the worker has nothing to hand back (it wakes the loop when it
+// has), otherwise how long until the main loop has to look again
+int preview_work_timeout(FileManager *file_manager)
+{
+    PreviewWork *work = file_manager->preview_work.get();
+
+    if (work == nullptr) {
+        return -1;
+    }
+    {
+        lock_guard<mutex> guard(work->lock);
+        if (!work->done.empty()) {
+            return 0;
+        }
+    }
+    if (work->selected_key.empty()) {
+        return -1;
+    }
+    auto elapsed = chrono::duration_cast<chrono::milliseconds>(
+                       chrono::steady_clock::now() - work->selected_since)
+                       .count();
+    if (elapsed > work->delay_ms) {
+        return -1;
     }
+    return work->delay_ms - elapsed;
+}
 
-    if (file.is_other()) {
-        mvwprintw(window, 0, 2, " Unknown file type [%s] ",
-                  display_name.c_str());
-        ERROR_ATTRON(window);
-        mvwprintw(window, 1, 1, "Nothing to display");
-        ERROR_ATTROFF(window);
-        wrefresh(window);
-        return;
+// The job for the entry at position in the list, null if its preview is
+// cached or can be made right away
+static shared_ptr<PreviewJob> get_neighbour_job(FileManager *file_manager,
+                                                size_t position, size_t width,
+                                                size_t height)
+{
+    if (position >= file_manager->files.size() ||
+        file_manager->search_contents) {
+        return nullptr;
     }
 
-    bool previewed = false;
+    FileEntry file = file_manager->files[position];
+    string key = get_preview_key(file, width, height, 0, file_manager);
+    if (file_manager->previews_cache.contains(key) ||
+        (file.is_directory() &&
+         file_manager->folders_cache.contains(file.path()))) {
+        return nullptr;
+    }
 
-    if (file.is_directory()) {
-        preview_folder(file, window, file_manager);
-        previewed = true;
+    auto job = make_preview_job(file, key, width, height, 0);
+    PreviewFrame frame;
+    if (preview_entry_error(*job, &frame)) {
+        return nullptr;
     }
+    return job;
+}
 
-    if (file.is_regular_file()) {
-        previewed =
-            preview_text_file(FILE_PATH(file), window, file.file_size());
+// Replaces the queue with the job of the selected entry, then the entries
+// just above and below it
+static void queue_preview_jobs(FileManager *file_manager,
+                               shared_ptr<PreviewJob> job)
+{
+    PreviewWork *work = file_manager->preview_work.get();
+    size_t position = file_manager->file_position;
+    vector<shared_ptr<PreviewJob>> jobs = {
+        job,
+        get_neighbour_job(file_manager, position + 1, job->width, job->height),
+        get_neighbour_job(file_manager, position - 1, job->width, job->height)};
+
+    {
+        lock_guard<mutex> guard(work->lock);
+        // nothing new if the worker is already on it
+        auto same_key = [&job](const shared_ptr<PreviewJob> &other) {
+            return other && other->key == job->key;
+        };
+        if (same_key(work->running) ||
+            (!work->queue.empty() && same_key(work->queue.front()))) {
+            return;
+        }
+
+        if (work->running) {
+            work->running->cancelled = true;
+        }
+        work->queue.clear();
+        for (const shared_ptr<PreviewJob> &queued : jobs) {
+            if (queued) {
+                work->queue.push_back(queued);
+            }
+        }
     }
+    work->wake.notify_one();
+}
 
-    if (!previewed) {
-        previewed = preview_binary_file(file, window);
+// Draws the preview of file from the cache. Anything that has to be read
+// goes to the worker once the cursor has rested on file for a moment, the
+// pane says so until it's there.
+void preview_file(const FileEntry &file, WINDOW *window,
+                  FileManager *file_manager)
+{
+    PerfScope perf_scope(PERF_PREVIEW_FILE);
+    size_t width = getmaxx(window);
+    size_t height = getmaxy(window);
+
+    size_t target_line = 0;
+    if (file_manager->search_contents &&
+        file.row < file_manager->content_matches.lines.size()) {
+        target_line = file_manager->content_matches.lines[file.row];
     }
 
-    if (!previewed) {
-        ERROR_ATTRON(window);
-        mvwprintw(window, 1, 1, "Couldn't preview file");
-        ERROR_ATTROFF(window);
-        wrefresh(window);
+    string key =
+        get_preview_key(file, width, height, target_line, file_manager);
+    auto &cache = file_manager->previews_cache;
+    string &shown_key = file_manager->screen.preview_key;
+
+    // the pane still holds this frame, nothing to draw
+    if (key == shown_key && cache.find(key) != nullptr) {
+        wnoutrefresh(window);
+        return;
+    }
+
+    werase(window);
+    box(window, ACS_VLINE, ACS_HLINE);
+
+    if (shared_ptr<const PreviewFrame> *frame = cache.find(key)) {
+        draw_preview_frame(window, **frame);
+        shown_key = key;
+        wnoutrefresh(window);
         return;
     }
 
-    wrefresh(window);
+    auto job = make_preview_job(file, key, width, height, target_line);
+    auto frame = make_shared<PreviewFrame>();
+    PreviewWork *work = file_manager->preview_work.get();
+
+    // a cached folder is only filtered and sorted, no need to wait for it
+    bool ready = preview_entry_error(*job, frame.get());
+    if (!ready && file.is_directory() &&
+        (work == nullptr || file_manager->folders_cache.contains(job->path) ||
+         load_stored_listing(file_manager, job->path))) {
+        preview_folder(job->path, width, height, file_manager, frame.get());
+        // previewing the folder may have just put its listing in the cache
+        key = get_preview_key(file, width, height, target_line, file_manager);
+        ready = true;
+    }
+    if (!ready && work == nullptr) {
+        build_file_frame(*job, frame.get());
+        ready = true;
+    }
+
+    if (ready) {
+        cache.insert(key, frame);
+        draw_preview_frame(window, *frame);
+        shown_key = key;
+        wnoutrefresh(window);
+        return;
+    }
+
+    if (key != work->selected_key) {
+        work->selected_key = key;
+        work->selected_since = chrono::steady_clock::now();
+    }
+    if (chrono::steady_clock::now() - work->selected_since >=
+        chrono::milliseconds(work->delay_ms)) {
+        queue_preview_jobs(file_manager, job);
+    }
+
+    string title = " Loading [" + job->path + "] ";
+    if (title.size() > width - 4) {
+        title.erase(width - 4);
+    }
+    mvwprintw(window, 0, 2, "%s", title.c_str());
+    shown_key.clear();
+    wnoutrefresh(window);
 }
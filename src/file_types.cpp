@@ -0,0 +1,222 @@
+#include <cstring>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "file_manager.hpp"
+
+class FileSignature {
+  public:
+    const char *name;
+    size_t offset;
+    string_view magic;
+};
+
+// Magic numbers of the common binary formats. Those at offset 0 are
+// dispatched on their first byte, the few further in are checked one by one.
+static const FileSignature FILE_SIGNATURES[] = {
+    // executables and objects
+    {"ELF executable", 0, "\x7F" "ELF"sv},
+    {"Mach-O binary", 0, "\xFE\xED\xFA\xCE"sv},
+    {"Mach-O binary", 0, "\xFE\xED\xFA\xCF"sv},
+    {"Mach-O binary", 0, "\xCE\xFA\xED\xFE"sv},
+    {"Mach-O binary", 0, "\xCF\xFA\xED\xFE"sv},
+    {"Mach-O universal binary or Java class", 0, "\xCA\xFE\xBA\xBE"sv},
+    {"PE/DOS executable", 0, "MZ"sv},
+    {"WebAssembly module", 0, "\0asm"sv},
+    {"ar archive", 0, "!<arch>\n"sv},
+    // archives and compressed streams
+    {"Zip archive", 0, "PK\x03\x04"sv},
+    {"Zip archive", 0, "PK\x05\x06"sv},
+    {"Zip archive", 0, "PK\x07\x08"sv},
+    {"gzip data", 0, "\x1F\x8B"sv},
+    {"bzip2 data", 0, "BZh"sv},
+    {"xz data", 0, "\xFD" "7zXZ\0"sv},
+    {"Zstandard data", 0, "\x28\xB5\x2F\xFD"sv},
+    {"LZ4 data", 0, "\x04\x22\x4D\x18"sv},
+    {"7-Zip archive", 0, "7z\xBC\xAF\x27\x1C"sv},
+    {"RAR archive", 0, "Rar!\x1A\x07"sv},
+    {"cpio archive", 0, "070701"sv},
+    {"tar archive", 257, "ustar"sv},
+    {"ISO 9660 image", 32769, "CD001"sv},
+    {"SquashFS image", 0, "hsqs"sv},
+    {"LUKS volume", 0, "LUKS\xBA\xBE"sv},
+    // images
+    {"PNG image", 0, "\x89PNG\r\n\x1A\n"sv},
+    {"JPEG image", 0, "\xFF\xD8\xFF"sv},
+    {"GIF image", 0, "GIF87a"sv},
+    {"GIF image", 0, "GIF89a"sv},
+    {"BMP image", 0, "BM"sv},
+    {"TIFF image", 0, "II*\0"sv},
+    {"TIFF image", 0, "MM\0*"sv},
+    {"ICO image", 0, "\0\0\1\0"sv},
+    {"Photoshop image", 0, "8BPS"sv},
+    // documents and databases
+    {"PDF document", 0, "%PDF-"sv},
+    {"SQLite database", 0, "SQLite format 3\0"sv},
+    {"Git pack", 0, "PACK"sv},
+    {"Git index", 0, "DIRC"sv},
+    // audio and video
+    {"RIFF data (WAV/AVI/WebP)", 0, "RIFF"sv},
+    {"Ogg data", 0, "OggS"sv},
+    {"FLAC audio", 0, "fLaC"sv},
+    {"MP3 audio", 0, "ID3"sv},
+    {"Matroska/WebM video", 0, "\x1A\x45\xDF\xA3"sv},
+    {"MP4/QuickTime video", 4, "ftyp"sv},
+};
+
+// Magics this short also start plain text files ("MZ", "BM"...), they name
+// a file but don't make it binary
+static const size_t MIN_BINARY_MAGIC_SIZE = 4;
+
+static const FileSignature *match_signature(const unsigned char *data,
+                                            size_t size)
+{
+    // built once, the longest magic of a first byte is tried first
+    static const array<vector<const FileSignature *>, 256> by_first_byte = [] {
+        array<vector<const FileSignature *>, 256> table;
+        for (const FileSignature &signature : FILE_SIGNATURES) {
+            if (signature.offset == 0) {
+                table[static_cast<unsigned char>(signature.magic[0])]
+                    .push_back(&signature);
+            }
+        }
+        for (auto &signatures : table) {
+            stable_sort(signatures.begin(), signatures.end(),
+                        [](const FileSignature *a, const FileSignature *b) {
+                            return a->magic.size() > b->magic.size();
+                        });
+        }
+        return table;
+    }();
+
+    if (size == 0) {
+        return nullptr;
+    }
+    for (const FileSignature *signature : by_first_byte[data[0]]) {
+        if (signature->magic.size() <= size &&
+            memcmp(data, signature->magic.data(), signature->magic.size()) ==
+                0) {
+            return signature;
+        }
+    }
+    for (const FileSignature &signature : FILE_SIGNATURES) {
+        if (signature.offset != 0 &&
+            signature.offset + signature.magic.size() <= size &&
+            memcmp(data + signature.offset, signature.magic.data(),
+                   signature.magic.size()) == 0) {
+            return &signature;
+        }
+    }
+    return nullptr;
+}
+
+// Name of the format of data (the start of a file), null if it's none of
+// the known ones
+const char *detect_file_type(const unsigned char *data, size_t size)
+{
+    const FileSignature *signature = match_signature(data, size);
+
+    return signature == nullptr ? nullptr : signature->name;
+}
+
+// Same idea as grep: a known binary header or a NUL byte in the first block
+bool is_binary_data(const unsigned char *data, size_t size)
+{
+    const FileSignature *signature = match_signature(data, size);
+
+    if (signature != nullptr &&
+        signature->magic.size() >= MIN_BINARY_MAGIC_SIZE) {
+        return true;
+    }
+    return memchr(data, '\0', size) != nullptr;
+}
+
+// "offset  xx xx xx xx xx xx xx xx  xx ...  |ascii|", as many bytes per row
+// (a power of two) as fit in width
+HexLayout get_hex_layout(size_t width, uint64_t file_size)
+{
+    HexLayout layout;
+
+    layout.offset_digits = 8;
+    while (file_size != 0 && layout.offset_digits < 16 &&
+           (file_size - 1) >> (layout.offset_digits * 4) != 0) {
+        layout.offset_digits += 2;
+    }
+
+    for (layout.row_bytes = 32; layout.row_bytes > 4; layout.row_bytes /= 2) {
+        size_t row_size = layout.offset_digits + 2 + layout.row_bytes * 4 +
+                          layout.row_bytes / 8 + 2;
+        if (row_size <= width) {
+            break;
+        }
+    }
+    layout.ascii_column =
+        layout.offset_digits + 2 + layout.row_bytes * 3 + layout.row_bytes / 8;
+    return layout;
+}
+
+// Two hex digits per byte, 16 bytes at a time with SSE2: the nibbles are
+// split, interleaved and turned into digits without a lookup
+static void encode_hex(const unsigned char *data, size_t size, char *out)
+{
+    static const char digits[] = "0123456789abcdef";
+    size_t i = 0;
+
+#ifdef __SSE2__
+    const __m128i nibble_mask = _mm_set1_epi8(0x0F);
+    const __m128i nine = _mm_set1_epi8(9);
+    const __m128i zero = _mm_set1_epi8('0');
+    const __m128i letters = _mm_set1_epi8('a' - '0' - 10);
+    auto to_digits = [&](__m128i nibbles) {
+        __m128i above_nine = _mm_cmpgt_epi8(nibbles, nine);
+        return _mm_add_epi8(_mm_add_epi8(nibbles, zero),
+                            _mm_and_si128(above_nine, letters));
+    };
+    for (; i + 16 <= size; i += 16) {
+        __m128i bytes =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        __m128i high = _mm_and_si128(_mm_srli_epi16(bytes, 4), nibble_mask);
+        __m128i low = _mm_and_si128(bytes, nibble_mask);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i * 2),
+                         to_digits(_mm_unpacklo_epi8(high, low)));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i * 2 + 16),
+                         to_digits(_mm_unpackhi_epi8(high, low)));
+    }
+#endif
+    for (; i < size; i++) {
+        out[i * 2] = digits[data[i] >> 4];
+        out[i * 2 + 1] = digits[data[i] & 0x0F];
+    }
+}
+
+// One row of a hex dump, size is less than row_bytes only on the last row
+string format_hex_row(const HexLayout &layout, const unsigned char *data,
+                      size_t size, uint64_t offset)
+{
+    array<char, 64> hex;
+    string row(layout.ascii_column + layout.row_bytes + 2, ' ');
+
+    for (int i = layout.offset_digits - 1; i >= 0; i--) {
+        row[i] = "0123456789abcdef"[offset & 0x0F];
+        offset >>= 4;
+    }
+
+    encode_hex(data, size, hex.data());
+    size_t column = layout.offset_digits + 2;
+    for (size_t i = 0; i < size; i++) {
+        row[column] = hex[i * 2];
+        row[column + 1] = hex[i * 2 + 1];
+        column += 3;
+        if (i % 8 == 7) {
+            column++;
+        }
+    }
+
+    row[layout.ascii_column] = '|';
+    for (size_t i = 0; i < size; i++) {
+        row[layout.ascii_column + 1 + i] = isprint(data[i]) ? data[i] : '.';
+    }
+    row[layout.ascii_column + 1 + size] = '|';
+    row.resize(layout.ascii_column + size + 2);
+    return row;
+}
@@ -2,122 +2,231 @@
 #include <filesystem>
 #include "file_manager.hpp"
 
-vector<fs::directory_entry> get_files_in_folder(const std::string &folder)
+shared_ptr<EntryTable> get_files_in_folder(const std::string &folder)
 {
-    vector<fs::directory_entry> files;
+    PerfScope perf_scope(PERF_READ_FOLDER, folder);
+    auto table = make_shared<EntryTable>();
+    table->folder = folder;
 
-    try {
-        for (const auto &entry : fs::directory_iterator(folder)) {
-            if (entry.path().filename() == "." ||
-                entry.path().filename() == "..") {
-                continue;
-            }
-            files.push_back(entry);
-        }
+    DIR *dir = opendir(folder.c_str());
+    perf_count(PERF_OPENS);
 
-    } catch (const fs::filesystem_error &e) {
-        return files;
+    if (dir == nullptr) {
+        return table;
     }
-    return files;
+
+    get_folder_version(dirfd(dir), &table->folder_mtime, &table->folder_inode);
+    while (const struct dirent *entry = readdir(dir)) {
+        add_folder_entry(table.get(), dirfd(dir), entry);
+    }
+
+    closedir(dir);
+    return table;
 }
 
-vector<fs::directory_entry> load_folder(FileManager *file_manager,
-                                        const std::string &folder,
-                                        bool force_update, bool search)
+// The cwd and its parents are never evicted, going back up has to be instant
+static bool is_cwd_or_parent(const string &cwd, const string &folder)
 {
-    const size_t max_cached_folders = 100;
+    if (cwd.compare(0, folder.size(), folder) != 0) {
+        return false;
+    }
+    return cwd.size() == folder.size() || folder.back() == '/' ||
+           cwd[folder.size()] == '/';
+}
+
+void setup_folders_cache(FileManager *file_manager)
+{
+    // can be sized per machine with FILE_MANAGER_CACHE_MB
+    size_t budget_mb = 64;
+    if (const char *env_budget = getenv("FILE_MANAGER_CACHE_MB")) {
+        budget_mb = strtoul(env_budget, nullptr, 10);
+    }
 
     auto &cache = file_manager->folders_cache;
-    auto cached_pair = cache.find(folder);
+    cache.budget = budget_mb * 1024 * 1024;
+    cache.measure = [](const shared_ptr<EntryTable> &table) {
+        return table->memory_usage() + table->folder.size();
+    };
+    cache.pinned = [file_manager](const string &folder) {
+        return is_cwd_or_parent(file_manager->cwd, folder);
+    };
+    cache.on_evict = [file_manager](const string &folder) {
+        unwatch_folder(file_manager, folder);
+    };
+}
 
-    vector<fs::directory_entry> files;
+void cache_folder(FileManager *file_manager, const string &folder,
+                  const shared_ptr<EntryTable> &table)
+{
+    file_manager->folders_cache.insert(folder, table);
+    watch_folder(file_manager, folder);
+}
 
-    if (cached_pair != cache.end() && !force_update) {
-        files = cached_pair->second;
-    } else {
-        // should clear based on a score or something
-        if (cache.size() >= max_cached_folders) {
-            cache.clear();
+static bool is_same_or_under(const string &folder, const string &path)
+{
+    if (folder.compare(0, path.size(), path) != 0) {
+        return false;
+    }
+    return folder.size() == path.size() || path == "/" ||
+           folder[path.size()] == '/';
+}
+
+// folder itself, anything under one of paths and the folders they are in
+static bool is_folder_touched(const string &cached, const string &folder,
+                              const vector<string> &paths)
+{
+    if (cached == folder) {
+        return true;
+    }
+
+    for (const string &path : paths) {
+        if (is_same_or_under(cached, path) ||
+            cached == fs::path(path).parent_path().string()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Drops the cached listings and tree sizes of the folders something that
+// ran in the background may have changed. The watched ones are patched by
+// the watcher instead, right away.
+void refresh_touched_folders(FileManager *file_manager, const string &folder,
+                             const vector<string> &paths)
+{
+    auto &cache = file_manager->folders_cache;
+    vector<string> touched;
+    bool watched = false;
+
+    forget_tree_size(file_manager, folder);
+    for (const string &path : paths) {
+        forget_tree_size(file_manager, path);
+    }
+
+    for (const auto &item : cache.items) {
+        if (is_folder_touched(item.key, folder, paths)) {
+            touched.push_back(item.key);
+        }
+    }
+
+    for (const string &cached : touched) {
+        if (is_folder_watched(file_manager, cached)) {
+            watched = true;
+        } else if (cached == file_manager->cwd &&
+                   !file_manager->recursive_search) {
+            start_folder_load(file_manager, cached, true);
+        } else {
+            cache.erase(cached);
         }
+    }
 
-        files = get_files_in_folder(folder);
-        cache[folder] = files;
+    if (watched) {
+        read_folder_events(file_manager);
+        apply_folder_changes(file_manager, true);
     }
+}
+
+// Filters the rows from `from` onwards
+void filter_files(FileManager *file_manager, FileList *files, size_t from,
+                  bool search)
+{
+    const EntryTable &table = *files->table;
+    auto &rows = files->rows;
 
     // Filter out hidden files if needed
     if (!file_manager->hidden_files) {
-        files.erase(remove_if(files.begin(), files.end(),
-                              [](const fs::directory_entry &entry) {
-                                  return FILE_NAME(entry).front() == '.';
-                              }),
-                    files.end());
+        rows.erase(remove_if(rows.begin() + from, rows.end(),
+                             [&table](uint32_t row) {
+                                 return table.name(row).front() == '.';
+                             }),
+                   rows.end());
     }
 
     if (!file_manager->current_search.empty() && search) {
-        files = search_files(files, file_manager->current_search);
+        search_files(files, from, file_manager->current_search);
     }
-
-    sort_files(&files, file_manager->sort_type);
-    return files;
 }
 
-bool can_read_file(const string &file_path)
+FileList load_folder(FileManager *file_manager, const std::string &folder,
+                     bool force_update, bool search)
 {
-    ifstream file(file_path);
+    PerfScope perf_scope(PERF_LOAD_FOLDER, folder);
+    shared_ptr<EntryTable> *cached_table =
+        force_update ? nullptr : file_manager->folders_cache.find(folder);
+
+    FileList files;
+
+    if (cached_table != nullptr) {
+        files.table = *cached_table;
+    } else {
+        files.table = get_files_in_folder(folder);
+        cache_folder(file_manager, folder, files.table);
+    }
 
-    bool state = file.good();
+    files.rows.resize(files.table->size());
+    for (uint32_t row = 0; row < files.rows.size(); row++) {
+        files.rows[row] = row;
+    }
 
-    file.close();
+    filter_files(file_manager, &files, 0, search);
 
-    return state;
+    sort_files(file_manager, &files);
+    return files;
 }
 
-static string read_repo_data(const string &file_path)
+// Rebuilds the files list from the cached table of the cwd, keeping the
+// selected entry selected if it's still there
+void refresh_files(FileManager *file_manager)
 {
-    ifstream file(file_path);
+    string selected_name;
 
-    if (!file) {
-        return "";
+    // the list holds search results, not the cwd
+    if (file_manager->recursive_search) {
+        return;
     }
 
-    string line;
-    string repo_name;
-    string branch_name;
-
-    while (getline(file, line)) {
-        if (line.find("url") != string::npos) {
-            repo_name = line.erase(line.find_last_of('.'))
-                            .substr(line.find_last_of('/') + 1);
-        }
-        if (line.find("branch \"") != string::npos) {
-            branch_name = line.erase(line.find_last_of('\"'))
-                              .substr(line.find_first_of('\"') + 1);
-        }
+    if (!file_manager->files.empty()) {
+        selected_name =
+            file_manager->files[file_manager->file_position].name();
     }
 
-    return repo_name + " <" + branch_name + ">";
+    file_manager->files =
+        load_folder(file_manager, file_manager->cwd, false, true);
+
+    select_file(file_manager, selected_name);
 }
 
-string find_git_repo(string folder)
+// Sorts the list again for keys that changed (tree sizes coming in), the
+// selection stays on the same entry
+void resort_files(FileManager *file_manager)
 {
-    while (!folder.empty() && (folder.back() == '/')) {
-        folder.pop_back();
+    FileList &files = file_manager->files;
+
+    if (files.empty()) {
+        return;
     }
 
-    while (!folder.empty()) {
-        string config_path = folder + "/.git/config";
-        if (can_read_file(config_path)) {
-            return read_repo_data(config_path);
-        }
+    uint32_t selected_row = files.rows[file_manager->file_position];
+    sort_files(file_manager, &files);
+    auto selected = find(files.rows.begin(), files.rows.end(), selected_row);
+    file_manager->file_position = selected - files.rows.begin();
+}
 
-        size_t last_slash = folder.find_last_of('/');
-        if (last_slash == string::npos) {
-            break;
+// Moves the selection to the entry called name, or keeps the position in
+// range if it isn't in the list anymore
+void select_file(FileManager *file_manager, string_view name)
+{
+    for (size_t i = 0; i < file_manager->files.size(); i++) {
+        if (file_manager->files[i].name() == name) {
+            file_manager->file_position = i;
+            return;
         }
-        folder = folder.substr(0, last_slash);
     }
 
-    return "";
+    if (file_manager->file_position >= file_manager->files.size()) {
+        file_manager->file_position =
+            file_manager->files.empty() ? 0 : file_manager->files.size() - 1;
+    }
 }
 
 static void display_folder_info(WINDOW *window, FileManager *file_manager)
@@ -138,77 +247,123 @@ static void display_folder_info(WINDOW *window, FileManager *file_manager)
         folder_path.append("+");
     }
 
-    if (file_manager->files.size() == 0) {
+    if (file_manager->folder_load) {
+        mvwprintw(window, 0, 2, " [%s] - %s %ld entries... ",
+                  folder_path.c_str(),
+                  file_manager->folder_load->revalidate ? "Checking"
+                                                        : "Loading",
+                  file_manager->folder_load->loaded.load());
+    } else if (file_manager->recursive_walk) {
+        mvwprintw(window, 0, 2, " [%s] - Searching %ld folders... ",
+                  folder_path.c_str(),
+                  file_manager->recursive_walk->walked_folders.load());
+    } else if (size_t measured =
+                   measured_folders(file_manager->disk_usage.get())) {
+        mvwprintw(window, 0, 2, " [%s] - Measuring %ld folders... ",
+                  folder_path.c_str(), measured);
+    } else if (file_manager->files.size() == 0) {
         mvwprintw(window, 0, 2, " [%s] - Empty ", folder_path.c_str());
         return;
+    } else {
+        mvwprintw(window, 0, 2, " [%s] - Entry %ld/%ld ", folder_path.c_str(),
+                  file_manager->file_position + 1, file_manager->files.size());
     }
-    mvwprintw(window, 0, 2, " [%s] - Entry %ld/%ld ", folder_path.c_str(),
-              file_manager->file_position + 1, file_manager->files.size());
 
-    string repo_name = find_git_repo(file_manager->cwd);
+    const GitRepo *repo = find_git_repo(file_manager, file_manager->cwd);
 
-    if (repo_name.size() != 0) {
-        mvwprintw(window, height - 1, 2, " Git: %s ", repo_name.c_str());
+    if (repo != nullptr) {
+        mvwprintw(window, height - 1, 2, " Git: %s ",
+                  repo->description.c_str());
     }
 }
 
 size_t count_files_in_folder(const string &folder)
 {
-    size_t count;
-    try {
-        count =
-            distance(fs::directory_iterator(folder), fs::directory_iterator{});
-    } catch (const fs::filesystem_error &e) {
+    PerfScope perf_scope(PERF_COUNT_FILES, folder);
+    DIR *dir = opendir(folder.c_str());
+    perf_count(PERF_OPENS);
+
+    if (dir == nullptr) {
         return 0;
     }
+
+    size_t count = 0;
+    while (const struct dirent *entry = readdir(dir)) {
+        const char *name = entry->d_name;
+        if (name[0] == '.' &&
+            (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+            continue;
+        }
+        count++;
+    }
+
+    closedir(dir);
     return count;
 }
 
+// "6.1 KB", "42 MB", "512 B", rounded to the nearest. Called for every row
+// drawn, so integers only, no log10/pow/printf
 string format_bytes(uint64_t bytes)
 {
-    const char *suffixes[] = {"B", "KB", "MB", "GB", "TB", "PB", "EB"};
-    uint64_t divisor = 1000;
+    static const char *suffixes[] = {"B", "KB", "MB", "GB", "TB", "PB", "EB"};
 
     if (bytes == 0) {
         return "0";
     }
 
-    int magnitude = static_cast<int>(log10(bytes) / log10(divisor));
-    magnitude = min(magnitude, 6);
-
-    double scaledSize = static_cast<double>(bytes) / pow(divisor, magnitude);
-
-    char buffer[32];
+    int magnitude = 0;
+    uint64_t divisor = 1;
+    while (magnitude < 6 && bytes / divisor >= 1000) {
+        divisor *= 1000;
+        magnitude++;
+    }
 
-    // A lot of stuff just to have 3 total digits
-    if (scaledSize < 10) {
-        snprintf(buffer, sizeof(buffer), "%.2f", scaledSize);
-        string numStr(buffer);
-        numStr = numStr.substr(0, 3);
-        if (numStr.back() == '.') {
-            numStr.pop_back();
-        }
-        snprintf(buffer, sizeof(buffer), "%s %s", numStr.c_str(),
-                 suffixes[magnitude]);
-    } else if (scaledSize < 100) {
-        snprintf(buffer, sizeof(buffer), "%.1f", scaledSize);
-        string numStr(buffer);
-        numStr = numStr.substr(0, 3);
-        if (numStr.back() == '.') {
-            numStr.pop_back();
+    char buffer[16];
+    char *end = buffer;
+    auto append_number = [&end](uint64_t number) {
+        char digits[20];
+        int count = 0;
+        do {
+            digits[count++] = '0' + number % 10;
+            number /= 10;
+        } while (number != 0);
+        while (count > 0) {
+            *end++ = digits[--count];
         }
-        snprintf(buffer, sizeof(buffer), "%s %s", numStr.c_str(),
-                 suffixes[magnitude]);
+    };
+
+    // bytes / unit rounded half up, without overflowing near UINT64_MAX
+    auto rounded = [bytes](uint64_t unit) {
+        return bytes / unit + (bytes % unit >= (unit + 1) / 2 ? 1 : 0);
+    };
+
+    // one decimal below 10, "9.96" rounds up to "10"
+    uint64_t tenths = divisor == 1 ? bytes * 10 : rounded(divisor / 10);
+    if (tenths < 100) {
+        append_number(tenths / 10);
+        *end++ = '.';
+        append_number(tenths % 10);
+    } else if (rounded(divisor) < 1000 || magnitude == 6) {
+        append_number(rounded(divisor));
     } else {
-        snprintf(buffer, sizeof(buffer), "%.0f %s", scaledSize,
-                 suffixes[magnitude]);
+        // "999.5 KB" rounds up to the next unit, not to "1000 KB"
+        *end++ = '1';
+        *end++ = '.';
+        *end++ = '0';
+        magnitude++;
     }
-
-    return buffer;
+    *end++ = ' ';
+    for (const char *suffix = suffixes[magnitude]; *suffix != '\0'; suffix++) {
+        *end++ = *suffix;
+    }
+    return string(buffer, end);
 }
 
-int find_file_color(const fs::directory_entry &file)
+int find_file_color(const FileEntry &file)
 {
+    if (!file.is_readable()) {
+        return RED;
+    }
     if (file.is_symlink()) {
         return MAGENTA;
     }
@@ -221,98 +376,327 @@ int find_file_color(const fs::directory_entry &file)
     return WHITE;
 }
 
-void display_files(WINDOW *window, FileManager *file_manager)
+// A content search result: path:line: snippet with the match underlined
+static void display_content_match(WINDOW *window, int y, size_t width,
+                                  FileManager *file_manager,
+                                  const FileEntry &file, bool selected)
 {
-    werase(window);
+    const ContentMatches &matches = file_manager->content_matches;
+    string prefix = string(file.name()) + ':' +
+                    to_string(matches.lines[file.row]) + ": ";
+    string line = prefix + matches.snippets[file.row];
+    size_t visible_size = line.size();
+
+    if (line.size() > width - 2) {
+        line.erase(width - 3);
+        line += '+';
+        visible_size = line.size() - 1;
+    }
+    mvwprintw(window, y, 1, "%s", line.c_str());
+
+    size_t match_start = prefix.size() + matches.columns[file.row];
+    size_t match_end = min(match_start + file_manager->current_search.size(),
+                           visible_size);
+    if (match_start < match_end) {
+        mvwchgat(window, y, 1 + match_start, match_end - match_start,
+                 A_BOLD | A_UNDERLINE | (selected ? A_REVERSE : 0),
+                 find_file_color(file), nullptr);
+    }
+}
 
-    size_t height = getmaxy(window);
-    size_t width = getmaxx(window);
+// The list only scrolls when the selection gets this close to an edge
+static const size_t SCROLL_MARGIN = 3;
 
-    box(window, ACS_VLINE, ACS_HLINE);
+// First entry shown so the selection stays SCROLL_MARGIN rows away from the
+// edges, moving the list as little as possible
+static size_t get_list_top(ScreenState *screen, size_t position, size_t size,
+                           size_t rows)
+{
+    size_t top = screen->list_top;
+    size_t margin = min(SCROLL_MARGIN, (rows - 1) / 2);
 
-    display_folder_info(window, file_manager);
-    display_sort_info(window, file_manager->sort_type);
+    if (position < top + margin) {
+        top = position > margin ? position - margin : 0;
+    } else if (position + margin >= top + rows) {
+        top = position + margin + 1 - rows;
+    }
+    if (size <= rows) {
+        top = 0;
+    } else if (top > size - rows) {
+        top = size - rows;
+    }
+    screen->list_top = top;
+    return top;
+}
 
-    if (file_manager->files.size() == 0) {
-        ERROR_ATTRON(window);
-        mvwprintw(window, 1, 1, "Directory is empty");
-        ERROR_ATTROFF(window);
-        wrefresh(window);
+// Past this many formatted rows they are all dropped and formatted again as
+// they show up, a long scroll through a huge folder doesn't keep them all
+static const size_t MAX_FORMATTED_ROWS = 4096;
+
+// Name and size columns of file, formatted the first time the row is shown
+// and kept until the folder changes or the list is resized
+static const RowColumns &get_row_columns(ListColumns *columns,
+                                         const FileEntry &file,
+                                         size_t name_space)
+{
+    if (columns->table != file.table ||
+        columns->version != file.table->version ||
+        columns->name_space != name_space ||
+        columns->rows.size() >= MAX_FORMATTED_ROWS) {
+        columns->rows.clear();
+        columns->table = file.table;
+        columns->version = file.table->version;
+        columns->name_space = name_space;
+    }
+
+    auto [found, inserted] = columns->rows.try_emplace(file.row);
+    RowColumns &row = found->second;
+    if (!inserted) {
+        return row;
+    }
+
+    row.name = file.name();
+    if (file.is_character_file()) {
+        row.name_width = row.name.size();
+        return row;
+    }
+
+    if (file.is_symlink()) {
+        error_code error;
+        row.name.append(" -> ").append(
+            fs::read_symlink(file.path(), error).string());
+    }
+
+    row.name_width = row.name.size();
+
+    // file names too long
+    if (row.name.size() > name_space) {
+        row.name.erase(name_space);
+        row.name += '+';
+        row.name_width = row.name.size() - 1;
+    }
+
+    if (file.is_regular_file()) {
+        row.size = format_bytes(file.file_size());
+    }
+    return row;
+}
+
+static void display_file_row(WINDOW *window, int y, size_t width,
+                             FileManager *file_manager, const FileEntry &file,
+                             bool selected, size_t marker_width,
+                             size_t mark_width, bool marked,
+                             const RowColumns &columns,
+                             const string &byte_format)
+{
+    // inside a repository a column shows the git status of each entry
+    static const char git_markers[] = {' ', 'M', '?', '!'};
+
+    wattron(window, COLOR_PAIR(find_file_color(file)));
+
+    if (selected) {
+        wattron(window, A_REVERSE);  // Reverse colors to highlight selected file
+    }
+
+    if (file_manager->search_contents) {
+        display_content_match(window, y, width, file_manager, file, selected);
+        wattrset(window, A_NORMAL);
         return;
     }
 
-    size_t available_rows = height - 2;
+    // the marked entries, while some of the list's are
+    if (mark_width != 0) {
+        mvwaddstr(window, y, 1, marked ? "* " : "  ");
+    }
 
-    size_t start_pos = 0;
-    if (file_manager->files.size() > available_rows) {
-        int tmp = file_manager->file_position -
-                  available_rows / 2;  // Divide by 2 to center
-        if (tmp < 0) {
-            start_pos = 0;
-        } else {
-            start_pos = tmp;
-        }
-        if (start_pos > file_manager->files.size() - available_rows) {
-            start_pos = file_manager->files.size() - available_rows;
-        }
+    if (file.is_character_file()) {
+        mvwaddnstr(window, y, 1 + mark_width, columns.name.data(),
+                   columns.name.size());
+        wattrset(window, A_NORMAL);
+        return;
     }
 
-    size_t end_pos =
-        min(start_pos + available_rows, file_manager->files.size());
-    for (size_t i = start_pos; i < end_pos; i++) {
-        fs::directory_entry file = file_manager->files[i];
+    // name, spaces up to the right aligned size, the git mark and the size
+    string file_line;
+    file_line.reserve(width);
+    file_line += columns.name;
 
-        if (!can_read_file(FILE_PATH(file))) {
-            wattron(window, COLOR_PAIR(1));
-        } else {
-            wattron(window, COLOR_PAIR(find_file_color(file)));
-        }
+    int to_append = width - 10 - marker_width - mark_width -
+                    columns.name.size() +
+                    (7 - byte_format.size());
+    if (to_append < 0) {
+        to_append = 0;
+    }
+    file_line.append(to_append, ' ');
 
-        if (i == file_manager->file_position) {
-            wattron(window,
-                    A_REVERSE);  // Reverse colors to highlight selected file
-        }
+    if (marker_width != 0) {
+        file_line += git_markers[get_git_mark(file_manager, file.row)];
+        file_line += ' ';
+    }
 
-        string file_line = FILE_NAME(file);
+    file_line += byte_format;
 
-        if (file.is_character_file()) {
-            mvwprintw(window, i - start_pos + 1, 1, "%s", file_line.c_str());
-            wattrset(window, A_NORMAL);
-            continue;
-        }
+    mvwaddnstr(window, y, 1 + mark_width, file_line.data(), file_line.size());
 
-        if (file.is_symlink()) {
-            file_line.append(" -> ").append(
-                fs::read_symlink(file.path()).string());
+    // underline the characters the search matched, in the file name only for
+    // recursive results
+    vector<size_t> match_positions;
+    size_t name_start = file.name().rfind('/') + 1;
+    if (!file_manager->current_search.empty() &&
+        match_search(file.name().substr(name_start),
+                     file_manager->current_search, &match_positions)) {
+        attr_t match_attributes = A_BOLD | A_UNDERLINE;
+        if (selected) {
+            match_attributes |= A_REVERSE;
         }
-
-        // string is a byte format (125 B, 78 MB...) for regular files and the
-        // file count for folders
-        string byte_format =
-            file.is_regular_file()
-                ? format_bytes(file.file_size())
-                : to_string(count_files_in_folder(FILE_PATH(file)));
-
-        // file names too long
-        if (file_line.size() > width - 11) {
-            file_line.erase(width - 11);
-            file_line += '+';
+        for (size_t position : match_positions) {
+            position += name_start;
+            if (position < columns.name_width) {
+                mvwchgat(window, y, 1 + mark_width + position, 1,
+                         match_attributes,
+                         find_file_color(file), nullptr);
+            }
         }
+    }
 
-        // add zeros between file name and byte format
-        int to_append =
-            width - 10 - file_line.size() + (7 - byte_format.size());
-        if (to_append < 0) {
-            to_append = 0;
-        }
-        file_line.append(to_append, ' ');
+    wattrset(window, A_NORMAL);
+}
 
-        file_line += byte_format;
+// Everything a row is drawn from, the row is only drawn again when it changes
+static string get_row_key(FileManager *file_manager, const FileEntry &file,
+                          bool selected, size_t width, size_t marker_width,
+                          size_t mark_width, const string &byte_format)
+{
+    char key[128];
+
+    snprintf(key, sizeof(key), "%p %llu %u %d %zu %zu %d %d %zu %d ",
+             static_cast<const void *>(file.table),
+             static_cast<unsigned long long>(file.table->version),
+             file.row, selected, width, marker_width,
+             marker_width != 0 ? get_git_mark(file_manager, file.row) : 0,
+             file_manager->search_contents, mark_width,
+             file_manager->marks.is_marked(file.table, file.row));
+    return key + byte_format + '\0' + file_manager->current_search;
+}
 
-        mvwprintw(window, i - start_pos + 1, 1, "%s", file_line.c_str());
+// Draws the rows of the list that changed since the last frame. The border,
+// the title and the status line are cheap and drawn every time.
+void display_files(WINDOW *window, FileManager *file_manager)
+{
+    PerfScope perf_scope(PERF_DISPLAY_FILES);
+    ScreenState &screen = file_manager->screen;
 
-        wattrset(window, A_NORMAL);
+    size_t height = getmaxy(window);
+    size_t width = getmaxx(window);
+    size_t available_rows = height - 2;
+
+    if (file_manager->files.size() == 0 ||
+        screen.list_rows.size() != available_rows) {
+        werase(window);
+        screen.list_rows.assign(available_rows, string());
+    }
+
+    box(window, ACS_VLINE, ACS_HLINE);
+
+    display_folder_info(window, file_manager);
+    display_sort_info(window, file_manager->sort_type);
+
+    if (file_manager->files.size() == 0) {
+        if (file_manager->folder_load || file_manager->recursive_walk) {
+            mvwprintw(window, 1, 1, file_manager->folder_load ? "Loading..."
+                                                              : "Searching...");
+            wnoutrefresh(window);
+            return;
+        }
+        if (file_manager->recursive_search &&
+            file_manager->current_search.empty()) {
+            mvwprintw(window, 1, 1, "Type to search the subfolders");
+            wnoutrefresh(window);
+            return;
+        }
+        ERROR_ATTRON(window);
+        mvwprintw(window, 1, 1, file_manager->recursive_search
+                                    ? "No matches"
+                                    : "Directory is empty");
+        ERROR_ATTROFF(window);
+        // the message isn't a row, the list starts over after it
+        screen.list_rows.clear();
+        wnoutrefresh(window);
+        return;
+    }
+
+    size_t start_pos =
+        get_list_top(&screen, file_manager->file_position,
+                     file_manager->files.size(), available_rows);
+
+    size_t marker_width = !file_manager->recursive_search &&
+                                  find_git_repo(file_manager,
+                                                file_manager->cwd) != nullptr
+                              ? 2
+                              : 0;
+    size_t mark_width = file_manager->marks.count != 0 &&
+                                file_manager->marks.table ==
+                                    file_manager->files.table &&
+                                !file_manager->search_contents
+                            ? 2
+                            : 0;
+    size_t name_space = width - 11 - marker_width - mark_width;
+
+    for (size_t y = 0; y < available_rows; y++) {
+        size_t i = start_pos + y;
+        string key;
+        string byte_format;
+
+        if (i < file_manager->files.size()) {
+            FileEntry file = file_manager->files[i];
+            const RowColumns &columns =
+                get_row_columns(&screen.columns, file, name_space);
+            // string is a byte format (125 B, 78 MB...) for regular files and
+            // the file count for folders, "..." until the count comes back.
+            // The tree size sorts show what's on disk instead, under folders
+            // too ("~" while it's still adding up).
+            byte_format = columns.size;
+            size_t child_count;
+            uint64_t tree_size;
+            bool complete;
+            bool by_tree_size = is_tree_size_sort(file_manager->sort_type);
+            if (by_tree_size && file.is_regular_file()) {
+                byte_format = format_bytes(file.allocated_size());
+            } else if (by_tree_size && file.is_directory() &&
+                       !file.is_symlink()) {
+                byte_format = "...";
+                if (find_tree_size(file_manager->disk_usage.get(),
+                                   file.path(), file.last_write_time(),
+                                   &tree_size, &complete)) {
+                    byte_format = (complete ? "" : "~") +
+                                  format_bytes(tree_size);
+                }
+            } else if (!file.is_regular_file()) {
+                byte_format = "...";
+                if (find_child_count(file_manager->child_counts.get(),
+                                     file.path(), file.last_write_time(),
+                                     &child_count)) {
+                    byte_format = to_string(child_count);
+                }
+            }
+            key = get_row_key(file_manager, file,
+                              i == file_manager->file_position, width,
+                              marker_width, mark_width, byte_format);
+            if (key == screen.list_rows[y]) {
+                continue;
+            }
+            mvwhline(window, y + 1, 1, ' ', width - 2);
+            display_file_row(window, y + 1, width, file_manager, file,
+                             i == file_manager->file_position, marker_width,
+                             mark_width,
+                             file_manager->marks.is_marked(file.table,
+                                                           file.row),
+                             columns, byte_format);
+        } else if (!screen.list_rows[y].empty()) {
+            mvwhline(window, y + 1, 1, ' ', width - 2);
+        }
+        screen.list_rows[y] = move(key);
     }
 
-    wrefresh(window);
+    wnoutrefresh(window);
 }
@@ -0,0 +1,162 @@
+#include "file_manager.hpp"
+
+// the first chunk is kept small so the first screenful shows up right away
+static const size_t FIRST_CHUNK_SIZE = 256;
+static const size_t CHUNK_SIZE = 4096;
+
+static void flush_chunk(FolderLoad *load, EntryTable *chunk)
+{
+    {
+        lock_guard<mutex> guard(load->chunk_lock);
+        load->chunk.append(*chunk);
+    }
+    *chunk = EntryTable();
+    wake_event_loop();
+}
+
+// Runs detached, a read stuck on a slow mount only keeps this thread alive
+static void read_folder_worker(shared_ptr<FolderLoad> load)
+{
+    name_perf_thread("folder loader");
+    PerfScope perf_scope(PERF_READ_FOLDER, load->folder);
+    EntryTable chunk;
+    size_t chunk_size = FIRST_CHUNK_SIZE;
+
+    DIR *dir = opendir(load->folder.c_str());
+    perf_count(PERF_OPENS);
+
+    if (dir != nullptr) {
+        get_folder_version(dirfd(dir), &load->folder_mtime,
+                           &load->folder_inode);
+        while (const struct dirent *entry = readdir(dir)) {
+            if (load->cancelled) {
+                closedir(dir);
+                return;
+            }
+            if (!add_folder_entry(&chunk, dirfd(dir), entry)) {
+                continue;
+            }
+            load->loaded++;
+            if (chunk.size() >= chunk_size) {
+                flush_chunk(load.get(), &chunk);
+                chunk_size = CHUNK_SIZE;
+            }
+        }
+        closedir(dir);
+    }
+
+    flush_chunk(load.get(), &chunk);
+    load->finished = true;
+    wake_event_loop();
+}
+
+void cancel_folder_load(FileManager *file_manager)
+{
+    if (file_manager->folder_load) {
+        file_manager->folder_load->cancelled = true;
+        file_manager->folder_load.reset();
+    }
+    file_manager->loading_table.reset();
+}
+
+void start_folder_load(FileManager *file_manager, const string &folder,
+                       bool force_update)
+{
+    cancel_folder_load(file_manager);
+
+    bool cached = false;
+    if (!force_update) {
+        cached = file_manager->folders_cache.contains(folder) ||
+                 load_stored_listing(file_manager, folder);
+    }
+
+    // a listing from the disk cache, or one whose watch was dropped, is
+    // drawn right away and read again behind it
+    if (cached) {
+        file_manager->files = load_folder(file_manager, folder, false, true);
+        const EntryTable &table = *file_manager->files.table;
+        if (!table.persisted && !table.unwatched) {
+            return;
+        }
+    }
+
+    auto load = make_shared<FolderLoad>();
+    load->folder = folder;
+    load->replace_files = !cached;
+    load->revalidate = cached;
+    file_manager->folder_load = load;
+    file_manager->loading_table = make_shared<EntryTable>();
+    file_manager->loading_table->folder = folder;
+
+    thread(read_folder_worker, load).detach();
+}
+
+// Moves the entries read since the last call into the files list, returns
+// true if the list changed
+bool poll_folder_load(FileManager *file_manager)
+{
+    shared_ptr<FolderLoad> load = file_manager->folder_load;
+
+    if (!load) {
+        return false;
+    }
+
+    // read finished before taking the chunk so the last one isn't missed
+    bool finished = load->finished;
+    EntryTable chunk;
+    {
+        lock_guard<mutex> guard(load->chunk_lock);
+        swap(chunk, load->chunk);
+    }
+
+    if (chunk.size() == 0 && !finished) {
+        return false;
+    }
+    PerfScope perf_scope(PERF_LOAD_FOLDER, load->folder);
+
+    auto &files = file_manager->files;
+    shared_ptr<EntryTable> table = file_manager->loading_table;
+
+    if (load->revalidate) {
+        table->append(chunk);
+        if (!finished) {
+            return false;
+        }
+        table->folder_mtime = load->folder_mtime;
+        table->folder_inode = load->folder_inode;
+        cache_folder(file_manager, load->folder, table);
+        file_manager->loading_table.reset();
+        file_manager->folder_load.reset();
+        refresh_files(file_manager);
+        return true;
+    }
+
+    if (load->replace_files) {
+        files.rows.clear();
+        files.table = table;
+        load->replace_files = false;
+    }
+
+    size_t middle = files.size();
+    for (uint32_t row = table->size(); row < table->size() + chunk.size();
+         row++) {
+        files.rows.push_back(row);
+    }
+    table->append(chunk);
+
+    filter_files(file_manager, &files, middle, true);
+    merge_sorted_files(file_manager, &files, middle);
+
+    if (finished) {
+        table->folder_mtime = load->folder_mtime;
+        table->folder_inode = load->folder_inode;
+        cache_folder(file_manager, load->folder, table);
+        file_manager->loading_table.reset();
+        file_manager->folder_load.reset();
+    }
+
+    if (file_manager->file_position >= files.size()) {
+        file_manager->file_position = files.empty() ? 0 : files.size() - 1;
+    }
+    return true;
+}
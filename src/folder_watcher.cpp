@@ -0,0 +1,322 @@
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include "file_manager.hpp"
+
+static const size_t MAX_WATCHED_FOLDERS = 64;
+
+// a folder churning thousands of files per second is patched at most this
+// often
+static const int FOLDER_CHANGES_DELAY_MS = 250;
+
+static const uint32_t WATCH_MASK = IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+                                   IN_MOVED_TO | IN_ATTRIB | IN_CLOSE_WRITE |
+                                   IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+
+void start_folder_watcher(FileManager *file_manager)
+{
+    file_manager->watcher.inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+}
+
+void stop_folder_watcher(FileManager *file_manager)
+{
+    FolderWatcher &watcher = file_manager->watcher;
+
+    if (watcher.inotify_fd != -1) {
+        close(watcher.inotify_fd);
+    }
+    watcher = FolderWatcher();
+}
+
+bool is_folder_watched(FileManager *file_manager, const string &folder)
+{
+    return file_manager->watcher.watches.count(folder) != 0;
+}
+
+void unwatch_folder(FileManager *file_manager, const string &folder)
+{
+    FolderWatcher &watcher = file_manager->watcher;
+    auto watch = watcher.watches.find(folder);
+
+    if (watch == watcher.watches.end()) {
+        return;
+    }
+
+    inotify_rm_watch(watcher.inotify_fd, watch->second);
+    watcher.folders.erase(watch->second);
+    watcher.watches.erase(watch);
+    watcher.watch_order.erase(
+        find(watcher.watch_order.begin(), watcher.watch_order.end(), folder));
+    watcher.changes.erase(folder);
+}
+
+// Changes to a folder nobody watches anymore go unnoticed, its listing is
+// read again before it's shown
+static void mark_unwatched(FileManager *file_manager, const string &folder)
+{
+    if (shared_ptr<EntryTable> *cached =
+            file_manager->folders_cache.peek(folder)) {
+        (*cached)->unwatched = true;
+    }
+}
+
+void watch_folder(FileManager *file_manager, const string &folder)
+{
+    FolderWatcher &watcher = file_manager->watcher;
+
+    if (watcher.inotify_fd == -1) {
+        return;
+    }
+
+    if (watcher.watches.count(folder) != 0) {
+        auto position = find(watcher.watch_order.begin(),
+                             watcher.watch_order.end(), folder);
+        watcher.watch_order.erase(position);
+        watcher.watch_order.push_back(folder);
+        return;
+    }
+
+    if (watcher.watch_order.size() >= MAX_WATCHED_FOLDERS) {
+        string oldest = watcher.watch_order.front();
+        if (oldest == file_manager->cwd) {
+            watcher.watch_order.pop_front();
+            watcher.watch_order.push_back(oldest);
+            oldest = watcher.watch_order.front();
+        }
+        unwatch_folder(file_manager, oldest);
+        mark_unwatched(file_manager, oldest);
+    }
+
+    int watch = inotify_add_watch(watcher.inotify_fd, folder.c_str(),
+                                  WATCH_MASK);
+    if (watch == -1) {
+        mark_unwatched(file_manager, folder);
+        return;
+    }
+
+    // a folder reached through a symlink can share a watch descriptor
+    auto previous = watcher.folders.find(watch);
+    if (previous != watcher.folders.end()) {
+        // a copy, unwatching erases the map's
+        string previous_folder = previous->second;
+        unwatch_folder(file_manager, previous_folder);
+        mark_unwatched(file_manager, previous_folder);
+        watch = inotify_add_watch(watcher.inotify_fd, folder.c_str(),
+                                  WATCH_MASK);
+        if (watch == -1) {
+            mark_unwatched(file_manager, folder);
+            return;
+        }
+    }
+
+    watcher.folders[watch] = folder;
+    watcher.watches[folder] = watch;
+    watcher.watch_order.push_back(folder);
+}
+
+static void add_folder_change(FolderWatcher *watcher, const string &folder,
+                              const char *name)
+{
+    if (watcher->changes.empty() && watcher->stale_folders.empty()) {
+        watcher->first_change = chrono::steady_clock::now();
+    }
+    if (name == nullptr) {
+        watcher->stale_folders.insert(folder);
+    } else {
+        watcher->changes[folder].insert(name);
+    }
+}
+
+// Drains the inotify queue into the pending changes, cheap enough to be
+// called on every loop iteration
+void read_folder_events(FileManager *file_manager)
+{
+    FolderWatcher &watcher = file_manager->watcher;
+
+    if (watcher.inotify_fd == -1) {
+        return;
+    }
+
+    alignas(struct inotify_event) char buffer[16384];
+    ssize_t length;
+
+    while ((length = read(watcher.inotify_fd, buffer, sizeof(buffer))) > 0) {
+        for (char *position = buffer; position < buffer + length;) {
+            const auto *event =
+                reinterpret_cast<const struct inotify_event *>(position);
+            position += sizeof(struct inotify_event) + event->len;
+
+            // events were dropped, every watched folder has to be re-read
+            if (event->mask & IN_Q_OVERFLOW) {
+                for (const auto &[folder, watch] : watcher.watches) {
+                    add_folder_change(&watcher, folder, nullptr);
+                }
+                continue;
+            }
+
+            auto folder = watcher.folders.find(event->wd);
+            if (folder == watcher.folders.end()) {
+                continue;
+            }
+
+            if (event->mask & IN_IGNORED) {
+                string folder_path = folder->second;
+                watcher.watches.erase(folder_path);
+                watcher.folders.erase(folder);
+                watcher.watch_order.erase(find(watcher.watch_order.begin(),
+                                               watcher.watch_order.end(),
+                                               folder_path));
+                mark_unwatched(file_manager, folder_path);
+                continue;
+            }
+
+            if (file_manager->git.git_dirs.count(folder->second) != 0) {
+                git_folder_changed(file_manager);
+                continue;
+            }
+
+            if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+                add_folder_change(&watcher, folder->second, nullptr);
+            } else if (event->len != 0) {
+                add_folder_change(&watcher, folder->second, event->name);
+            }
+        }
+    }
+}
+
+// Re-stats the changed names of a cached folder and patches its table
+static void patch_folder(EntryTable *table, const unordered_set<string> &names)
+{
+    int folder_fd = open(table->folder.c_str(), O_RDONLY | O_DIRECTORY);
+    perf_count(PERF_OPENS);
+
+    if (folder_fd == -1) {
+        return;
+    }
+
+    unordered_map<string_view, uint32_t> changed_rows;
+    for (const string &name : names) {
+        changed_rows.emplace(name, UINT32_MAX);
+    }
+
+    // one pass over the table finds every existing row at once
+    for (uint32_t row = 0; row < table->size(); row++) {
+        auto changed_row = changed_rows.find(table->name(row));
+        if (changed_row != changed_rows.end()) {
+            changed_row->second = row;
+        }
+    }
+
+    vector<uint32_t> removed_rows;
+
+    for (const auto &[name, row] : changed_rows) {
+        string entry_name(name);
+        struct stat file_stat;
+        uint8_t type;
+        uint8_t entry_flags;
+
+        if (!stat_folder_entry(folder_fd, entry_name.c_str(), DT_UNKNOWN,
+                               &file_stat, &type, &entry_flags)) {
+            if (row != UINT32_MAX) {
+                removed_rows.push_back(row);
+            }
+        } else if (row != UINT32_MAX) {
+            table->set_entry(row, file_stat, type, entry_flags);
+        } else {
+            table->add_entry(name, file_stat, type, entry_flags);
+        }
+    }
+
+    // highest rows first so the rows moved by remove_row are never pending
+    sort(removed_rows.rbegin(), removed_rows.rend());
+    for (uint32_t row : removed_rows) {
+        table->remove_row(row);
+    }
+    // not a read of the folder anymore, the disk cache leaves it out
+    table->folder_mtime = 0;
+
+    close(folder_fd);
+}
+
+// Patches the cached folders once the changes have settled for
+// FOLDER_CHANGES_DELAY_MS (or right away when force is set). Returns true if
+// the files list was rebuilt.
+bool apply_folder_changes(FileManager *file_manager, bool force)
+{
+    FolderWatcher &watcher = file_manager->watcher;
+
+    if (watcher.changes.empty() && watcher.stale_folders.empty()) {
+        return false;
+    }
+
+    if (!force && folder_watcher_timeout(file_manager) > 0) {
+        return false;
+    }
+
+    auto &cache = file_manager->folders_cache;
+    bool cwd_changed = false;
+
+    // a folder still being read gets patched once it's in the cache
+    string loading_folder;
+    if (file_manager->folder_load) {
+        loading_folder = file_manager->folder_load->folder;
+    }
+
+    for (const string &folder : watcher.stale_folders) {
+        forget_tree_size(file_manager, folder);
+        // search results stay, the listing is read again when they're left
+        if (folder == file_manager->cwd && !file_manager->recursive_search) {
+            start_folder_load(file_manager, folder, true);
+            loading_folder = folder;
+        } else {
+            cache.erase(folder);
+        }
+        watcher.changes.erase(folder);
+    }
+    watcher.stale_folders.clear();
+
+    for (auto change = watcher.changes.begin();
+         change != watcher.changes.end();) {
+        if (change->first == loading_folder) {
+            ++change;
+            continue;
+        }
+
+        forget_tree_size(file_manager, change->first);
+
+        if (shared_ptr<EntryTable> *cached = cache.peek(change->first)) {
+            patch_folder(cached->get(), change->second);
+            cache.update_size(change->first);
+            cwd_changed |= change->first == file_manager->cwd;
+        }
+        change = watcher.changes.erase(change);
+    }
+
+    if (!watcher.changes.empty()) {
+        watcher.first_change = chrono::steady_clock::now();
+    }
+
+    if (cwd_changed) {
+        refresh_files(file_manager);
+    }
+    return cwd_changed;
+}
+
+// Milliseconds the loop may wait before changes have to be applied, -1 if
+// there are none (new events wake the loop through the inotify fd)
+int folder_watcher_timeout(FileManager *file_manager)
+{
+    FolderWatcher &watcher = file_manager->watcher;
+
+    if (watcher.inotify_fd == -1) {
+        return -1;
+    }
+
+    if (watcher.changes.empty() && watcher.stale_folders.empty()) {
+        return -1;
+    }
+
+    auto elapsed = chrono::duration_cast<chrono::milliseconds>(
+                       chrono::steady_clock::now() - watcher.first_change)
+                       .count();
+    return max(0, FOLDER_CHANGES_DELAY_MS - static_cast<int>(elapsed));
+}
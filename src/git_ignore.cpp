@@ -0,0 +1,190 @@
+#include "file_manager.hpp"
+
+static bool match_char_class(const char **pattern, char character)
+{
+    const char *position = *pattern + 1;
+    bool negated = *position == '!' || *position == '^';
+    bool matched = false;
+
+    if (negated) {
+        position++;
+    }
+
+    // a ']' right after the '[' is part of the class
+    for (bool first = true; *position && (first || *position != ']');
+         first = false) {
+        char low = *position;
+        char high = low;
+        if (position[1] == '-' && position[2] && position[2] != ']') {
+            high = position[2];
+            position += 2;
+        }
+        if (low <= character && character <= high) {
+            matched = true;
+        }
+        position++;
+    }
+
+    // unterminated class, match the '[' literally
+    if (*position != ']') {
+        *pattern += 1;
+        return character == '[';
+    }
+
+    *pattern = position + 1;
+    return matched != negated;
+}
+
+// Glob matching with gitignore semantics, '*' and '?' don't match '/' while
+// "**" spans any number of folders
+static bool glob_match(const char *pattern, const char *text)
+{
+    while (*pattern) {
+        switch (*pattern) {
+            case '*': {
+                if (pattern[1] == '*' && (pattern[2] == '/' || !pattern[2])) {
+                    const char *rest = pattern + 2;
+                    if (*rest == '\0') {
+                        return true;
+                    }
+                    rest++;
+                    for (const char *position = text;; position++) {
+                        if ((position == text || position[-1] == '/') &&
+                            glob_match(rest, position)) {
+                            return true;
+                        }
+                        if (*position == '\0') {
+                            return false;
+                        }
+                    }
+                }
+                while (*pattern == '*') {
+                    pattern++;
+                }
+                for (const char *position = text;; position++) {
+                    if (glob_match(pattern, position)) {
+                        return true;
+                    }
+                    if (*position == '\0' || *position == '/') {
+                        return false;
+                    }
+                }
+            }
+            case '?':
+                if (*text == '\0' || *text == '/') {
+                    return false;
+                }
+                pattern++;
+                text++;
+                break;
+            case '[':
+                if (*text == '\0' || *text == '/' ||
+                    !match_char_class(&pattern, *text)) {
+                    return false;
+                }
+                text++;
+                break;
+            case '\\':
+                if (pattern[1]) {
+                    pattern++;
+                }
+                [[fallthrough]];
+            default:
+                if (*pattern != *text) {
+                    return false;
+                }
+                pattern++;
+                text++;
+        }
+    }
+    return *text == '\0';
+}
+
+// Reads the rules of an ignore file, base is the folder holding it relative
+// to the repository root ("" or "src/")
+void GitIgnore::load(const string &file_path, const string &base)
+{
+    ifstream file(file_path);
+    string line;
+
+    while (getline(file, line)) {
+        while (!line.empty() && (line.back() == ' ' || line.back() == '\r') &&
+               (line.size() < 2 || line[line.size() - 2] != '\\')) {
+            line.pop_back();
+        }
+        if (line.empty() || line.front() == '#') {
+            continue;
+        }
+
+        GitIgnoreRule rule;
+        rule.base = base;
+        if (line.front() == '!') {
+            rule.negated = true;
+            line.erase(0, 1);
+        }
+        if (!line.empty() && line.back() == '/') {
+            rule.folder_only = true;
+            line.pop_back();
+        }
+        // a slash anywhere but at the end anchors the pattern to base
+        rule.anchored = line.find('/') != string::npos;
+        if (!line.empty() && line.front() == '/') {
+            line.erase(0, 1);
+        }
+        if (line.empty()) {
+            continue;
+        }
+        rule.pattern = line;
+        rules.push_back(rule);
+    }
+}
+
+// Every rule that applies inside the folder at prefix ("" or "src/lib/") of
+// the repository at root: info/exclude and the .gitignore files from the root
+// down to the folder
+void GitIgnore::load_for_folder(const string &root, const string &git_dir,
+                                const string &prefix)
+{
+    load(git_dir + "/info/exclude", "");
+    load(root + "/.gitignore", "");
+    for (size_t slash = prefix.find('/'); slash != string::npos;
+         slash = prefix.find('/', slash + 1)) {
+        string base = prefix.substr(0, slash + 1);
+        load(root + "/" + base + ".gitignore", base);
+    }
+}
+
+bool GitIgnore::matches(const string &path, bool is_folder) const
+{
+    bool ignored = false;
+    size_t last_slash = path.find_last_of('/');
+    const char *file_name =
+        path.c_str() + (last_slash == string::npos ? 0 : last_slash + 1);
+
+    // later rules override earlier ones
+    for (const GitIgnoreRule &rule : rules) {
+        if (ignored != rule.negated || (rule.folder_only && !is_folder) ||
+            path.compare(0, rule.base.size(), rule.base) != 0) {
+            continue;
+        }
+        const char *text =
+            rule.anchored ? path.c_str() + rule.base.size() : file_name;
+        if (glob_match(rule.pattern.c_str(), text)) {
+            ignored = !rule.negated;
+        }
+    }
+    return ignored;
+}
+
+// path is relative to the repository root, anything inside an ignored folder
+// is ignored too
+bool GitIgnore::is_ignored(const string &path, bool is_folder) const
+{
+    for (size_t slash = path.find('/'); slash != string::npos;
+         slash = path.find('/', slash + 1)) {
+        if (matches(path.substr(0, slash), true)) {
+            return true;
+        }
+    }
+    return matches(path, is_folder);
+}
@@ -0,0 +1,655 @@
+#include <fcntl.h>
+#include <cstring>
+#include "file_manager.hpp"
+
+static uint32_t rotate_left(uint32_t value, int bits)
+{
+    return (value << bits) | (value >> (32 - bits));
+}
+
+void Sha1::process_block()
+{
+    array<uint32_t, 80> words;
+
+    for (int i = 0; i < 16; i++) {
+        words[i] = static_cast<uint32_t>(block[i * 4]) << 24 |
+                   static_cast<uint32_t>(block[i * 4 + 1]) << 16 |
+                   static_cast<uint32_t>(block[i * 4 + 2]) << 8 |
+                   static_cast<uint32_t>(block[i * 4 + 3]);
+    }
+    for (int i = 16; i < 80; i++) {
+        words[i] = rotate_left(
+            words[i - 3] ^ words[i - 8] ^ words[i - 14] ^ words[i - 16], 1);
+    }
+
+    uint32_t a = state[0];
+    uint32_t b = state[1];
+    uint32_t c = state[2];
+    uint32_t d = state[3];
+    uint32_t e = state[4];
+
+    for (int i = 0; i < 80; i++) {
+        uint32_t f;
+        uint32_t k;
+        if (i < 20) {
+            f = (b & c) | (~b & d);
+            k = 0x5A827999;
+        } else if (i < 40) {
+            f = b ^ c ^ d;
+            k = 0x6ED9EBA1;
+        } else if (i < 60) {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8F1BBCDC;
+        } else {
+            f = b ^ c ^ d;
+            k = 0xCA62C1D6;
+        }
+        uint32_t temp = rotate_left(a, 5) + f + e + k + words[i];
+        e = d;
+        d = c;
+        c = rotate_left(b, 30);
+        b = a;
+        a = temp;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+}
+
+void Sha1::update(const uint8_t *data, size_t size)
+{
+    total_size += size;
+    while (size > 0) {
+        size_t copied = min(size, block.size() - block_size);
+        memcpy(block.data() + block_size, data, copied);
+        block_size += copied;
+        data += copied;
+        size -= copied;
+        if (block_size == block.size()) {
+            process_block();
+            block_size = 0;
+        }
+    }
+}
+
+sha1_t Sha1::digest()
+{
+    uint64_t bit_size = total_size * 8;
+    uint8_t padding = 0x80;
+
+    update(&padding, 1);
+    padding = 0;
+    while (block_size != 56) {
+        update(&padding, 1);
+    }
+    for (int i = 7; i >= 0; i--) {
+        uint8_t size_byte = bit_size >> (i * 8);
+        update(&size_byte, 1);
+    }
+
+    sha1_t hash;
+    for (int i = 0; i < 20; i++) {
+        hash[i] = state[i / 4] >> (24 - (i % 4) * 8);
+    }
+    return hash;
+}
+
+// Object id git gives to a file's content, "blob <size>\0<content>"
+bool hash_git_blob(const string &file_path, const struct stat &file_stat,
+                   sha1_t *hash)
+{
+    Sha1 sha1;
+    string header = "blob ";
+
+    if (S_ISLNK(file_stat.st_mode)) {
+        array<char, 4096> target;
+        ssize_t size = readlink(file_path.c_str(), target.data(), target.size());
+        if (size < 0) {
+            return false;
+        }
+        header += to_string(size);
+        sha1.update(reinterpret_cast<const uint8_t *>(header.c_str()),
+                    header.size() + 1);
+        sha1.update(reinterpret_cast<const uint8_t *>(target.data()), size);
+        *hash = sha1.digest();
+        return true;
+    }
+
+    int fd = open(file_path.c_str(), O_RDONLY | O_CLOEXEC);
+    perf_count(PERF_OPENS);
+    if (fd == -1) {
+        return false;
+    }
+
+    header += to_string(file_stat.st_size);
+    sha1.update(reinterpret_cast<const uint8_t *>(header.c_str()),
+                header.size() + 1);
+
+    vector<uint8_t> buffer(1 << 16);
+    ssize_t size;
+    while ((size = read(fd, buffer.data(), buffer.size())) > 0) {
+        sha1.update(buffer.data(), size);
+    }
+    close(fd);
+
+    if (size < 0) {
+        return false;
+    }
+    *hash = sha1.digest();
+    return true;
+}
+
+static uint32_t read_be32(const uint8_t *data)
+{
+    return static_cast<uint32_t>(data[0]) << 24 |
+           static_cast<uint32_t>(data[1]) << 16 |
+           static_cast<uint32_t>(data[2]) << 8 | static_cast<uint32_t>(data[3]);
+}
+
+// Parses the entries of a .git/index file (versions 2 to 4), they come out
+// sorted by path
+bool read_git_index(const string &index_path, vector<GitIndexEntry> *entries)
+{
+    ifstream file(index_path, ios::binary);
+    string content((istreambuf_iterator<char>(file)),
+                   istreambuf_iterator<char>());
+    const auto *data = reinterpret_cast<const uint8_t *>(content.data());
+    size_t size = content.size();
+
+    entries->clear();
+
+    if (size < 12 || memcmp(data, "DIRC", 4) != 0) {
+        return false;
+    }
+
+    uint32_t version = read_be32(data + 4);
+    uint32_t count = read_be32(data + 8);
+    size_t offset = 12;
+
+    if (version < 2 || version > 4) {
+        return false;
+    }
+
+    entries->reserve(count);
+    string previous_path;
+
+    for (uint32_t i = 0; i < count; i++) {
+        // ctime, mtime, dev, ino, mode, uid, gid, size, sha-1, flags
+        if (offset + 62 > size) {
+            return false;
+        }
+        const uint8_t *entry = data + offset;
+        GitIndexEntry index_entry;
+        index_entry.mtime_seconds = read_be32(entry + 8);
+        index_entry.mtime_nanoseconds = read_be32(entry + 12);
+        index_entry.mode = read_be32(entry + 24);
+        index_entry.size = read_be32(entry + 36);
+        memcpy(index_entry.hash.data(), entry + 40, 20);
+
+        uint16_t flags = entry[60] << 8 | entry[61];
+        uint16_t extended_flags = 0;
+        size_t header_size = 62;
+        if (flags & 0x4000) {
+            if (offset + 64 > size) {
+                return false;
+            }
+            extended_flags = entry[62] << 8 | entry[63];
+            header_size = 64;
+        }
+        index_entry.skip_check = (flags & 0x8000) || (extended_flags & 0x4000);
+        index_entry.changed = (flags & 0x3000) || (extended_flags & 0x2000);
+
+        const char *path = reinterpret_cast<const char *>(entry) + header_size;
+        size_t path_limit = size - offset - header_size;
+
+        if (version == 4) {
+            // the path drops some bytes from the previous one then adds a
+            // suffix, the number of bytes dropped is a varint
+            size_t position = 0;
+            uint64_t dropped = 0;
+            uint8_t byte;
+            do {
+                if (position >= path_limit) {
+                    return false;
+                }
+                byte = path[position++];
+                dropped = (dropped << 7) | (byte & 0x7F);
+                if (byte & 0x80) {
+                    dropped++;
+                }
+            } while (byte & 0x80);
+            size_t suffix_size = strnlen(path + position, path_limit - position);
+            if (dropped > previous_path.size() ||
+                position + suffix_size >= path_limit) {
+                return false;
+            }
+            index_entry.path = previous_path.substr(0, previous_path.size() -
+                                                           dropped);
+            index_entry.path.append(path + position, suffix_size);
+            offset += header_size + position + suffix_size + 1;
+        } else {
+            size_t path_size = strnlen(path, path_limit);
+            if (path_size >= path_limit) {
+                return false;
+            }
+            index_entry.path.assign(path, path_size);
+            // entries are padded with 1 to 8 nul bytes to a multiple of 8
+            offset += (header_size + path_size + 8) & ~static_cast<size_t>(7);
+        }
+
+        previous_path = index_entry.path;
+        entries->push_back(move(index_entry));
+    }
+    return true;
+}
+
+// index_mtime is the index file's, in nanoseconds
+static bool is_entry_modified(const string &root,
+                              const GitIndexEntry &index_entry,
+                              int64_t index_mtime)
+{
+    const uint32_t gitlink_mode = 0160000;
+    const uint32_t symlink_mode = 0120000;
+
+    if (index_entry.skip_check || index_entry.mode == gitlink_mode) {
+        return false;
+    }
+    if (index_entry.changed) {
+        return true;
+    }
+
+    string file_path = root + "/" + index_entry.path;
+    struct stat file_stat;
+
+    perf_count(PERF_STATS);
+    if (lstat(file_path.c_str(), &file_stat) != 0) {
+        return true;  // deleted
+    }
+    if (static_cast<uint32_t>(file_stat.st_size) != index_entry.size) {
+        return true;
+    }
+    // a file turned into a symlink or a folder, or chmod +x / -x
+    bool is_symlink = (index_entry.mode & 0170000) == symlink_mode;
+    if (S_ISLNK(file_stat.st_mode) != is_symlink ||
+        (!is_symlink && !S_ISREG(file_stat.st_mode))) {
+        return true;
+    }
+    bool is_executable = (file_stat.st_mode & S_IXUSR) != 0;
+    if (!is_symlink && is_executable != ((index_entry.mode & 0100) != 0)) {
+        return true;
+    }
+
+    // written in the same tick as the index or after it (racy git), the
+    // matching mtime can't vouch for the content
+    int64_t mtime = file_stat.st_mtim.tv_sec * 1000000000LL +
+                    file_stat.st_mtim.tv_nsec;
+    if (static_cast<uint32_t>(file_stat.st_mtim.tv_sec) ==
+            index_entry.mtime_seconds &&
+        static_cast<uint32_t>(file_stat.st_mtim.tv_nsec) ==
+            index_entry.mtime_nanoseconds &&
+        mtime < index_mtime) {
+        return false;
+    }
+
+    // touched but maybe not changed, only the content can tell
+    sha1_t hash;
+    return !hash_git_blob(file_path, file_stat, &hash) ||
+           hash != index_entry.hash;
+}
+
+// Markers of the entries of a folder inside repo: modified files (folders
+// holding one), untracked and ignored entries. Compares the worktree against
+// the index only, like the "not staged" part of git status.
+static unordered_map<string, uint8_t> compute_git_status(
+    const GitRepo &repo, const string &folder,
+    const vector<GitIndexEntry> &index, int64_t index_mtime)
+{
+    PerfScope perf_scope(PERF_GIT_STATUS, folder);
+    unordered_map<string, uint8_t> marks;
+    string prefix;
+
+    if (folder.size() > repo.root.size()) {
+        prefix = folder.substr(repo.root.size() + 1) + "/";
+    }
+
+    unordered_set<string> tracked;
+    auto index_entry =
+        lower_bound(index.begin(), index.end(), prefix,
+                    [](const GitIndexEntry &entry, const string &path) {
+                        return entry.path < path;
+                    });
+
+    for (; index_entry != index.end() &&
+           index_entry->path.compare(0, prefix.size(), prefix) == 0;
+         ++index_entry) {
+        size_t name_end = index_entry->path.find('/', prefix.size());
+        string name = index_entry->path.substr(prefix.size(),
+                                               name_end - prefix.size());
+        tracked.insert(name);
+        if (marks[name] != GIT_MODIFIED &&
+            is_entry_modified(repo.root, *index_entry, index_mtime)) {
+            marks[name] = GIT_MODIFIED;
+        }
+    }
+
+    GitIgnore git_ignore;
+    git_ignore.load_for_folder(repo.root, repo.common_dir, prefix);
+
+    DIR *dir = opendir(folder.c_str());
+    perf_count(PERF_OPENS);
+    if (dir == nullptr) {
+        return marks;
+    }
+    while (const struct dirent *entry = readdir(dir)) {
+        string name = entry->d_name;
+        if (name == "." || name == ".." || name == ".git" ||
+            tracked.count(name) != 0) {
+            continue;
+        }
+        bool is_folder = entry->d_type == DT_DIR;
+        if (entry->d_type == DT_UNKNOWN) {
+            struct stat file_stat;
+            perf_count(PERF_STATS);
+            is_folder = fstatat(dirfd(dir), entry->d_name, &file_stat,
+                                AT_SYMLINK_NOFOLLOW) == 0 &&
+                        S_ISDIR(file_stat.st_mode);
+        }
+        marks[name] = git_ignore.is_ignored(prefix + name, is_folder)
+                          ? GIT_IGNORED
+                          : GIT_UNTRACKED;
+    }
+    closedir(dir);
+
+    return marks;
+}
+
+// Detached like the other workers. The parsed index is kept between requests
+// and only read again when the file changes.
+static void git_status_worker(shared_ptr<GitStatusWork> work)
+{
+    vector<GitIndexEntry> index;
+    string index_path;
+    int64_t index_mtime = -1;
+    off_t index_size = -1;
+
+    name_perf_thread("git status");
+    unique_lock<mutex> guard(work->lock);
+
+    while (true) {
+        work->wake.wait(guard,
+                        [&work] { return work->stopped || work->requested; });
+        if (work->stopped) {
+            return;
+        }
+
+        uint64_t request_id = work->request_id;
+        shared_ptr<GitRepo> repo = work->repo;
+        string folder = work->folder;
+        work->requested = false;
+        work->busy = true;
+        guard.unlock();
+
+        string path = repo->git_dir + "/index";
+        struct stat index_stat = {};
+        stat(path.c_str(), &index_stat);
+        int64_t mtime = index_stat.st_mtim.tv_sec * 1000000000LL +
+                        index_stat.st_mtim.tv_nsec;
+        if (path != index_path || mtime != index_mtime ||
+            index_stat.st_size != index_size) {
+            read_git_index(path, &index);
+            index_path = path;
+            index_mtime = mtime;
+            index_size = index_stat.st_size;
+        }
+
+        auto marks = compute_git_status(*repo, folder, index, index_mtime);
+
+        guard.lock();
+        work->busy = false;
+        work->result_id = request_id;
+        work->result = move(marks);
+        wake_event_loop();
+    }
+}
+
+void start_git_status(FileManager *file_manager)
+{
+    file_manager->git.work = make_shared<GitStatusWork>();
+
+    thread(git_status_worker, file_manager->git.work).detach();
+}
+
+void stop_git_status(FileManager *file_manager)
+{
+    GitStatusWork *work = file_manager->git.work.get();
+
+    if (work == nullptr) {
+        return;
+    }
+    {
+        lock_guard<mutex> guard(work->lock);
+        work->stopped = true;
+    }
+    work->wake.notify_one();
+    file_manager->git.work.reset();
+}
+
+static string read_first_line(const string &file_path)
+{
+    ifstream file(file_path);
+    string line;
+
+    getline(file, line);
+    return line;
+}
+
+// "<repo name> <branch>", the name comes from the remote url and the branch
+// from HEAD (a short hash when detached)
+static string read_repo_description(const GitRepo &repo)
+{
+    ifstream config(repo.common_dir + "/config");
+    string line;
+    string repo_name;
+
+    while (getline(config, line)) {
+        size_t url = line.find("url = ");
+        if (url == string::npos) {
+            continue;
+        }
+        repo_name = line.substr(url + 6);
+        while (!repo_name.empty() && repo_name.back() == '/') {
+            repo_name.pop_back();
+        }
+        if (repo_name.size() > 4 &&
+            repo_name.compare(repo_name.size() - 4, 4, ".git") == 0) {
+            repo_name.erase(repo_name.size() - 4);
+        }
+        repo_name = repo_name.substr(repo_name.find_last_of("/:") + 1);
+        break;
+    }
+
+    if (repo_name.empty()) {
+        repo_name = repo.root.substr(repo.root.find_last_of('/') + 1);
+    }
+
+    string head = read_first_line(repo.git_dir + "/HEAD");
+    string branch_name;
+    if (head.compare(0, 16, "ref: refs/heads/") == 0) {
+        branch_name = head.substr(16);
+    } else if (head.compare(0, 5, "ref: ") == 0) {
+        branch_name = head.substr(5);
+    } else {
+        branch_name = head.substr(0, 7);
+    }
+
+    return repo_name + " <" + branch_name + ">";
+}
+
+// Looks for .git in folder itself, it's a folder in a normal repository and
+// a "gitdir: <path>" file in worktrees and submodules
+static shared_ptr<GitRepo> open_git_repo(const string &folder)
+{
+    PerfScope perf_scope(PERF_GIT_REPO, folder);
+    string dot_git = (folder.empty() ? "" : folder) + "/.git";
+    struct stat git_stat;
+
+    perf_count(PERF_STATS);
+    if (stat(dot_git.c_str(), &git_stat) != 0) {
+        return nullptr;
+    }
+
+    auto repo = make_shared<GitRepo>();
+    repo->root = folder.empty() ? "/" : folder;
+    repo->git_dir = dot_git;
+
+    if (S_ISREG(git_stat.st_mode)) {
+        string line = read_first_line(dot_git);
+        if (line.compare(0, 8, "gitdir: ") != 0) {
+            return nullptr;
+        }
+        repo->git_dir = line.substr(8);
+        if (repo->git_dir.front() != '/') {
+            repo->git_dir = folder + "/" + repo->git_dir;
+        }
+    } else if (!S_ISDIR(git_stat.st_mode)) {
+        return nullptr;
+    }
+
+    // a linked worktree names the repository's own .git, relative to its
+    // git dir
+    repo->common_dir = read_first_line(repo->git_dir + "/commondir");
+    if (repo->common_dir.empty()) {
+        repo->common_dir = repo->git_dir;
+    } else if (repo->common_dir.front() != '/') {
+        repo->common_dir = repo->git_dir + "/" + repo->common_dir;
+    }
+
+    repo->description = read_repo_description(*repo);
+    return repo;
+}
+
+// Repository holding folder, cached for every folder visited on the way up
+// until something under .git changes (see git_folder_changed) or, without
+// inotify, until the cwd changes
+const GitRepo *find_git_repo(FileManager *file_manager, const string &folder)
+{
+    auto &repos = file_manager->git.repos;
+
+    if (auto cached = repos.find(folder); cached != repos.end()) {
+        return cached->second.get();
+    }
+
+    string current = folder;
+    while (!current.empty() && current.back() == '/') {
+        current.pop_back();
+    }
+
+    vector<string> visited;
+    shared_ptr<GitRepo> repo;
+
+    while (true) {
+        if (auto cached = repos.find(current.empty() ? "/" : current);
+            cached != repos.end()) {
+            repo = cached->second;
+            break;
+        }
+        visited.push_back(current.empty() ? "/" : current);
+        repo = open_git_repo(current);
+        size_t slash = current.find_last_of('/');
+        // a relative path runs out of slashes before reaching ""
+        if (repo || current.empty() || slash == string::npos) {
+            break;
+        }
+        current.erase(slash);
+    }
+
+    for (const string &visited_folder : visited) {
+        repos[visited_folder] = repo;
+    }
+    return repo.get();
+}
+
+// Called by the watcher for any event under a .git folder (HEAD, config,
+// index...)
+void git_folder_changed(FileManager *file_manager)
+{
+    file_manager->git.repos.clear();
+    file_manager->git.generation++;
+}
+
+// Keeps the markers in sync with the files list: asks the worker for new
+// ones when the listing, the folder or the repository changed, and picks up
+// its answer
+void update_git_status(FileManager *file_manager)
+{
+    GitState &git = file_manager->git;
+    const EntryTable *table = file_manager->files.table.get();
+
+    // search results span several folders, only listings get marks
+    if (git.work == nullptr || table == nullptr || file_manager->folder_load ||
+        file_manager->recursive_search) {
+        return;
+    }
+
+    const GitRepo *repo = find_git_repo(file_manager, file_manager->cwd);
+    if (repo == nullptr) {
+        git.marks.clear();
+        git.marks_key = {nullptr, 0, 0};
+        return;
+    }
+
+    // also re-watches .git if the watcher dropped it
+    if (!is_folder_watched(file_manager, repo->git_dir)) {
+        watch_folder(file_manager, repo->git_dir);
+        git.git_dirs.insert(repo->git_dir);
+    }
+
+    auto key = make_tuple(table, table->version, git.generation);
+    if (key == git.marks_key) {
+        return;
+    }
+
+    GitStatusWork &work = *git.work;
+    lock_guard<mutex> guard(work.lock);
+
+    if (key != git.requested_key) {
+        git.requested_key = key;
+        git.pending_request_id = ++git.next_request_id;
+        work.request_id = git.pending_request_id;
+        work.repo = git.repos[file_manager->cwd];
+        work.folder = file_manager->cwd;
+        work.requested = true;
+        work.wake.notify_one();
+        return;
+    }
+
+    if (work.result_id != git.pending_request_id) {
+        return;
+    }
+
+    git.marks.assign(table->size(), GIT_CLEAN);
+    for (uint32_t row = 0; row < table->size(); row++) {
+        auto mark = work.result.find(string(table->name(row)));
+        if (mark != work.result.end()) {
+            git.marks[row] = mark->second;
+        }
+    }
+    git.marks_key = key;
+}
+
+uint8_t get_git_mark(FileManager *file_manager, uint32_t row)
+{
+    const GitState &git = file_manager->git;
+    const EntryTable *table = file_manager->files.table.get();
+
+    // the watcher patched the table since, rows may have moved until the
+    // worker answers for the new version
+    if (get<0>(git.marks_key) != table || table == nullptr ||
+        get<1>(git.marks_key) != table->version || row >= git.marks.size()) {
+        return GIT_CLEAN;
+    }
+    return git.marks[row];
+}
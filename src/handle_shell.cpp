@@ -3,14 +3,10 @@
 #include <cstdlib>
 #include "file_manager.hpp"
 
-int run_command(const string &command)
+void display_shell(WINDOW *window, FileManager *file_manager)
 {
-    string silent_command = command + " > /dev/null";
-    return system(silent_command.c_str());
-}
+    bool in_shell = file_manager->in_shell;
 
-void display_shell(WINDOW *window, bool in_shell)
-{
     werase(window);
 
     if (in_shell) {
@@ -19,38 +15,35 @@ void display_shell(WINDOW *window, bool in_shell)
     box(window, ACS_VLINE, ACS_HLINE);
     if (in_shell) {
         wattroff(window, COLOR_PAIR(1));
+        mvwprintw(window, 1, 1, "%s", file_manager->shell_command.c_str());
+        wattron(window, COLOR_PAIR(1));
+        wprintw(window, "_");
+        wattroff(window, COLOR_PAIR(1));
     }
 
-    wrefresh(window);
+    wnoutrefresh(window);
 }
 
-int handle_shell_input(WINDOW *window, FileManager *file_manager)
+int handle_shell_input(FileManager *file_manager, int input)
 {
-    static string command;
-
-    mvwprintw(window, 1, 1, "%s", command.c_str());
-    wattron(window, COLOR_PAIR(1));
-    wprintw(window, "_");
-    wattroff(window, COLOR_PAIR(1));
-    wrefresh(window);
-
-    int input = getch();
+    string &command = file_manager->shell_command;
 
+    // runs in the background, the folders it changes are refreshed when
+    // it's done
     if (input == 10) {
-        run_command(command);
+        if (!command.empty()) {
+            start_job(file_manager, command);
+        }
 
         command.erase();
 
-        wclear(window);
-        wrefresh(window);
-
         file_manager->in_shell = false;
         return 1;
     }
 
-    if (input == 9) {
+    if (input == 9 && !file_manager->files.empty()) {
         command.append(
-            FILE_PATH(file_manager->files[file_manager->file_position]));
+            file_manager->files[file_manager->file_position].path());
         return 0;
     }
 
@@ -70,14 +63,3 @@ int handle_shell_input(WINDOW *window, FileManager *file_manager)
 
     return 0;
 }
-
-void handle_shell_return(int return_value, FileManager *file_manager)
-{
-    if (return_value == 1) {
-        file_manager->files =
-            load_folder(file_manager, file_manager->cwd, true, true);
-        if (file_manager->file_position > file_manager->files.size() - 1) {
-            file_manager->file_position = file_manager->files.size() - 1;
-        }
-    }
-}
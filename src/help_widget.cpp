@@ -1,7 +1,33 @@
 #include <utility>
 #include "file_manager.hpp"
 
-void display_help(WINDOW *window)
+static const array<pair<string, string>, 18> keybinds = {
+    {{"Key", "Action"},
+     {"Up/Down", "Move selection up/down"},
+     {"Left", "Go to parent directory"},
+     {"Right", "Go to selected directory, or page file"},
+     {"a", "Toggle hidden files"},
+     {"p", "Toggle file preview pane"},
+     {"s", "Cycle through sorting nodes"},
+     {"f", "Search in folder"},
+     {"F", "Search in subfolders (Ctrl-G: .gitignore)"},
+     {"g", "Search file contents in subfolders"},
+     {"t", "Run a command in the background"},
+     {"j", "Jobs and their output (J next, K stop)"},
+     {"Space/M", "Mark the entry, or all of them/none"},
+     {"c/v", "Copy/move the marked entries here"},
+     {"D/C", "Delete/chmod them (X stops operations)"},
+     {"Ctrl-P", "Performance overlay"},
+     {"h", "Open help menu"},
+     {"q", "Quit"}}};
+
+// the keys, the cache lines under them and the borders
+int get_help_height()
+{
+    return keybinds.size() + 8;
+}
+
+void display_help(WINDOW *window, FileManager *file_manager)
 {
     werase(window);
 
@@ -10,26 +36,55 @@ void display_help(WINDOW *window)
     size_t height = getmaxy(window);
     size_t width = getmaxx(window);
 
-    if (width < 45 || height < 13) {
+    if (width < 3) {
         return;
     }
 
-    const array<pair<string, string>, 10> keybinds = {
-        {{"Key", "Action"},
-         {"Up/Down", "Move selection up/down"},
-         {"Left", "Go to parent directory"},
-         {"Right", "Go to selected directory"},
-         {"a", "Toggle hidden files"},
-         {"p", "Toggle file preview pane"},
-         {"s", "Cycle through sorting nodes"},
-         {"t", "Open shell"},
-         {"h", "Open help menu"},
-         {"q", "Quit"}}};
-
-    for (size_t i = 0; i < keybinds.size(); i++) {
-        mvwprintw(window, i + 1, 1, "%-9s  %s", keybinds.at(i).first.c_str(),
-                  keybinds.at(i).second.c_str());
+    // what fits of it on a small terminal
+    for (size_t i = 0; i < keybinds.size() && i + 2 < height; i++) {
+        char line[128];
+        snprintf(line, sizeof(line), "%-9s  %s", keybinds.at(i).first.c_str(),
+                 keybinds.at(i).second.c_str());
+        mvwaddnstr(window, i + 1, 1, line, width - 2);
+    }
+
+    // folders cache usage, to size FILE_MANAGER_CACHE_MB
+    const auto &cache = file_manager->folders_cache;
+    if (height >= keybinds.size() + 5) {
+        mvwprintw(window, keybinds.size() + 2, 1,
+                  "Cache: %ld folders, %s / %s", cache.size(),
+                  format_bytes(cache.used).c_str(),
+                  format_bytes(cache.budget).c_str());
+        mvwprintw(window, keybinds.size() + 3, 1,
+                  "%ld hits, %ld misses, %ld evictions", cache.hits,
+                  cache.misses, cache.evictions);
+    }
+
+    // and the rendered previews one, FILE_MANAGER_PREVIEW_CACHE_MB
+    const auto &previews = file_manager->previews_cache;
+    if (height >= keybinds.size() + 6) {
+        mvwprintw(window, keybinds.size() + 4, 1,
+                  "Previews: %ld, %s / %s, %ld hits", previews.size(),
+                  format_bytes(previews.used).c_str(),
+                  format_bytes(previews.budget).c_str(), previews.hits);
+    }
+
+    // what the last frame and the whole session wrote to the terminal
+    const ScreenState &screen = file_manager->screen;
+    if (height >= keybinds.size() + 7) {
+        mvwprintw(window, keybinds.size() + 5, 1,
+                  "Terminal: %s last frame, %s in %ld frames",
+                  format_bytes(screen.frame_bytes).c_str(),
+                  format_bytes(screen.tty_bytes).c_str(), screen.frames);
+    }
+
+    // listings saved by the last sessions, FILE_MANAGER_DISK_CACHE_MB
+    const ListingStore &store = file_manager->listing_store;
+    if (store.budget != 0 && height >= keybinds.size() + 8) {
+        mvwprintw(window, keybinds.size() + 6, 1,
+                  "Disk cache: %u folders saved, %ld shown", store.folder_count,
+                  store.loaded);
     }
 
-    wrefresh(window);
+    wnoutrefresh(window);
 }
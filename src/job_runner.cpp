@@ -0,0 +1,463 @@
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <cerrno>
+#include <cstring>
+#include "file_manager.hpp"
+
+// what a job wrote last, per job
+static const size_t JOB_OUTPUT_SIZE = 64 * 1024;
+// finished jobs kept for the list, the oldest go first
+static const size_t MAX_JOBS = 32;
+// how often a job is checked on while its output is quiet
+static const int JOB_POLL_MS = 100;
+// output is sent to the interface at most this often
+static const int WAKE_INTERVAL_MS = 100;
+
+void OutputRing::append(const char *data, size_t size)
+{
+    if (buffer.empty()) {
+        buffer.resize(JOB_OUTPUT_SIZE);
+    }
+
+    // only the end of a read bigger than the ring is kept
+    if (size > buffer.size()) {
+        written += size - buffer.size();
+        data += size - buffer.size();
+        size = buffer.size();
+    }
+
+    size_t position = written % buffer.size();
+    size_t first = min(size, buffer.size() - position);
+    memcpy(buffer.data() + position, data, first);
+    memcpy(buffer.data(), data + first, size - first);
+    written += size;
+}
+
+string OutputRing::text() const
+{
+    if (written <= buffer.size()) {
+        return string(buffer.data(), written);
+    }
+
+    size_t position = written % buffer.size();
+    string text(buffer.data() + position, buffer.size() - position);
+    text.append(buffer.data(), position);
+    return text;
+}
+
+// Words of command that may be paths, split on blanks and the shell's
+// operators. Quotes are dropped, nothing is expanded but a leading ~/.
+static vector<string> get_command_words(const string &command)
+{
+    vector<string> words;
+    string word;
+    char quote = '\0';
+
+    for (char character : command) {
+        if (quote != '\0') {
+            if (character == quote) {
+                quote = '\0';
+            } else {
+                word += character;
+            }
+        } else if (character == '\'' || character == '"') {
+            quote = character;
+        } else if (isspace(character) || strchr(";|&<>()", character)) {
+            if (!word.empty()) {
+                words.push_back(move(word));
+                word.clear();
+            }
+        } else {
+            word += character;
+        }
+    }
+    if (!word.empty()) {
+        words.push_back(move(word));
+    }
+    return words;
+}
+
+// Everything the command names, as absolute paths. Options and the command
+// names themselves come along, they only ever match folders nobody cached.
+static vector<string> get_job_paths(const string &folder,
+                                    const string &command)
+{
+    vector<string> paths;
+    const char *home = getenv("HOME");
+
+    for (string &word : get_command_words(command)) {
+        if (word[0] == '-') {
+            continue;
+        }
+        if (word.compare(0, 2, "~/") == 0 && home != nullptr) {
+            word.replace(0, 1, home);
+        }
+
+        fs::path path =
+            word[0] == '/' ? fs::path(word) : fs::path(folder) / word;
+        string normal = path.lexically_normal().string();
+        while (normal.size() > 1 && normal.back() == '/') {
+            normal.pop_back();
+        }
+        paths.push_back(move(normal));
+    }
+    return paths;
+}
+
+// Reaps the job's process once it exited (waiting for it if wait is set),
+// under the lock stop_job() takes so it never signals a process group that
+// is gone. Returns true if it was reaped.
+static bool reap_job(Job *job, bool wait, int *status)
+{
+    siginfo_t info;
+    int result;
+
+    // left a zombie until the lock is held, its id can't be reused meanwhile
+    do {
+        info.si_pid = 0;
+        result = waitid(P_PID, job->pid, &info,
+                        WEXITED | WNOWAIT | (wait ? 0 : WNOHANG));
+    } while (result == -1 && errno == EINTR);
+    if (result == -1 || info.si_pid == 0) {
+        return false;
+    }
+
+    lock_guard<mutex> guard(job->lock);
+    waitpid(job->pid, status, 0);
+    job->reaped = true;
+    return true;
+}
+
+// Detached, reads the job's output until it's gone. A child of the job left
+// running may keep the pipe open, so the job is waited for on the side and
+// what's left in the pipe once it exited is the end of its output.
+static void job_worker(shared_ptr<Job> job, int output_fd)
+{
+    name_perf_thread("job");
+    char buffer[16384];
+    bool exited = false;
+    int status = 0;
+    auto last_wake = chrono::steady_clock::now();
+
+    while (true) {
+        pollfd fd = {output_fd, POLLIN, 0};
+        int ready = poll(&fd, 1, exited ? 0 : JOB_POLL_MS);
+
+        if (ready > 0) {
+            ssize_t size = read(output_fd, buffer, sizeof(buffer));
+            if (size > 0) {
+                {
+                    lock_guard<mutex> guard(job->lock);
+                    job->output.append(buffer, size);
+                }
+                auto now = chrono::steady_clock::now();
+                if (now - last_wake >=
+                    chrono::milliseconds(WAKE_INTERVAL_MS)) {
+                    last_wake = now;
+                    wake_event_loop();
+                }
+                continue;
+            }
+            if (size == -1 && errno == EINTR) {
+                continue;
+            }
+            // closed its output, still has to exit
+            if (!exited) {
+                reap_job(job.get(), true, &status);
+            }
+            break;
+        }
+        if (exited) {
+            break;
+        }
+        exited = reap_job(job.get(), false, &status);
+    }
+
+    close(output_fd);
+    job->status = status;
+    job->elapsed = chrono::steady_clock::now() - job->started;
+    job->finished = true;
+    wake_event_loop();
+}
+
+// Runs command with sh -c in the cwd, in its own process group with stdin
+// from /dev/null and stdout and stderr going to the job's output
+static pid_t spawn_job(const string &command, int output_fd)
+{
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null",
+                                     O_RDONLY, 0);
+    posix_spawn_file_actions_adddup2(&actions, output_fd, STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, output_fd, STDERR_FILENO);
+
+    // what ncurses and the interrupt handler changed isn't the job's
+    posix_spawnattr_t attributes;
+    posix_spawnattr_init(&attributes);
+    sigset_t signals;
+    sigemptyset(&signals);
+    posix_spawnattr_setsigmask(&attributes, &signals);
+    for (int signal_number : {SIGINT, SIGQUIT, SIGPIPE, SIGTSTP, SIGTTIN,
+                              SIGTTOU, SIGWINCH}) {
+        sigaddset(&signals, signal_number);
+    }
+    posix_spawnattr_setsigdefault(&attributes, &signals);
+    posix_spawnattr_setpgroup(&attributes, 0);
+    posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETPGROUP |
+                                              POSIX_SPAWN_SETSIGDEF |
+                                              POSIX_SPAWN_SETSIGMASK);
+
+    pid_t pid;
+    const char *argv[] = {"sh", "-c", command.c_str(), nullptr};
+    int error = posix_spawn(&pid, "/bin/sh", &actions, &attributes,
+                            const_cast<char *const *>(argv), environ);
+
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attributes);
+    if (error != 0) {
+        errno = error;
+        return -1;
+    }
+    return pid;
+}
+
+// Starts command in the background, the interface goes on while it runs.
+// A command that can't be started shows up as a failed job.
+void start_job(FileManager *file_manager, const string &command)
+{
+    JobList &list = file_manager->jobs;
+    auto job = make_shared<Job>();
+
+    job->id = list.next_id++;
+    job->command = command;
+    job->folder = file_manager->cwd;
+    job->paths = get_job_paths(job->folder, command);
+    job->started = chrono::steady_clock::now();
+    list.jobs.push_back(job);
+    list.shown = job->id;
+
+    int pipe_fds[2] = {-1, -1};
+    if (pipe2(pipe_fds, O_CLOEXEC) == 0) {
+        job->pid = spawn_job(command, pipe_fds[1]);
+    }
+    if (job->pid == -1) {
+        string error = string("cannot run: ") + strerror(errno) + "\n";
+        job->output.append(error.data(), error.size());
+        job->status = 127 << 8;
+        job->finished = true;
+        if (pipe_fds[0] != -1) {
+            close(pipe_fds[0]);
+            close(pipe_fds[1]);
+        }
+        return;
+    }
+    close(pipe_fds[1]);
+
+    thread(job_worker, job, pipe_fds[0]).detach();
+}
+
+// Refreshes what the jobs that finished since the last call touched,
+// returns true if one did
+bool poll_jobs(FileManager *file_manager)
+{
+    JobList &list = file_manager->jobs;
+    bool finished = false;
+
+    for (const shared_ptr<Job> &job : list.jobs) {
+        if (job->finished && !job->collected) {
+            job->collected = true;
+            refresh_touched_folders(file_manager, job->folder, job->paths);
+            finished = true;
+        }
+    }
+
+    while (list.jobs.size() > MAX_JOBS) {
+        auto oldest = find_if(list.jobs.begin(), list.jobs.end(),
+                              [](const shared_ptr<Job> &job) {
+                                  return job->collected;
+                              });
+        if (oldest == list.jobs.end()) {
+            break;
+        }
+        list.jobs.erase(oldest);
+    }
+    return finished;
+}
+
+// Signals the job's process group, unless its process was already reaped
+static void signal_job(Job *job, int signal_number)
+{
+    lock_guard<mutex> guard(job->lock);
+    if (!job->reaped && job->pid > 0) {
+        kill(-job->pid, signal_number);
+    }
+}
+
+// SIGTERM to the job's process group
+void stop_job(FileManager *file_manager, int id)
+{
+    for (const shared_ptr<Job> &job : file_manager->jobs.jobs) {
+        if (job->id == id && !job->finished) {
+            signal_job(job.get(), SIGTERM);
+        }
+    }
+}
+
+// On quit the jobs still running get a SIGHUP, like when a terminal closes.
+// Their output had nowhere to go anyway.
+void stop_jobs(FileManager *file_manager)
+{
+    for (const shared_ptr<Job> &job : file_manager->jobs.jobs) {
+        if (!job->finished) {
+            signal_job(job.get(), SIGHUP);
+        }
+    }
+}
+
+size_t running_jobs(FileManager *file_manager)
+{
+    const auto &jobs = file_manager->jobs.jobs;
+
+    return count_if(jobs.begin(), jobs.end(), [](const shared_ptr<Job> &job) {
+        return !job->finished;
+    });
+}
+
+// The job shown in the preview pane, the newest if that one is gone
+static shared_ptr<Job> get_shown_job(JobList *list)
+{
+    for (const shared_ptr<Job> &job : list->jobs) {
+        if (job->id == list->shown) {
+            return job;
+        }
+    }
+    if (list->jobs.empty()) {
+        return nullptr;
+    }
+    list->shown = list->jobs.back()->id;
+    return list->jobs.back();
+}
+
+// J, the one before the shown job, from the oldest back to the newest
+void show_next_job(FileManager *file_manager)
+{
+    JobList &list = file_manager->jobs;
+    shared_ptr<Job> shown = get_shown_job(&list);
+
+    if (!shown) {
+        return;
+    }
+    auto position = find(list.jobs.begin(), list.jobs.end(), shown);
+    list.shown = position == list.jobs.begin() ? list.jobs.back()->id
+                                               : (*prev(position))->id;
+}
+
+// "#3 exit 0 1.2s tar czf out.tgz src"
+static string format_job(const Job &job)
+{
+    char status[64];
+    auto elapsed = job.finished ? job.elapsed
+                                : chrono::steady_clock::now() - job.started;
+    double seconds = chrono::duration<double>(elapsed).count();
+
+    if (!job.finished) {
+        snprintf(status, sizeof(status), "#%d running %.1fs ", job.id,
+                 seconds);
+    } else if (WIFSIGNALED(job.status)) {
+        snprintf(status, sizeof(status), "#%d %s %.1fs ", job.id,
+                 strsignal(WTERMSIG(job.status)), seconds);
+    } else {
+        snprintf(status, sizeof(status), "#%d exit %d %.1fs ", job.id,
+                 WEXITSTATUS(job.status), seconds);
+    }
+    return status + job.command;
+}
+
+// Output as the terminal would have shown it: a carriage return starts the
+// line over (progress bars), other control characters are dropped and tabs
+// become spaces. Lines are cut at width.
+static vector<string> get_output_lines(const string &output, size_t width)
+{
+    vector<string> lines(1);
+
+    for (size_t i = 0; i < output.size(); i++) {
+        char character = output[i];
+        string &line = lines.back();
+
+        if (character == '\n') {
+            lines.emplace_back();
+        } else if (character == '\r') {
+            if (i + 1 < output.size() && output[i + 1] != '\n') {
+                line.clear();
+            }
+        } else if (character == '\t') {
+            line.append(8 - line.size() % 8, ' ');
+        } else if (static_cast<unsigned char>(character) >= ' ' &&
+                   character != 127) {
+            line += character;
+        }
+        if (lines.back().size() > width) {
+            lines.back().resize(width);
+        }
+    }
+    if (lines.back().empty()) {
+        lines.pop_back();
+    }
+    return lines;
+}
+
+// The jobs, newest first, over the preview pane with the end of the shown
+// job's output below them
+void display_jobs(WINDOW *window, FileManager *file_manager)
+{
+    JobList &list = file_manager->jobs;
+    size_t height = getmaxy(window);
+    size_t width = getmaxx(window);
+
+    // drawn over the preview, which has to be drawn again afterwards
+    file_manager->screen.preview_key.clear();
+
+    werase(window);
+    box(window, ACS_VLINE, ACS_HLINE);
+    mvwprintw(window, 0, 2, " Jobs - J next, K stop ");
+
+    shared_ptr<Job> shown = get_shown_job(&list);
+    if (!shown || height < 5 || width < 4) {
+        if (!shown && height > 2) {
+            mvwprintw(window, 1, 1, "No jobs yet, t runs a command");
+        }
+        wnoutrefresh(window);
+        return;
+    }
+
+    // a quarter of the pane at most
+    size_t list_height = min(list.jobs.size(), max<size_t>(height / 4, 1));
+    size_t y = 1;
+    for (auto job = list.jobs.rbegin(); y <= list_height; ++job, y++) {
+        if (*job == shown) {
+            wattron(window, A_REVERSE);
+        }
+        mvwaddnstr(window, y, 1, format_job(**job).c_str(), width - 2);
+        wattroff(window, A_REVERSE);
+    }
+
+    mvwhline(window, y, 1, ACS_HLINE, width - 2);
+    mvwprintw(window, y, 2, " Output of #%d ", shown->id);
+    y++;
+
+    string output;
+    {
+        lock_guard<mutex> guard(shown->lock);
+        output = shown->output.text();
+    }
+    vector<string> lines = get_output_lines(output, width - 2);
+    size_t rows = height - 1 - y;
+    size_t first = lines.size() > rows ? lines.size() - rows : 0;
+    for (size_t line = first; line < lines.size(); line++, y++) {
+        mvwaddstr(window, y, 1, lines[line].c_str());
+    }
+
+    wnoutrefresh(window);
+}
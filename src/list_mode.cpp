@@ -0,0 +1,400 @@
+#include <fcntl.h>
+#include <climits>
+#include <cstring>
+#include "file_manager.hpp"
+
+// entries are written out this many at a time when they aren't sorted
+static const size_t LIST_CHUNK_SIZE = 4096;
+static const size_t OUTPUT_BUFFER_SIZE = 1 << 16;
+
+using list_format_t = enum list_format_e {
+    FORMAT_TSV,
+    FORMAT_JSON,  // one object per line
+    FORMAT_NULL0,
+};
+
+class ListOptions {
+  public:
+    string folder = ".";
+    int sort_type = ALPHABETICAL_INCREASING;
+    bool sorted = true;  // false streams entries in readdir order
+    bool hidden = false;
+    bool recursive = false;
+    string filter;
+    int format = FORMAT_TSV;
+};
+
+class ListOutput {
+  public:
+    string buffer;
+    int format;
+
+    void flush()
+    {
+        fwrite(buffer.data(), 1, buffer.size(), stdout);
+        buffer.clear();
+    }
+};
+
+static const pair<const char *, int> LIST_SORTS[] = {
+    {"name", ALPHABETICAL_INCREASING},
+    {"name-desc", ALPHABETICAL_DECREASING},
+    {"case", ALPHABETICAL_INCREASING_CASE_SENSITIVE},
+    {"case-desc", ALPHABETICAL_DECREASING_CASE_SENSITIVE},
+    {"size", FILE_SIZE_INCREASING},
+    {"size-desc", FILE_SIZE_DECREASING},
+    {"mtime", FIRST_MODIFIED},
+    {"mtime-desc", LAST_MODIFIED},
+    {"natural", NATURAL_INCREASING},
+    {"natural-desc", NATURAL_DECREASING},
+    {"locale", LOCALE_INCREASING},
+    {"locale-desc", LOCALE_DECREASING},
+    {"tree-size", TREE_SIZE_INCREASING},
+    {"tree-size-desc", TREE_SIZE_DECREASING},
+};
+
+static void print_list_usage(FILE *output)
+{
+    fprintf(output,
+            "usage: file_manager --list [DIR] [--sort ORDER] [--hidden]\n"
+            "                    [--recursive] [--filter TEXT]\n"
+            "                    [--format tsv|json|null0]\n"
+            "\n"
+            "Lists DIR (default .) without starting the interface.\n"
+            "  --sort       none (readdir order, streamed), name, case,\n"
+            "               size, mtime, natural, locale or tree-size\n"
+            "               (disk usage of folders), -desc to reverse\n"
+            "               (default name)\n"
+            "  --hidden     include dotfiles\n"
+            "  --recursive  list the subfolders too, links aren't followed\n"
+            "  --filter     only names matching TEXT, as the f search\n"
+            "  --format     tsv: type, size, mtime, path (default)\n"
+            "               json: one object per line\n"
+            "               null0: paths ending with a NUL byte\n");
+}
+
+// Returns false (and says why) if the arguments don't make sense
+static bool parse_list_options(int argc, char **argv, ListOptions *options)
+{
+    bool folder_set = false;
+
+    for (int i = 1; i < argc; i++) {
+        string argument = argv[i];
+        bool has_value = i + 1 < argc;
+
+        if (argument == "--list") {
+            continue;
+        }
+        if (argument == "--hidden") {
+            options->hidden = true;
+        } else if (argument == "--recursive") {
+            options->recursive = true;
+        } else if (argument == "--filter" && has_value) {
+            options->filter = argv[++i];
+        } else if (argument == "--sort" && has_value) {
+            string order = argv[++i];
+            auto sort = find_if(begin(LIST_SORTS), end(LIST_SORTS),
+                                [&order](const pair<const char *, int> &sort) {
+                                    return order == sort.first;
+                                });
+            if (order == "none") {
+                options->sorted = false;
+            } else if (sort == end(LIST_SORTS)) {
+                fprintf(stderr, "file_manager: unknown sort '%s'\n",
+                        order.c_str());
+                return false;
+            } else {
+                options->sorted = true;
+                options->sort_type = sort->second;
+            }
+        } else if (argument == "--format" && has_value) {
+            string format = argv[++i];
+            if (format == "tsv") {
+                options->format = FORMAT_TSV;
+            } else if (format == "json") {
+                options->format = FORMAT_JSON;
+            } else if (format == "null0") {
+                options->format = FORMAT_NULL0;
+            } else {
+                fprintf(stderr, "file_manager: unknown format '%s'\n",
+                        format.c_str());
+                return false;
+            }
+        } else if (argument.empty()) {
+            fprintf(stderr, "file_manager: empty folder name\n");
+            return false;
+        } else if (argument[0] != '-' && !folder_set) {
+            options->folder = argument;
+            folder_set = true;
+        } else {
+            fprintf(stderr, "file_manager: unexpected argument '%s'\n",
+                    argument.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+static const char *get_type_name(uint8_t type)
+{
+    static const char *names[] = {"unknown", "file",   "dir",   "char",
+                                  "block",   "fifo", "socket"};
+
+    return type < size(names) ? names[type] : "unknown";
+}
+
+// Paths in tsv keep one entry per line: tab, newline and backslash are
+// escaped the C way
+static void append_tsv_path(string *buffer, string_view path)
+{
+    for (char character : path) {
+        switch (character) {
+            case '\t':
+                buffer->append("\\t");
+                break;
+            case '\n':
+                buffer->append("\\n");
+                break;
+            case '\\':
+                buffer->append("\\\\");
+                break;
+            default:
+                buffer->push_back(character);
+        }
+    }
+}
+
+// Control characters, quotes and backslashes escaped, other bytes as they
+// are (names that aren't UTF-8 stay that way)
+void append_json_escaped(string *buffer, string_view text)
+{
+    for (unsigned char character : text) {
+        if (character == '"' || character == '\\') {
+            buffer->push_back('\\');
+            buffer->push_back(character);
+        } else if (character < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", character);
+            buffer->append(escaped);
+        } else {
+            buffer->push_back(character);
+        }
+    }
+}
+
+static void append_number(string *buffer, uint64_t number)
+{
+    char digits[24];
+    char *end = digits + sizeof(digits);
+    char *start = end;
+
+    do {
+        *--start = '0' + number % 10;
+        number /= 10;
+    } while (number != 0);
+    buffer->append(start, end);
+}
+
+// Seconds with the nanoseconds as decimals
+static void append_mtime(string *buffer, int64_t mtime)
+{
+    int64_t seconds = mtime / 1000000000;
+    int64_t nanoseconds = mtime % 1000000000;
+    if (nanoseconds < 0) {
+        seconds--;
+        nanoseconds += 1000000000;
+    }
+    char text[40];
+    snprintf(text, sizeof(text), "%lld.%09lld",
+             static_cast<long long>(seconds),
+             static_cast<long long>(nanoseconds));
+    buffer->append(text);
+}
+
+static void write_entry(ListOutput *output, const FileEntry &file,
+                        const string &prefix)
+{
+    string &buffer = output->buffer;
+    string_view name = file.name();
+
+    switch (output->format) {
+        case FORMAT_NULL0:
+            buffer.append(prefix).append(name).push_back('\0');
+            break;
+        case FORMAT_TSV:
+            buffer.append(get_type_name(file.type()));
+            if (file.is_symlink()) {
+                buffer.append("-link");
+            }
+            buffer.push_back('\t');
+            append_number(&buffer, file.file_size());
+            buffer.push_back('\t');
+            append_mtime(&buffer, file.last_write_time());
+            buffer.push_back('\t');
+            append_tsv_path(&buffer, prefix);
+            append_tsv_path(&buffer, name);
+            buffer.push_back('\n');
+            break;
+        case FORMAT_JSON:
+            buffer.append("{\"path\":\"");
+            append_json_escaped(&buffer, prefix);
+            append_json_escaped(&buffer, name);
+            buffer.append("\",\"type\":\"");
+            buffer.append(get_type_name(file.type()));
+            buffer.append("\",\"link\":");
+            buffer.append(file.is_symlink() ? "true" : "false");
+            buffer.append(",\"size\":");
+            append_number(&buffer, file.file_size());
+            buffer.append(",\"mtime\":");
+            append_mtime(&buffer, file.last_write_time());
+            buffer.append(",\"mode\":");
+            append_number(&buffer, file.table->modes[file.row] & 07777);
+            buffer.append("}\n");
+            break;
+    }
+    if (buffer.size() >= OUTPUT_BUFFER_SIZE) {
+        output->flush();
+    }
+}
+
+// Writes the rows of table left by the hidden files and the search filters,
+// sorted if asked, and adds the folders to walk next to subfolders
+static void write_entries(FileManager *file_manager, ListOutput *output,
+                          const shared_ptr<EntryTable> &table, bool sort,
+                          const string &prefix, vector<string> *subfolders)
+{
+    FileList files;
+    files.table = table;
+    files.rows.resize(table->size());
+    for (uint32_t row = 0; row < files.rows.size(); row++) {
+        files.rows[row] = row;
+    }
+
+    filter_files(file_manager, &files, 0, false);
+    if (sort) {
+        sort_files(file_manager, &files);
+    }
+
+    // the filter only picks what's printed, every folder is walked
+    FileList matches;
+    const FileList *printed = &files;
+    if (!file_manager->current_search.empty()) {
+        matches = files;
+        search_files(&matches, 0, file_manager->current_search);
+        printed = &matches;
+    }
+    for (size_t i = 0; i < printed->size(); i++) {
+        write_entry(output, (*printed)[i], prefix);
+    }
+
+    if (subfolders == nullptr) {
+        return;
+    }
+    for (size_t i = 0; i < files.size(); i++) {
+        FileEntry folder = files[i];
+        if (folder.is_directory() && !folder.is_symlink()) {
+            subfolders->push_back(prefix + string(folder.name()));
+        }
+    }
+}
+
+// Lists one folder, in chunks as readdir() returns them unless it has to be
+// sorted. Returns false if it can't be opened.
+static bool list_folder(FileManager *file_manager, ListOutput *output,
+                        const ListOptions &options, const string &path,
+                        const string &prefix, vector<string> *subfolders)
+{
+    PerfScope perf_scope(PERF_READ_FOLDER, path);
+    DIR *dir = opendir(path.c_str());
+
+    perf_count(PERF_OPENS);
+    if (dir == nullptr) {
+        fprintf(stderr, "file_manager: cannot open '%s': %s\n", path.c_str(),
+                strerror(errno));
+        return false;
+    }
+
+    // only the sizes and times need a stat per entry
+    bool metadata = options.format != FORMAT_NULL0 ||
+                    (options.sorted &&
+                     ((options.sort_type >= FILE_SIZE_INCREASING &&
+                       options.sort_type <= FIRST_MODIFIED) ||
+                      is_tree_size_sort(options.sort_type)));
+    auto table = make_shared<EntryTable>();
+    table->folder = path;
+
+    while (const struct dirent *entry = readdir(dir)) {
+        if (metadata) {
+            add_folder_entry(table.get(), dirfd(dir), entry);
+        } else {
+            add_folder_name(table.get(), dirfd(dir), entry);
+        }
+        if (!options.sorted && table->size() >= LIST_CHUNK_SIZE) {
+            write_entries(file_manager, output, table, false, prefix,
+                          subfolders);
+            table = make_shared<EntryTable>();
+            table->folder = path;
+        }
+    }
+    closedir(dir);
+
+    write_entries(file_manager, output, table, options.sorted, prefix,
+                  subfolders);
+    return true;
+}
+
+// file_manager --list: the loader, filters and sorts of the interface for
+// scripts, written to stdout as each folder is read. Only one folder is in
+// memory at a time (a chunk of it when unsorted). Returns the exit status.
+int run_list_mode(int argc, char **argv)
+{
+    ListOptions options;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
+            print_list_usage(stdout);
+            return 0;
+        }
+    }
+    if (!parse_list_options(argc, argv, &options)) {
+        print_list_usage(stderr);
+        return 2;
+    }
+
+    FileManager file_manager;
+    setup_sorting(&file_manager);
+    file_manager.sort_type = options.sort_type;
+    file_manager.hidden_files = options.hidden;
+    file_manager.current_search = options.filter;
+
+    ListOutput output;
+    output.format = options.format;
+    output.buffer.reserve(OUTPUT_BUFFER_SIZE + PATH_MAX * 2);
+
+    string root = options.folder;
+    while (root.size() > 1 && root.back() == '/') {
+        root.pop_back();
+    }
+    // only "/" still ends with one
+    string separator = root.back() == '/' ? "" : "/";
+
+    // depth first, subfolders pushed in reverse so they come out in order
+    int status = 0;
+    vector<string> pending = {""};
+    vector<string> subfolders;
+    while (!pending.empty()) {
+        string folder = move(pending.back());
+        pending.pop_back();
+
+        string path = folder.empty() ? root : root + separator + folder;
+        string prefix = folder.empty() ? "" : folder + '/';
+        subfolders.clear();
+        if (!list_folder(&file_manager, &output, options, path, prefix,
+                         options.recursive ? &subfolders : nullptr)) {
+            status = 1;
+        }
+        pending.insert(pending.end(), subfolders.rbegin(), subfolders.rend());
+    }
+    output.flush();
+    return status;
+}
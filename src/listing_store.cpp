@@ -0,0 +1,406 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <cstring>
+#include <ctime>
+#include "file_manager.hpp"
+
+// Layout of the file, in the machine's byte order: the header, the index of
+// the folders sorted by path, then each folder's path and rows. The rows
+// are the EntryTable columns one after the other, widest first, with the
+// names at the end. A file from another version or byte order is ignored.
+static const char STORE_MAGIC[8] = {'F', 'E', 'A', 'M', 'L', 'S', 'T', 'S'};
+static const uint32_t STORE_VERSION = 1;
+
+// bytes of a row without its name
+static const size_t ROW_BYTES = 4 * sizeof(uint64_t) + 2 * sizeof(uint32_t) +
+                                sizeof(uint16_t) + 2 * sizeof(uint8_t);
+
+static_assert(sizeof(mode_t) == sizeof(uint32_t), "modes are stored as u32");
+static_assert(sizeof(ino_t) == sizeof(uint64_t), "inodes are stored as u64");
+
+class StoreHeader {
+  public:
+    char magic[8];
+    uint32_t version;
+    uint32_t folder_count;
+    uint64_t file_size;  // a file cut short is ignored
+};
+
+class StoreFolder {
+  public:
+    uint64_t path_offset;
+    uint64_t rows_offset;
+    uint64_t rows_size;
+    int64_t folder_mtime;
+    uint64_t folder_inode;
+    int64_t last_used;  // seconds since the epoch, the oldest go first
+    uint32_t path_size;
+    uint32_t rows;
+};
+
+// A folder going into the next file
+class SavedFolder {
+  public:
+    string path;
+    string rows;
+    StoreFolder record;
+};
+
+// $XDG_CACHE_HOME/file_manager/listings or ~/.cache/file_manager/listings
+static string get_store_path()
+{
+    const char *cache_home = getenv("XDG_CACHE_HOME");
+    if (cache_home != nullptr && cache_home[0] == '/') {
+        return string(cache_home) + "/file_manager/listings";
+    }
+    const char *home = getenv("HOME");
+    if (home != nullptr && home[0] == '/') {
+        return string(home) + "/.cache/file_manager/listings";
+    }
+    return "";
+}
+
+// Off unless FILE_MANAGER_DISK_CACHE_MB is set. Only maps the file, the
+// pages of the folders looked up are the only ones read.
+void open_listing_store(FileManager *file_manager)
+{
+    ListingStore &store = file_manager->listing_store;
+
+    if (const char *env_budget = getenv("FILE_MANAGER_DISK_CACHE_MB")) {
+        store.budget = strtoul(env_budget, nullptr, 10) * 1024 * 1024;
+    }
+    store.path = get_store_path();
+    if (store.budget == 0 || store.path.empty()) {
+        store.budget = 0;
+        return;
+    }
+
+    auto file = make_unique<MappedFile>(AT_FDCWD, store.path.c_str());
+    StoreHeader header;
+    if (file->size < sizeof(header)) {
+        return;
+    }
+    memcpy(&header, file->data, sizeof(header));
+    if (memcmp(header.magic, STORE_MAGIC, sizeof(STORE_MAGIC)) != 0 ||
+        header.version != STORE_VERSION || header.file_size != file->size ||
+        (file->size - sizeof(header)) / sizeof(StoreFolder) <
+            header.folder_count) {
+        return;
+    }
+    madvise(const_cast<unsigned char *>(file->data), file->size, MADV_RANDOM);
+
+    store.folder_count = header.folder_count;
+    store.file = move(file);
+}
+
+static StoreFolder get_store_folder(const ListingStore &store, uint32_t index)
+{
+    StoreFolder record;
+    memcpy(&record,
+           store.file->data + sizeof(StoreHeader) + index * sizeof(record),
+           sizeof(record));
+    return record;
+}
+
+static string_view get_stored_path(const ListingStore &store,
+                                   const StoreFolder &record)
+{
+    if (record.path_offset > store.file->size ||
+        record.path_size > store.file->size - record.path_offset) {
+        return {};
+    }
+    return string_view(
+        reinterpret_cast<const char *>(store.file->data) + record.path_offset,
+        record.path_size);
+}
+
+// Binary search of the index
+static bool find_store_folder(const ListingStore &store, string_view folder,
+                              StoreFolder *record)
+{
+    uint32_t low = 0;
+    uint32_t high = store.folder_count;
+
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        *record = get_store_folder(store, middle);
+        int order = get_stored_path(store, *record).compare(folder);
+        if (order == 0) {
+            return true;
+        }
+        if (order < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return false;
+}
+
+template <typename T>
+static void read_column(const unsigned char **cursor, size_t rows,
+                        vector<T> *column)
+{
+    column->resize(rows);
+    memcpy(column->data(), *cursor, rows * sizeof(T));
+    *cursor += rows * sizeof(T);
+}
+
+// Copies the rows of a folder out of the file, nullptr if they don't add up
+static shared_ptr<EntryTable> read_stored_rows(const ListingStore &store,
+                                               const StoreFolder &record)
+{
+    size_t rows = record.rows;
+
+    if (record.rows_offset > store.file->size ||
+        record.rows_size > store.file->size - record.rows_offset ||
+        record.rows_size < rows * ROW_BYTES) {
+        return nullptr;
+    }
+
+    auto table = make_shared<EntryTable>();
+    const unsigned char *cursor = store.file->data + record.rows_offset;
+    read_column(&cursor, rows, &table->sizes);
+    read_column(&cursor, rows, &table->allocated);
+    read_column(&cursor, rows, &table->mtimes);
+    read_column(&cursor, rows, &table->inodes);
+    read_column(&cursor, rows, &table->modes);
+    read_column(&cursor, rows, &table->name_offsets);
+    read_column(&cursor, rows, &table->name_sizes);
+    read_column(&cursor, rows, &table->types);
+    read_column(&cursor, rows, &table->flags);
+    table->names.assign(reinterpret_cast<const char *>(cursor),
+                        record.rows_size - rows * ROW_BYTES);
+
+    for (size_t row = 0; row < rows; row++) {
+        if (table->name_offsets[row] > table->names.size() ||
+            table->name_sizes[row] >
+                table->names.size() - table->name_offsets[row]) {
+            return nullptr;
+        }
+    }
+    return table;
+}
+
+// Puts the saved listing of folder in the folders cache if the folder's
+// mtime and inode still match, returns false if there is none. The table
+// is marked persisted so start_folder_load() reads the folder again.
+bool load_stored_listing(FileManager *file_manager, const string &folder)
+{
+    ListingStore &store = file_manager->listing_store;
+    StoreFolder record;
+
+    if (!store.file || !find_store_folder(store, folder, &record)) {
+        return false;
+    }
+    PerfScope perf_scope(PERF_READ_FOLDER, folder);
+
+    struct stat folder_stat;
+    perf_count(PERF_STATS);
+    if (stat(folder.c_str(), &folder_stat) != 0 ||
+        !S_ISDIR(folder_stat.st_mode) ||
+        folder_stat.st_ino != record.folder_inode ||
+        folder_stat.st_mtim.tv_sec * 1000000000LL +
+                folder_stat.st_mtim.tv_nsec !=
+            record.folder_mtime) {
+        return false;
+    }
+
+    shared_ptr<EntryTable> table = read_stored_rows(store, record);
+    if (!table) {
+        return false;
+    }
+    table->folder = folder;
+    table->folder_mtime = record.folder_mtime;
+    table->folder_inode = record.folder_inode;
+    table->persisted = true;
+    cache_folder(file_manager, folder, table);
+    store.loaded++;
+    return true;
+}
+
+template <typename T>
+static void append_column(string *buffer, const vector<T> &column)
+{
+    buffer->append(reinterpret_cast<const char *>(column.data()),
+                   column.size() * sizeof(T));
+}
+
+// The names are copied in row order, what removed rows left in the arena
+// is dropped on the way
+static void write_rows(const EntryTable &table, string *buffer)
+{
+    vector<uint32_t> name_offsets;
+    string names;
+
+    for (uint32_t row = 0; row < table.size(); row++) {
+        name_offsets.push_back(names.size());
+        names.append(table.name(row));
+    }
+
+    append_column(buffer, table.sizes);
+    append_column(buffer, table.allocated);
+    append_column(buffer, table.mtimes);
+    append_column(buffer, table.inodes);
+    append_column(buffer, table.modes);
+    append_column(buffer, name_offsets);
+    append_column(buffer, table.name_sizes);
+    append_column(buffer, table.types);
+    append_column(buffer, table.flags);
+    buffer->append(names);
+}
+
+static size_t get_rows_size(const EntryTable &table)
+{
+    size_t names_size = 0;
+    for (uint16_t name_size : table.name_sizes) {
+        names_size += name_size;
+    }
+    return table.size() * ROW_BYTES + names_size;
+}
+
+// rows start on 8 bytes so the file can be read in place
+static size_t align_offset(size_t offset)
+{
+    return (offset + 7) & ~static_cast<size_t>(7);
+}
+
+// Written next to the old file, synced and renamed over it: a crash leaves
+// either file whole, never a mix. folders are sorted by path.
+static bool write_store_file(const string &path,
+                             vector<SavedFolder> *folders)
+{
+    string temp_path = path + ".tmp" + to_string(getpid());
+    FILE *file = fopen(temp_path.c_str(), "wb");
+
+    if (file == nullptr) {
+        return false;
+    }
+
+    StoreHeader header;
+    memcpy(header.magic, STORE_MAGIC, sizeof(STORE_MAGIC));
+    header.version = STORE_VERSION;
+    header.folder_count = folders->size();
+
+    size_t offset = sizeof(header) + folders->size() * sizeof(StoreFolder);
+    for (SavedFolder &folder : *folders) {
+        folder.record.path_offset = offset;
+        folder.record.path_size = folder.path.size();
+        folder.record.rows_offset =
+            align_offset(offset + folder.path.size());
+        folder.record.rows_size = folder.rows.size();
+        offset = folder.record.rows_offset + folder.rows.size();
+    }
+    header.file_size = offset;
+
+    static const char padding[8] = {};
+    fwrite(&header, sizeof(header), 1, file);
+    for (const SavedFolder &folder : *folders) {
+        fwrite(&folder.record, sizeof(folder.record), 1, file);
+    }
+    for (const SavedFolder &folder : *folders) {
+        size_t path_end = folder.record.path_offset + folder.path.size();
+        fwrite(folder.path.data(), 1, folder.path.size(), file);
+        fwrite(padding, 1, folder.record.rows_offset - path_end, file);
+        fwrite(folder.rows.data(), 1, folder.rows.size(), file);
+    }
+
+    bool written =
+        !ferror(file) && fflush(file) == 0 && fsync(fileno(file)) == 0;
+    written = fclose(file) == 0 && written;
+    if (!written || rename(temp_path.c_str(), path.c_str()) != 0) {
+        unlink(temp_path.c_str());
+        return false;
+    }
+
+    // the rename itself only lasts once the folder is synced
+    string parent = fs::path(path).parent_path().string();
+    int parent_fd = open(parent.c_str(), O_RDONLY | O_DIRECTORY);
+    if (parent_fd != -1) {
+        fsync(parent_fd);
+        close(parent_fd);
+    }
+    return true;
+}
+
+// Saves the listings of this session, most recently used first, then the
+// ones already saved that weren't seen again, until the budget is used up.
+// Listings the watcher patched aren't a read of their folder anymore and are
+// left out.
+void save_listing_store(FileManager *file_manager)
+{
+    ListingStore &store = file_manager->listing_store;
+
+    if (store.budget == 0) {
+        return;
+    }
+
+    vector<SavedFolder> folders;
+    unordered_set<string> seen;
+    size_t total = sizeof(StoreHeader);
+    int64_t now = time(nullptr);
+
+    auto fits = [&total, &store](size_t path_size, size_t rows_size) {
+        size_t size =
+            sizeof(StoreFolder) + align_offset(path_size) + rows_size;
+        if (total + size > store.budget) {
+            return false;
+        }
+        total += size;
+        return true;
+    };
+
+    for (const auto &item : file_manager->folders_cache.items) {
+        const EntryTable &table = *item.value;
+        seen.insert(item.key);
+        if (table.folder_mtime == 0 ||
+            !fits(item.key.size(), get_rows_size(table))) {
+            continue;
+        }
+
+        SavedFolder folder;
+        folder.path = item.key;
+        write_rows(table, &folder.rows);
+        folder.record.folder_mtime = table.folder_mtime;
+        folder.record.folder_inode = table.folder_inode;
+        folder.record.last_used = now;
+        folder.record.rows = table.size();
+        folders.push_back(move(folder));
+    }
+
+    vector<StoreFolder> stored;
+    for (uint32_t index = 0; index < store.folder_count; index++) {
+        stored.push_back(get_store_folder(store, index));
+    }
+    stable_sort(stored.begin(), stored.end(),
+                [](const StoreFolder &left, const StoreFolder &right) {
+                    return left.last_used > right.last_used;
+                });
+
+    for (const StoreFolder &record : stored) {
+        string_view path = get_stored_path(store, record);
+        if (path.empty() || seen.count(string(path)) != 0 ||
+            record.rows_offset > store.file->size ||
+            record.rows_size > store.file->size - record.rows_offset ||
+            !fits(path.size(), record.rows_size)) {
+            continue;
+        }
+
+        SavedFolder folder;
+        folder.path = path;
+        folder.rows.assign(reinterpret_cast<const char *>(store.file->data) +
+                               record.rows_offset,
+                           record.rows_size);
+        folder.record = record;
+        folders.push_back(move(folder));
+    }
+
+    sort(folders.begin(), folders.end(),
+         [](const SavedFolder &left, const SavedFolder &right) {
+             return left.path < right.path;
+         });
+
+    error_code error;
+    fs::create_directories(fs::path(store.path).parent_path(), error);
+    write_store_file(store.path, &folders);
+}
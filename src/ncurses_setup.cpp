@@ -1,3 +1,5 @@
+#include <fcntl.h>
+#include <cstring>
 #include "file_manager.hpp"
 
 bool color_support()
@@ -22,15 +24,10 @@ bool color_support()
     return true;
 }
 
-int start_ncurses()
+// Color pairs of the interface, also used by the headless screen of the
+// benchmarks
+void setup_colors()
 {
-    initscr();
-
-    start_color();
-    if (!color_support()) {
-        return 1;
-    }
-
     init_pair(1, COLOR_RED, COLOR_BLACK);
     init_pair(2, COLOR_WHITE, COLOR_BLACK);
 
@@ -39,8 +36,22 @@ int start_ncurses()
     init_pair(GREEN, COLOR_GREEN, COLOR_BLACK);
     init_pair(YELLOW, COLOR_YELLOW, COLOR_BLACK);
     init_pair(MAGENTA, COLOR_MAGENTA, COLOR_BLACK);
+}
+
+int start_ncurses()
+{
+    initscr();
+
+    start_color();
+    if (!color_support()) {
+        return 1;
+    }
+
+    setup_colors();
 
     keypad(stdscr, TRUE);
+    // lets doupdate() scroll the terminal instead of redrawing every line
+    idlok(stdscr, TRUE);
     cbreak();
     noecho();
     curs_set(0);
@@ -62,3 +73,46 @@ static void sigint_handler(int value [[maybe_unused]])
 }
 
 void handle_signals() { signal(SIGINT, sigint_handler); }
+
+// The next frame draws the list and the preview from scratch, for when
+// something else was drawn over them
+void invalidate_screen(FileManager *file_manager)
+{
+    file_manager->screen.list_rows.clear();
+    file_manager->screen.preview_key.clear();
+}
+
+// "wchar" of the main thread, all it writes is the terminal output
+static uint64_t get_written_bytes(int io_stats_fd)
+{
+    char buffer[512];
+    ssize_t size = pread(io_stats_fd, buffer, sizeof(buffer) - 1, 0);
+
+    if (size <= 0) {
+        return 0;
+    }
+    buffer[size] = '\0';
+    const char *wchar = strstr(buffer, "wchar: ");
+    return wchar == nullptr ? 0 : strtoull(wchar + 7, nullptr, 10);
+}
+
+// Single doupdate() for everything the windows queued with wnoutrefresh()
+void update_screen(FileManager *file_manager)
+{
+    PerfScope perf_scope(PERF_TERMINAL);
+    ScreenState &screen = file_manager->screen;
+
+    if (screen.io_stats_fd == -1) {
+        screen.io_stats_fd = open("/proc/thread-self/io", O_RDONLY | O_CLOEXEC);
+    }
+    if (screen.io_stats_fd == -1) {
+        doupdate();
+        return;
+    }
+
+    uint64_t written = get_written_bytes(screen.io_stats_fd);
+    doupdate();
+    screen.frame_bytes = get_written_bytes(screen.io_stats_fd) - written;
+    screen.tty_bytes += screen.frame_bytes;
+    screen.frames++;
+}
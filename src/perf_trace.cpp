@@ -0,0 +1,360 @@
+#include <cstring>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#include "file_manager.hpp"
+
+// a trace of a long session is cut there, about 80 bytes each
+static const size_t MAX_TRACE_EVENTS = 1000000;
+
+static const int OVERLAY_WIDTH = 44;
+
+static const char *const SCOPE_NAMES[PERF_SCOPES] = {
+    "frame",         "input",         "read_folder",  "load_folder",
+    "sort_files",    "count_files",   "disk_usage",   "find_git_repo",
+    "git_status",    "search",        "display_files", "preview_file",
+    "build_preview", "terminal",
+};
+
+atomic<bool> perf_enabled{false};
+
+// Totals since the last frame, added to by every thread
+static array<atomic<uint64_t>, PERF_SCOPES> scope_ns;
+static array<atomic<uint32_t>, PERF_SCOPES> scope_calls;
+static array<atomic<uint64_t>, PERF_COUNTERS> counts;
+
+class TraceEvent {
+  public:
+    int scope;
+    int thread;
+    int64_t start;
+    int64_t duration;
+    string detail;
+};
+
+// Sampled once per frame
+class TraceCounters {
+  public:
+    int64_t time;
+    int64_t heap_bytes;
+    uint64_t tty_bytes;
+    array<uint64_t, PERF_COUNTERS> counts;
+};
+
+class PerfTrace {
+  public:
+    FILE *file = nullptr;
+    string path;
+    int64_t start = 0;
+    mutex lock;
+    vector<TraceEvent> events;
+    vector<TraceCounters> counters;
+    vector<pair<int, string>> threads;
+    size_t dropped = 0;
+};
+
+static PerfTrace perf_trace;
+static atomic<bool> tracing{false};
+static atomic<int> next_thread_id{1};
+
+// Small ids in the order the threads were first seen, the first one is the
+// main thread
+static int get_thread_id()
+{
+    thread_local int id = next_thread_id++;
+    return id;
+}
+
+int64_t perf_clock()
+{
+    return chrono::duration_cast<chrono::nanoseconds>(
+               chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+void end_perf_scope(int scope, int64_t start, string_view detail)
+{
+    int64_t duration = perf_clock() - start;
+
+    scope_ns[scope].fetch_add(duration, memory_order_relaxed);
+    scope_calls[scope].fetch_add(1, memory_order_relaxed);
+
+    if (!tracing.load(memory_order_relaxed)) {
+        return;
+    }
+    int thread = get_thread_id();
+    lock_guard<mutex> guard(perf_trace.lock);
+    if (perf_trace.events.size() >= MAX_TRACE_EVENTS) {
+        perf_trace.dropped++;
+        return;
+    }
+    perf_trace.events.push_back({scope, thread, start, duration, string(detail)});
+}
+
+void add_perf_count(int counter, uint64_t count)
+{
+    counts[counter].fetch_add(count, memory_order_relaxed);
+}
+
+// The file is opened right away so a bad path is reported before the
+// interface starts, it's written by stop_perf_trace()
+bool start_perf_trace(const string &path)
+{
+    perf_trace.file = fopen(path.c_str(), "w");
+    if (perf_trace.file == nullptr) {
+        fprintf(stderr, "file_manager: cannot write '%s': %s\n", path.c_str(),
+                strerror(errno));
+        return false;
+    }
+    perf_trace.path = path;
+    perf_trace.start = perf_clock();
+    tracing = true;
+    perf_enabled = true;
+    return true;
+}
+
+// Names the calling thread in the trace
+void name_perf_thread(const char *name)
+{
+    if (!tracing.load(memory_order_relaxed)) {
+        return;
+    }
+    int thread = get_thread_id();
+    lock_guard<mutex> guard(perf_trace.lock);
+    perf_trace.threads.emplace_back(thread, name);
+}
+
+static void append_trace_time(string *buffer, int64_t nanoseconds)
+{
+    char text[32];
+    snprintf(text, sizeof(text), "%.3f", nanoseconds / 1000.0);
+    buffer->append(text);
+}
+
+// Chrome's trace event format, opens in chrome://tracing and Perfetto
+static void write_trace_events(FILE *file)
+{
+    string buffer = "{\"traceEvents\":[\n";
+    string pid = to_string(getpid());
+    bool first = true;
+
+    auto start_event = [&buffer, &first, &pid](const char *phase) {
+        buffer.append(first ? "{\"ph\":\"" : ",\n{\"ph\":\"");
+        buffer.append(phase).append("\",\"pid\":").append(pid);
+        first = false;
+    };
+
+    for (const auto &[thread, name] : perf_trace.threads) {
+        start_event("M");
+        buffer.append(",\"tid\":").append(to_string(thread));
+        buffer.append(",\"name\":\"thread_name\",\"args\":{\"name\":\"");
+        append_json_escaped(&buffer, name);
+        buffer.append("\"}}");
+    }
+
+    for (const TraceEvent &event : perf_trace.events) {
+        start_event("X");
+        buffer.append(",\"tid\":").append(to_string(event.thread));
+        buffer.append(",\"name\":\"").append(SCOPE_NAMES[event.scope]);
+        buffer.append("\",\"ts\":");
+        append_trace_time(&buffer, event.start - perf_trace.start);
+        buffer.append(",\"dur\":");
+        append_trace_time(&buffer, event.duration);
+        if (!event.detail.empty()) {
+            buffer.append(",\"args\":{\"detail\":\"");
+            append_json_escaped(&buffer, event.detail);
+            buffer.append("\"}");
+        }
+        buffer.push_back('}');
+        if (buffer.size() >= 1 << 16) {
+            fwrite(buffer.data(), 1, buffer.size(), file);
+            buffer.clear();
+        }
+    }
+
+    for (const TraceCounters &sample : perf_trace.counters) {
+        string time;
+        append_trace_time(&time, sample.time - perf_trace.start);
+        start_event("C");
+        buffer.append(",\"name\":\"heap\",\"ts\":").append(time);
+        buffer.append(",\"args\":{\"bytes\":");
+        buffer.append(to_string(sample.heap_bytes)).append("}}");
+        start_event("C");
+        buffer.append(",\"name\":\"terminal\",\"ts\":").append(time);
+        buffer.append(",\"args\":{\"bytes\":");
+        buffer.append(to_string(sample.tty_bytes)).append("}}");
+        start_event("C");
+        buffer.append(",\"name\":\"syscalls\",\"ts\":").append(time);
+        buffer.append(",\"args\":{\"opens\":");
+        buffer.append(to_string(sample.counts[PERF_OPENS]));
+        buffer.append(",\"stats\":");
+        buffer.append(to_string(sample.counts[PERF_STATS])).append("}}");
+    }
+
+    buffer.append("\n],\"displayTimeUnit\":\"ms\",\"otherData\":{");
+    buffer.append("\"dropped_events\":").append(to_string(perf_trace.dropped));
+    buffer.append("}}\n");
+    fwrite(buffer.data(), 1, buffer.size(), file);
+}
+
+// Writes the trace if one was started. Detached workers may still be
+// running, what they add from now on is dropped.
+void stop_perf_trace()
+{
+    if (!tracing) {
+        return;
+    }
+    tracing = false;
+
+    lock_guard<mutex> guard(perf_trace.lock);
+    write_trace_events(perf_trace.file);
+    if (fclose(perf_trace.file) != 0) {
+        fprintf(stderr, "file_manager: cannot write '%s': %s\n",
+                perf_trace.path.c_str(), strerror(errno));
+    }
+    perf_trace.file = nullptr;
+    perf_trace.events = {};
+    perf_trace.counters = {};
+}
+
+static int64_t get_heap_bytes()
+{
+#ifdef __GLIBC__
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+#else
+    return 0;
+#endif
+}
+
+// Closes the frame drawn last: the totals since the frame before go to the
+// overlay and the trace. Only called while perf_enabled is set.
+void end_perf_frame(FileManager *file_manager)
+{
+    PerfState &perf = file_manager->perf;
+    PerfFrame &frame = perf.last;
+    int64_t now = perf_clock();
+
+    frame.frame_ns = perf.frame_start == 0 ? 0 : now - perf.frame_start;
+    perf.frame_start = now;
+
+    for (int scope = 0; scope < PERF_SCOPES; scope++) {
+        frame.scope_ns[scope] = scope_ns[scope].exchange(0);
+        frame.scope_calls[scope] = scope_calls[scope].exchange(0);
+    }
+    for (int counter = 0; counter < PERF_COUNTERS; counter++) {
+        frame.counts[counter] = counts[counter].exchange(0);
+    }
+
+    int64_t heap_bytes = get_heap_bytes();
+    frame.heap_change = heap_bytes - frame.heap_bytes;
+    frame.heap_bytes = heap_bytes;
+
+    const auto &folders = file_manager->folders_cache;
+    const auto &previews = file_manager->previews_cache;
+    frame.folder_hits = folders.hits - perf.folder_hits;
+    frame.folder_misses = folders.misses - perf.folder_misses;
+    frame.preview_hits = previews.hits - perf.preview_hits;
+    frame.preview_misses = previews.misses - perf.preview_misses;
+    perf.folder_hits = folders.hits;
+    perf.folder_misses = folders.misses;
+    perf.preview_hits = previews.hits;
+    perf.preview_misses = previews.misses;
+
+    if (tracing) {
+        lock_guard<mutex> guard(perf_trace.lock);
+        perf_trace.counters.push_back({now, heap_bytes,
+                                  file_manager->screen.frame_bytes,
+                                  frame.counts});
+    }
+}
+
+void toggle_perf_overlay(FileManager *file_manager)
+{
+    PerfState &perf = file_manager->perf;
+
+    perf.overlay = !perf.overlay;
+    perf_enabled = perf.overlay || tracing;
+    // what the timers gathered while off would count as the next frame's
+    if (perf.overlay) {
+        end_perf_frame(file_manager);
+    }
+    invalidate_screen(file_manager);
+}
+
+// "1.25 ms", "310 us"
+static string format_duration(uint64_t nanoseconds)
+{
+    char text[32];
+
+    if (nanoseconds >= 1000000) {
+        snprintf(text, sizeof(text), "%.2f ms", nanoseconds / 1e6);
+    } else {
+        snprintf(text, sizeof(text), "%lu us", nanoseconds / 1000);
+    }
+    return text;
+}
+
+static string format_hit_rate(uint64_t hits, uint64_t misses)
+{
+    if (hits + misses == 0) {
+        return "-";
+    }
+    return to_string(hits * 100 / (hits + misses)) + "%";
+}
+
+// Window of the overlay in the bottom right corner, over the other panes.
+// nullptr if the terminal is too small for it.
+WINDOW *create_perf_overlay()
+{
+    int height = PERF_SCOPES + 7;
+
+    if (LINES < height || COLS < OVERLAY_WIDTH) {
+        return nullptr;
+    }
+    return subwin(stdscr, height, OVERLAY_WIDTH, LINES - height,
+                  COLS - OVERLAY_WIDTH);
+}
+
+// Breakdown of the last frame
+void display_perf_overlay(WINDOW *window, FileManager *file_manager)
+{
+    const PerfFrame &frame = file_manager->perf.last;
+
+    if (window == nullptr) {
+        return;
+    }
+
+    werase(window);
+    box(window, ACS_VLINE, ACS_HLINE);
+    mvwprintw(window, 0, 2, " Last frame ");
+
+    mvwprintw(window, 1, 2, "%-14s %6s %14s", "scope", "calls", "time");
+    int y = 2;
+    for (int scope = 0; scope < PERF_SCOPES; scope++, y++) {
+        if (frame.scope_calls[scope] == 0) {
+            mvwprintw(window, y, 2, "%-14s %6s %14s", SCOPE_NAMES[scope], "",
+                      "-");
+            continue;
+        }
+        mvwprintw(window, y, 2, "%-14s %6u %14s", SCOPE_NAMES[scope],
+                  frame.scope_calls[scope],
+                  format_duration(frame.scope_ns[scope]).c_str());
+    }
+
+    mvwprintw(window, y++, 2, "%s after the last, terminal %s",
+              format_duration(frame.frame_ns).c_str(),
+              format_bytes(file_manager->screen.frame_bytes).c_str());
+    mvwprintw(window, y++, 2, "opens %lu, stats %lu", frame.counts[PERF_OPENS],
+              frame.counts[PERF_STATS]);
+    mvwprintw(window, y++, 2, "heap %s (%c%s)",
+              format_bytes(frame.heap_bytes).c_str(),
+              frame.heap_change < 0 ? '-' : '+',
+              format_bytes(llabs(frame.heap_change)).c_str());
+    mvwprintw(window, y, 2, "cache hits: folders %s, previews %s",
+              format_hit_rate(frame.folder_hits, frame.folder_misses).c_str(),
+              format_hit_rate(frame.preview_hits, frame.preview_misses)
+                  .c_str());
+
+    wnoutrefresh(window);
+}
@@ -0,0 +1,350 @@
+#include <fcntl.h>
+#include <cstring>
+#include "file_manager.hpp"
+
+static const int DEFAULT_SEARCH_DEPTH = 32;
+static const unsigned MAX_SEARCH_WALKERS = 8;
+
+// Depth limit from FILE_MANAGER_SEARCH_DEPTH, .gitignore is honoured until
+// toggled off from the search bar
+void setup_recursive_search(FileManager *file_manager)
+{
+    file_manager->recursive_search = false;
+    file_manager->search_contents = false;
+    file_manager->search_git_ignore = true;
+    file_manager->search_depth = DEFAULT_SEARCH_DEPTH;
+
+    if (const char *env_depth = getenv("FILE_MANAGER_SEARCH_DEPTH")) {
+        char *end;
+        long depth = strtol(env_depth, &end, 10);
+        if (end != env_depth && *end == '\0' && depth >= 0) {
+            file_manager->search_depth = depth;
+        }
+    }
+}
+
+// One folder more for an idle walker, or all of them when the walk is over
+static void wake_walkers(RecursiveSearch *search, bool all)
+{
+    {
+        lock_guard<mutex> guard(search->idle_lock);
+        search->queued++;
+    }
+    if (all) {
+        search->idle_wake.notify_all();
+    } else {
+        search->idle_wake.notify_one();
+    }
+}
+
+static void queue_search_folder(RecursiveSearch *search, size_t walker,
+                                SearchFolder folder)
+{
+    SearchQueue &queue = *search->queues[walker];
+
+    search->pending_folders++;
+    {
+        lock_guard<mutex> guard(queue.lock);
+        queue.folders.push_back(move(folder));
+    }
+    wake_walkers(search, false);
+}
+
+// Own queue from the back (depth first, the parent's inodes are still warm),
+// other walkers' queues from the front where the bigger subtrees are
+static bool take_search_folder(RecursiveSearch *search, size_t walker,
+                               SearchFolder *folder)
+{
+    size_t walkers = search->queues.size();
+
+    for (size_t i = 0; i < walkers; i++) {
+        SearchQueue &queue = *search->queues[(walker + i) % walkers];
+        lock_guard<mutex> guard(queue.lock);
+        if (queue.folders.empty()) {
+            continue;
+        }
+        if (i == 0) {
+            *folder = move(queue.folders.back());
+            queue.folders.pop_back();
+        } else {
+            *folder = move(queue.folders.front());
+            queue.folders.pop_front();
+        }
+        return true;
+    }
+    return false;
+}
+
+// Content search of one entry of a folder, a row per matching line. Only
+// regular files are read, symlinks aren't followed like for folders.
+static void search_folder_file(RecursiveSearch *search, DIR *dir,
+                               const struct dirent *entry,
+                               const string &relative_path, EntryTable *matches,
+                               ContentMatches *content_matches)
+{
+    if (entry->d_type != DT_REG && entry->d_type != DT_UNKNOWN) {
+        return;
+    }
+
+    struct stat file_stat;
+    uint8_t type;
+    uint8_t entry_flags;
+    if (!stat_folder_entry(dirfd(dir), entry->d_name, entry->d_type,
+                           &file_stat, &type, &entry_flags) ||
+        type != ENTRY_REGULAR || (entry_flags & ENTRY_SYMLINK) ||
+        !(entry_flags & ENTRY_READABLE)) {
+        return;
+    }
+
+    size_t found = search_file_contents(dirfd(dir), entry->d_name,
+                                        search->needle, search->cancelled,
+                                        content_matches);
+    for (size_t i = 0; i < found; i++) {
+        matches->add_entry(relative_path, file_stat, type, entry_flags);
+    }
+}
+
+static void walk_search_folder(RecursiveSearch *search, size_t walker,
+                               const SearchFolder &folder)
+{
+    PerfScope perf_scope(PERF_SEARCH, folder.folder);
+    string folder_path = search->root;
+    if (folder_path.back() != '/') {
+        folder_path += '/';
+    }
+    folder_path += folder.folder;
+
+    DIR *dir = opendir(folder_path.c_str());
+    perf_count(PERF_OPENS);
+    if (dir == nullptr) {
+        return;
+    }
+
+    // the rules of the starting folder are loaded by start_recursive_search
+    shared_ptr<const GitIgnore> git_ignore = folder.git_ignore;
+    string ignore_file = folder_path + ".gitignore";
+    if (git_ignore && folder.depth > 0 &&
+        access(ignore_file.c_str(), F_OK) == 0) {
+        auto folder_rules = make_shared<GitIgnore>(*git_ignore);
+        folder_rules->load(ignore_file, search->repo_prefix + folder.folder);
+        git_ignore = folder_rules;
+    }
+
+    EntryTable matches;
+    ContentMatches content_matches;
+    while (const struct dirent *entry = readdir(dir)) {
+        if (search->cancelled) {
+            break;
+        }
+
+        const char *name = entry->d_name;
+        if (name[0] == '.' &&
+            (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+            continue;
+        }
+        if (!search->hidden_files && name[0] == '.') {
+            continue;
+        }
+
+        // symlinks to folders aren't followed, no loops to worry about
+        bool is_folder = entry->d_type == DT_DIR;
+        if (entry->d_type == DT_UNKNOWN) {
+            struct stat file_stat;
+            perf_count(PERF_STATS);
+            is_folder = fstatat(dirfd(dir), name, &file_stat,
+                                AT_SYMLINK_NOFOLLOW) == 0 &&
+                        S_ISDIR(file_stat.st_mode);
+        }
+        if (is_folder && strcmp(name, ".git") == 0) {
+            continue;
+        }
+
+        string relative_path = folder.folder + name;
+        if (git_ignore &&
+            git_ignore->matches(search->repo_prefix + relative_path,
+                                is_folder)) {
+            continue;
+        }
+
+        if (is_folder && folder.depth < search->max_depth) {
+            queue_search_folder(search, walker,
+                                {relative_path + '/', folder.depth + 1,
+                                 git_ignore});
+        }
+
+        if (search->contents) {
+            search_folder_file(search, dir, entry, relative_path, &matches,
+                               &content_matches);
+            continue;
+        }
+        if (!match_search(name, search->needle, nullptr)) {
+            continue;
+        }
+        struct stat file_stat;
+        uint8_t type;
+        uint8_t entry_flags;
+        if (stat_folder_entry(dirfd(dir), name, entry->d_type, &file_stat,
+                              &type, &entry_flags)) {
+            matches.add_entry(relative_path, file_stat, type, entry_flags);
+        }
+    }
+    closedir(dir);
+
+    search->walked_folders++;
+    if (matches.size() != 0) {
+        lock_guard<mutex> guard(search->chunk_lock);
+        search->chunk.append(matches);
+        search->content_chunk.append(content_matches);
+    }
+}
+
+// Runs detached, the last walker out marks the search finished
+static void search_walker(shared_ptr<RecursiveSearch> search, size_t walker)
+{
+    name_perf_thread("search walker");
+    SearchFolder folder;
+
+    while (!search->cancelled) {
+        // read before looking so a folder queued meanwhile isn't slept over
+        uint64_t queued;
+        {
+            lock_guard<mutex> guard(search->idle_lock);
+            queued = search->queued;
+        }
+        if (take_search_folder(search.get(), walker, &folder)) {
+            walk_search_folder(search.get(), walker, folder);
+            if (--search->pending_folders == 0) {
+                wake_walkers(search.get(), true);
+            }
+            continue;
+        }
+        // folders being walked can still queue more
+        if (search->pending_folders == 0) {
+            break;
+        }
+        unique_lock<mutex> guard(search->idle_lock);
+        search->idle_wake.wait(guard, [&search, queued] {
+            return search->queued != queued || search->pending_folders == 0 ||
+                   search->cancelled;
+        });
+    }
+
+    if (--search->running_walkers == 0) {
+        search->finished = true;
+        wake_event_loop();
+    }
+}
+
+void cancel_recursive_search(FileManager *file_manager)
+{
+    if (file_manager->recursive_walk) {
+        file_manager->recursive_walk->cancelled = true;
+        wake_walkers(file_manager->recursive_walk.get(), true);
+        file_manager->recursive_walk.reset();
+    }
+}
+
+// Leaves the results mode, the cwd gets listed again
+void stop_recursive_search(FileManager *file_manager)
+{
+    cancel_recursive_search(file_manager);
+    if (file_manager->recursive_search) {
+        file_manager->recursive_search = false;
+        file_manager->search_contents = false;
+        file_manager->content_matches.clear();
+        file_manager->directory_change = true;
+    }
+}
+
+// (Re)starts the search of the subfolders of the cwd for current_search (in
+// the names, or the contents with search_contents), the results replace the
+// files list as they come in
+void start_recursive_search(FileManager *file_manager)
+{
+    cancel_recursive_search(file_manager);
+
+    file_manager->recursive_search = true;
+    file_manager->file_position = 0;
+    file_manager->files.rows.clear();
+    file_manager->files.table = make_shared<EntryTable>();
+    file_manager->files.table->folder = file_manager->cwd;
+    file_manager->content_matches.clear();
+
+    if (file_manager->current_search.empty()) {
+        return;
+    }
+
+    auto search = make_shared<RecursiveSearch>();
+    search->root = file_manager->cwd;
+    search->needle = file_manager->current_search;
+    search->hidden_files = file_manager->hidden_files;
+    search->contents = file_manager->search_contents;
+    search->max_depth = file_manager->search_depth;
+
+    SearchFolder root_folder;
+    const GitRepo *repo = find_git_repo(file_manager, file_manager->cwd);
+    if (repo != nullptr && file_manager->search_git_ignore) {
+        if (file_manager->cwd.size() > repo->root.size()) {
+            search->repo_prefix =
+                file_manager->cwd.substr(repo->root.size() + 1) + "/";
+        }
+        auto git_ignore = make_shared<GitIgnore>();
+        git_ignore->load_for_folder(repo->root, repo->common_dir,
+                                    search->repo_prefix);
+        root_folder.git_ignore = git_ignore;
+    }
+
+    size_t walkers = clamp(thread::hardware_concurrency(), 2u,
+                           MAX_SEARCH_WALKERS);
+    for (size_t i = 0; i < walkers; i++) {
+        search->queues.push_back(make_unique<SearchQueue>());
+    }
+    queue_search_folder(search.get(), 0, root_folder);
+
+    file_manager->recursive_walk = search;
+    search->running_walkers = walkers;
+    for (size_t i = 0; i < walkers; i++) {
+        thread(search_walker, search, i).detach();
+    }
+}
+
+// Moves the matches found since the last call into the files list, returns
+// true if the list changed
+bool poll_recursive_search(FileManager *file_manager)
+{
+    shared_ptr<RecursiveSearch> search = file_manager->recursive_walk;
+
+    if (!search) {
+        return false;
+    }
+
+    bool finished = search->finished;
+    EntryTable chunk;
+    ContentMatches content_chunk;
+    {
+        lock_guard<mutex> guard(search->chunk_lock);
+        swap(chunk, search->chunk);
+        swap(content_chunk, search->content_chunk);
+    }
+
+    if (chunk.size() == 0 && !finished) {
+        return false;
+    }
+
+    auto &files = file_manager->files;
+    EntryTable *table = files.table.get();
+    size_t middle = files.size();
+
+    for (uint32_t row = table->size(); row < table->size() + chunk.size();
+         row++) {
+        files.rows.push_back(row);
+    }
+    table->append(chunk);
+    file_manager->content_matches.append(content_chunk);
+    merge_sorted_files(file_manager, &files, middle);
+
+    if (finished) {
+        file_manager->recursive_walk.reset();
+    }
+    return true;
+}
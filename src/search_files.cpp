@@ -1,17 +1,154 @@
+#include <numeric>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "file_manager.hpp"
 
-vector<fs::directory_entry> search_files(
-    const vector<fs::directory_entry> &files, const string &needle)
+// Searches are fuzzy (the characters of the needle appear in the name in the
+// same order, not necessarily next to each other) and smart case (case
+// sensitive only if the needle has an upper case letter).
+
+bool is_case_sensitive(const string &needle)
+{
+    return any_of(needle.begin(), needle.end(), [](unsigned char character) {
+        return isupper(character);
+    });
+}
+
+// Position of the first byte of text from `from` onwards equal to character,
+// with fold_case the case bit is ignored (character has to be a lower case
+// letter then). 16 bytes at a time with SSE2.
+size_t find_character(string_view text, size_t from, unsigned char character,
+                      bool fold_case)
+{
+    unsigned char case_bit = fold_case ? 0x20 : 0;
+    size_t i = from;
+
+#ifdef __SSE2__
+    const __m128i wanted = _mm_set1_epi8(character);
+    const __m128i case_bits = _mm_set1_epi8(case_bit);
+    for (; i + 16 <= text.size(); i += 16) {
+        __m128i chunk = _mm_loadu_si128(
+            reinterpret_cast<const __m128i *>(text.data() + i));
+        int found = _mm_movemask_epi8(
+            _mm_cmpeq_epi8(_mm_or_si128(chunk, case_bits), wanted));
+        if (found != 0) {
+            return i + __builtin_ctz(found);
+        }
+    }
+#endif
+    for (; i < text.size(); i++) {
+        if ((static_cast<unsigned char>(text[i]) | case_bit) == character) {
+            return i;
+        }
+    }
+    return string_view::npos;
+}
+
+// Leftmost match of needle in name, positions gets the index of each
+// matched character when not null
+static bool fuzzy_match(string_view name, const string &needle,
+                        bool case_sensitive, vector<size_t> *positions)
 {
-    vector<fs::directory_entry> searched_files;
+    size_t position = 0;
 
-    for (const auto &entry : files) {
-        if (FILE_NAME(entry).find(needle) != string::npos) {
-            searched_files.push_back(entry);
+    if (positions != nullptr) {
+        positions->clear();
+    }
+    if (needle.size() > name.size()) {
+        return false;
+    }
+
+    for (unsigned char character : needle) {
+        bool fold_case = !case_sensitive && isalpha(character);
+        position = find_character(name, position,
+                                  fold_case ? tolower(character) : character,
+                                  fold_case);
+        if (position == string_view::npos) {
+            return false;
         }
+        if (positions != nullptr) {
+            positions->push_back(position);
+        }
+        position++;
+    }
+    return true;
+}
+
+bool match_search(string_view name, const string &needle,
+                  vector<size_t> *positions)
+{
+    return fuzzy_match(name, needle, is_case_sensitive(needle), positions);
+}
+
+// Drops the rows from `from` onwards whose name doesn't match needle
+void search_files(FileList *files, size_t from, const string &needle)
+{
+    PerfScope perf_scope(PERF_SEARCH, needle);
+    const EntryTable &table = *files->table;
+    auto &rows = files->rows;
+    bool case_sensitive = is_case_sensitive(needle);
+
+    rows.erase(remove_if(rows.begin() + from, rows.end(),
+                         [&table, &needle, case_sensitive](uint32_t row) {
+                             return !fuzzy_match(table.name(row), needle,
+                                                 case_sensitive, nullptr);
+                         }),
+               rows.end());
+}
+
+// Filters the files list on the current search without going back to the
+// folder, a longer needle only narrows the results of the shorter one
+void update_search(FileManager *file_manager)
+{
+    SearchState &search = file_manager->search;
+    FileList &files = file_manager->files;
+    const string &needle = file_manager->current_search;
+
+    if (!files.table) {
+        return;
+    }
+
+    if (search.table != files.table ||
+        search.table_version != files.table->version ||
+        search.sort_type != file_manager->sort_type ||
+        search.hidden_files != file_manager->hidden_files) {
+        search = SearchState();
+        search.table = files.table;
+        search.table_version = files.table->version;
+        search.sort_type = file_manager->sort_type;
+        search.hidden_files = file_manager->hidden_files;
+
+        FileList all_files;
+        all_files.table = files.table;
+        all_files.rows.resize(files.table->size());
+        iota(all_files.rows.begin(), all_files.rows.end(), 0);
+        filter_files(file_manager, &all_files, 0, false);
+        sort_files(file_manager, &all_files);
+        search.steps.push_back({"", move(all_files.rows)});
+    }
+
+    // back to the last step the needle still starts with
+    while (search.steps.size() > 1 &&
+           needle.compare(0, search.steps.back().needle.size(),
+                          search.steps.back().needle) != 0) {
+        search.steps.pop_back();
+    }
+
+    if (search.steps.back().needle != needle) {
+        FileList matches;
+        matches.table = files.table;
+        matches.rows = search.steps.back().rows;
+        search_files(&matches, 0, needle);
+        search.steps.push_back({needle, move(matches.rows)});
     }
 
-    return searched_files;
+    string selected_name;
+    if (!files.empty()) {
+        selected_name = files[file_manager->file_position].name();
+    }
+    files.rows = search.steps.back().rows;
+    select_file(file_manager, selected_name);
 }
 
 void display_search(WINDOW *window, FileManager *file_manager)
@@ -24,7 +161,13 @@ void display_search(WINDOW *window, FileManager *file_manager)
 
     box(window, ACS_VLINE, ACS_HLINE);
 
-    mvwprintw(window, 1, 1, "%s", file_manager->current_search.c_str());
+    wmove(window, 1, 1);
+    if (file_manager->recursive_search) {
+        wprintw(window, "[%s%s] ",
+                file_manager->search_contents ? "contents" : "subfolders",
+                file_manager->search_git_ignore ? ", .gitignore" : "");
+    }
+    wprintw(window, "%s", file_manager->current_search.c_str());
 
     if (file_manager->in_search) {
         wprintw(window, "_");
@@ -32,30 +175,50 @@ void display_search(WINDOW *window, FileManager *file_manager)
         wprintw(window, " ");
     }
 
-    wrefresh(window);
+    // the shell's jobs go on in the background
+    if (size_t running = running_jobs(file_manager)) {
+        mvwprintw(window, 0, 2, " %ld job%s running, j to see ", running,
+                  running == 1 ? "" : "s");
+    }
+
+    wnoutrefresh(window);
 }
 
-int handle_search_input(FileManager *file_manager)
+int handle_search_input(FileManager *file_manager, int input)
 {
     if (!file_manager->in_search) {
         return 0;
     }
 
-    int input = getch();
-
     if (input == 27) {
         file_manager->in_search = false;
         return 0;
     }
 
+    // honour .gitignore files or not in recursive searches
+    if (input == CTRL('g')) {
+        file_manager->search_git_ignore = !file_manager->search_git_ignore;
+        if (file_manager->recursive_search) {
+            start_recursive_search(file_manager);
+        }
+        return 0;
+    }
+
+    bool changed = false;
+
     if (input == 263 && !file_manager->current_search.empty()) {
         file_manager->current_search.pop_back();
-        return 1;
+        changed = true;
+    } else if (isascii(input) == 1 && input != 10) {
+        file_manager->current_search += input;
+        changed = true;
     }
 
-    if (isascii(input) == 1 && input != 10) {
-        file_manager->current_search += input;
-        return 1;
+    // a recursive search starts over, the walk of the old needle is dropped
+    if (changed && file_manager->recursive_search) {
+        start_recursive_search(file_manager);
+    } else if (changed) {
+        update_search(file_manager);
     }
 
     return 0;
@@ -1,116 +1,480 @@
+#include <clocale>
 #include <cstring>
-#include <functional>
 #include "file_manager.hpp"
 
 namespace fs = filesystem;
 
-static auto get_comparable_key(const fs::directory_entry& entry)
+static const size_t DEFAULT_PARALLEL_SORT_THRESHOLD = 50000;
+static const unsigned MAX_SORT_THREADS = 8;
+// below this a sort part isn't worth its own thread
+static const size_t MIN_SORT_PART_SIZE = 16384;
+
+// Keys are pulled out of the table once before sorting (instead of on every
+// comparison), the sort then only moves keys around and the rows are read
+// back from them at the end.
+
+// Size and time sorts, the whole key fits in an integer so it's radix sorted
+class NumericKey {
+  public:
+    uint64_t key;
+    uint32_t row;
+};
+
+// Name sorts, the first 16 bytes of the sort key decide most comparisons
+// without going to the names arena
+class NameKey {
+  public:
+    uint64_t prefix[2];
+    uint32_t row;
+    bool not_directory;  // show directories before files
+};
+
+// strcasecmp for names that aren't null terminated
+static int compare_names_case_insensitive(string_view name_a, string_view name_b)
+{
+    size_t length = min(name_a.size(), name_b.size());
+
+    for (size_t i = 0; i < length; i++) {
+        int char_a = tolower(static_cast<unsigned char>(name_a[i]));
+        int char_b = tolower(static_cast<unsigned char>(name_b[i]));
+        if (char_a != char_b) {
+            return char_a - char_b;
+        }
+    }
+    return static_cast<int>(name_a.size() > name_b.size()) -
+           static_cast<int>(name_a.size() < name_b.size());
+}
+
+// Version order key, a run of digits becomes '0', its length and the digits
+// without leading zeros so comparing keys compares numbers by value
+// ("file2" < "file10"). Letters are folded to lower case.
+static void append_natural_key(string_view name, string *key)
 {
-    return make_tuple(!entry.is_directory(),  // show directories before files
-                      entry.path().filename().string());
+    for (size_t i = 0; i < name.size();) {
+        unsigned char character = name[i];
+        if (!isdigit(character)) {
+            key->push_back(tolower(character));
+            i++;
+            continue;
+        }
+        while (i < name.size() && name[i] == '0') {
+            i++;
+        }
+        size_t digits_end = i;
+        while (digits_end < name.size() &&
+               isdigit(static_cast<unsigned char>(name[digits_end]))) {
+            digits_end++;
+        }
+        // names are at most 255 bytes, so is a run of digits
+        key->push_back('0');
+        key->push_back(static_cast<char>(digits_end - i));
+        key->append(name.substr(i, digits_end - i));
+        i = digits_end;
+    }
 }
 
-// Alphabetical sorting functions
-static bool alphabetical_increasing_sort(const fs::directory_entry& entry_a,
-                                         const fs::directory_entry& entry_b)
+// strxfrm() key for the locale sorts
+static void append_collation_key(string_view name, string *key)
 {
-    const auto key_a = get_comparable_key(entry_a);
-    const auto key_b = get_comparable_key(entry_b);
+    string terminated_name(name);
+    size_t key_start = key->size();
 
-    if (get<0>(key_a) != get<0>(key_b)) {
-        return static_cast<int>(get<0>(key_a)) <
-               static_cast<int>(get<0>(key_b));
+    key->resize(key_start + name.size() * 4 + 1);
+    size_t key_size = strxfrm(&(*key)[key_start], terminated_name.c_str(),
+                              key->size() - key_start);
+    if (key_size >= key->size() - key_start) {
+        key->resize(key_start + key_size + 1);
+        strxfrm(&(*key)[key_start], terminated_name.c_str(), key_size + 1);
     }
-    return strcasecmp(get<1>(key_a).c_str(), get<1>(key_b).c_str()) < 0;
+    key->resize(key_start + key_size);
 }
 
-static bool alphabetical_decreasing_sort(const fs::directory_entry& entry_a,
-                                         const fs::directory_entry& entry_b)
+// First 16 bytes of a sort key as big endian integers, comparing two
+// prefixes gives the same answer as comparing the keys as far as they go
+static void get_key_prefix(string_view key, bool fold_case, uint64_t *prefix)
 {
-    return !alphabetical_increasing_sort(entry_a, entry_b);
+    for (size_t word = 0; word < 2; word++) {
+        prefix[word] = 0;
+        for (size_t i = word * 8; i < word * 8 + 8; i++) {
+            unsigned char character = i < key.size() ? key[i] : 0;
+            if (fold_case) {
+                character = tolower(character);
+            }
+            prefix[word] = prefix[word] << 8 | character;
+        }
+    }
 }
 
-// Case-sensitive versions
-static bool alphabetical_increasing_case_sort(
-    const fs::directory_entry& entry_a, const fs::directory_entry& entry_b)
+// Natural and locale sort keys of the names of a table, kept between sorts
+// since they are the slow part of those sorts. A streamed folder only
+// appends rows so its keys get extended chunk by chunk instead of redone.
+class SortKeys {
+  public:
+    weak_ptr<EntryTable> table;
+    uint64_t names_version = 0;
+    bool natural = false;
+    vector<uint32_t> offsets{0};  // key of row i is [offsets[i], offsets[i+1])
+    string keys;
+
+    string_view key(uint32_t row) const
+    {
+        return string_view(keys.data() + offsets[row],
+                           offsets[row + 1] - offsets[row]);
+    }
+};
+
+static const SortKeys &get_sort_keys(const shared_ptr<EntryTable> &table,
+                                     bool natural)
 {
-    const auto key_a = get_comparable_key(entry_a);
-    const auto key_b = get_comparable_key(entry_b);
+    static SortKeys sort_keys;
 
-    if (get<0>(key_a) != get<0>(key_b)) {
-        return static_cast<int>(get<0>(key_a)) <
-               static_cast<int>(get<0>(key_b));
+    if (sort_keys.table.lock() != table ||
+        sort_keys.names_version != table->names_version ||
+        sort_keys.natural != natural ||
+        sort_keys.offsets.size() > table->size() + 1) {
+        sort_keys = SortKeys();
+        sort_keys.table = table;
+        sort_keys.names_version = table->names_version;
+        sort_keys.natural = natural;
     }
-    return get<1>(key_a) < get<1>(key_b);
+
+    for (uint32_t row = sort_keys.offsets.size() - 1; row < table->size();
+         row++) {
+        if (natural) {
+            append_natural_key(table->name(row), &sort_keys.keys);
+        } else {
+            append_collation_key(table->name(row), &sort_keys.keys);
+        }
+        sort_keys.offsets.push_back(sort_keys.keys.size());
+    }
+    return sort_keys;
 }
 
-static bool alphabetical_decreasing_case_sort(
-    const fs::directory_entry& entry_a, const fs::directory_entry& entry_b)
+// LSD radix sort on the 64 bit keys, 8 bits at a time. Passes where every key
+// has the same byte are skipped, which is most of them for sizes and times.
+// Stable, equal keys stay in their input order.
+static void radix_sort(NumericKey *keys, size_t count)
 {
-    return !alphabetical_increasing_case_sort(entry_a, entry_b);
+    static const int PASSES = sizeof(uint64_t);
+    vector<array<size_t, 256>> histograms(PASSES);
+
+    for (size_t i = 0; i < count; i++) {
+        for (int pass = 0; pass < PASSES; pass++) {
+            histograms[pass][(keys[i].key >> (pass * 8)) & 0xFF]++;
+        }
+    }
+
+    vector<NumericKey> buffer(count);
+    NumericKey *source = keys;
+    NumericKey *destination = buffer.data();
+
+    for (int pass = 0; pass < PASSES && count > 0; pass++) {
+        auto &histogram = histograms[pass];
+        if (histogram[(source[0].key >> (pass * 8)) & 0xFF] == count) {
+            continue;
+        }
+        size_t offset = 0;
+        for (size_t &bucket : histogram) {
+            size_t bucket_size = bucket;
+            bucket = offset;
+            offset += bucket_size;
+        }
+        for (size_t i = 0; i < count; i++) {
+            destination[histogram[(source[i].key >> (pass * 8)) & 0xFF]++] =
+                source[i];
+        }
+        swap(source, destination);
+    }
+
+    if (source != keys) {
+        copy(source, source + count, keys);
+    }
 }
 
-// File size sorting
-static auto get_size_comparable_key(const fs::directory_entry& entry)
+// Merge sort over threads, each part is sorted on its own thread then the
+// parts are merged pairwise (also in parallel) until one is left
+template <typename Key, typename Compare>
+static void parallel_sort(Key *keys, size_t count, Compare compare,
+                          size_t threshold)
 {
-    return make_tuple(!entry.is_regular_file(),  // Directories first
-                      entry.is_regular_file()
-                          ? entry.file_size()
-                          : count_files_in_folder(entry.path()));
+    size_t threads = min(thread::hardware_concurrency(), MAX_SORT_THREADS);
+    size_t parts = 1;
+
+    while (parts * 2 <= threads && count / (parts * 2) >= MIN_SORT_PART_SIZE) {
+        parts *= 2;
+    }
+    if (count < threshold || parts == 1) {
+        sort(keys, keys + count, compare);
+        return;
+    }
+
+    vector<size_t> bounds(parts + 1);
+    for (size_t i = 0; i <= parts; i++) {
+        bounds[i] = count * i / parts;
+    }
+
+    vector<thread> workers;
+    for (size_t i = 0; i < parts; i++) {
+        workers.emplace_back([keys, &bounds, &compare, i] {
+            sort(keys + bounds[i], keys + bounds[i + 1], compare);
+        });
+    }
+    for (thread &worker : workers) {
+        worker.join();
+    }
+
+    vector<Key> buffer(count);
+    Key *source = keys;
+    Key *destination = buffer.data();
+
+    for (size_t width = 1; width < parts; width *= 2) {
+        workers.clear();
+        for (size_t i = 0; i < parts; i += width * 2) {
+            size_t low = bounds[i];
+            size_t middle = bounds[i + width];
+            size_t high = bounds[i + width * 2];
+            workers.emplace_back([=, &compare] {
+                merge(source + low, source + middle, source + middle,
+                      source + high, destination + low, compare);
+            });
+        }
+        for (thread &worker : workers) {
+            worker.join();
+        }
+        swap(source, destination);
+    }
+
+    if (source != keys) {
+        copy(source, source + count, keys);
+    }
 }
 
-static bool file_size_increasing_sort(const fs::directory_entry& entry_a,
-                                      const fs::directory_entry& entry_b)
+// File size sorting, folders are ranked by their number of entries. Counts
+// that aren't known yet are asked for and false returned, the list is sorted
+// again once they come in.
+static bool get_size_key(const FileEntry &entry, ChildCounts *child_counts,
+                         uint64_t *key)
 {
-    return get_size_comparable_key(entry_a) < get_size_comparable_key(entry_b);
+    size_t count = 0;
+
+    if (entry.is_regular_file()) {
+        *key = min<uint64_t>(entry.file_size(), INT64_MAX);
+        return true;
+    }
+    if (!find_child_count(child_counts, entry.path(), entry.last_write_time(),
+                          &count)) {
+        return false;
+    }
+    *key = min<uint64_t>(count, INT64_MAX);
+    return true;
+}
+
+// Bytes on disk: under folders (what's known so far while they're measured)
+// and of anything else. Symlinks aren't followed and count for nothing.
+static uint64_t get_tree_size_key(const FileEntry &entry,
+                                  DiskUsage *disk_usage)
+{
+    uint64_t size = entry.allocated_size();
+    bool complete;
+
+    if (entry.is_symlink()) {
+        size = 0;
+    } else if (entry.is_directory() &&
+               !find_tree_size(disk_usage, entry.path(),
+                               entry.last_write_time(), &size, &complete)) {
+        size = 0;
+    }
+    return min<uint64_t>(size, INT64_MAX);
+}
+
+// Modification times are offset to be unsigned, 2^62 ns either side of 1970
+// is more than a century
+static uint64_t get_time_key(const FileEntry &entry)
+{
+    const int64_t limit = INT64_C(1) << 62;
+
+    return clamp(entry.last_write_time(), -limit, limit - 1) + limit;
 }
 
-static bool file_size_decreasing_sort(const fs::directory_entry& entry_a,
-                                      const fs::directory_entry& entry_b)
+static void sort_numeric_rows(FileList *files, size_t middle, int sort_type,
+                              ChildCounts *child_counts,
+                              DiskUsage *disk_usage)
 {
-    return get_size_comparable_key(entry_a) > get_size_comparable_key(entry_b);
+    bool by_size =
+        sort_type == FILE_SIZE_INCREASING || sort_type == FILE_SIZE_DECREASING;
+    bool by_tree_size = is_tree_size_sort(sort_type);
+    bool decreasing = sort_type == FILE_SIZE_DECREASING ||
+                      sort_type == LAST_MODIFIED ||
+                      sort_type == TREE_SIZE_DECREASING;
+    vector<NumericKey> keys(files->size());
+
+    for (size_t i = 0; i < files->size(); i++) {
+        FileEntry entry = (*files)[i];
+        uint64_t key;
+        if (by_tree_size) {
+            key = get_tree_size_key(entry, disk_usage);
+        } else if (by_size && !get_size_key(entry, child_counts, &key)) {
+            // still being counted, last either way
+            keys[i] = {UINT64_MAX, entry.row};
+            continue;
+        } else {
+            // the top bit keeps regular files and the rest apart
+            key = static_cast<uint64_t>(!entry.is_regular_file()) << 63 |
+                  (by_size ? key : get_time_key(entry));
+        }
+        keys[i] = {decreasing ? ~key : key, entry.row};
+    }
+
+    radix_sort(keys.data() + middle, keys.size() - middle);
+    inplace_merge(keys.begin(), keys.begin() + middle, keys.end(),
+                  [](const NumericKey &key_a, const NumericKey &key_b) {
+                      return key_a.key < key_b.key;
+                  });
+
+    for (size_t i = 0; i < keys.size(); i++) {
+        files->rows[i] = keys[i].row;
+    }
 }
 
-// Modification time sorting
-static auto get_time_comparable_key(const fs::directory_entry& entry)
+static void sort_name_rows(FileList *files, size_t middle, int sort_type,
+                           size_t parallel_threshold)
 {
-    return make_tuple(!entry.is_regular_file(),  // Directories first
-                      entry.last_write_time());
+    const EntryTable *table = files->table.get();
+    bool by_key = sort_type >= NATURAL_INCREASING;
+    bool fold_case = sort_type == ALPHABETICAL_INCREASING ||
+                     sort_type == ALPHABETICAL_DECREASING;
+    bool decreasing = sort_type == ALPHABETICAL_DECREASING ||
+                      sort_type == ALPHABETICAL_DECREASING_CASE_SENSITIVE ||
+                      sort_type == NATURAL_DECREASING ||
+                      sort_type == LOCALE_DECREASING;
+    const SortKeys *sort_keys =
+        by_key ? &get_sort_keys(files->table, sort_type <= NATURAL_DECREASING)
+               : nullptr;
+    vector<NameKey> keys(files->size());
+
+    for (size_t i = 0; i < files->size(); i++) {
+        FileEntry entry = (*files)[i];
+        keys[i].row = entry.row;
+        keys[i].not_directory = !entry.is_directory();
+        get_key_prefix(by_key ? sort_keys->key(entry.row) : entry.name(),
+                       fold_case, keys[i].prefix);
+    }
+
+    // past the prefixes, names that have the same key (only differ by case
+    // or leading zeros) are ordered by name so the result doesn't depend on
+    // the input order
+    auto compare_rows = [table, sort_keys, fold_case](uint32_t row_a,
+                                                       uint32_t row_b) {
+        string_view name_a = table->name(row_a);
+        string_view name_b = table->name(row_b);
+        if (sort_keys != nullptr) {
+            if (int difference =
+                    sort_keys->key(row_a).compare(sort_keys->key(row_b))) {
+                return difference;
+            }
+            if (int difference =
+                    compare_names_case_insensitive(name_a, name_b)) {
+                return difference;
+            }
+        } else if (fold_case) {
+            return compare_names_case_insensitive(name_a, name_b);
+        }
+        return name_a.compare(name_b);
+    };
+
+    auto increasing = [compare_rows](const NameKey &key_a,
+                                     const NameKey &key_b) {
+        if (key_a.not_directory != key_b.not_directory) {
+            return key_a.not_directory < key_b.not_directory;
+        }
+        if (key_a.prefix[0] != key_b.prefix[0]) {
+            return key_a.prefix[0] < key_b.prefix[0];
+        }
+        if (key_a.prefix[1] != key_b.prefix[1]) {
+            return key_a.prefix[1] < key_b.prefix[1];
+        }
+        if (int difference = compare_rows(key_a.row, key_b.row)) {
+            return difference < 0;
+        }
+        // same name, content search results of a file stay in line order
+        return key_a.row < key_b.row;
+    };
+
+    auto sort_and_merge = [&keys, middle, parallel_threshold](auto compare) {
+        parallel_sort(keys.data() + middle, keys.size() - middle, compare,
+                      parallel_threshold);
+        inplace_merge(keys.begin(), keys.begin() + middle, keys.end(),
+                      compare);
+    };
+
+    // decreasing sorts are the increasing ones with the arguments swapped,
+    // directories included
+    if (decreasing) {
+        sort_and_merge([increasing](const NameKey &key_a,
+                                    const NameKey &key_b) {
+            return increasing(key_b, key_a);
+        });
+    } else {
+        sort_and_merge(increasing);
+    }
+
+    for (size_t i = 0; i < keys.size(); i++) {
+        files->rows[i] = keys[i].row;
+    }
 }
 
-static bool last_modified_sort(const fs::directory_entry& entry_a,
-                               const fs::directory_entry& entry_b)
+// Sorts the rows from middle onwards and merges them into the already sorted
+// front
+static void sort_rows(FileManager *file_manager, FileList *files,
+                      size_t middle)
 {
-    return get_time_comparable_key(entry_a) > get_time_comparable_key(entry_b);
+    int sort_type = file_manager->sort_type;
+
+    if (files->size() - middle == 0) {
+        return;
+    }
+
+    if ((sort_type >= FILE_SIZE_INCREASING && sort_type <= FIRST_MODIFIED) ||
+        is_tree_size_sort(sort_type)) {
+        sort_numeric_rows(files, middle, sort_type,
+                          file_manager->child_counts.get(),
+                          file_manager->disk_usage.get());
+    } else {
+        sort_name_rows(files, middle, sort_type,
+                       file_manager->parallel_sort_threshold);
+    }
 }
 
-static bool first_modified_sort(const fs::directory_entry& entry_a,
-                                const fs::directory_entry& entry_b)
+// Locale for the collation sorts and how long a list has to be before it's
+// sorted on several threads (FILE_MANAGER_SORT_THRESHOLD entries)
+void setup_sorting(FileManager *file_manager)
 {
-    return get_time_comparable_key(entry_a) < get_time_comparable_key(entry_b);
+    setlocale(LC_COLLATE, "");
+
+    file_manager->parallel_sort_threshold = DEFAULT_PARALLEL_SORT_THRESHOLD;
+    if (const char *env_threshold = getenv("FILE_MANAGER_SORT_THRESHOLD")) {
+        char *end;
+        unsigned long long threshold = strtoull(env_threshold, &end, 10);
+        if (end != env_threshold && *end == '\0') {
+            file_manager->parallel_sort_threshold = threshold;
+        }
+    }
 }
 
 // Main sorting function
-void sort_files(vector<fs::directory_entry>* files, int sort_type)
+void sort_files(FileManager *file_manager, FileList *files)
 {
-    static const unordered_map<int, function<bool(const fs::directory_entry&,
-                                                  const fs::directory_entry&)>>
-        sort_functions = {
-            {ALPHABETICAL_INCREASING, alphabetical_increasing_sort},
-            {ALPHABETICAL_DECREASING, alphabetical_decreasing_sort},
-            {ALPHABETICAL_INCREASING_CASE_SENSITIVE,
-             alphabetical_increasing_case_sort},
-            {ALPHABETICAL_DECREASING_CASE_SENSITIVE,
-             alphabetical_decreasing_case_sort},
-            {FILE_SIZE_INCREASING, file_size_increasing_sort},
-            {FILE_SIZE_DECREASING, file_size_decreasing_sort},
-            {LAST_MODIFIED, last_modified_sort},
-            {FIRST_MODIFIED, first_modified_sort}};
+    PerfScope perf_scope(PERF_SORT_FILES);
+    sort_rows(file_manager, files, 0);
+}
 
-    if (auto sort_func = sort_functions.find(sort_type);
-        sort_func != sort_functions.end()) {
-        sort(files->begin(), files->end(), sort_func->second);
-    }
+// Sorts the entries from middle onwards and merges them into the already
+// sorted front, used when a folder is streamed in by chunks
+void merge_sorted_files(FileManager *file_manager, FileList *files,
+                        size_t middle)
+{
+    PerfScope perf_scope(PERF_SORT_FILES);
+    sort_rows(file_manager, files, middle);
 }
 
 // Display sort information in the bottom right of the files list
@@ -124,7 +488,13 @@ void display_sort_info(WINDOW* window, int sort_type)
          {FILE_SIZE_INCREASING, {" small->big ", 13}},
          {FILE_SIZE_DECREASING, {" big->small ", 13}},
          {LAST_MODIFIED, {" new->old ", 11}},
-         {FIRST_MODIFIED, {" old->new ", 11}}};
+         {FIRST_MODIFIED, {" old->new ", 11}},
+         {NATURAL_INCREASING, {" 1->10 ", 8}},
+         {NATURAL_DECREASING, {" 10->1 ", 8}},
+         {LOCALE_INCREASING, {" locale a->z ", 14}},
+         {LOCALE_DECREASING, {" locale z->a ", 14}},
+         {TREE_SIZE_INCREASING, {" tree small->big ", 18}},
+         {TREE_SIZE_DECREASING, {" tree big->small ", 18}}};
 
     int width = getmaxx(window);
     int height = getmaxy(window);
@@ -0,0 +1,102 @@
+#ifndef CHECK_H_
+#define CHECK_H_
+
+#include <fcntl.h>
+#include <cstdlib>
+#include <cstring>
+#include "file_manager.hpp"
+
+// What the tests share. Each file tests a part of the core library and is an
+// executable of its own, run by ctest: a failed check is printed and the
+// exit status is 1 once they've all run.
+
+inline int failures = 0;
+
+#define CHECK(condition)                                                   \
+    do {                                                                   \
+        if (!(condition)) {                                                \
+            fprintf(stderr, "%s:%d: failed: %s\n", __FILE__, __LINE__,     \
+                    #condition);                                           \
+            failures++;                                                    \
+        }                                                                  \
+    } while (0)
+
+#define CHECK_EQUAL(left, right)                                           \
+    do {                                                                   \
+        auto left_value = (left);                                          \
+        auto right_value = (right);                                        \
+        if (!(left_value == right_value)) {                                \
+            fprintf(stderr, "%s:%d: failed: %s == %s\n", __FILE__,         \
+                    __LINE__, #left, #right);                              \
+            failures++;                                                    \
+        }                                                                  \
+    } while (0)
+
+// A folder of its own under TMPDIR, removed by finish_tests()
+inline string make_test_folder()
+{
+    const char *temp = getenv("TMPDIR");
+    string pattern = string(temp != nullptr ? temp : "/tmp") +
+                     "/file_manager_tests.XXXXXX";
+
+    if (mkdtemp(pattern.data()) == nullptr) {
+        perror("mkdtemp");
+        exit(1);
+    }
+    return pattern;
+}
+
+inline int finish_tests(const string &root)
+{
+    error_code error;
+
+    if (!root.empty()) {
+        fs::remove_all(root, error);
+    }
+    if (failures != 0) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
+
+inline void write_file(const string &path, const string &content)
+{
+    ofstream(path, ios::binary) << content;
+}
+
+inline string read_file(const string &path)
+{
+    ifstream file(path, ios::binary);
+
+    return string(istreambuf_iterator<char>(file),
+                  istreambuf_iterator<char>());
+}
+
+// command through sh, its output dropped
+inline bool run(const string &command)
+{
+    return system((command + " >/dev/null 2>&1").c_str()) == 0;
+}
+
+// Like the bench, without a screen
+inline void setup_file_manager(FileManager *file_manager, const string &cwd)
+{
+    file_manager->cwd = cwd;
+    file_manager->file_position = 0;
+    file_manager->directory_change = false;
+    file_manager->sort_type = ALPHABETICAL_INCREASING;
+    file_manager->hidden_files = false;
+    file_manager->preview = false;
+    file_manager->in_shell = false;
+    file_manager->in_search = false;
+    file_manager->recursive_search = false;
+    file_manager->search_contents = false;
+    file_manager->search_git_ignore = false;
+    file_manager->search_depth = 32;
+    file_manager->help_menu = false;
+    setup_folders_cache(file_manager);
+    setup_sorting(file_manager);
+}
+
+#endif /* CHECK_H_ */
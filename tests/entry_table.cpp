@@ -0,0 +1,134 @@
+#include "check.hpp"
+
+// entry_table.cpp: the rows of a listing, removing them and packing the
+// names left behind
+
+static void add_file(EntryTable *table, const string &name, uint64_t size)
+{
+    struct stat file_stat = {};
+    file_stat.st_mode = S_IFREG | 0644;
+    file_stat.st_size = size;
+    file_stat.st_ino = size + 1;
+    table->add_entry(name, file_stat, ENTRY_REGULAR, ENTRY_READABLE);
+}
+
+// every column still has a value per row and each name goes with its size
+static bool rows_match(const EntryTable &table)
+{
+    for (uint32_t row = 0; row < table.size(); row++) {
+        string name(table.name(row));
+        if (table.sizes[row] != name.size() * 10 ||
+            table.inodes[row] != table.sizes[row] + 1) {
+            return false;
+        }
+    }
+    return table.flags.size() == table.size() &&
+           table.modes.size() == table.size() &&
+           table.allocated.size() == table.size() &&
+           table.mtimes.size() == table.size() &&
+           table.name_offsets.size() == table.size() &&
+           table.name_sizes.size() == table.size();
+}
+
+static void test_remove_row()
+{
+    EntryTable table;
+    table.folder = "/tmp";
+    add_file(&table, "a", 10);
+    add_file(&table, "bbbbbbbbbb", 100);
+    add_file(&table, "cc", 20);
+    add_file(&table, "ddd", 30);
+    CHECK_EQUAL(table.path(1), "/tmp/bbbbbbbbbb");
+
+    uint64_t version = table.version;
+    uint64_t names_version = table.names_version;
+    size_t names_size = table.names.size();
+
+    // the last row takes the place of the removed one
+    table.remove_row(0);
+    CHECK_EQUAL(table.size(), 3u);
+    CHECK_EQUAL(table.name(0), "ddd");
+    CHECK_EQUAL(table.name(1), "bbbbbbbbbb");
+    CHECK_EQUAL(table.name(2), "cc");
+    CHECK(rows_match(table));
+    CHECK(table.version > version);
+    CHECK(table.names_version > names_version);
+
+    // not enough garbage yet to pack the names
+    CHECK_EQUAL(table.garbage_bytes, 1u);
+    CHECK_EQUAL(table.names.size(), names_size);
+
+    // removing the last row moves nothing
+    table.remove_row(2);
+    CHECK_EQUAL(table.size(), 2u);
+    CHECK_EQUAL(table.name(0), "ddd");
+    CHECK_EQUAL(table.name(1), "bbbbbbbbbb");
+    CHECK(rows_match(table));
+    CHECK_EQUAL(table.garbage_bytes, 3u);
+}
+
+static void test_compaction()
+{
+    EntryTable table;
+    table.folder = "/";
+    add_file(&table, "keep", 40);
+    add_file(&table, "long_name_to_drop", 170);
+    add_file(&table, "another_long_name", 170);
+    add_file(&table, "kept_too", 80);
+
+    // over half of the arena is garbage after the second removal
+    table.remove_row(1);
+    CHECK_EQUAL(table.garbage_bytes, 17u);
+    CHECK_EQUAL(table.name(1), "kept_too");
+    table.remove_row(2);
+    CHECK_EQUAL(table.garbage_bytes, 0u);
+    CHECK_EQUAL(table.names, "keepkept_too");
+    CHECK_EQUAL(table.size(), 2u);
+    CHECK_EQUAL(table.name(0), "keep");
+    CHECK_EQUAL(table.name(1), "kept_too");
+    CHECK_EQUAL(table.path(1), "/kept_too");
+    CHECK(rows_match(table));
+
+    // down to nothing
+    table.remove_row(0);
+    table.remove_row(0);
+    CHECK_EQUAL(table.size(), 0u);
+    CHECK(table.names.empty());
+    CHECK_EQUAL(table.garbage_bytes, 0u);
+
+    // the arena is usable again afterwards
+    add_file(&table, "new", 30);
+    CHECK_EQUAL(table.name(0), "new");
+    CHECK(rows_match(table));
+}
+
+static void test_append()
+{
+    EntryTable table;
+    EntryTable other;
+    table.folder = "/tmp";
+    add_file(&table, "aa", 20);
+    add_file(&table, "bbbbbbbbbb", 100);
+    table.remove_row(0);
+    add_file(&other, "ccc", 30);
+    add_file(&other, "d", 10);
+
+    // the offsets of the appended names are moved past the garbage too
+    uint64_t names_version = table.names_version;
+    table.append(other);
+    CHECK_EQUAL(table.size(), 3u);
+    CHECK_EQUAL(table.name(0), "bbbbbbbbbb");
+    CHECK_EQUAL(table.name(1), "ccc");
+    CHECK_EQUAL(table.name(2), "d");
+    CHECK_EQUAL(table.path(2), "/tmp/d");
+    CHECK(rows_match(table));
+    CHECK_EQUAL(table.names_version, names_version);
+}
+
+int main()
+{
+    test_remove_row();
+    test_compaction();
+    test_append();
+    return finish_tests("");
+}
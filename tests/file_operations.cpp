@@ -0,0 +1,147 @@
+#include <sys/stat.h>
+#include <unistd.h>
+#include "check.hpp"
+
+// file_operations.cpp: a tree copied, moved and deleted by the workers, as
+// the keys of the interface start them
+
+// Shows folder with the entry called name selected
+static void show_folder(FileManager *file_manager, const string &folder,
+                        const string &name)
+{
+    FileList &files = file_manager->files;
+
+    file_manager->cwd = folder;
+    files.table = get_files_in_folder(folder);
+    files.rows.clear();
+    for (uint32_t row = 0; row < files.table->size(); row++) {
+        if (files.table->name(row) == name) {
+            file_manager->file_position = files.rows.size();
+        }
+        files.rows.push_back(row);
+    }
+}
+
+static void mark(FileManager *file_manager, const string &name)
+{
+    FileList &files = file_manager->files;
+
+    for (uint32_t row : files.rows) {
+        if (files.table->name(row) == name) {
+            file_manager->marks.toggle(files.table, row);
+        }
+    }
+}
+
+// What the main loop does until the operation is done
+static void wait_operations(FileManager *file_manager)
+{
+    for (int i = 0; i < 10000 && !file_manager->operations.running.empty();
+         i++) {
+        poll_file_operations(file_manager);
+        usleep(1000);
+    }
+    CHECK(file_manager->operations.running.empty());
+    CHECK(file_manager->operations.last != nullptr);
+    if (file_manager->operations.last != nullptr) {
+        CHECK_EQUAL(file_manager->operations.last->error_count, 0u);
+    }
+}
+
+static mode_t mode_of(const string &path)
+{
+    struct stat file_stat = {};
+    lstat(path.c_str(), &file_stat);
+    return file_stat.st_mode & 07777;
+}
+
+// the tree as made by make_tree, under folder
+static bool is_tree(const string &folder)
+{
+    error_code error;
+    return read_file(folder + "/top.txt") == "top" &&
+           read_file(folder + "/a/b/deep.txt") == string(100000, 'd') &&
+           read_file(folder + "/a/run.sh") == "#!/bin/sh\n" &&
+           mode_of(folder + "/a/run.sh") == 0755 &&
+           mode_of(folder + "/a/b") == 0700 &&
+           fs::is_directory(folder + "/empty") &&
+           fs::is_empty(folder + "/empty", error) &&
+           fs::is_symlink(folder + "/a/link") &&
+           fs::read_symlink(folder + "/a/link") == "../../outside" &&
+           fs::is_symlink(folder + "/a/broken") &&
+           fs::read_symlink(folder + "/a/broken") == "missing";
+}
+
+static void make_tree(const string &folder)
+{
+    fs::create_directories(folder + "/a/b");
+    fs::create_directories(folder + "/empty");
+    write_file(folder + "/top.txt", "top");
+    write_file(folder + "/a/b/deep.txt", string(100000, 'd'));
+    write_file(folder + "/a/run.sh", "#!/bin/sh\n");
+    chmod((folder + "/a/run.sh").c_str(), 0755);
+    chmod((folder + "/a/b").c_str(), 0700);
+    fs::create_symlink("../../outside", folder + "/a/link");
+    fs::create_symlink("missing", folder + "/a/broken");
+}
+
+int main()
+{
+    string root = make_test_folder();
+    string source = root + "/source";
+    string copies = root + "/copies";
+    string moved = root + "/moved";
+
+    // what the symlinks point to, never followed
+    fs::create_directories(root + "/outside");
+    write_file(root + "/outside/kept", "kept");
+    fs::create_directories(copies);
+    fs::create_directories(moved);
+    make_tree(source + "/tree");
+    CHECK(is_tree(source + "/tree"));
+
+    FileManager file_manager;
+    setup_file_manager(&file_manager, root);
+    setup_file_operations(&file_manager);
+
+    // c: the marked entries into the cwd
+    show_folder(&file_manager, source, "tree");
+    mark(&file_manager, "tree");
+    show_folder(&file_manager, copies, "");
+    start_file_operation(&file_manager, OPERATION_COPY);
+    CHECK_EQUAL(file_manager.marks.count, 0u);
+    wait_operations(&file_manager);
+    CHECK(is_tree(copies + "/tree"));
+    CHECK(is_tree(source + "/tree"));
+    // 4 folders, 3 files and 2 symlinks
+    CHECK_EQUAL(file_manager.operations.last->done_files.load(), 9u);
+    CHECK_EQUAL(file_manager.operations.last->found_bytes.load(), 100013u);
+
+    // v: moved, nothing left behind
+    show_folder(&file_manager, copies, "tree");
+    mark(&file_manager, "tree");
+    show_folder(&file_manager, moved, "");
+    start_file_operation(&file_manager, OPERATION_MOVE);
+    wait_operations(&file_manager);
+    CHECK(is_tree(moved + "/tree"));
+    CHECK(!fs::exists(copies + "/tree"));
+
+    // D: only once it's confirmed
+    show_folder(&file_manager, moved, "tree");
+    open_operation_prompt(&file_manager, OPERATION_DELETE);
+    CHECK_EQUAL(file_manager.operations.prompt, OPERATION_DELETE);
+    handle_operation_prompt(&file_manager, 'n');
+    CHECK_EQUAL(file_manager.operations.prompt, -1);
+    CHECK(file_manager.operations.running.empty());
+    CHECK(is_tree(moved + "/tree"));
+
+    open_operation_prompt(&file_manager, OPERATION_DELETE);
+    handle_operation_prompt(&file_manager, 'y');
+    wait_operations(&file_manager);
+    CHECK(!fs::exists(moved + "/tree"));
+    CHECK(fs::is_empty(moved));
+    CHECK_EQUAL(file_manager.operations.last->done_files.load(), 9u);
+    CHECK_EQUAL(read_file(root + "/outside/kept"), "kept");
+
+    return finish_tests(root);
+}
@@ -0,0 +1,153 @@
+#include <unistd.h>
+#include "check.hpp"
+
+// file_pager.cpp: the line index, jumps and the in-file search, through the
+// keys of the pager
+
+static FileEntry find_entry(const shared_ptr<EntryTable> &table,
+                            const string &name)
+{
+    for (uint32_t row = 0; row < table->size(); row++) {
+        if (table->name(row) == name) {
+            return {table.get(), row};
+        }
+    }
+    return {table.get(), 0};
+}
+
+static void type_keys(FileManager *file_manager, const string &keys)
+{
+    for (char key : keys) {
+        handle_pager_input(file_manager, key);
+    }
+}
+
+// What the main loop does until the index is built and the search is done
+static void wait_pager(FileManager *file_manager)
+{
+    for (int i = 0; i < 10000 && pager_pending(file_manager); i++) {
+        poll_pager(file_manager);
+        usleep(1000);
+    }
+    CHECK(!pager_pending(file_manager));
+}
+
+static void test_lines(const string &root)
+{
+    // enough lines for a few checkpoints of the index
+    string text;
+    vector<size_t> starts;
+    for (int line = 1; line <= 20000; line++) {
+        starts.push_back(text.size());
+        text += "line " + to_string(line) + "\n";
+    }
+    write_file(root + "/lines.txt", text);
+
+    shared_ptr<EntryTable> table = get_files_in_folder(root);
+    FileManager file_manager;
+    setup_file_manager(&file_manager, root);
+    CHECK(open_pager(&file_manager, find_entry(table, "lines.txt")));
+    FilePager *pager = file_manager.pager.get();
+    if (pager == nullptr) {
+        return;
+    }
+    CHECK(!pager->hex);
+    wait_pager(&file_manager);
+    CHECK_EQUAL(pager->index->lines.load(), 20000u);
+    CHECK_EQUAL(pager->index->checkpoints.size(), 20000u / 4096);
+    CHECK_EQUAL(pager->index->checkpoints[0], starts[4096]);
+
+    // lines before, on and after a checkpoint
+    for (size_t line : {1, 2, 4096, 4097, 4098, 8193, 12345, 20000}) {
+        type_keys(&file_manager, ":" + to_string(line) + "\n");
+        wait_pager(&file_manager);
+        CHECK_EQUAL(pager->top, starts[line - 1]);
+    }
+    // past the end it's the last line
+    type_keys(&file_manager, ":99999\n");
+    CHECK_EQUAL(pager->top, starts.back());
+    // a percentage is of the bytes, to the line holding it
+    type_keys(&file_manager, ":50%\n");
+    CHECK_EQUAL(pager->top, text.rfind('\n', text.size() / 2 - 1) + 1);
+    type_keys(&file_manager, ":x\n");
+    CHECK_EQUAL(pager->message, "Not a line number");
+
+    // the last page and back to the top
+    type_keys(&file_manager, "G");
+    CHECK_EQUAL(pager->top, starts[20000 - pager->rows]);
+    type_keys(&file_manager, "k");
+    CHECK_EQUAL(pager->top, starts[20000 - pager->rows - 1]);
+    type_keys(&file_manager, "g");
+    CHECK_EQUAL(pager->top, 0u);
+
+    // lines 1500 and 15000 to 15009 match
+    type_keys(&file_manager, "/line 1500\n");
+    wait_pager(&file_manager);
+    CHECK_EQUAL(pager->match_offset, starts[1499]);
+    type_keys(&file_manager, "n");
+    wait_pager(&file_manager);
+    CHECK_EQUAL(pager->match_offset, starts[14999]);
+    type_keys(&file_manager, "n");
+    wait_pager(&file_manager);
+    CHECK_EQUAL(pager->match_offset, starts[15000]);
+    type_keys(&file_manager, "N");
+    wait_pager(&file_manager);
+    CHECK_EQUAL(pager->match_offset, starts[14999]);
+    type_keys(&file_manager, "N");
+    wait_pager(&file_manager);
+    CHECK_EQUAL(pager->match_offset, starts[1499]);
+    CHECK(pager->top <= pager->match_offset);
+
+    // backward from the top of the last page, smart case
+    type_keys(&file_manager, "G?LINE\n");
+    wait_pager(&file_manager);
+    CHECK_EQUAL(pager->message, "Pattern not found");
+    type_keys(&file_manager, "?line 2\n");
+    wait_pager(&file_manager);
+    CHECK_EQUAL(pager->match_offset, starts[2998]);
+
+    close_pager(&file_manager);
+    CHECK(file_manager.pager == nullptr);
+}
+
+// a line longer than the window is cut into rows of its width
+static void test_long_line(const string &root)
+{
+    write_file(root + "/long.txt", string(200, 'a') + "\nb\n");
+
+    shared_ptr<EntryTable> table = get_files_in_folder(root);
+    FileManager file_manager;
+    setup_file_manager(&file_manager, root);
+    CHECK(open_pager(&file_manager, find_entry(table, "long.txt")));
+    FilePager *pager = file_manager.pager.get();
+    if (pager == nullptr) {
+        return;
+    }
+    wait_pager(&file_manager);
+    CHECK_EQUAL(pager->width, 80u);
+
+    type_keys(&file_manager, "j");
+    CHECK_EQUAL(pager->top, 80u);
+    type_keys(&file_manager, "j");
+    CHECK_EQUAL(pager->top, 160u);
+    type_keys(&file_manager, "j");
+    CHECK_EQUAL(pager->top, 201u);
+    type_keys(&file_manager, "j");  // already on the last row
+    CHECK_EQUAL(pager->top, 201u);
+    type_keys(&file_manager, "k");
+    CHECK_EQUAL(pager->top, 160u);
+    type_keys(&file_manager, ":2\n");
+    CHECK_EQUAL(pager->top, 201u);
+}
+
+int main()
+{
+    string root = make_test_folder();
+
+    // the size of the window the pager is opened in, without a screen
+    COLS = 82;
+    LINES = 26;
+    test_lines(root);
+    test_long_line(root);
+    return finish_tests(root);
+}
@@ -0,0 +1,114 @@
+#include "check.hpp"
+
+// file_types.cpp: the formats told by their magic numbers and the rows of a
+// hex dump
+
+static const unsigned char *bytes_of(string_view data)
+{
+    return reinterpret_cast<const unsigned char *>(data.data());
+}
+
+static const char *type_of(string_view data)
+{
+    return detect_file_type(bytes_of(data), data.size());
+}
+
+static bool is_binary(string_view data)
+{
+    return is_binary_data(bytes_of(data), data.size());
+}
+
+static bool is_type(string_view data, const char *name)
+{
+    const char *type = type_of(data);
+    return type != nullptr && strcmp(type, name) == 0;
+}
+
+static void test_signatures()
+{
+    CHECK(is_type("\x7F" "ELF\2\1\1"sv, "ELF executable"));
+    CHECK(is_type("\x89PNG\r\n\x1A\n\0\0\0\rIHDR"sv, "PNG image"));
+    CHECK(is_type("\xFD" "7zXZ\0\0"sv, "xz data"));
+    CHECK(is_type("\0asm\1\0\0\0"sv, "WebAssembly module"));
+    CHECK(is_type("%PDF-1.7\n"sv, "PDF document"));
+    // the magic further in
+    CHECK(is_type("\0\0\0\x20" "ftypisom"sv, "MP4/QuickTime video"));
+    string tar(512, '\0');
+    tar.replace(257, 5, "ustar");
+    CHECK(is_type(tar, "tar archive"));
+    // the longest of the magics on the same first byte wins
+    CHECK(is_type("GIF89a"sv, "GIF image"));
+    CHECK(is_type("PK\x05\x06"sv, "Zip archive"));
+
+    // too short for its magic, or none at all
+    CHECK(type_of("\x89PNG"sv) == nullptr);
+    CHECK(type_of(tar.substr(0, 260)) == nullptr);
+    CHECK(type_of(""sv) == nullptr);
+    CHECK(type_of("#include <stdio.h>\n"sv) == nullptr);
+
+    // a short magic names a text file without making it binary
+    CHECK(is_type("MZ is a text file too"sv, "PE/DOS executable"));
+    CHECK(!is_binary("MZ is a text file too"sv));
+    CHECK(!is_binary("BM"sv));
+    CHECK(is_binary("\x7F" "ELF"sv));
+    CHECK(is_binary("text with a \0 in it"sv));
+    CHECK(!is_binary("plain text\n"sv));
+}
+
+static void test_hex_layout()
+{
+    // as many bytes per row as fit, offsets grow with the file
+    HexLayout layout = get_hex_layout(80, 1000);
+    CHECK_EQUAL(layout.row_bytes, 16u);
+    CHECK_EQUAL(layout.offset_digits, 8);
+    CHECK_EQUAL(layout.ascii_column, 60u);
+
+    layout = get_hex_layout(200, 1ULL << 40);
+    CHECK_EQUAL(layout.row_bytes, 32u);
+    CHECK_EQUAL(layout.offset_digits, 10);
+
+    layout = get_hex_layout(20, 0);
+    CHECK_EQUAL(layout.row_bytes, 4u);
+    CHECK_EQUAL(layout.offset_digits, 8);
+}
+
+static void test_hex_row()
+{
+    HexLayout layout = get_hex_layout(80, 1000);
+    CHECK_EQUAL(format_hex_row(layout, bytes_of("0123456789abcdef"), 16, 0x10),
+                "00000010  30 31 32 33 34 35 36 37  38 39 61 62 63 64 65 66  "
+                "|0123456789abcdef|");
+
+    // the last row of a file is cut after its bytes
+    const unsigned char last[] = {0x00, 0xFF, 'A'};
+    CHECK_EQUAL(format_hex_row(layout, last, 3, 0x3e0),
+                "000003e0  00 ff 41" + string(42, ' ') + "|..A|");
+
+    // every byte value through the 16 bytes at a time encoding
+    layout = get_hex_layout(200, 256);
+    CHECK_EQUAL(layout.row_bytes, 32u);
+    for (size_t offset = 0; offset < 256; offset += layout.row_bytes) {
+        unsigned char bytes[32];
+        string expected;
+        char digits[4];
+        for (size_t i = 0; i < sizeof(bytes); i++) {
+            bytes[i] = offset + i;
+            snprintf(digits, sizeof(digits), "%02x ", bytes[i]);
+            expected += digits;
+            if (i % 8 == 7) {
+                expected += ' ';
+            }
+        }
+        string row = format_hex_row(layout, bytes, sizeof(bytes), offset);
+        CHECK_EQUAL(row.substr(10, layout.ascii_column - 10), expected);
+        CHECK_EQUAL(row.size(), layout.ascii_column + 34);
+    }
+}
+
+int main()
+{
+    test_signatures();
+    test_hex_layout();
+    test_hex_row();
+    return finish_tests("");
+}
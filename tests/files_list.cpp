@@ -0,0 +1,167 @@
+#include "check.hpp"
+
+// files_list.cpp: the folders cache, an LruCache bounded by memory with the
+// cwd and its parents pinned, and the sizes as shown
+
+static vector<string> keys_of(const LruCache<string, string> &cache)
+{
+    vector<string> keys;
+    for (const auto &item : cache.items) {
+        keys.push_back(item.key);
+    }
+    return keys;
+}
+
+static void test_lru_eviction()
+{
+    LruCache<string, string> cache;
+    vector<string> evicted;
+    cache.budget = 10;
+    cache.measure = [](const string &value) { return value.size(); };
+    cache.on_evict = [&evicted](const string &key) {
+        evicted.push_back(key);
+    };
+
+    cache.insert("a", "1234");
+    cache.insert("b", "1234");
+    CHECK_EQUAL(cache.used, 8u);
+    CHECK((keys_of(cache) == vector<string>{"b", "a"}));
+
+    // a lookup makes "a" the most recent, so "b" goes first
+    CHECK(cache.find("a") != nullptr);
+    CHECK(cache.find("missing") == nullptr);
+    CHECK_EQUAL(cache.hits, 1u);
+    CHECK_EQUAL(cache.misses, 1u);
+    cache.insert("c", "1234");
+    CHECK((keys_of(cache) == vector<string>{"c", "a"}));
+    CHECK((evicted == vector<string>{"b"}));
+    CHECK_EQUAL(cache.used, 8u);
+    CHECK_EQUAL(cache.evictions, 1u);
+
+    // peek leaves the order and the counters alone
+    CHECK_EQUAL(*cache.peek("a"), "1234");
+    CHECK(cache.peek("b") == nullptr);
+    CHECK_EQUAL(cache.hits, 1u);
+    CHECK_EQUAL(cache.misses, 1u);
+    cache.insert("d", "1234");
+    CHECK((keys_of(cache) == vector<string>{"d", "c"}));
+
+    // inserting a key again replaces its value and its size
+    cache.insert("c", "12");
+    CHECK_EQUAL(cache.size(), 2u);
+    CHECK_EQUAL(cache.used, 6u);
+    CHECK_EQUAL(*cache.peek("c"), "12");
+
+    // the newest item stays even over the budget on its own
+    evicted.clear();
+    cache.insert("e", "12345678901234");
+    CHECK((keys_of(cache) == vector<string>{"e"}));
+    CHECK((evicted == vector<string>{"d", "c"}));
+    CHECK_EQUAL(cache.used, 14u);
+
+    cache.erase("e");
+    CHECK_EQUAL(cache.size(), 0u);
+    CHECK_EQUAL(cache.used, 0u);
+    CHECK(cache.index.empty());
+}
+
+static void test_lru_pinned()
+{
+    LruCache<string, string> cache;
+    vector<string> evicted;
+    cache.budget = 3;
+    cache.pinned = [](const string &key) { return key == "pinned"; };
+    cache.on_evict = [&evicted](const string &key) {
+        evicted.push_back(key);
+    };
+
+    // one per item without measure, the pinned one is skipped over even
+    // though it's the least recently used
+    cache.insert("pinned", "");
+    cache.insert("a", "");
+    cache.insert("b", "");
+    cache.insert("c", "");
+    CHECK((keys_of(cache) == vector<string>{"c", "b", "pinned"}));
+    CHECK((evicted == vector<string>{"a"}));
+
+    // with only pinned items left to evict the cache stays over budget
+    cache.pinned = [](const string &) { return true; };
+    cache.insert("d", "");
+    CHECK_EQUAL(cache.size(), 4u);
+    CHECK_EQUAL(cache.used, 4u);
+    CHECK_EQUAL(evicted.size(), 1u);
+}
+
+static void test_lru_update_size()
+{
+    LruCache<string, string> cache;
+    cache.budget = 10;
+    cache.measure = [](const string &value) { return value.size(); };
+
+    cache.insert("a", "123");
+    cache.insert("b", "123");
+
+    // a value grown in place is measured again and can push others out
+    *cache.peek("b") = "123456789";
+    cache.update_size("b");
+    CHECK_EQUAL(cache.used, 9u);
+    CHECK((keys_of(cache) == vector<string>{"b"}));
+
+    cache.update_size("missing");
+    CHECK_EQUAL(cache.used, 9u);
+
+    cache.clear();
+    CHECK_EQUAL(cache.size(), 0u);
+    CHECK_EQUAL(cache.used, 0u);
+}
+
+// the cwd and its parents are never evicted from the folders cache
+static void test_folders_cache()
+{
+    FileManager file_manager;
+    setenv("FILE_MANAGER_CACHE_MB", "0", 1);
+    setup_file_manager(&file_manager, "/home/user/project");
+    unsetenv("FILE_MANAGER_CACHE_MB");
+
+    auto &cache = file_manager.folders_cache;
+    CHECK_EQUAL(cache.budget, 0u);
+    for (string folder : {"/", "/home", "/home/user", "/home/user/project",
+                          "/home/user/project/src", "/home/user2", "/tmp"}) {
+        auto table = make_shared<EntryTable>();
+        table->folder = folder;
+        cache.insert(folder, table);
+    }
+    CHECK(cache.contains("/"));
+    CHECK(cache.contains("/home"));
+    CHECK(cache.contains("/home/user"));
+    CHECK(cache.contains("/home/user/project"));
+    CHECK(!cache.contains("/home/user/project/src"));
+    CHECK(!cache.contains("/home/user2"));
+    CHECK(cache.contains("/tmp"));  // the newest
+    CHECK(cache.used >= cache.size() * sizeof(EntryTable));
+}
+
+// three significant digits at most, rounded to nearest
+static void test_format_bytes()
+{
+    CHECK_EQUAL(format_bytes(0), "0");
+    CHECK_EQUAL(format_bytes(1), "1.0 B");
+    CHECK_EQUAL(format_bytes(999), "999 B");
+    CHECK_EQUAL(format_bytes(1000), "1.0 KB");
+    CHECK_EQUAL(format_bytes(9949), "9.9 KB");
+    CHECK_EQUAL(format_bytes(9950), "10 KB");
+    CHECK_EQUAL(format_bytes(999499), "999 KB");
+    CHECK_EQUAL(format_bytes(999500), "1.0 MB");
+    CHECK_EQUAL(format_bytes(1500000000), "1.5 GB");
+    CHECK_EQUAL(format_bytes(UINT64_MAX), "18 EB");
+}
+
+int main()
+{
+    test_lru_eviction();
+    test_lru_pinned();
+    test_lru_update_size();
+    test_folders_cache();
+    test_format_bytes();
+    return finish_tests("");
+}
@@ -0,0 +1,148 @@
+#include "check.hpp"
+
+// git_status.cpp: the object hashes, the index reader and the repository
+// lookup, against what the git CLI writes
+
+static string to_hex(const sha1_t &hash)
+{
+    string hex;
+    char digits[3];
+
+    for (uint8_t byte : hash) {
+        snprintf(digits, sizeof(digits), "%02x", byte);
+        hex += digits;
+    }
+    return hex;
+}
+
+static string sha1_of(const string &data)
+{
+    Sha1 sha1;
+    sha1.update(reinterpret_cast<const uint8_t *>(data.data()), data.size());
+    return to_hex(sha1.digest());
+}
+
+static void test_sha1(const string &root)
+{
+    // FIPS 180 vectors, the last one goes over many blocks
+    CHECK_EQUAL(sha1_of(""), "da39a3ee5e6b4b0d3255bfef95601890afd80709");
+    CHECK_EQUAL(sha1_of("abc"), "a9993e364706816aba3e25717850c26c9cd0d89d");
+    CHECK_EQUAL(
+        sha1_of("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"),
+        "84983e441c3bd26ebaae4aa1f95129e5e54670f1");
+    CHECK_EQUAL(sha1_of(string(1000000, 'a')),
+                "34aa973cd4c4daa4f61eeb2bdbad27316534016f");
+
+    // what git hash-object gives
+    struct stat file_stat;
+    sha1_t hash;
+    write_file(root + "/hello", "hello\n");
+    stat((root + "/hello").c_str(), &file_stat);
+    CHECK(hash_git_blob(root + "/hello", file_stat, &hash));
+    CHECK_EQUAL(to_hex(hash), "ce013625030ba8dba906f756967f9e9ca394464a");
+
+    write_file(root + "/empty", "");
+    stat((root + "/empty").c_str(), &file_stat);
+    CHECK(hash_git_blob(root + "/empty", file_stat, &hash));
+    CHECK_EQUAL(to_hex(hash), "e69de29bb2d1d6434b8b29ae775ad8c2e48c5391");
+}
+
+// The entries of an index git wrote, for each version
+static void test_git_index(const string &root)
+{
+    string repo = root + "/repo";
+    string git = "git -C '" + repo + "' ";
+
+    if (!run("git --version")) {
+        fprintf(stderr, "git not found, index tests skipped\n");
+        return;
+    }
+    fs::create_directories(repo + "/dir/sub");
+    write_file(repo + "/a.txt", "hello\n");
+    write_file(repo + "/dir/b.txt", "");
+    write_file(repo + "/dir/sub/c.txt", "c\n");
+    write_file(repo + "/dir/sub/c.txt.orig", "c\n");
+    CHECK(run(git + "init -q") && run(git + "add -A"));
+
+    const vector<string> paths = {"a.txt", "dir/b.txt", "dir/sub/c.txt",
+                                  "dir/sub/c.txt.orig"};
+    vector<GitIndexEntry> entries;
+    for (const char *version : {"2", "4"}) {
+        CHECK(run(git + "update-index --index-version " + version));
+        CHECK(read_git_index(repo + "/.git/index", &entries));
+        CHECK_EQUAL(entries.size(), paths.size());
+        for (size_t i = 0; i < entries.size() && i < paths.size(); i++) {
+            CHECK_EQUAL(entries[i].path, paths[i]);
+            CHECK(!entries[i].changed && !entries[i].skip_check);
+        }
+        if (entries.size() == paths.size()) {
+            CHECK_EQUAL(to_hex(entries[0].hash),
+                        "ce013625030ba8dba906f756967f9e9ca394464a");
+            CHECK_EQUAL(entries[0].size, 6U);
+            CHECK_EQUAL(entries[0].mode, 0100644U);
+        }
+    }
+
+    // intent-to-add needs the extended flags, git moves to version 3
+    write_file(repo + "/new.txt", "new\n");
+    CHECK(run(git + "update-index --index-version 2") &&
+          run(git + "add -N new.txt"));
+    CHECK(read_git_index(repo + "/.git/index", &entries));
+    CHECK_EQUAL(entries.size(), paths.size() + 1);
+    if (entries.size() == paths.size() + 1) {
+        CHECK_EQUAL(entries[4].path, "new.txt");
+        CHECK(entries[4].changed);
+    }
+
+    // cut short, or not an index at all
+    string index;
+    {
+        ifstream file(repo + "/.git/index", ios::binary);
+        index.assign(istreambuf_iterator<char>(file),
+                     istreambuf_iterator<char>());
+    }
+    write_file(root + "/short_index", index.substr(0, 80));
+    CHECK(!read_git_index(root + "/short_index", &entries));
+    CHECK(!read_git_index(root + "/hello", &entries));
+}
+
+// The repository of a linked worktree, and a relative path that runs out
+// of slashes on the way up
+static void test_find_git_repo(const string &root)
+{
+    string repo = root + "/repo";
+    string worktree = root + "/worktree";
+    string git = "git -C '" + repo + "' ";
+
+    FileManager file_manager;
+    setup_file_manager(&file_manager, root);
+    CHECK(find_git_repo(&file_manager, "relative") == nullptr);
+    CHECK(find_git_repo(&file_manager, "relative/path") == nullptr);
+
+    if (!run("git --version")) {
+        return;
+    }
+    CHECK(run(git + "remote add origin https://example.com/team/project.git") &&
+          run(git + "-c user.name=test -c user.email=test@example.com "
+                    "commit -q -m first") &&
+          run(git + "worktree add -q -b side '" + worktree + "'"));
+
+    const GitRepo *found = find_git_repo(&file_manager, worktree + "/dir/sub");
+    CHECK(found != nullptr);
+    if (found != nullptr) {
+        CHECK_EQUAL(found->root, worktree);
+        CHECK_EQUAL(found->git_dir, repo + "/.git/worktrees/worktree");
+        CHECK(fs::equivalent(found->common_dir, repo + "/.git"));
+        CHECK_EQUAL(found->description, "project <side>");
+    }
+}
+
+int main()
+{
+    string root = make_test_folder();
+
+    test_sha1(root);
+    test_git_index(root);
+    test_find_git_repo(root);
+    return finish_tests(root);
+}
@@ -0,0 +1,93 @@
+#include <sys/wait.h>
+#include <unistd.h>
+#include "check.hpp"
+
+// job_runner.cpp: the ring keeping the end of a job's output, and jobs run
+// to the end or stopped
+
+static void test_output_ring()
+{
+    OutputRing ring;
+    CHECK_EQUAL(ring.text(), "");
+
+    ring.append("hello ", 6);
+    ring.append("world", 5);
+    CHECK_EQUAL(ring.text(), "hello world");
+    CHECK_EQUAL(ring.written, 11u);
+    size_t capacity = ring.buffer.size();
+    CHECK(capacity > 11);
+
+    // filled past its end, the oldest bytes go first
+    string line;
+    for (char letter = 'a'; ring.written < capacity * 2; letter++) {
+        line = string(1000, letter);
+        ring.append(line.data(), line.size());
+    }
+    string text = ring.text();
+    CHECK_EQUAL(text.size(), capacity);
+    CHECK_EQUAL(text.substr(text.size() - 1000), line);
+    CHECK(text.find("hello") == string::npos);
+    CHECK_EQUAL(ring.buffer.size(), capacity);
+
+    // only the end of a read bigger than the ring is kept
+    string big(capacity + 10, 'x');
+    big.replace(0, 10, "0123456789");
+    big.replace(big.size() - 3, 3, "end");
+    uint64_t written = ring.written;
+    ring.append(big.data(), big.size());
+    CHECK_EQUAL(ring.written, written + big.size());
+    CHECK_EQUAL(ring.text(), big.substr(10));
+}
+
+static void wait_job(const Job &job)
+{
+    for (int i = 0; i < 10000 && !job.finished; i++) {
+        usleep(1000);
+    }
+    CHECK(job.finished);
+}
+
+static void test_jobs(const string &root)
+{
+    FileManager file_manager;
+    setup_file_manager(&file_manager, root);
+
+    // stdout and stderr and the exit status
+    start_job(&file_manager, "echo out; echo err >&2; exit 3");
+    shared_ptr<Job> job = file_manager.jobs.jobs.back();
+    wait_job(*job);
+    {
+        lock_guard<mutex> guard(job->lock);
+        CHECK_EQUAL(job->output.text(), "out\nerr\n");
+        CHECK(job->reaped);
+    }
+    CHECK(WIFEXITED(job->status) && WEXITSTATUS(job->status) == 3);
+    CHECK_EQUAL(job->folder, root);
+    CHECK(poll_jobs(&file_manager));
+    CHECK(job->collected);
+    CHECK(!poll_jobs(&file_manager));
+
+    // stopping it ends the whole process group
+    start_job(&file_manager, "sleep 30 & sleep 30; echo never");
+    job = file_manager.jobs.jobs.back();
+    CHECK_EQUAL(job->id, 2);
+    CHECK_EQUAL(running_jobs(&file_manager), 1u);
+    stop_job(&file_manager, job->id);
+    wait_job(*job);
+    CHECK(WIFSIGNALED(job->status) && WTERMSIG(job->status) == SIGTERM);
+    CHECK_EQUAL(job->output.text(), "");
+    CHECK_EQUAL(running_jobs(&file_manager), 0u);
+
+    // a reaped job isn't signalled again
+    stop_job(&file_manager, job->id);
+    stop_jobs(&file_manager);
+}
+
+int main()
+{
+    string root = make_test_folder();
+
+    test_output_ring();
+    test_jobs(root);
+    return finish_tests(root);
+}
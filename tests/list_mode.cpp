@@ -0,0 +1,134 @@
+#include <unistd.h>
+#include "check.hpp"
+
+// list_mode.cpp: what file_manager --list writes in each format
+
+// Runs --list with the arguments, what it writes to stdout goes to output
+static int run_list(const string &root, vector<string> arguments,
+                    string *output)
+{
+    string path = root + "/output";
+    int saved_stdout = dup(STDOUT_FILENO);
+    int file = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    fflush(stdout);
+    dup2(file, STDOUT_FILENO);
+    close(file);
+
+    arguments.insert(arguments.begin(), {"file_manager", "--list"});
+    vector<char *> argv;
+    for (string &argument : arguments) {
+        argv.push_back(argument.data());
+    }
+    argv.push_back(nullptr);
+    int status = run_list_mode(argv.size() - 1, argv.data());
+
+    fflush(stdout);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+    *output = read_file(path);
+    return status;
+}
+
+static void set_mtime(const string &path, time_t seconds, long nanoseconds)
+{
+    struct timespec times[2] = {{0, UTIME_OMIT}, {seconds, nanoseconds}};
+    utimensat(AT_FDCWD, path.c_str(), times, AT_SYMLINK_NOFOLLOW);
+}
+
+static void test_formats(const string &root)
+{
+    string folder = root + "/listed";
+    string output;
+
+    fs::create_directories(folder + "/sub");
+    write_file(folder + "/b.txt", "abc");
+    write_file(folder + "/a\tb", "");
+    write_file(folder + "/sub/c\"q", "12345");
+    write_file(folder + "/.hidden", "");
+    fs::create_symlink("b.txt", folder + "/link");
+    chmod((folder + "/sub").c_str(), 0755);
+    chmod((folder + "/b.txt").c_str(), 0640);
+    chmod((folder + "/a\tb").c_str(), 0644);
+    chmod((folder + "/sub/c\"q").c_str(), 0600);
+    set_mtime(folder + "/b.txt", 1000000000, 500000000);
+    set_mtime(folder + "/a\tb", 1000000000, 0);
+    set_mtime(folder + "/sub/c\"q", 1500000000, 1);
+    set_mtime(folder + "/sub", 1600000000, 0);
+
+    // a folder's size is up to the filesystem
+    struct stat sub_stat;
+    stat((folder + "/sub").c_str(), &sub_stat);
+    string sub_size = to_string(sub_stat.st_size);
+
+    // folders first, the link described by its target, names escaped
+    CHECK_EQUAL(run_list(root, {folder}, &output), 0);
+    CHECK_EQUAL(output, "dir\t" + sub_size +
+                            "\t1600000000.000000000\tsub\n"
+                            "file\t0\t1000000000.000000000\ta\\tb\n"
+                            "file\t3\t1000000000.500000000\tb.txt\n"
+                            "file-link\t3\t1000000000.500000000\tlink\n");
+
+    CHECK_EQUAL(run_list(root, {folder, "--format", "json", "--recursive"},
+                         &output),
+                0);
+    CHECK_EQUAL(output,
+                "{\"path\":\"sub\",\"type\":\"dir\",\"link\":false,\"size\":" +
+                    sub_size +
+                    ",\"mtime\":1600000000.000000000,\"mode\":493}\n"
+                    "{\"path\":\"a\\u0009b\",\"type\":\"file\",\"link\":false,"
+                    "\"size\":0,\"mtime\":1000000000.000000000,\"mode\":420}\n"
+                    "{\"path\":\"b.txt\",\"type\":\"file\",\"link\":false,"
+                    "\"size\":3,\"mtime\":1000000000.500000000,\"mode\":416}\n"
+                    "{\"path\":\"link\",\"type\":\"file\",\"link\":true,"
+                    "\"size\":3,\"mtime\":1000000000.500000000,\"mode\":416}\n"
+                    "{\"path\":\"sub/c\\\"q\",\"type\":\"file\",\"link\":false,"
+                    "\"size\":5,\"mtime\":1500000000.000000001,"
+                    "\"mode\":384}\n");
+
+    // names as they are, each ending with a NUL
+    CHECK_EQUAL(run_list(root,
+                         {folder, "--format", "null0", "--recursive",
+                          "--hidden", "--sort", "size-desc"},
+                         &output),
+                0);
+    CHECK_EQUAL(output, "sub\0b.txt\0link\0.hidden\0a\tb\0sub/c\"q\0"s);
+
+    // the filter picks what's printed, the subfolders are still walked
+    CHECK_EQUAL(run_list(root,
+                         {"--format", "null0", "--filter", "cq",
+                          "--recursive", folder + "/"},
+                         &output),
+                0);
+    CHECK_EQUAL(output, "sub/c\"q\0"s);
+}
+
+static void test_errors(const string &root)
+{
+    string output;
+
+    // the reasons go to stderr
+    int saved_stderr = dup(STDERR_FILENO);
+    int null = open("/dev/null", O_WRONLY);
+    dup2(null, STDERR_FILENO);
+    close(null);
+
+    CHECK_EQUAL(run_list(root, {""}, &output), 2);
+    CHECK_EQUAL(run_list(root, {root, "--format", "xml"}, &output), 2);
+    CHECK_EQUAL(run_list(root, {root, "--sort", "color"}, &output), 2);
+    CHECK_EQUAL(run_list(root, {root, root}, &output), 2);
+    CHECK_EQUAL(run_list(root, {root + "/missing"}, &output), 1);
+    CHECK(output.empty());
+
+    dup2(saved_stderr, STDERR_FILENO);
+    close(saved_stderr);
+}
+
+int main()
+{
+    string root = make_test_folder();
+
+    test_formats(root);
+    test_errors(root);
+    return finish_tests(root);
+}
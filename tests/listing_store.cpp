@@ -0,0 +1,70 @@
+#include "check.hpp"
+
+// listing_store.cpp: listings saved by one session and read back by the
+// next, as long as their folder didn't change
+
+int main()
+{
+    string root = make_test_folder();
+    string folder = root + "/listed";
+    fs::create_directories(folder + "/sub");
+    write_file(folder + "/one", "1");
+    write_file(folder + "/two", string(5000, 'x'));
+    fs::create_symlink("one", folder + "/link");
+
+    setenv("XDG_CACHE_HOME", (root + "/cache").c_str(), 1);
+    setenv("FILE_MANAGER_DISK_CACHE_MB", "1", 1);
+
+    shared_ptr<EntryTable> read = get_files_in_folder(folder);
+    {
+        FileManager file_manager;
+        setup_file_manager(&file_manager, root);
+        open_listing_store(&file_manager);
+        cache_folder(&file_manager, folder, read);
+        save_listing_store(&file_manager);
+    }
+
+    FileManager file_manager;
+    setup_file_manager(&file_manager, root);
+    open_listing_store(&file_manager);
+    CHECK_EQUAL(file_manager.listing_store.folder_count, 1U);
+    CHECK(!load_stored_listing(&file_manager, root));
+    CHECK(load_stored_listing(&file_manager, folder));
+
+    shared_ptr<EntryTable> *stored = file_manager.folders_cache.peek(folder);
+    CHECK(stored != nullptr);
+    if (stored != nullptr) {
+        const EntryTable &table = **stored;
+        CHECK(table.persisted);
+        CHECK_EQUAL(table.size(), read->size());
+        for (uint32_t row = 0; row < table.size() && row < read->size();
+             row++) {
+            CHECK(table.name(row) == read->name(row));
+            CHECK_EQUAL(table.sizes[row], read->sizes[row]);
+            CHECK_EQUAL(table.mtimes[row], read->mtimes[row]);
+            CHECK_EQUAL(table.modes[row], read->modes[row]);
+            CHECK_EQUAL(table.types[row], read->types[row]);
+            CHECK_EQUAL(table.flags[row], read->flags[row]);
+        }
+    }
+
+    // the folder changed since, its listing isn't used
+    struct timespec times[2] = {{0, UTIME_OMIT}, {1000000000, 0}};
+    utimensat(AT_FDCWD, folder.c_str(), times, 0);
+    FileManager next_session;
+    setup_file_manager(&next_session, root);
+    open_listing_store(&next_session);
+    CHECK(!load_stored_listing(&next_session, folder));
+
+    // nor a store cut short
+    string store_path = root + "/cache/file_manager/listings";
+    CHECK(truncate(store_path.c_str(), 100) == 0);
+    FileManager broken_store;
+    setup_file_manager(&broken_store, root);
+    open_listing_store(&broken_store);
+    CHECK_EQUAL(broken_store.listing_store.folder_count, 0U);
+
+    unsetenv("FILE_MANAGER_DISK_CACHE_MB");
+    unsetenv("XDG_CACHE_HOME");
+    return finish_tests(root);
+}
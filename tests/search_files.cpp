@@ -0,0 +1,29 @@
+#include "check.hpp"
+
+// search_files.cpp: the fuzzy match of a name against the search
+
+static void test_search()
+{
+    vector<size_t> positions;
+
+    CHECK(match_search("file_manager.cpp", "fmc", &positions));
+    CHECK(positions == vector<size_t>({0, 5, 13}));
+    CHECK(!match_search("file_manager.cpp", "mf", nullptr));
+    CHECK(!match_search("ab", "abc", nullptr));
+    CHECK(match_search("anything", "", nullptr));
+
+    // smart case: an upper case letter makes the search case sensitive
+    CHECK(match_search("File_Manager", "fm", nullptr));
+    CHECK(match_search("File_Manager", "FM", nullptr));
+    CHECK(!match_search("file_manager", "FM", nullptr));
+
+    // past 16 bytes the SSE2 path does the work
+    CHECK(match_search("abcdefghijklmnopqrstuvwxyz_XYZ", "z_x", &positions));
+    CHECK(positions == vector<size_t>({25, 26, 27}));
+}
+
+int main()
+{
+    test_search();
+    return finish_tests("");
+}
@@ -0,0 +1,77 @@
+#include "check.hpp"
+
+// sort_functions.cpp: the orders of a listing
+
+static vector<string> sorted_names(FileManager *file_manager,
+                                   const vector<string> &names)
+{
+    FileList files;
+    files.table = make_shared<EntryTable>();
+    files.table->folder = "/";
+
+    // sized after their position, the last name is the biggest
+    struct stat file_stat = {};
+    file_stat.st_mode = S_IFREG | 0644;
+    for (const string &name : names) {
+        file_stat.st_size = files.rows.size() * 100;
+        files.table->add_entry(name, file_stat, ENTRY_REGULAR,
+                               ENTRY_READABLE);
+        files.rows.push_back(files.rows.size());
+    }
+    sort_files(file_manager, &files);
+
+    vector<string> sorted;
+    for (size_t i = 0; i < files.size(); i++) {
+        sorted.emplace_back(files[i].name());
+    }
+    return sorted;
+}
+
+static void test_natural_sort()
+{
+    FileManager file_manager;
+    setup_file_manager(&file_manager, "/");
+    const vector<string> names = {"img12.png", "img10.png", "img2.png",
+                                  "img1.png", "doc.txt"};
+
+    file_manager.sort_type = NATURAL_INCREASING;
+    CHECK(sorted_names(&file_manager, names) ==
+          vector<string>({"doc.txt", "img1.png", "img2.png", "img10.png",
+                          "img12.png"}));
+    file_manager.sort_type = NATURAL_DECREASING;
+    CHECK(sorted_names(&file_manager, names) ==
+          vector<string>({"img12.png", "img10.png", "img2.png", "img1.png",
+                          "doc.txt"}));
+    file_manager.sort_type = ALPHABETICAL_INCREASING;
+    CHECK(sorted_names(&file_manager, names) ==
+          vector<string>({"doc.txt", "img1.png", "img10.png", "img12.png",
+                          "img2.png"}));
+
+    // runs of digits longer than any integer, and leading zeros
+    file_manager.sort_type = NATURAL_INCREASING;
+    CHECK(sorted_names(&file_manager,
+                       {"v100000000000000000000000", "v9", "v009", "v10"}) ==
+          vector<string>({"v009", "v9", "v10", "v100000000000000000000000"}));
+}
+
+static void test_size_sort()
+{
+    FileManager file_manager;
+    setup_file_manager(&file_manager, "/");
+    const vector<string> names = {"img12.png", "img10.png", "img2.png",
+                                  "img1.png", "doc.txt"};
+
+    file_manager.sort_type = FILE_SIZE_DECREASING;
+    CHECK(sorted_names(&file_manager, names) ==
+          vector<string>({"doc.txt", "img1.png", "img2.png", "img10.png",
+                          "img12.png"}));
+    file_manager.sort_type = FILE_SIZE_INCREASING;
+    CHECK(sorted_names(&file_manager, names) == names);
+}
+
+int main()
+{
+    test_natural_sort();
+    test_size_sort();
+    return finish_tests("");
+}